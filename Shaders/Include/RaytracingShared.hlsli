@@ -8,6 +8,15 @@ NRI_RESOURCE( Texture2D<float4>, gIn_Textures[], t, 5, 2 );
 
 #define TEX_SAMPLER                         gLinearMipmapLinearSampler
 
+// Permutations ( "Shaders/<pass>_P<N>.cs.hlsl" ) define these as literals, the generic shaders read them from the constants
+#ifndef PERMUTATION_AHS_DYNAMIC_MIP
+    #define PERMUTATION_AHS_DYNAMIC_MIP     gAhsDynamicMip
+#endif
+
+#ifndef PERMUTATION_HIGHLIGHT_AHS
+    #define PERMUTATION_HIGHLIGHT_AHS       gHighlightAhs
+#endif
+
 #if( USE_LOAD == 1 )
     #define SAMPLE( coords ) Load( int3( coords ) )
 #else
@@ -16,6 +25,39 @@ NRI_RESOURCE( Texture2D<float4>, gIn_Textures[], t, 5, 2 );
 
 #include "HairBRDF.hlsli"
 
+//====================================================================================================================================
+// INSTANCE DATA
+//====================================================================================================================================
+
+float4 GetInstanceBaseColorAndMetalnessScale( InstanceData instanceData )
+{ return f16tof32( uint4( instanceData.materialScales.xy, instanceData.materialScales.xy >> 16 ) ).xzyw; }
+
+float4 GetInstanceEmissionAndRoughnessScale( InstanceData instanceData )
+{ return f16tof32( uint4( instanceData.materialScales.zw, instanceData.materialScales.zw >> 16 ) ).xzyw; }
+
+float GetInstanceInvScale( InstanceData instanceData )
+{ return f16tof32( instanceData.rotation22AndInvScale >> 16 ); }
+
+// Static instances only
+float3x3 GetInstanceRotation( InstanceData instanceData )
+{
+    uint4 r = instanceData.rotation;
+
+    float3 row0 = f16tof32( uint3( r.x, r.x >> 16, r.y ) );
+    float3 row1 = f16tof32( uint3( r.y >> 16, r.z, r.z >> 16 ) );
+    float3 row2 = f16tof32( uint3( r.w, r.w >> 16, instanceData.rotation22AndInvScale ) );
+
+    return float3x3( row0, row1, row2 );
+}
+
+// Dynamic instances only
+float3x4 GetInstanceTransform( InstanceData instanceData )
+{
+    InstanceData t = gIn_InstanceData[ instanceData.rotation.x ];
+
+    return float3x4( asfloat( t.materialScales ), asfloat( t.rotation ), asfloat( uint4( t.rotation22AndInvScale, t.textureOffsetAndFlags, t.primitiveOffset, t.morphedPrimitiveOffset ) ) );
+}
+
 //====================================================================================================================================
 // GEOMETRY & MATERIAL PROPERTIES
 //====================================================================================================================================
@@ -189,15 +231,17 @@ MaterialProps GetMaterialProps( GeometryProps geometryProps )
     // Base color
     float3 coords = GetSamplingCoords( baseTexture, geometryProps.uv, geometryProps.mip, MIP_SHARP );
     float4 color = gIn_Textures[ NonUniformResourceIndex( baseTexture ) ].SAMPLE( coords );
-    color.xyz *= instanceData.baseColorAndMetalnessScale.xyz;
+    float4 baseColorAndMetalnessScale = GetInstanceBaseColorAndMetalnessScale( instanceData );
+    float4 emissionAndRoughnessScale = GetInstanceEmissionAndRoughnessScale( instanceData );
+    color.xyz *= baseColorAndMetalnessScale.xyz;
     color.xyz *= geometryProps.IsTransparent( ) ? 1.0 : STL::Math::PositiveRcp( color.w ); // Correct handling of BC1 with pre-multiplied alpha
     float3 baseColor = saturate( color.xyz );
 
     // Roughness and metalness
     coords = GetSamplingCoords( baseTexture + 1, geometryProps.uv, geometryProps.mip, MIP_SHARP );
     float3 materialProps = gIn_Textures[ NonUniformResourceIndex( baseTexture + 1 ) ].SAMPLE( coords ).xyz;
-    float roughness = saturate( materialProps.y * instanceData.emissionAndRoughnessScale.w );
-    float metalness = saturate( materialProps.z * instanceData.baseColorAndMetalnessScale.w );
+    float roughness = saturate( materialProps.y * emissionAndRoughnessScale.w );
+    float metalness = saturate( materialProps.z * baseColorAndMetalnessScale.w );
 
     // Normal
     coords = GetSamplingCoords( baseTexture + 2, geometryProps.uv, geometryProps.mip, MIP_LESS_SHARP );
@@ -211,7 +255,7 @@ MaterialProps GetMaterialProps( GeometryProps geometryProps )
     // Emission
     coords = GetSamplingCoords( baseTexture + 3, geometryProps.uv, geometryProps.mip, MIP_VISIBILITY );
     float3 Lemi = gIn_Textures[ NonUniformResourceIndex( baseTexture + 3 ) ].SAMPLE( coords ).xyz;
-    Lemi *= instanceData.emissionAndRoughnessScale.xyz;
+    Lemi *= emissionAndRoughnessScale.xyz;
     Lemi *= ( baseColor + 0.01 ) / ( max( baseColor, max( baseColor, baseColor ) ) + 0.01 );
 
     [flatten]
@@ -490,11 +534,11 @@ float ReprojectIrradiance(
         \
         /* Transform */ \
         float3x3 mObjectToWorld = (float3x3)rayQuery.CandidateObjectToWorld3x4( ); \
-        float3x4 mOverloaded = float3x4( instanceData.mOverloadedMatrix0, instanceData.mOverloadedMatrix1, instanceData.mOverloadedMatrix2 ); \
         if( instanceData.textureOffsetAndFlags & ( FLAG_STATIC << FLAG_FIRST_BIT ) ) \
-            mObjectToWorld = ( float3x3 )mOverloaded; \
+            mObjectToWorld = GetInstanceRotation( instanceData ); \
         \
-        float flip = STL::Math::Sign( instanceData.invScale ) * ( rayQuery.CandidateTriangleFrontFace( ) ? -1.0 : 1.0 ); \
+        float invScale = GetInstanceInvScale( instanceData ); \
+        float flip = STL::Math::Sign( invScale ) * ( rayQuery.CandidateTriangleFrontFace( ) ? -1.0 : 1.0 ); \
         \
         /* Primitive */ \
         uint primitiveIndex = instanceData.primitiveOffset + rayQuery.CandidatePrimitiveIndex( ); \
@@ -509,7 +553,7 @@ float ReprojectIrradiance(
         float2 uv = barycentrics.x * primitiveData.uv0 + barycentrics.y * primitiveData.uv1 + barycentrics.z * primitiveData.uv2; \
         \
         [branch]\
-        if(gAhsDynamicMip) \
+        if( PERMUTATION_AHS_DYNAMIC_MIP ) \
         { \
         /* Normal */ \
         float3 n0 = STL::Packing::DecodeUnitVector( primitiveData.n0, true ); \
@@ -525,7 +569,7 @@ float ReprojectIrradiance(
         float a = rayQuery.CandidateTriangleRayT( ); \
         a *= mipAndCone.y; \
         a *= STL::Math::PositiveRcp( NoR ); \
-        a *= primitiveData.worldToUvUnits * abs( instanceData.invScale ); \
+        a *= primitiveData.worldToUvUnits * abs( invScale ); \
         \
         float mip = log2( a ); \
         mip += MAX_MIP_LEVEL; \
@@ -537,7 +581,7 @@ float ReprojectIrradiance(
         float3 coords = GetSamplingCoords( baseTexture, uv, mip, MIP_VISIBILITY ); \
         float alpha = gIn_Textures[ baseTexture ].SAMPLE( coords ).w; \
         \
-        if( alpha > 0.5 ) \
+        if( alpha > gAlphaCutoff ) \
             rayQuery.CommitNonOpaqueTriangleHit( ); \
         } \
         else \
@@ -545,7 +589,7 @@ float ReprojectIrradiance(
             uint baseTexture = ( instanceData.textureOffsetAndFlags & NON_FLAG_MASK ) + 0; \
             float3 coords = GetSamplingCoords( baseTexture, uv, 0, MIP_VISIBILITY ); \
             float alpha = gIn_Textures[ baseTexture ].SAMPLE( coords ).w; \
-            if( alpha > 0.5 ) \
+            if( alpha > gAlphaCutoff ) \
                 rayQuery.CommitNonOpaqueTriangleHit( ); \
         } \
     }
@@ -628,12 +672,11 @@ GeometryProps CastRay( float3 origin, float3 direction, float Tmin, float Tmax,
 
         // Transform
         float3x3 mObjectToWorld = (float3x3)rayQuery.CommittedObjectToWorld3x4( );
-        float3x4 mOverloaded = float3x4( instanceData.mOverloadedMatrix0, instanceData.mOverloadedMatrix1, instanceData.mOverloadedMatrix2 ); \
-
         if( props.IsStatic( ) )
-            mObjectToWorld = ( float3x3 )mOverloaded;
+            mObjectToWorld = GetInstanceRotation( instanceData );
 
-        float flip = STL::Math::Sign( instanceData.invScale ) * ( rayQuery.CommittedTriangleFrontFace( ) ? -1.0 : 1.0 );
+        float invScale = GetInstanceInvScale( instanceData );
+        float flip = STL::Math::Sign( invScale ) * ( rayQuery.CommittedTriangleFrontFace( ) ? -1.0 : 1.0 );
 
         // Primitive
         uint primitiveIndex = instanceData.primitiveOffset + rayQuery.CommittedPrimitiveIndex( );
@@ -656,13 +699,13 @@ GeometryProps CastRay( float3 origin, float3 direction, float Tmin, float Tmax,
 
         // Curvature
         props.curvature = barycentrics.x * primitiveData.curvature0_curvature1.x + barycentrics.y * primitiveData.curvature0_curvature1.y + barycentrics.z * primitiveData.curvature2_bitangentSign.x;
-        props.curvature /= abs( instanceData.invScale );
+        props.curvature /= abs( invScale );
 
         // Mip level (TODO: doesn't take into account integrated AO / SO - i.e. diffuse = lowest mip, but what if we see the sky through a tiny hole?)
         float NoR = abs( dot( direction, props.N ) );
         float a = props.tmin * mipAndCone.y;
         a *= STL::Math::PositiveRcp( NoR );
-        a *= primitiveData.worldToUvUnits * abs( instanceData.invScale );
+        a *= primitiveData.worldToUvUnits * abs( invScale );
 
         float mip = log2( a );
         mip += MAX_MIP_LEVEL;
@@ -688,10 +731,10 @@ GeometryProps CastRay( float3 origin, float3 direction, float Tmin, float Tmax,
             MorphedPrimitivePrevData prevData = gIn_MorphedPrimitivePrevPositions[ instanceData.morphedPrimitiveOffset + rayQuery.CommittedPrimitiveIndex( ) ];
 
             float3 XprevLocal = barycentrics.x * prevData.position0.xyz + barycentrics.y * prevData.position1.xyz + barycentrics.z * prevData.position2.xyz;
-            props.Xprev = STL::Geometry::AffineTransform( mOverloaded, XprevLocal );
+            props.Xprev = STL::Geometry::AffineTransform( GetInstanceTransform( instanceData ), XprevLocal );
         }
         else if( !props.IsStatic( ) )
-            props.Xprev = STL::Geometry::AffineTransform( mOverloaded, props.X );
+            props.Xprev = STL::Geometry::AffineTransform( GetInstanceTransform( instanceData ), props.X );
         else
             props.Xprev = props.X;
     }
@@ -113,6 +113,9 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
 #define MORPH_MAX_ACTIVE_TARGETS_NUM        8u
 #define MORPH_ELEMENTS_PER_ROW_NUM          4
 #define MORPH_ROWS_NUM                      ( MORPH_MAX_ACTIVE_TARGETS_NUM / MORPH_ELEMENTS_PER_ROW_NUM )
+#define MORPH_BATCH_MAX_MESHES_NUM          32u // meshes updated by a single dispatch, limited by the constant buffer size
+#define MORPH_BATCH_ROWS_NUM                ( MORPH_BATCH_MAX_MESHES_NUM / 4 )
+#define MORPH_GROUP_SIZE                    256
 
 // Instance flags
 #define FLAG_FIRST_BIT                      26 // this + number of flags must be <= 32
@@ -178,25 +181,49 @@ struct PrimitiveData
     float worldToUvUnits;
 };
 
-struct InstanceData
+// Morph mesh work tables: one entry per mesh of a batch
+struct MorphMeshVerticesWork
 {
-    // For static: mObjectToWorld
-    // For rigid dynamic: mWorldToWorldPrev
-    // For deformable dynamic: mObjectToWorldPrev
-    float4 mOverloadedMatrix0;
-    float4 mOverloadedMatrix1;
-    float4 mOverloadedMatrix2;
+    uint4 indices[ MORPH_ROWS_NUM ];
+    float4 weights[ MORPH_ROWS_NUM ];
 
-    float4 baseColorAndMetalnessScale;
-    float4 emissionAndRoughnessScale;
+    uint32_t weightNum;
+    uint32_t vertexNum;
+    uint32_t positionCurrFrameOffset;
+    uint32_t attributesOutputOffset;
+};
 
-    uint32_t textureOffsetAndFlags;
+struct MorphMeshPrimitivesWork
+{
+    uint2 positionFrameOffsets;
+    uint32_t primitiveNum;
+    uint32_t indexOffset;
+
+    uint32_t attributesOffset;
     uint32_t primitiveOffset;
     uint32_t morphedPrimitiveOffset;
+    uint32_t padding;
+};
+
+// IMPORTANT: encoded by "Source/InstanceDataEncoding.hpp", FP16 pairs are packed as "lo | hi << 16"
+struct InstanceData
+{
+    // FP16: baseColor.xyz, metalnessScale, emission.xyz, roughnessScale
+    uint4 materialScales;
+
+    // For static: mObjectToWorld rotation, FP16 rows 00 01 02 10 11 12 20 21 (22 is in "rotation22AndInvScale")
+    // For dynamic: x - index of the transform record (3 float4 rows, stored after the instance records):
+    //      for rigid dynamic: mWorldToWorldPrev
+    //      for deformable dynamic: mObjectToWorldPrev
+    uint4 rotation;
 
     // TODO: handling object scale embedded into the transformation matrix (assuming uniform scale)
     // TODO: sign represents triangle winding
-    float invScale;
+    uint32_t rotation22AndInvScale; // FP16: rotation 22, invScale
+
+    uint32_t textureOffsetAndFlags;
+    uint32_t primitiveOffset;
+    uint32_t morphedPrimitiveOffset;
 };
 
 //===============================================================
@@ -248,6 +275,7 @@ NRI_RESOURCE( cbuffer, GlobalConstants, b, 0, 0 )
     float gAperture;
     float gFocalDistance;
     float gFocalLength;
+    float gAlphaCutoff;
     uint32_t gDenoiserType;
     uint32_t gDisableShadowsAndEnableImportanceSampling; // TODO: remove - modify GetSunIntensity to return 0 if sun is below horizon
     uint32_t gOnScreen;
@@ -299,26 +327,28 @@ NRI_RESOURCE( cbuffer, GlobalConstants, b, 0, 0 )
     uint32_t gNisOutputViewportHeight;
 };
 
+// Thread groups are flattened over all meshes of a batch: a group belongs to the last mesh with "first group <= group index".
+// IMPORTANT: filled by "Source/MorphBatching.hpp", which mirrors "FindMesh" of the morph shaders
 NRI_RESOURCE( cbuffer, MorphMeshUpdateVerticesConstants, b, 0, 3 )
 {
-    uint4 gIndices[ MORPH_ROWS_NUM ];
-    float4 gWeights[ MORPH_ROWS_NUM ];
+    MorphMeshVerticesWork gVerticesWork[ MORPH_BATCH_MAX_MESHES_NUM ];
+    uint4 gVerticesFirstGroup[ MORPH_BATCH_ROWS_NUM ];
 
-    uint32_t gNumWeights;
-    uint32_t gNumVertices;
-    uint32_t gPositionCurrFrameOffset;
-    uint32_t gAttributesOutputOffset;
+    uint32_t gVerticesMeshNum;
+    uint32_t gVerticesPadding0;
+    uint32_t gVerticesPadding1;
+    uint32_t gVerticesPadding2;
 };
 
 NRI_RESOURCE( cbuffer, MorphMeshUpdatePrimitivesConstants, b, 0, 3 )
 {
-    uint2 gPositionFrameOffsets;
-    uint32_t gNumPrimitives;
-    uint32_t gIndexOffset;
+    MorphMeshPrimitivesWork gPrimitivesWork[ MORPH_BATCH_MAX_MESHES_NUM ];
+    uint4 gPrimitivesFirstGroup[ MORPH_BATCH_ROWS_NUM ];
 
-    uint32_t gAttributesOffset;
-    uint32_t gPrimitiveOffset;
-    uint32_t gMorphedPrimitiveOffset;
+    uint32_t gPrimitivesMeshNum;
+    uint32_t gPrimitivesPadding0;
+    uint32_t gPrimitivesPadding1;
+    uint32_t gPrimitivesPadding2;
 };
 
 #if( !defined( __cplusplus ) )
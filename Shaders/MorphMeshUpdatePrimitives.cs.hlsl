@@ -58,25 +58,48 @@ float ComputeWorldToUvUnits( float2 uv0, float2 uv1, float2 uv2, float worldArea
     return uvArea == 0 ? 1.0f : STL::Math::Sqrt( uvArea / worldArea );
 }
 
-[numthreads( 256, 1, 1 )]
-void main( uint primitiveIndex : SV_DispatchThreadId )
+uint FindMesh( uint groupIndex )
 {
-    uint i0 = gIn_MorphMeshIndices[ gIndexOffset + primitiveIndex * 3 + 0 ];
-    uint i1 = gIn_MorphMeshIndices[ gIndexOffset + primitiveIndex * 3 + 1 ];
-    uint i2 = gIn_MorphMeshIndices[ gIndexOffset + primitiveIndex * 3 + 2 ];
+    uint first = 0;
+    uint last = gPrimitivesMeshNum - 1;
+    while( first < last )
+    {
+        uint middle = ( first + last + 1 ) >> 1;
+        if( gPrimitivesFirstGroup[ middle >> 2 ][ middle & 3 ] <= groupIndex )
+            first = middle;
+        else
+            last = middle - 1;
+    }
+
+    return first;
+}
+
+[numthreads( MORPH_GROUP_SIZE, 1, 1 )]
+void main( uint groupIndex : SV_GroupId, uint threadIndex : SV_GroupIndex )
+{
+    uint meshIndex = FindMesh( groupIndex );
+    MorphMeshPrimitivesWork work = gPrimitivesWork[ meshIndex ];
+
+    uint primitiveIndex = ( groupIndex - gPrimitivesFirstGroup[ meshIndex >> 2 ][ meshIndex & 3 ] ) * MORPH_GROUP_SIZE + threadIndex;
+    if( primitiveIndex >= work.primitiveNum )
+        return;
+
+    uint i0 = gIn_MorphMeshIndices[ work.indexOffset + primitiveIndex * 3 + 0 ];
+    uint i1 = gIn_MorphMeshIndices[ work.indexOffset + primitiveIndex * 3 + 1 ];
+    uint i2 = gIn_MorphMeshIndices[ work.indexOffset + primitiveIndex * 3 + 2 ];
 
-    MorphedAttributes a0 = gIn_MorphedAttributes[ gAttributesOffset + i0 ];
-    MorphedAttributes a1 = gIn_MorphedAttributes[ gAttributesOffset + i1 ];
-    MorphedAttributes a2 = gIn_MorphedAttributes[ gAttributesOffset + i2 ];
+    MorphedAttributes a0 = gIn_MorphedAttributes[ work.attributesOffset + i0 ];
+    MorphedAttributes a1 = gIn_MorphedAttributes[ work.attributesOffset + i1 ];
+    MorphedAttributes a2 = gIn_MorphedAttributes[ work.attributesOffset + i2 ];
 
-    PrimitiveData result = gInOut_PrimitiveData[ gPrimitiveOffset + primitiveIndex ];
+    PrimitiveData result = gInOut_PrimitiveData[ work.primitiveOffset + primitiveIndex ];
 
     // TODO: not needed for hair because in any case curvature defined ONLY by hair thickness will be found
     // We need macro-curvature computed based on tangents (or macro normals, computed based on tangents!)
     #if 0
-        float3 p0 = gIn_MorphedPositions[ gPositionFrameOffsets.x + i0 ].xyz;
-        float3 p1 = gIn_MorphedPositions[ gPositionFrameOffsets.x + i1 ].xyz;
-        float3 p2 = gIn_MorphedPositions[ gPositionFrameOffsets.x + i2 ].xyz;
+        float3 p0 = gIn_MorphedPositions[ work.positionFrameOffsets.x + i0 ].xyz;
+        float3 p1 = gIn_MorphedPositions[ work.positionFrameOffsets.x + i1 ].xyz;
+        float3 p2 = gIn_MorphedPositions[ work.positionFrameOffsets.x + i2 ].xyz;
 
         float2 uv0 = ( float2 )result.uv0;
         float2 uv1 = ( float2 )result.uv1;
@@ -102,10 +125,10 @@ void main( uint primitiveIndex : SV_DispatchThreadId )
     result.t1 = a1.T;
     result.t2 = a2.T;
 
-    gInOut_PrimitiveData[ gPrimitiveOffset + primitiveIndex ] = result;
+    gInOut_PrimitiveData[ work.primitiveOffset + primitiveIndex ] = result;
 
-    uint index = gMorphedPrimitiveOffset + primitiveIndex;
-    gOut_PrimitivePrevData[ index ].position0 = gIn_MorphedPositions[ gPositionFrameOffsets.y + i0 ];
-    gOut_PrimitivePrevData[ index ].position1 = gIn_MorphedPositions[ gPositionFrameOffsets.y + i1 ];
-    gOut_PrimitivePrevData[ index ].position2 = gIn_MorphedPositions[ gPositionFrameOffsets.y + i2 ];
+    uint index = work.morphedPrimitiveOffset + primitiveIndex;
+    gOut_PrimitivePrevData[ index ].position0 = gIn_MorphedPositions[ work.positionFrameOffsets.y + i0 ];
+    gOut_PrimitivePrevData[ index ].position1 = gIn_MorphedPositions[ work.positionFrameOffsets.y + i1 ];
+    gOut_PrimitivePrevData[ index ].position2 = gIn_MorphedPositions[ work.positionFrameOffsets.y + i2 ];
 }
@@ -18,10 +18,30 @@ NRI_RESOURCE( StructuredBuffer<MorphVertex>, gIn_MorphMeshVertices, t, 0, 3 );
 NRI_RESOURCE( RWStructuredBuffer<float4>, gOut_MorphedPositions, u, 0, 3 );
 NRI_RESOURCE( RWStructuredBuffer<MorphedAttributes>, gOut_MorphedAttributes, u, 1, 3 );
 
-[numthreads( 256, 1, 1 )]
-void main( uint vertexIndex : SV_DispatchThreadId )
+uint FindMesh( uint groupIndex )
 {
-    if( vertexIndex >= gNumVertices )
+    uint first = 0;
+    uint last = gVerticesMeshNum - 1;
+    while( first < last )
+    {
+        uint middle = ( first + last + 1 ) >> 1;
+        if( gVerticesFirstGroup[ middle >> 2 ][ middle & 3 ] <= groupIndex )
+            first = middle;
+        else
+            last = middle - 1;
+    }
+
+    return first;
+}
+
+[numthreads( MORPH_GROUP_SIZE, 1, 1 )]
+void main( uint groupIndex : SV_GroupId, uint threadIndex : SV_GroupIndex )
+{
+    uint meshIndex = FindMesh( groupIndex );
+    MorphMeshVerticesWork work = gVerticesWork[ meshIndex ];
+
+    uint vertexIndex = ( groupIndex - gVerticesFirstGroup[ meshIndex >> 2 ][ meshIndex & 3 ] ) * MORPH_GROUP_SIZE + threadIndex;
+    if( vertexIndex >= work.vertexNum )
         return;
 
     float3 position = 0;
@@ -29,14 +49,14 @@ void main( uint vertexIndex : SV_DispatchThreadId )
     float3 T = 0;
 
     // TODO: unroll to 4 weights at a time?
-    uint maxWeights = min( MORPH_MAX_ACTIVE_TARGETS_NUM, gNumWeights );
+    uint maxWeights = min( MORPH_MAX_ACTIVE_TARGETS_NUM, work.weightNum );
     for( uint i = 0; i < maxWeights; i++ )
     {
         uint row = i / MORPH_ELEMENTS_PER_ROW_NUM;
         uint col = i % MORPH_ELEMENTS_PER_ROW_NUM;
 
-        uint morphTargetIndex = gIndices[ row ][ col ];
-        float weight = gWeights[ row ][ col ];
+        uint morphTargetIndex = work.indices[ row ][ col ];
+        float weight = work.weights[ row ][ col ];
         uint morphTargetVertexIndex = morphTargetIndex + vertexIndex;
 
         MorphVertex v = gIn_MorphMeshVertices[ morphTargetVertexIndex ];
@@ -46,11 +66,11 @@ void main( uint vertexIndex : SV_DispatchThreadId )
         T += STL::Packing::DecodeUnitVector( ( float2 )v.T, true, true ) * weight;
     }
 
-    gOut_MorphedPositions[ gPositionCurrFrameOffset + vertexIndex] = float4( position, 1.0 );
+    gOut_MorphedPositions[ work.positionCurrFrameOffset + vertexIndex ] = float4( position, 1.0 );
 
     MorphedAttributes attributes = ( MorphedAttributes )0;
     attributes.N = ( float16_t2 )STL::Packing::EncodeUnitVector( normalize( N ), true );
     attributes.T = ( float16_t2 )STL::Packing::EncodeUnitVector( normalize( T ), true );
 
-    gOut_MorphedAttributes[ gAttributesOutputOffset + vertexIndex ] = attributes;
+    gOut_MorphedAttributes[ work.attributesOutputOffset + vertexIndex ] = attributes;
 }
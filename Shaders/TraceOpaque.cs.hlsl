@@ -807,7 +807,7 @@ void main( uint2 pixelPos : SV_DispatchThreadId )
         return;
     }
 
-    if( geometryProps0.IsAnyHitInvoked( ) && gHighlightAhs)
+    if( PERMUTATION_HIGHLIGHT_AHS && geometryProps0.IsAnyHitInvoked( ) )
         materialProps0.baseColor = lerp( materialProps0.baseColor, float3(1.0, 0.0, 1.0), 0.5 );
 
     // G-buffer
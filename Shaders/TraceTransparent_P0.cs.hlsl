@@ -0,0 +1,14 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+// Permutation 0 (see TracePermutationKey)
+#define PERMUTATION_AHS_DYNAMIC_MIP         0
+
+#include "TraceTransparent.cs.hlsl"
@@ -0,0 +1,434 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#include "OmmBakeServer.h"
+#include <stdio.h>
+#include <string.h>
+#include <filesystem>
+
+namespace ommhelper
+{
+    bool OmmBakeServer::Start(const char* socketPath, const char* cacheFolder, uint32_t workerNum)
+    {
+        m_SocketPath = socketPath;
+        m_CacheFolder = cacheFolder;
+
+        std::error_code errorCode;
+        std::filesystem::create_directories(m_CacheFolder, errorCode);
+
+        m_ListenSocket = OmmBakeSocketApi::Listen(socketPath);
+        if (m_ListenSocket == OMM_BAKE_INVALID_SOCKET)
+        {
+            printf("[FAIL]: Can't listen on %s\n", socketPath);
+            return false;
+        }
+
+        workerNum = workerNum ? workerNum : std::max(std::thread::hardware_concurrency(), 1u);
+        for (uint32_t i = 0; i < workerNum; ++i)
+            m_Workers.emplace_back(&OmmBakeServer::WorkerLoop, this);
+
+        printf("[OMM Server] Listening on %s. Workers: %u. Cache: %s\n", socketPath, workerNum, cacheFolder);
+        return true;
+    }
+
+    void OmmBakeServer::Run()
+    {
+        while (!m_IsStopped)
+        {
+            OmmBakeSocket socket = OmmBakeSocketApi::Accept(m_ListenSocket, OMM_BAKE_SERVER_ACCEPT_TIMEOUT_MS);
+            ReleaseFinishedClients();
+            if (socket == OMM_BAKE_INVALID_SOCKET)
+                continue;
+
+            std::lock_guard<std::mutex> lock(m_ClientsMutex);
+            Client& client = m_Clients.emplace_back();
+            client.socket = socket;
+            client.thread = std::thread(&OmmBakeServer::HandleClient, this, &client);
+        }
+    }
+
+    void OmmBakeServer::RequestStop()
+    {
+        m_IsStopped = true;
+    }
+
+    void OmmBakeServer::Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_JobsMutex);
+            m_IsStopped = true;
+        }
+        m_QueueCondition.notify_all();
+
+        OmmBakeSocketApi::Close(m_ListenSocket);
+        m_ListenSocket = OMM_BAKE_INVALID_SOCKET;
+        remove(m_SocketPath.c_str());
+
+        { // unblock the readers, responses of submitted jobs still go out
+            std::lock_guard<std::mutex> lock(m_ClientsMutex);
+            for (Client& client : m_Clients)
+                OmmBakeSocketApi::Shutdown(client.socket);
+        }
+
+        for (std::thread& worker : m_Workers)
+            worker.join();
+        m_Workers.clear();
+
+        // Workers finish the job in hand only. Nobody is going to take the rest, fail it so the senders don't wait forever
+        std::deque<std::shared_ptr<BakeJob>> abandonedJobs;
+        {
+            std::lock_guard<std::mutex> lock(m_JobsMutex);
+            abandonedJobs.swap(m_Queue);
+        }
+        for (const std::shared_ptr<BakeJob>& job : abandonedJobs)
+            FailJob(job);
+
+        std::list<Client> clients;
+        {
+            std::lock_guard<std::mutex> lock(m_ClientsMutex);
+            clients.swap(m_Clients);
+        }
+        for (Client& client : clients)
+            client.thread.join();
+    }
+
+    void OmmBakeServer::ReleaseFinishedClients()
+    {
+        std::lock_guard<std::mutex> lock(m_ClientsMutex);
+        for (auto it = m_Clients.begin(); it != m_Clients.end();)
+        {
+            if (it->isDone)
+            {
+                it->thread.join();
+                it = m_Clients.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+
+    void OmmBakeServer::HandleClient(Client* client)
+    {
+        const OmmBakeSocket socket = client->socket;
+ // Requests are read and submitted as they come, responses are streamed back in request order
+        std::mutex pendingMutex;
+        std::condition_variable pendingCondition;
+        std::deque<std::shared_ptr<BakeJob>> pendingJobs;
+        bool isClientDone = false;
+
+        std::thread sender([&]()
+        {
+            bool isConnected = true;
+            while (true)
+            {
+                std::shared_ptr<BakeJob> job;
+                {
+                    std::unique_lock<std::mutex> lock(pendingMutex);
+                    pendingCondition.wait(lock, [&]() { return !pendingJobs.empty() || isClientDone; });
+                    if (pendingJobs.empty())
+                        break;
+                    job = pendingJobs.front();
+                    pendingJobs.pop_front();
+                }
+
+                std::unique_lock<std::mutex> jobLock(job->mutex);
+                job->isDoneCondition.wait(jobLock, [&]() { return job->isDone; });
+                if (isConnected)
+                    isConnected = SendBakeResponse(socket, job->response, job->outputs);
+            }
+        });
+
+        while (!m_IsStopped)
+        {
+            std::unique_ptr<OmmBakeRequest> request = std::make_unique<OmmBakeRequest>();
+            if (!RecvBakeRequest(socket, *request))
+                break;
+
+            std::shared_ptr<BakeJob> job = SubmitJob(std::move(request));
+            {
+                std::lock_guard<std::mutex> lock(pendingMutex);
+                pendingJobs.push_back(job);
+            }
+            pendingCondition.notify_one();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            isClientDone = true;
+        }
+        pendingCondition.notify_one();
+        sender.join();
+
+        std::lock_guard<std::mutex> lock(m_ClientsMutex); // Stop() may be shutting the socket down right now
+        OmmBakeSocketApi::Close(socket);
+        client->socket = OMM_BAKE_INVALID_SOCKET;
+        client->isDone = true;
+    }
+
+    std::shared_ptr<OmmBakeServer::BakeJob> OmmBakeServer::SubmitJob(std::unique_ptr<OmmBakeRequest> request)
+    {
+        const void* mips[OMM_BAKE_PROTOCOL_MAX_MIP_NUM] = {};
+        for (uint32_t mip = 0; mip < request->header.mipNum; ++mip)
+            mips[mip] = request->mips[mip].data();
+        uint64_t hash = CalculateBakeRequestHash(request->header, request->indices.data(), request->texCoords.data(), mips);
+
+        ++m_RequestNum;
+        std::shared_ptr<BakeJob> job;
+        bool isStopped = false;
+        {
+            std::lock_guard<std::mutex> lock(m_JobsMutex);
+            auto it = m_InFlightJobs.find(hash);
+            if (it != m_InFlightJobs.end())
+            {
+                ++m_DeduplicatedNum;
+                return it->second;
+            }
+
+            job = std::make_shared<BakeJob>();
+            job->response.magic = OMM_BAKE_PROTOCOL_MAGIC;
+            job->response.requestHash = hash;
+
+            isStopped = m_IsStopped;
+            if (!isStopped)
+            {
+                job->request = std::move(*request);
+                m_InFlightJobs.insert(std::make_pair(hash, job));
+                m_Queue.push_back(job);
+            }
+        }
+
+        if (isStopped) // too late, no worker is going to take it
+            FailJob(job);
+        else
+            m_QueueCondition.notify_one();
+        return job;
+    }
+
+    void OmmBakeServer::CompleteJob(const std::shared_ptr<BakeJob>& job)
+    {
+        { // inputs are not needed anymore, outputs live until the last client got them
+            OmmBakeRequest& request = job->request;
+            request.indices = {};
+            request.texCoords = {};
+            for (std::vector<uint8_t>& mip : request.mips)
+                mip = {};
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_JobsMutex);
+            auto it = m_InFlightJobs.find(job->response.requestHash);
+            if (it != m_InFlightJobs.end() && it->second == job) // jobs failed on stop may not be registered
+                m_InFlightJobs.erase(it);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->isDone = true;
+        }
+        job->isDoneCondition.notify_all();
+
+        printf("[OMM Server] %016llx: %s. Requests: %llu, deduplicated: %llu, cache hits: %llu\n", (unsigned long long)job->response.requestHash,
+            job->response.result != ommResult_SUCCESS ? "failed" : (job->response.isFromCache ? "cache" : "baked"),
+            (unsigned long long)m_RequestNum.load(), (unsigned long long)m_DeduplicatedNum.load(), (unsigned long long)m_CacheHitNum.load());
+    }
+
+    void OmmBakeServer::FailJob(const std::shared_ptr<BakeJob>& job)
+    {
+        job->response.result = ommResult_FAILURE;
+        for (uint64_t& size : job->response.sizes)
+            size = 0;
+        CompleteJob(job);
+    }
+
+    void OmmBakeServer::WorkerLoop()
+    {
+        ommBaker baker = 0;
+        ommBakerCreationDesc bakerDesc = ommBakerCreationDescDefault();
+        bakerDesc.enableValidation = false;
+        bakerDesc.type = ommBakerType_CPU;
+        if (ommCreateBaker(&bakerDesc, &baker) != ommResult_SUCCESS)
+        {
+            printf("[FAIL]: ommCreateOpacityMicromapBaker\n");
+            std::abort();
+        }
+
+        while (true)
+        {
+            std::shared_ptr<BakeJob> job;
+            {
+                std::unique_lock<std::mutex> lock(m_JobsMutex);
+                m_QueueCondition.wait(lock, [&]() { return !m_Queue.empty() || m_IsStopped; });
+                if (m_IsStopped)
+                    break;
+                job = m_Queue.front();
+                m_Queue.pop_front();
+            }
+
+            uint64_t hash = job->response.requestHash;
+            if (ReadFromCache(hash, *job))
+                ++m_CacheHitNum;
+            else
+            {
+                Bake(baker, *job);
+                if (job->response.result == ommResult_SUCCESS)
+                    WriteToCache(hash, *job);
+            }
+            CompleteJob(job);
+        }
+
+        ommDestroyBaker(baker);
+    }
+
+    void OmmBakeServer::Bake(ommBaker baker, BakeJob& job)
+    {
+        const OmmBakeRequestHeader& header = job.request.header;
+        OmmBakeResponseHeader& response = job.response;
+
+        ommCpuTextureMipDesc mipDescs[OMM_BAKE_PROTOCOL_MAX_MIP_NUM] = {};
+        for (uint32_t mip = 0; mip < header.mipNum; ++mip)
+        {
+            mipDescs[mip] = ommCpuTextureMipDescDefault();
+            mipDescs[mip].width = header.mipWidth[mip];
+            mipDescs[mip].height = header.mipHeight[mip];
+            mipDescs[mip].textureData = job.request.mips[mip].data();
+        }
+
+        ommCpuTextureDesc textureDesc = ommCpuTextureDescDefault();
+        textureDesc.mipCount = header.mipNum;
+        textureDesc.mips = mipDescs;
+        textureDesc.format = ommCpuTextureFormat(header.textureFormat);
+        textureDesc.alphaCutoff = header.alphaCutoff;
+
+        ommCpuTexture texture = 0;
+        response.result = ommCpuCreateTexture(baker, &textureDesc, &texture);
+        if (response.result != ommResult_SUCCESS)
+            return;
+
+        ommCpuBakeInputDesc bakeDesc = ommCpuBakeInputDescDefault();
+        bakeDesc.texture = texture;
+        bakeDesc.alphaMode = ommAlphaMode(header.alphaMode);
+        bakeDesc.runtimeSamplerDesc.addressingMode = ommTextureAddressMode(header.addressingMode);
+        bakeDesc.runtimeSamplerDesc.filter = ommTextureFilterMode(header.filter);
+        bakeDesc.maxSubdivisionLevel = (uint8_t)header.maxSubdivisionLevel;
+        bakeDesc.alphaCutoff = header.alphaCutoff;
+        bakeDesc.dynamicSubdivisionScale = header.dynamicSubdivisionScale;
+        bakeDesc.indexFormat = ommIndexFormat(header.indexFormat);
+        bakeDesc.indexBuffer = job.request.indices.data();
+        bakeDesc.indexCount = header.indexCount;
+        bakeDesc.texCoords = job.request.texCoords.data();
+        bakeDesc.texCoordFormat = ommTexCoordFormat(header.texCoordFormat);
+        bakeDesc.format = ommFormat(header.format);
+        // the worker pool is the parallelism here
+        bakeDesc.bakeFlags = ommCpuBakeFlags(header.bakeFlags & ~uint32_t(ommCpuBakeFlags_EnableInternalThreads));
+
+        ommCpuBakeResult bakeResult = 0;
+        response.result = ommCpuBake(baker, &bakeDesc, &bakeResult);
+        if (response.result == ommResult_SUCCESS)
+        {
+            const ommCpuBakeResultDesc* resDesc = nullptr;
+            response.result = ommCpuGetBakeResultDesc(bakeResult, &resDesc);
+            if (response.result == ommResult_SUCCESS && resDesc->arrayData)
+            {
+                size_t indexStride = resDesc->indexFormat == ommIndexFormat_I16_UINT ? sizeof(uint16_t) : sizeof(uint32_t);
+                const void* data[OMM_BAKE_PROTOCOL_OUTPUT_NUM] = { resDesc->arrayData, resDesc->descArray, resDesc->indexBuffer, resDesc->descArrayHistogram, resDesc->indexHistogram };
+                uint64_t sizes[OMM_BAKE_PROTOCOL_OUTPUT_NUM] =
+                {
+                    resDesc->arrayDataSize,
+                    resDesc->descArrayCount * sizeof(ommCpuOpacityMicromapDesc),
+                    resDesc->indexCount * indexStride,
+                    resDesc->descArrayHistogramCount * sizeof(ommCpuOpacityMicromapUsageCount),
+                    resDesc->indexHistogramCount * sizeof(ommCpuOpacityMicromapUsageCount),
+                };
+
+                for (uint32_t i = 0; i < OMM_BAKE_PROTOCOL_OUTPUT_NUM; ++i)
+                {
+                    response.sizes[i] = sizes[i];
+                    job.outputs[i].resize(sizes[i]);
+                    if (sizes[i])
+                        memcpy(job.outputs[i].data(), data[i], sizes[i]);
+                }
+                response.indexFormat = resDesc->indexFormat;
+                response.descArrayHistogramCount = resDesc->descArrayHistogramCount;
+                response.indexHistogramCount = resDesc->indexHistogramCount;
+            }
+            ommCpuDestroyBakeResult(bakeResult);
+        }
+        ommCpuDestroyTexture(baker, texture);
+    }
+
+    std::string OmmBakeServer::GetCacheFilename(uint64_t hash) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.ommbake", (unsigned long long)hash);
+        return m_CacheFolder + "/" + name;
+    }
+
+    bool OmmBakeServer::ReadFromCache(uint64_t hash, BakeJob& job)
+    {
+        std::string filename = GetCacheFilename(hash);
+        std::error_code errorCode;
+        uint64_t fileSize = std::filesystem::file_size(filename, errorCode);
+        if (errorCode)
+            return false;
+
+        FILE* file = fopen(filename.c_str(), "rb");
+        if (!file)
+            return false;
+
+        OmmBakeResponseHeader header = {};
+        bool result = fread(&header, sizeof(header), 1, file) == 1;
+        result = result && header.magic == OMM_BAKE_PROTOCOL_MAGIC && header.requestHash == hash;
+
+        uint64_t remainingSize = fileSize - sizeof(header);
+        for (uint32_t i = 0; i < OMM_BAKE_PROTOCOL_OUTPUT_NUM && result; ++i)
+        { // truncated or corrupted records must not drive the allocation size
+            result = header.sizes[i] <= OMM_BAKE_PROTOCOL_MAX_CHUNK_SIZE && header.sizes[i] <= remainingSize;
+            if (!result)
+                break;
+            remainingSize -= header.sizes[i];
+
+            job.outputs[i].resize(header.sizes[i]);
+            result = header.sizes[i] == 0 || fread(job.outputs[i].data(), header.sizes[i], 1, file) == 1;
+        }
+        fclose(file);
+
+        if (!result)
+        { // broken record, bake again
+            for (std::vector<uint8_t>& output : job.outputs)
+                output.clear();
+            return false;
+        }
+
+        job.response = header;
+        job.response.isFromCache = 1;
+        return true;
+    }
+
+    void OmmBakeServer::WriteToCache(uint64_t hash, const BakeJob& job)
+    { // write to a temporary file first: several servers may share the cache folder
+        std::string filename = GetCacheFilename(hash);
+        std::string tmpFilename = filename + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+
+        FILE* file = fopen(tmpFilename.c_str(), "wb");
+        if (!file)
+            return;
+
+        bool result = fwrite(&job.response, sizeof(job.response), 1, file) == 1;
+        for (uint32_t i = 0; i < OMM_BAKE_PROTOCOL_OUTPUT_NUM && result; ++i)
+            result = job.response.sizes[i] == 0 || fwrite(job.outputs[i].data(), job.response.sizes[i], 1, file) == 1;
+        fclose(file);
+
+        std::error_code errorCode;
+        if (result)
+            std::filesystem::rename(tmpFilename, filename, errorCode);
+        if (!result || errorCode)
+            std::filesystem::remove(tmpFilename, errorCode);
+    }
+}
@@ -0,0 +1,90 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#pragma once
+#include <string>
+#include <map>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+
+#define OMM_SUPPORTS_CPP17 (1)
+#include "omm.h"
+
+#include "VisibilityMasks/OmmBakeProtocol.h"
+
+#define OMM_BAKE_SERVER_ACCEPT_TIMEOUT_MS 100
+
+namespace ommhelper
+{
+    class OmmBakeServer
+    {
+    public:
+        bool Start(const char* socketPath, const char* cacheFolder, uint32_t workerNum);
+        void Run(); // accept loop, returns after RequestStop()
+        void RequestStop(); // only raises a flag: safe from signal handlers and other threads
+        // After Run() returned: started bakes are finished and sent, queued ones are failed, all threads are joined
+        void Stop();
+
+    private:
+        struct BakeJob
+        {
+            OmmBakeRequest request;
+            OmmBakeResponseHeader response;
+            std::vector<uint8_t> outputs[OMM_BAKE_PROTOCOL_OUTPUT_NUM];
+
+            std::mutex mutex;
+            std::condition_variable isDoneCondition;
+            bool isDone = false;
+        };
+
+        struct Client
+        {
+            std::thread thread;
+            OmmBakeSocket socket;
+            bool isDone = false;
+        };
+
+        void HandleClient(Client* client);
+        void ReleaseFinishedClients();
+        std::shared_ptr<BakeJob> SubmitJob(std::unique_ptr<OmmBakeRequest> request);
+        void CompleteJob(const std::shared_ptr<BakeJob>& job);
+        void FailJob(const std::shared_ptr<BakeJob>& job);
+        void WorkerLoop();
+        void Bake(ommBaker baker, BakeJob& job);
+
+        std::string GetCacheFilename(uint64_t hash) const;
+        bool ReadFromCache(uint64_t hash, BakeJob& job);
+        void WriteToCache(uint64_t hash, const BakeJob& job);
+
+    private:
+        std::string m_SocketPath;
+        std::string m_CacheFolder;
+        OmmBakeSocket m_ListenSocket = OMM_BAKE_INVALID_SOCKET;
+
+        std::mutex m_JobsMutex;
+        std::condition_variable m_QueueCondition;
+        std::map<uint64_t, std::shared_ptr<BakeJob>> m_InFlightJobs; // identical requests share one job
+        std::deque<std::shared_ptr<BakeJob>> m_Queue;
+        std::vector<std::thread> m_Workers;
+        std::atomic<bool> m_IsStopped = false;
+
+        std::mutex m_ClientsMutex;
+        std::list<Client> m_Clients;
+
+        std::atomic<uint64_t> m_RequestNum = 0;
+        std::atomic<uint64_t> m_DeduplicatedNum = 0;
+        std::atomic<uint64_t> m_CacheHitNum = 0;
+    };
+}
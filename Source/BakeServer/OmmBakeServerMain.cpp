@@ -0,0 +1,58 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#include "OmmBakeServer.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+static ommhelper::OmmBakeServer g_Server;
+
+static void OnStopSignal(int)
+{
+    g_Server.RequestStop();
+}
+
+// Usage: OMMBakeServer [--socket=<path>] [--cache=<folder>] [--threads=<num>]
+int main(int argc, char** argv)
+{
+    const char* socketPath = OMM_BAKE_SERVER_DEFAULT_SOCKET;
+    const char* cacheFolder = "_OmmCache/Server";
+    uint32_t workerNum = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--socket=", 9) == 0)
+            socketPath = arg + 9;
+        else if (strncmp(arg, "--cache=", 8) == 0)
+            cacheFolder = arg + 8;
+        else if (strncmp(arg, "--threads=", 10) == 0)
+            workerNum = (uint32_t)atoi(arg + 10);
+        else
+        {
+            printf("Usage: OMMBakeServer [--socket=<path>] [--cache=<folder>] [--threads=<num>]\n");
+            return 1;
+        }
+    }
+
+    if (!g_Server.Start(socketPath, cacheFolder, workerNum))
+        return 1;
+
+    signal(SIGINT, OnStopSignal);
+    signal(SIGTERM, OnStopSignal);
+
+    g_Server.Run();
+    printf("[OMM Server] Stopping\n");
+    g_Server.Stop();
+
+    return 0;
+}
@@ -0,0 +1,158 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// CPU side of the "InstanceData" layout (see Shared.hlsli): encoder and decoder, the shaders decode with "f16tof32".
+// FP16 values round to nearest even. A decoded value "v" is within "GetHalfErrorBound(v)" of the encoded one,
+// out of range values are clamped to +/-65504.
+// NOTE: expects "InstanceData" and "FP16_MAX" to be defined (Shared.hlsli), no other dependencies
+
+constexpr float FP16_MIN_NORMAL = 6.103515625e-05f; // 2^-14
+
+inline uint16_t FloatToHalf(float value)
+{
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+
+    uint32_t sign = (f >> 16) & 0x8000;
+    uint32_t absf = f & 0x7FFFFFFF;
+
+    if (absf >= 0x477FF000) // rounds to infinity (65520 and above), NaN
+        return uint16_t(sign | 0x7BFF);
+
+    if (absf < 0x38800000) // denormal: multiple of 2^-24
+    {
+        float a;
+        memcpy(&a, &absf, sizeof(a));
+        return uint16_t(sign | (uint32_t)lrintf(a * 16777216.0f));
+    }
+
+    uint32_t h = absf - 0x38000000; // rebias the exponent: (127 - 15) << 23
+    h = (h + 0xFFF + ((h >> 13) & 0x1)) >> 13;
+
+    return uint16_t(sign | h);
+}
+
+inline float HalfToFloat(uint16_t h)
+{
+    uint32_t exponent = (h >> 10) & 0x1F;
+    uint32_t mantissa = h & 0x3FF;
+
+    float value;
+    if (exponent == 0)
+        value = float(mantissa) * (1.0f / 16777216.0f);
+    else if (exponent == 31)
+        value = mantissa ? NAN : INFINITY;
+    else
+    {
+        uint32_t f = ((exponent + 112) << 23) | (mantissa << 13);
+        memcpy(&value, &f, sizeof(value));
+    }
+
+    return (h & 0x8000) ? -value : value;
+}
+
+// Maximum absolute error of a value round tripped through FP16
+inline float GetHalfErrorBound(float value)
+{
+    float absValue = fabsf(value);
+    if (absValue > FP16_MAX)
+        return absValue - float(FP16_MAX);
+
+    return absValue < FP16_MIN_NORMAL ? 1.0f / 33554432.0f : absValue / 2048.0f; // half an ulp: 2^-25 or 2^-11 relative
+}
+
+inline uint32_t PackHalf2(float lo, float hi)
+{ return uint32_t(FloatToHalf(lo)) | (uint32_t(FloatToHalf(hi)) << 16); }
+
+inline float UnpackHalfLo(uint32_t packed)
+{ return HalfToFloat(uint16_t(packed & 0xFFFF)); }
+
+inline float UnpackHalfHi(uint32_t packed)
+{ return HalfToFloat(uint16_t(packed >> 16)); }
+
+struct InstanceDataDesc
+{
+    float rotation[3][3]; // static only, rows
+    float baseColorAndMetalnessScale[4];
+    float emissionAndRoughnessScale[4];
+    float invScale;
+    uint32_t transformIndex; // dynamic only
+    uint32_t textureOffsetAndFlags;
+    uint32_t primitiveOffset;
+    uint32_t morphedPrimitiveOffset;
+    bool isStatic;
+};
+
+inline void EncodeInstanceData(const InstanceDataDesc& desc, InstanceData& instanceData)
+{
+    const float* c = desc.baseColorAndMetalnessScale;
+    const float* e = desc.emissionAndRoughnessScale;
+    instanceData.materialScales = uint4(PackHalf2(c[0], c[1]), PackHalf2(c[2], c[3]), PackHalf2(e[0], e[1]), PackHalf2(e[2], e[3]));
+
+    float rotation22 = 0.0f;
+    if (desc.isStatic)
+    {
+        const float (*r)[3] = desc.rotation;
+        instanceData.rotation = uint4(PackHalf2(r[0][0], r[0][1]), PackHalf2(r[0][2], r[1][0]), PackHalf2(r[1][1], r[1][2]), PackHalf2(r[2][0], r[2][1]));
+        rotation22 = r[2][2];
+    }
+    else
+        instanceData.rotation = uint4(desc.transformIndex, 0, 0, 0);
+
+    instanceData.rotation22AndInvScale = PackHalf2(rotation22, desc.invScale);
+    instanceData.textureOffsetAndFlags = desc.textureOffsetAndFlags;
+    instanceData.primitiveOffset = desc.primitiveOffset;
+    instanceData.morphedPrimitiveOffset = desc.morphedPrimitiveOffset;
+}
+
+inline void DecodeInstanceData(const InstanceData& instanceData, bool isStatic, InstanceDataDesc& desc)
+{
+    const uint32_t m[4] = { instanceData.materialScales.x, instanceData.materialScales.y, instanceData.materialScales.z, instanceData.materialScales.w };
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        desc.baseColorAndMetalnessScale[i * 2] = UnpackHalfLo(m[i]);
+        desc.baseColorAndMetalnessScale[i * 2 + 1] = UnpackHalfHi(m[i]);
+        desc.emissionAndRoughnessScale[i * 2] = UnpackHalfLo(m[i + 2]);
+        desc.emissionAndRoughnessScale[i * 2 + 1] = UnpackHalfHi(m[i + 2]);
+    }
+
+    const uint32_t r[4] = { instanceData.rotation.x, instanceData.rotation.y, instanceData.rotation.z, instanceData.rotation.w };
+    memset(desc.rotation, 0, sizeof(desc.rotation));
+    desc.transformIndex = 0;
+    if (isStatic)
+    {
+        for (uint32_t i = 0; i < 8; i++)
+            desc.rotation[i / 3][i % 3] = (i & 0x1) ? UnpackHalfHi(r[i / 2]) : UnpackHalfLo(r[i / 2]);
+        desc.rotation[2][2] = UnpackHalfLo(instanceData.rotation22AndInvScale);
+    }
+    else
+        desc.transformIndex = r[0];
+
+    desc.invScale = UnpackHalfHi(instanceData.rotation22AndInvScale);
+    desc.textureOffsetAndFlags = instanceData.textureOffsetAndFlags;
+    desc.primitiveOffset = instanceData.primitiveOffset;
+    desc.morphedPrimitiveOffset = instanceData.morphedPrimitiveOffset;
+    desc.isStatic = isStatic;
+}
+
+// Transform records of dynamic instances share the buffer: 3 float4 rows, bit cast into the 12 dwords of a record
+inline void EncodeInstanceTransform(const float4& row0, const float4& row1, const float4& row2, InstanceData& instanceData)
+{
+    static_assert(sizeof(InstanceData) == 3 * sizeof(float4), "a transform record must fill an instance record");
+
+    memcpy((uint8_t*)&instanceData, &row0, sizeof(float4));
+    memcpy((uint8_t*)&instanceData + sizeof(float4), &row1, sizeof(float4));
+    memcpy((uint8_t*)&instanceData + 2 * sizeof(float4), &row2, sizeof(float4));
+}
@@ -0,0 +1,47 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#pragma once
+#include <stdint.h>
+
+// CPU side of the morph mesh work tables (see "MorphMeshUpdate*Constants" in Shared.hlsli). Meshes are updated in batches of up to
+// "MORPH_BATCH_MAX_MESHES_NUM" meshes, one dispatch per batch. The thread groups of a batch are flattened: each mesh starts at
+// its first group, and the shaders find the mesh of a group with a binary search, mirrored by "FindMorphBatchMesh".
+// NOTE: expects "uint4" and the "MORPH_*" constants to be defined (Shared.hlsli), no other dependencies
+
+inline uint32_t GetMorphBatchEnd(uint32_t batchBegin, uint32_t batchMeshNum, uint32_t meshNum)
+{ return meshNum - batchBegin > batchMeshNum ? batchBegin + batchMeshNum : meshNum; }
+
+inline uint32_t GetMorphGroupNum(uint32_t itemNum)
+{ return (itemNum + MORPH_GROUP_SIZE - 1) / MORPH_GROUP_SIZE; }
+
+// Mesh "batchMeshIndex" of the batch starts at group "groupNum", which is advanced past its "itemNum" vertices or primitives
+inline void AddMorphBatchMesh(uint4* firstGroups, uint32_t batchMeshIndex, uint32_t itemNum, uint32_t& groupNum)
+{
+    firstGroups[batchMeshIndex / 4].pv[batchMeshIndex % 4] = groupNum;
+    groupNum += GetMorphGroupNum(itemNum);
+}
+
+// "FindMesh" of the morph shaders: the last mesh starting at or before the group, meshes without groups are skipped
+inline uint32_t FindMorphBatchMesh(const uint4* firstGroups, uint32_t batchMeshNum, uint32_t groupIndex)
+{
+    uint32_t first = 0;
+    uint32_t last = batchMeshNum - 1;
+    while (first < last)
+    {
+        uint32_t middle = (first + last + 1) >> 1;
+        if (firstGroups[middle >> 2].pv[middle & 3] <= groupIndex)
+            first = middle;
+        else
+            last = middle - 1;
+    }
+
+    return first;
+}
@@ -8,10 +8,18 @@ distribution of this software and related documentation without an express
 license agreement from NVIDIA CORPORATION is strictly prohibited.
 */
 
+#include <algorithm>
 #include <set>
 #include <map>
 #include <future>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
 #include "VisibilityMasks/OmmHelper.h"
+#include "VisibilityMasks/OmmAhsEstimator.h"
+#include "VisibilityMasks/OmmAlphaBounds.h"
 
 #include "NRIFramework.h"
 
@@ -28,6 +36,8 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
 
 #include "Detex/detex.h"
 #include "Profiler/NriProfiler.hpp"
+#include "Profiler/AllocationTracker.hpp"
+#include "TracePermutations.hpp"
 
 #ifdef _WIN32
     #undef APIENTRY
@@ -40,11 +50,14 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
 
 // NRD mode and other shared settings are here
 #include "../Shaders/Include/Shared.hlsli"
+#include "InstanceDataEncoding.hpp"
+#include "MorphBatching.hpp"
 
 constexpr uint32_t MAX_ANIMATED_INSTANCE_NUM        = 512;
 constexpr auto BLAS_RIGID_MESH_BUILD_BITS           = nri::AccelerationStructureBuildBits::PREFER_FAST_TRACE;
 constexpr auto BLAS_DEFORMABLE_MESH_BUILD_BITS      = nri::AccelerationStructureBuildBits::PREFER_FAST_BUILD | nri::AccelerationStructureBuildBits::ALLOW_UPDATE;
-constexpr auto TLAS_BUILD_BITS                      = nri::AccelerationStructureBuildBits::PREFER_FAST_TRACE;
+constexpr auto TLAS_BUILD_BITS                      = nri::AccelerationStructureBuildBits::PREFER_FAST_TRACE | nri::AccelerationStructureBuildBits::ALLOW_UPDATE;
+constexpr uint32_t TLAS_MAX_REFIT_NUM               = 64; // consecutive refits before a full rebuild restores trace quality
 constexpr float ACCUMULATION_TIME                   = 0.5f; // seconds
 constexpr float NEAR_Z                              = 0.001f; // m
 constexpr float GLASS_THICKNESS                     = 0.002f; // m
@@ -57,6 +70,10 @@ constexpr uint32_t TEXTURES_PER_MATERIAL            = 4;
 constexpr uint32_t MAX_TEXTURE_TRANSITIONS_NUM      = 32;
 constexpr uint32_t DYNAMIC_CONSTANT_BUFFER_SIZE     = 1024 * 1024; // 1MB
 constexpr uint32_t MAX_ANIMATION_HISTORY_FRAME_NUM  = 2;
+constexpr uint32_t OMM_MAX_LOD_NUM                  = 3; // masked blas variants per alpha tested geometry
+constexpr uint32_t OMM_GPU_TUNING_SAMPLE_NUM        = 16; // geometries timed per gpu baker variant
+constexpr uint32_t OMM_CONTEXT_BUFFERED_NUM         = 2; // command buffers per omm context: the next one is recorded while the previous one executes
+constexpr uint32_t OMM_TIMELINE_EVENT_NUM           = 256; // timestamped submissions per queue and lod
 
 //=================================================================================
 // Important tests, sensitive to regressions or just testing base functionality
@@ -331,10 +348,34 @@ struct NRIInterface
     , public nri::HelperInterface
 {};
 
+enum class FrameSection : uint32_t
+{ // recorded into separate command buffers and submitted in this order
+    AccelerationStructures, // morph mesh updates, TLAS
+    Tracing, // tracing, denoising, composition, upscaling
+    Present, // copy to the back buffer, UI
+
+    MAX_NUM
+};
+
+enum class AllocationScope : uint32_t
+{
+    PrepareFrame,
+    RenderFrame,
+    Profiler,
+    TlasBuild,
+
+    // Worker jobs, gathered by the render thread after waiting for them. Section jobs are in "FrameSection" order
+    AccelerationStructuresJob,
+    TracingJob,
+    SubmitJob,
+
+    MAX_NUM
+};
+
 struct Frame
 {
-    nri::CommandAllocator* commandAllocator;
-    nri::CommandBuffer* commandBuffer;
+    std::array<nri::CommandAllocator*, (uint32_t)FrameSection::MAX_NUM> commandAllocators; // allocators can't be shared between recording threads
+    std::array<nri::CommandBuffer*, (uint32_t)FrameSection::MAX_NUM> commandBuffers;
     nri::Descriptor* globalConstantBufferDescriptor;
     nri::DescriptorSet* globalConstantBufferDescriptorSet;
     uint64_t globalConstantBufferOffset;
@@ -458,6 +499,150 @@ struct AnimatedInstance
     }
 };
 
+enum class TlasBuildAction : uint32_t
+{
+    Skip,
+    Update,
+    Rebuild,
+
+    MAX_NUM
+};
+
+struct TlasInstanceHash
+{ // accumulated while TLAS instances are written to the staging buffer
+    uint64_t topology = 14695981039346656037ull; // instance set, masks, flags and BLAS handles
+    uint64_t transform = 14695981039346656037ull; // world space: camera relative translations would change with every camera move
+    uint64_t blasBuild = 14695981039346656037ull; // BLASes are rebuilt in place (morph meshes, masked geometry in reused heaps)
+    uint64_t origin = 0; // camera relative origin, shifts all instances at once
+
+    inline void Add(const nri::GeometryObjectInstance& instance, uint64_t blasBuildId, const float4x4& objectToWorldRotation, const double3& position)
+    {
+        const uint64_t fields[] = { instance.instanceId, instance.mask, instance.shaderBindingTableLocalOffset, (uint64_t)instance.flags, instance.accelerationStructureHandle };
+        topology = Hash(topology, fields, sizeof(fields));
+        transform = Hash(transform, objectToWorldRotation.a16, sizeof(float) * 12);
+        transform = Hash(transform, &position, sizeof(position));
+        blasBuild = Hash(blasBuild, &blasBuildId, sizeof(blasBuildId));
+    }
+
+    inline void SetOrigin(const double3& cameraRelativeOrigin)
+    {
+        origin = Hash(14695981039346656037ull, &cameraRelativeOrigin, sizeof(cameraRelativeOrigin));
+    }
+
+    static inline uint64_t Hash(uint64_t hash, const void* data, size_t size)
+    {
+        const uint8_t* p = (const uint8_t*)data;
+        while (size--)
+            hash = (hash ^ (*p++)) * 1099511628211ull;
+        return hash;
+    }
+};
+
+struct TlasState
+{
+    uint64_t topologyHash = 0;
+    uint64_t transformHash = 0;
+    uint64_t blasBuildHash = 0;
+    uint64_t originHash = 0;
+    uint32_t refitNum = 0; // a pure origin shift doesn't degrade the tree and isn't counted
+    bool isBuilt = false;
+
+    // stats
+    uint32_t actionNum[(uint32_t)TlasBuildAction::MAX_NUM] = {};
+    double savedMs = 0.0; // estimated vs. rebuilding every frame
+};
+
+struct MorphUpdateStats
+{ // command stream of the last morph mesh update
+    uint32_t meshNum;
+    uint32_t dispatchNum;
+    uint32_t barrierNum;
+    uint32_t blasBuildNum;
+};
+
+struct FrameRecordingDesc
+{ // render side snapshot, taken by RenderFrame before the sections are recorded. PrepareFrame keeps updating the live state
+    Settings settings;
+    nrd::RelaxDiffuseSpecularSettings relaxSettings;
+    nrd::ReblurSettings reblurSettings;
+    nrd::ReferenceSettings referenceSettings;
+    nrd::CommonSettings commonSettings;
+    NrdUserPool userPool;
+    std::chrono::high_resolution_clock::time_point updateBegin; // PrepareFrame start, input is sampled right before
+    float2 viewportJitter;
+    uint32_t rectW;
+    uint32_t rectH;
+    uint32_t rectGridW;
+    uint32_t rectGridH;
+    uint32_t windowGridW;
+    uint32_t windowGridH;
+    bool forceHistoryReset;
+    bool resolve;
+    bool showValidation;
+    bool useShaderPermutations;
+};
+
+class FrameWorker
+{ // persistent thread running one job per posted frame, so frames don't create threads
+public:
+    template<typename Job> void Start(Job job)
+    {
+        m_Thread = std::thread([this, job]()
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            while (true)
+            {
+                m_Condition.wait(lock, [this]() { return m_PendingFrame != 0 || m_IsExiting; });
+                if (!m_PendingFrame)
+                    return;
+
+                uint32_t frameIndex = m_PendingFrame - 1;
+                lock.unlock();
+                job(frameIndex);
+                lock.lock();
+
+                m_PendingFrame = 0;
+                m_Condition.notify_all();
+            }
+        });
+    }
+
+    void Post(uint32_t frameIndex)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_PendingFrame = frameIndex + 1;
+        }
+        m_Condition.notify_all();
+    }
+
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Condition.wait(lock, [this]() { return m_PendingFrame == 0; });
+    }
+
+    void Stop()
+    { // a posted frame is finished first
+        if (!m_Thread.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_IsExiting = true;
+        }
+        m_Condition.notify_all();
+        m_Thread.join();
+    }
+
+private:
+    std::thread m_Thread;
+    std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+    uint32_t m_PendingFrame = 0; // 1 + index of the posted frame, 0: idle
+    bool m_IsExiting = false;
+};
+
 class DynamicConstantBufferAllocator
 {
 public:
@@ -521,6 +706,10 @@ struct AlphaTestedGeometry
 
     std::vector<uint8_t> indexData;
     std::vector<uint8_t> uvData;
+    std::vector<uint8_t> serializedOmmArray; // from the OMM array cache, alive until the build is finished
+    nri::Buffer* stagingBuffers[(uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum]; // cpu side baker output, copied to the build inputs on the copy queue
+    std::vector<uint8_t> retainedOmmData[(uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum]; // bake output kept for the AHS estimator
+    uint32_t retainedOmmIndexStride;
 
     uint64_t positionBufferSize;
     uint64_t positionOffset;
@@ -531,6 +720,8 @@ struct AlphaTestedGeometry
 
     uint32_t meshIndex;
     uint32_t materialIndex;
+    uint32_t mipOffset; // planned by the last FillOmmBakerInputs, clamped to the resident mips
+    uint32_t missingMipNum; // requested mips that weren't resident, part of the cache key
 
     const nri::Format vertexFormat = nri::Format::RGB32_SFLOAT;
     const nri::Format uvFormat = nri::Format::RG32_SFLOAT;
@@ -545,12 +736,165 @@ struct OmmGpuBakerPrebuildMemoryStats
     size_t maxTransientBufferSizes[OMM_MAX_TRANSIENT_POOL_BUFFERS];
 };
 
+struct OmmGeometryTable
+{ // Hot fields of the alpha tested geometries as structure of arrays, by geometry id. Planning and scheduling passes read only these,
+  // bake and build descriptors stay in AlphaTestedGeometry
+    std::vector<uint64_t> instanceHashes; // cache keys, see GetOmmCacheHash
+    std::vector<uint32_t> primitiveNums;
+    std::vector<uint64_t> dataSizes[(uint32_t)ommhelper::OmmDataLayout::GpuOutputNum]; // gpu baker outputs, 0 unless queued
+    std::vector<uint64_t> transientBufferSizes[OMM_MAX_TRANSIENT_POOL_BUFFERS];
+    std::vector<uint32_t> queue; // geometry ids of the current gpu bake pass, ascending
+
+    size_t GetSize() const { return instanceHashes.size(); };
+
+    void Resize(size_t geometryNum)
+    {
+        instanceHashes.resize(geometryNum);
+        primitiveNums.resize(geometryNum);
+        for (std::vector<uint64_t>& sizes : dataSizes)
+            sizes.assign(geometryNum, 0);
+        for (std::vector<uint64_t>& sizes : transientBufferSizes)
+            sizes.assign(geometryNum, 0);
+        queue.clear();
+    }
+
+    void SetQueue(const std::vector<uint32_t>& ids)
+    {
+        ClearQueue();
+        queue = ids;
+    }
+
+    void ClearQueue()
+    { // sizes are reset for the queued geometries only
+        for (uint32_t id : queue)
+        {
+            for (std::vector<uint64_t>& sizes : dataSizes)
+                sizes[id] = 0;
+            for (std::vector<uint64_t>& sizes : transientBufferSizes)
+                sizes[id] = 0;
+        }
+        queue.clear();
+    }
+};
+
 struct OmmBatch
 {
     size_t offset;
     size_t count;
 };
 
+enum class OmmBatchRecordChunk : uint32_t
+{ // Batch records share the mask cache format, one chunk per slot
+    Entries,
+    Histograms, // in the API format
+    GpuData, // blas build inputs of the whole batch, uploaded as is
+    MaxNum,
+};
+
+struct OmmBatchRecordEntry
+{ // Geometries without OMMs keep zero sizes
+    uint64_t instanceHash;
+    uint64_t offsets[(uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum]; // in the gpu data chunk, storage buffer offset aligned
+    uint64_t sizes[(uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum];
+    uint64_t histogramOffsets[2]; // [desc array, index] in the histogram chunk
+    uint64_t histogramSizes[2];
+    uint32_t histogramNums[2];
+    uint32_t ommIndexFormat;
+    uint32_t ommIndexStride;
+};
+
+struct OmmBatchRecord
+{ // Warm start of a whole batch: one read and one copy instead of per geometry buffers
+    std::vector<OmmBatchRecordEntry> entries;
+    std::vector<uint8_t> histograms;
+    uint64_t gpuDataSize;
+    bool isValid;
+};
+
+struct OmmBuildTarget
+{ // Where the blasses of a bake pass go. Carried by the pass and its pending builds, nothing of it is shared with other threads
+    uint32_t lod;
+    uint32_t generation; // memory generation: the full rebuild, or the re-bake pass
+    bool isRebake; // replaces variants already bound, see m_ReplacedMaskedBlasses
+};
+
+struct OmmPendingBuild
+{ // Blas build in flight on the bake context, finished before the context is reused
+    OmmBatch batch;
+    OmmBuildTarget target;
+    OmmBatchRecord record; // histograms referenced by the build queue
+    std::vector<ommhelper::MaskedGeometryBuildDesc*> buildQueue;
+    size_t buildInputBufferNum; // leading entries of m_OmmBuildInputBuffers and m_OmmTmpAllocations owned by the build
+    size_t tmpAllocationNum;
+    bool isActive;
+};
+
+enum class OmmTimelineSection : uint32_t
+{ // timestamped OMM submissions, shown in the profiler as "OMM GPU: <name>"
+    Setup, // bake context
+    Bake,
+    Build,
+    Serialize,
+    Readback, // copy context
+    Upload,
+
+    MAX_NUM
+};
+
+constexpr const char* OMM_TIMELINE_SECTION_NAMES[] = { "setup", "bake", "build", "serialize", "readback", "upload" };
+static_assert(sizeof(OMM_TIMELINE_SECTION_NAMES) / sizeof(OMM_TIMELINE_SECTION_NAMES[0]) == (uint32_t)OmmTimelineSection::MAX_NUM, "OMM_TIMELINE_SECTION_NAMES mismatch");
+
+struct OmmTimelineEvent
+{
+    OmmTimelineSection section;
+    uint32_t queryOffset; // [begin, end] timestamps in the pool of the queue
+};
+
+struct OmmTimelineStats
+{ // GPU busy time of the bakes finished since the profiler last took them
+    double sectionTimeMs[(uint32_t)OmmTimelineSection::MAX_NUM];
+    double copyOverlapTimeMs;
+    bool hasCopyTimestamps; // D3D12 copy queues have none, see OmmNriContext::Init
+};
+
+struct OmmCpuAlphaTexture
+{ // Alpha planes of the baked mip range. Lives from the first to the last cache miss baking from it
+    std::vector<uint8_t> data;
+    size_t mipDataOffsets[OMM_MAX_MIP_NUM];
+    uint32_t mipOffset;
+    uint32_t mipNum;
+    uint32_t cpuNodeId;
+    uint32_t pendingGeometryNum;
+};
+
+struct OmmRebakeStats
+{ // Targeted re-bakes driven by texture residency events, since startup and of the last re-bake pass
+    uint32_t eventNum;
+    uint32_t geometryNum[2]; // [total, last pass]
+    uint64_t primitiveNum[2];
+    double passTimeMs; // last pass, bake and build of all LODs
+    double latencyMs[2]; // residency event to swap in, last pass [average, max]
+};
+
+struct OmmGpuBakerTuning
+{ // Gpu baker knobs picked by timing a sample of the scene, persisted per device and scene
+    uint64_t scratchMemoryBudget; // BakerScratchMemoryBudget
+    uint64_t memorySize; // baker buffers of the sample
+    double bakeTimeMs; // setup and bake passes of the sample, gpu timestamps. 0: no variant fits the memory budget
+    uint32_t computeOnlyWorkload;
+    uint32_t sampleGeometryNum;
+    uint32_t variantNum; // measured
+};
+
+struct OmmAhsEstimate
+{
+    std::string label;
+    ommhelper::OmmAhsStats stats;
+    uint64_t stateHash; // bake configuration
+    uint32_t cameraNum;
+    uint32_t ommGeometryNum; // geometries with OMM data, the rest always invokes any-hit
+};
+
 class Sample : public SampleBase
 {
 public:
@@ -569,7 +913,21 @@ public:
         cmdLine.add("ommDebugMode", 0, "enable omm-bake Nsight debug mode");
         cmdLine.add("disableOmmBlasBuild", 0, "disable masked geometry building. Baking only");
         cmdLine.add("enableOmmCache", 0, "enable omm init from cache");
+        cmdLine.add("enableOmmBatchRecords", 0, "cache upload ready batch records for one-copy warm starts");
+        cmdLine.add("ommGpuTimeline", 0, "print every timestamped OMM submission of the bake, build and copy queues");
         cmdLine.add<uint32_t>("ommBuildPostponeFrameId", 0, "build OMM on desired frameId", false, 0);
+        cmdLine.add("ommCpuNumaPlacement", 0, "pin cpu baker threads and alpha data to NUMA nodes");
+        cmdLine.add<uint32_t>("ommCpuSplitWorkLog2", 0, "bake cpu geometries above 2^N micro-triangles as parallel triangle-range chunks. 0: split rejected workloads only", false, 0, cmdline::range(0u, 40u));
+        cmdLine.add<std::string>("ommBakeServer", 0, "bake cpu OMMs on a local bake server listening on this socket", false, "");
+        cmdLine.add("assertNoFrameAllocations", 0, "abort on heap allocations in steady state frames");
+        cmdLine.add<uint32_t>("ommPrepareThreadNum", 0, "threads preparing masked geometry builds. 0: all logical cpus", false, 0);
+        cmdLine.add<uint32_t>("ommPlanningBenchmark", 0, "time gpu bake planning passes on N synthetic geometries at startup", false, 0);
+        cmdLine.add<uint32_t>("ommMipStreamingFrames", 0, "simulate alpha texture streaming from the coarsest mip, a finer mip every N frames. Drives OMM re-bakes", false, 0);
+        cmdLine.add("pipelinedUpdate", 0, "prepare the next frame while the current one is recorded and submitted");
+        cmdLine.add<uint32_t>("frameLatencyReport", 0, "print cpu frame time and input latency averaged over N frames", false, 0);
+        cmdLine.add("perMeshMorphUpdate", 0, "update morph meshes with one dispatch per mesh instead of batched dispatches");
+        cmdLine.add("morphUpdateReport", 0, "print dispatch, barrier and BLAS build counts of the morph mesh update when they change");
+        cmdLine.add("disableShaderPermutations", 0, "use the generic trace shaders, which branch on frame uniform flags");
     }
 
     void ReadCmdLine(cmdline::parser& cmdLine) override
@@ -579,6 +937,20 @@ public:
         m_OmmBakeDesc.buildFrameId = cmdLine.get<uint32_t>("ommBuildPostponeFrameId");
         m_DisableOmmBlasBuild = cmdLine.exist("disableOmmBlasBuild");
         m_OmmBakeDesc.enableCache = cmdLine.exist("enableOmmCache");
+        m_OmmUseBatchRecords = cmdLine.exist("enableOmmBatchRecords");
+        m_OmmPrintGpuTimeline = cmdLine.exist("ommGpuTimeline");
+        m_OmmBakeDesc.cpuFlags.enableNumaPlacement = cmdLine.exist("ommCpuNumaPlacement");
+        m_OmmBakeDesc.cpuFlags.splitWorkLog2 = cmdLine.get<uint32_t>("ommCpuSplitWorkLog2");
+        m_OmmBakeServerSocket = cmdLine.get<std::string>("ommBakeServer");
+        m_AllocationTracker.assertNoAllocations = cmdLine.exist("assertNoFrameAllocations");
+        m_OmmPlanningBenchmarkGeometryNum = cmdLine.get<uint32_t>("ommPlanningBenchmark");
+        m_OmmMipStreamingFrames = cmdLine.get<uint32_t>("ommMipStreamingFrames");
+        m_OmmPrepareThreadNum = cmdLine.get<uint32_t>("ommPrepareThreadNum");
+        m_EnablePipelinedUpdate = cmdLine.exist("pipelinedUpdate");
+        m_FrameLatencyReportFrameNum = cmdLine.get<uint32_t>("frameLatencyReport");
+        m_EnableBatchedMorphUpdate = !cmdLine.exist("perMeshMorphUpdate");
+        m_MorphUpdateReport = cmdLine.exist("morphUpdateReport");
+        m_EnableShaderPermutations = !cmdLine.exist("disableShaderPermutations");
     }
 
     bool Initialize(nri::GraphicsAPI graphicsAPI) override;
@@ -600,6 +972,15 @@ public:
     inline nri::Pipeline*& Get(Pipeline index)
     { return m_Pipelines[(uint32_t)index]; }
 
+    inline nri::Pipeline* GetTracePipeline(TracePass pass, Pipeline generic, const FrameRecordingDesc& desc)
+    {
+        if (!desc.useShaderPermutations)
+            return Get(generic);
+
+        TracePermutationKey key = TracePermutationKey::Make(pass, desc.settings.ahsDynamicMipSelection, desc.settings.highLightAhs);
+        return m_TracePermutations.Find(pass, key, Get(generic));
+    }
+
     inline nri::Descriptor*& Get(Descriptor index)
     { return m_Descriptors[(uint32_t)index]; }
 
@@ -628,7 +1009,15 @@ public:
     void UploadStaticData();
     void UpdateConstantBuffer(uint32_t frameIndex, uint32_t maxAccumulatedFrameNum);
     void RestoreBindings(nri::CommandBuffer& commandBuffer, const Frame& frame);
-    void BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex);
+    void StartFrameWorkers();
+    void StopFrameWorkers();
+    void RecordFrameSection(FrameSection section, uint32_t frameIndex);
+    void SubmitFrame(uint32_t frameIndex);
+    void RecordAccelerationStructureUpdates(nri::CommandBuffer& commandBuffer, ProfilerContext* profilerContext, uint32_t frameIndex);
+    void RecordTracingAndPost(nri::CommandBuffer& commandBuffer, ProfilerContext* profilerContext, uint32_t frameIndex);
+    void RecordPresent(nri::CommandBuffer& commandBuffer);
+    void BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex, ProfilerContext* profilerContext);
+    TlasBuildAction ChooseTlasBuildAction(TlasState& state, const TlasInstanceHash& hash);
     uint32_t BuildOptimizedTransitions(const TextureState* states, uint32_t stateNum, std::array<nri::TextureTransitionBarrierDesc, MAX_TEXTURE_TRANSITIONS_NUM>& transitions);
 
     void GenerateGeometry(utils::Scene& scene);
@@ -649,6 +1038,19 @@ public:
     inline float GetDenoisingRange() const
     { return 4.0f * m_Scene.aabb.GetRadius(); }
 
+    inline const std::string& GetTestsPath()
+    { // resolved once, the tests UI runs every frame
+        if (m_TestsPath.empty())
+        {
+            std::string sceneName = std::string(utils::GetFileName(m_SceneFile));
+            size_t dotPos = sceneName.find_last_of(".");
+            if (dotPos != std::string::npos)
+                sceneName = sceneName.substr(0, dotPos) + ".bin";
+            m_TestsPath = utils::GetFullPath(sceneName, utils::DataFolder::TESTS);
+        }
+        return m_TestsPath;
+    }
+
     inline nrd::ReblurSettings GetDefaultReblurSettings() const
     {
         nrd::ReblurSettings defaults = {};
@@ -666,12 +1068,25 @@ private:
     NRIInterface NRI = {};
     utils::Scene m_Scene;
     nri::Device* m_Device = nullptr;
+    nri::AdapterDesc m_AdapterDesc = {};
     nri::SwapChain* m_SwapChain = nullptr;
     nri::CommandQueue* m_CommandQueue = nullptr;
     nri::Fence* m_FrameFence;
+    std::atomic<uint32_t> m_StartedFrameIndex = 0; // the latest frame passed to RenderFrame, see WaitForMaskedGeometrySwap
     nri::DescriptorPool* m_DescriptorPool = nullptr;
     nri::PipelineLayout* m_PipelineLayout = nullptr;
     std::array<Frame, BUFFERED_FRAME_MAX_NUM> m_Frames = {};
+    std::array<FrameWorker, (uint32_t)FrameSection::Present> m_FrameSectionWorkers; // sections before "Present", which is recorded by the render thread
+    FrameWorker m_FrameSubmitWorker; // pipelined update: submits while the next frame is prepared
+    std::array<ProfilerContext*, (uint32_t)FrameSection::MAX_NUM> m_FrameSectionProfilerContexts = {};
+    std::array<double, (uint32_t)FrameSection::MAX_NUM> m_FrameSectionRecordingTimeMs = {};
+    FrameRecordingDesc m_FrameRecordingDesc = {};
+    std::chrono::high_resolution_clock::time_point m_UpdateBegin;
+    std::chrono::high_resolution_clock::time_point m_FrameRecordingBegin;
+    double m_FrameRecordingTimeMs = 0.0;
+    double m_MainThreadTimeMs = 0.0;
+    double m_InputToPresentTimeMs = 0.0; // cpu side: PrepareFrame start to the present call
+    uint32_t m_FrameLatencyReportFrameNum = 0;
 
     DynamicConstantBufferAllocator m_DynamicConstantBufferAllocator = {};
     nri::Descriptor* m_MorphTargetPoseConstantBufferView = nullptr;
@@ -686,9 +1101,15 @@ private:
     std::vector<nri::DescriptorSet*> m_DescriptorSets;
     std::vector<nri::Pipeline*> m_Pipelines;
     std::vector<nri::AccelerationStructure*> m_AccelerationStructures;
+    std::vector<uint64_t> m_BlasBuildIds; // parallel to m_AccelerationStructures, bumped by every in-place rebuild
     std::vector<BackBuffer> m_SwapChainBuffers;
     std::vector<AnimatedInstance> m_AnimatedInstances;
     std::array<float, 256> m_FrameTimes = {};
+    std::array<TlasState, 2> m_TlasStates = {}; // TLAS_World, TLAS_Emissive
+    MorphUpdateStats m_MorphUpdateStats = {};
+    TracePermutationCache<nri::Pipeline*> m_TracePermutations;
+    double m_TracePermutationCreationTimeMs = 0.0;
+    uint32_t m_TracePermutationNum = 0;
     nrd::RelaxDiffuseSpecularSettings m_RelaxSettings = {};
     nrd::ReblurSettings m_ReblurSettings = {};
     nrd::ReferenceSettings m_ReferenceSettings = {};
@@ -701,10 +1122,13 @@ private:
     uint2 m_RenderResolution = {};
     uint64_t m_ConstantBufferSize = 0;
     uint64_t m_MorphMeshScratchSize = 0;
+    uint64_t m_InstanceDataUploadBytes = 0;
     uint32_t m_OpaqueObjectsNum = 0;
     uint32_t m_TransparentObjectsNum = 0;
     uint32_t m_EmissiveObjectsNum = 0;
     uint32_t m_ProxyInstancesNum = 0;
+    uint32_t m_InstanceRecordMaxNum = 0;
+    uint32_t m_StaticInstanceRecordNum = 0;
     uint32_t m_LastSelectedTest = uint32_t(-1);
     uint32_t m_TestNum = uint32_t(-1);
     int32_t m_DlssQuality = int32_t(-1);
@@ -720,6 +1144,13 @@ private:
     bool m_ShowValidationOverlay = true;
     bool m_PositiveZ = true;
     bool m_ReversedZ = false;
+    bool m_EnableTlasUpdatePolicy = true;
+    bool m_IsStaticInstanceDataUploaded = false;
+    bool m_EnableParallelRecording = true;
+    bool m_EnablePipelinedUpdate = false;
+    bool m_EnableBatchedMorphUpdate = true;
+    bool m_EnableShaderPermutations = true;
+    bool m_MorphUpdateReport = false;
 
     float4 m_HairBaseColorOverride = float4(0.227f, 0.130f, 0.035f, 1.0f);
     float2 m_HairBetasOverride = float2(0.25f, 0.6f);
@@ -729,30 +1160,89 @@ private: //OMM:
     struct OmmNriContext;
 
     void InitAlphaTestedGeometry();
+    void RunOmmPlanningBenchmark(uint32_t geometryNum);
 
     void RebuildOmmGeometry();
-    void RebuildOmmGeometryAsync(uint32_t const* frameId);
-    void OmmGeometryUpdate(OmmNriContext& context, bool doBatching);
-
-    void FillOmmBakerInputs();
-    void FillOmmBlasBuildQueue(const OmmBatch& batch, std::vector<ommhelper::MaskedGeometryBuildDesc*>& outBuildQueue);
-
-    void RunOmmSetupPass(OmmNriContext& context, ommhelper::OmmBakeGeometryDesc** queue, size_t count, OmmGpuBakerPrebuildMemoryStats& memoryStats);
-    void BakeOmmGpu(OmmNriContext& context, std::vector<ommhelper::OmmBakeGeometryDesc*>& batch);
-    OmmGpuBakerPrebuildMemoryStats GetGpuBakerPrebuildMemoryStats(bool printStats);
+    void RebuildOmmGeometryAsync(ommhelper::OmmBakeDesc bakeDesc);
+    void WaitForMaskedGeometrySwap();
+    void RebakeOmmGeometryAsync(ommhelper::OmmBakeDesc bakeDesc, std::map<uint32_t, std::chrono::high_resolution_clock::time_point> rebakes);
+    uint32_t OmmGeometryUpdate(OmmNriContext& context, const ommhelper::OmmBakeDesc& bakeDesc, bool doBatching);
+    void BakeOmmLod(OmmNriContext& context, const ommhelper::OmmBakeDesc& bakeDesc, const OmmBuildTarget& target, bool doBatching, const std::vector<uint32_t>& geometryIds = {});
+
+    void OnOmmTextureMipResident(uint32_t textureIndex, uint32_t mip);
+    void StepOmmMipStreaming(uint32_t frameId);
+    std::map<uint32_t, std::chrono::high_resolution_clock::time_point> QueueOmmRebakes();
+    uint32_t GetOmmTextureMipOffset(const ommhelper::OmmBakeDesc& bakeDesc, uint32_t textureIndex, const std::vector<uint8_t>& residentMips, uint32_t& outMissingMipNum);
+
+    void FillOmmBakerInputs(const ommhelper::OmmBakeDesc& bakeDesc, const std::vector<uint32_t>& geometryIds = {});
+    void AcquireOmmCpuAlphaTextures(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch, const std::vector<ommhelper::OmmBakeGeometryDesc*>& bakeQueue);
+    void ReleaseOmmCpuAlphaTextures(const OmmBatch& batch, const std::vector<ommhelper::OmmBakeGeometryDesc*>& bakeQueue);
+    void BakeOmmCpuFromAlphaBounds(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch, const std::vector<ommhelper::OmmBakeGeometryDesc*>& bakeQueue);
+    bool IsOmmAlphaBoundsAvailable(const ommhelper::OmmBakeDesc& bakeDesc, const AlphaTestedGeometry& geometry, uint64_t boundsStateHash);
+    bool ReadOmmAlphaBoundsFromCache(uint64_t hash, uint64_t boundsStateHash, ommhelper::OmmAlphaBounds& outBounds);
+    void ReleaseStaleOmmAlphaBounds(const ommhelper::OmmBakeDesc& bakeDesc);
+    void FillOmmBlasGeometryInputs(AlphaTestedGeometry& geometry);
+    void FillOmmArraySerializationInputs(AlphaTestedGeometry& geometry);
+    uint64_t FillOmmBlasBuildQueue(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch, std::vector<ommhelper::MaskedGeometryBuildDesc*>& outBuildQueue);
+    uint64_t FillOmmBlasBuildQueueFromRecord(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch, const OmmBatchRecord& record, std::vector<ommhelper::MaskedGeometryBuildDesc*>& outBuildQueue);
+    void FinishOmmBlasBuild(OmmNriContext& context, const ommhelper::OmmBakeDesc& bakeDesc, OmmPendingBuild& build);
+    void FinishOmmGpuReadback(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch);
+    void ReleaseOmmBakeOutputs(const OmmBatch& batch, uint32_t lod);
+    void WaitForOmmCopies();
+    void InitOmmTimeline();
+    void BeginOmmTimeline(OmmNriContext& context);
+    void PrintOmmTimeline(OmmNriContext& context);
+    void UpdateOmmTimelineEvents();
+
+    void RunOmmSetupPass(OmmNriContext& context, const ommhelper::OmmBakeDesc& bakeDesc, ommhelper::OmmBakeGeometryDesc** queue, size_t count, OmmGpuBakerPrebuildMemoryStats& memoryStats);
+    void RecordOmmGpuBakerPass(OmmNriContext& context, const ommhelper::OmmBakeDesc& bakeDesc, ommhelper::OmmBakeGeometryDesc** queue, size_t count, ommhelper::OmmGpuBakerPass pass);
+    void TuneOmmGpuBaker(OmmNriContext& context, ommhelper::OmmBakeDesc& bakeDesc, bool allowRaster);
+    double TimeOmmGpuBakerVariant(OmmNriContext& context, const ommhelper::OmmBakeDesc& bakeDesc, const std::vector<uint32_t>& queueIds, uint64_t& outMemorySize);
+    void ApplyOmmGpuBakerTuning();
+    void BakeOmmGpu(OmmNriContext& context, const ommhelper::OmmBakeDesc& bakeDesc, std::vector<ommhelper::OmmBakeGeometryDesc*>& batch);
+    void PrepareOmmGpuBakerTextures(OmmNriContext& context, const std::vector<ommhelper::OmmBakeGeometryDesc*>& queue);
+    OmmGpuBakerPrebuildMemoryStats GetGpuBakerPrebuildMemoryStats(const ommhelper::OmmBakeDesc& bakeDesc, bool printStats);
+    void GatherOmmGpuBakerSizes();
+    std::vector<ommhelper::OmmBakeGeometryDesc*> QueueOmmGpuBake(const std::vector<uint32_t>& ids);
 
     void CreateAndBindGpuBakerSatitcBuffers(const OmmGpuBakerPrebuildMemoryStats& memoryStats);
     void CreateAndBindGpuBakerArrayDataBuffer(const OmmGpuBakerPrebuildMemoryStats& memoryStats);
     void CreateAndBindGpuBakerReadbackBuffer(const OmmGpuBakerPrebuildMemoryStats& memoryStats);
 
     inline uint64_t GetInstanceHash(uint32_t meshId, uint32_t materialId) { return uint64_t(meshId) << 32 | uint64_t(materialId); };
+    inline uint64_t GetOmmCacheHash(const AlphaTestedGeometry& geometry)
+    { // Bakes from partially resident textures never alias the ones from the requested mips
+        uint64_t hash = GetInstanceHash(geometry.meshIndex, geometry.materialIndex);
+        return geometry.missingMipNum ? hash ^ (uint64_t(geometry.missingMipNum) << 56) : hash;
+    };
     inline std::string GetOmmCacheFilename() { return m_OmmCacheFolderName + std::string("/") + m_SceneName; };
-    void InitializeOmmGeometryFromCache(const OmmBatch& batch, std::vector<ommhelper::OmmBakeGeometryDesc*>& outBakeQueue);
-    void SaveMaskCache(const OmmBatch& batch);
-
-    nri::AccelerationStructure* GetMaskedBlas(uint64_t insatanceMask);
+    inline std::string GetOmmArrayCacheFilename() { return GetOmmCacheFilename() + std::string(".ommarrays"); };
+    void SaveOmmArrayCache(const OmmBatch& batch);
+    inline std::string GetOmmBatchRecordFilename() { return GetOmmCacheFilename() + std::string(".ommbatches"); };
+    inline std::string GetOmmAlphaBoundsFilename() { return GetOmmCacheFilename() + std::string(".ommbounds"); };
+    inline std::string GetOmmGpuTuningFilename() { return GetOmmCacheFilename() + std::string(".ommtuning"); };
+    uint64_t GetOmmGpuTuningStateHash(const ommhelper::OmmBakeDesc& bakeDesc, bool allowRaster);
+    uint64_t GetOmmBatchRecordStateHash(const ommhelper::OmmBakeDesc& bakeDesc);
+    uint64_t GetOmmBatchHash(const OmmBatch& batch);
+    bool ReadOmmBatchRecord(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch, OmmBatchRecord& outRecord);
+    bool IsOmmBatchRecordEntryValid(const OmmBatchRecordEntry& entry, const OmmBatchRecord& record);
+    void SaveOmmBatchRecord(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch);
+
+    void BuildOmmAhsEstimatorScene();
+    uint32_t SetOmmAhsEstimatorData(const ommhelper::OmmBakeDesc& bakeDesc);
+    void GenerateOmmAhsEstimatorRays(std::vector<ommhelper::OmmAhsRay>& outRays);
+    void EstimateOmmAnyHitSavings();
+    OmmAhsEstimate EstimateOmmAnyHitSavingsAsync(std::vector<std::vector<ommhelper::OmmAhsRay>> rays, std::vector<float3> sunDirections, ommhelper::OmmBakeDesc bakeDesc);
+    bool UpdateOmmAhsEstimate();
+    void InitializeOmmGeometryFromCache(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch, std::vector<ommhelper::OmmBakeGeometryDesc*>& outBakeQueue);
+    void SaveMaskCache(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch);
+
+    nri::AccelerationStructure* GetMaskedBlas(uint64_t insatanceMask, uint32_t lod, uint64_t& outBuildId);
+    uint32_t UpdateOmmInstanceLod(size_t instanceIndex, const utils::Instance& instance, const utils::Mesh& mesh);
 
     void ReleaseMaskedGeometry();
+    void ReleaseRetiredMaskedGeometry(uint32_t generation);
+    std::set<uint32_t> GetOmmRetiredGenerations(uint32_t generation);
     void ReleaseBakingResources();
 
     void AppendOmmImguiSettings();
@@ -760,49 +1250,136 @@ private: //OMM:
 private:
     struct OmmNriContext
     {
-        void Init(const NRIInterface& NRI, nri::Device* device, nri::CommandQueueType type);
+        void Init(const NRIInterface& NRI, nri::Device* device, nri::CommandQueueType type, const char* name);
         void Destroy(const NRIInterface& NRI);
-
-        nri::CommandAllocator* commandAllocator;
-        nri::CommandBuffer* commandBuffer;
+        void BeginRecording(const NRIInterface& NRI);
+        uint64_t Submit(const NRIInterface& NRI, nri::Fence* waitFence = nullptr, uint64_t waitValue = 0);
+        void Wait(const NRIInterface& NRI) { NRI.Wait(*fence, fenceValue); };
+        uint32_t BeginEvent(const NRIInterface& NRI, OmmTimelineSection section);
+        void EndEvent(const NRIInterface& NRI, uint32_t eventId);
+
+        nri::CommandAllocator* commandAllocators[OMM_CONTEXT_BUFFERED_NUM];
+        nri::CommandBuffer* commandBuffers[OMM_CONTEXT_BUFFERED_NUM];
+        uint64_t submittedFenceValues[OMM_CONTEXT_BUFFERED_NUM] = {};
+        uint32_t bufferId = 0;
+        nri::CommandBuffer* commandBuffer; // being recorded
         nri::CommandQueue* commandQueue;
         nri::Fence* fence;
         uint64_t fenceValue = 0;
+
+        const char* queueName;
+        nri::QueryPool* timestampPool = nullptr; // null if the queue can't write timestamps
+        std::vector<OmmTimelineEvent> events; // since the last BeginOmmTimeline()
+        bool isTimelineActive = false;
     };
     ommhelper::OpacityMicroMapsHelper m_OmmHelper = {};
 
     //preprocessed alpha geometry from the scene:
-    std::vector<AlphaTestedGeometry> m_OmmAlphaGeometry;
+    std::vector<AlphaTestedGeometry> m_OmmAlphaGeometry; // cold store, by geometry id
+    OmmGeometryTable m_OmmGeometryTable;
     std::vector<nri::Memory*> m_OmmAlphaGeometryMemories;
     std::vector<nri::Buffer*> m_OmmAlphaGeometryBuffers;
 
     //temporal resources for baking
-    std::vector<uint8_t> m_OmmRawAlphaChannelForCpuBaker;
+    std::map<uint32_t, OmmCpuAlphaTexture> m_OmmCpuAlphaTextures; // by scene texture index
+    uint64_t m_OmmCpuAlphaDataSizes[2] = {}; // [resident, peak]
+    uint32_t m_OmmCpuAlphaDecodedTextureNum = 0;
+    double m_OmmCpuBakeTimeMs[2] = {}; // last measured [unpinned, pinned]
+    double m_OmmGpuBakeTimeMs[2] = {}; // last measured [material textures, alpha proxies]
+    uint64_t m_OmmGpuTextureSizes[2] = {}; // mips sampled by the gpu baker [material textures, alpha proxies]
+    std::map<uint32_t, nri::Texture*> m_OmmAlphaProxyTextures; // by scene texture index, R8 copies of the baked mip
+    bool m_OmmUseAlphaProxies = false;
+    OmmGpuBakerTuning m_OmmGpuBakerTuning = {}; // last applied, ui thread
+    OmmGpuBakerTuning m_PendingOmmGpuBakerTuning = {}; // written by the bake that tuned, applied to m_OmmBakeDesc once it's done
+    bool m_IsOmmGpuBakerTuningPending = false;
+    nri::QueryPool* m_OmmTimestampPool = nullptr; // alive while the gpu baker is being tuned, [setup begin, setup end, bake begin, bake end]
+    nri::Buffer* m_OmmTimestampBuffer = nullptr;
+    uint32_t m_OmmGpuTuningMemoryBudgetMb = 1024; // baker buffers of the sample
+    bool m_OmmAutoTuneGpuBaker = false;
+    uint64_t m_OmmCpuBakePrimitiveNum[2] = {};
+    std::map<uint32_t, double> m_OmmBuildPrepareTimeMs; // last measured by prepare thread count: build queue filling and prebuild queries
+    uint32_t m_OmmPrepareThreadNum = 0; // 0: all logical cpus
+    std::map<std::pair<uint64_t, uint64_t>, ommhelper::OmmAlphaBounds> m_OmmAlphaBounds; // by (bounds state hash, instance hash), kept across rebakes
+    uint64_t m_OmmAlphaBoundsSize = 0;
+    uint32_t m_OmmAlphaBoundsCounts[3] = {}; // [baked, read from cache, reused from memory]
+    double m_OmmAlphaBoundsTimeMs[2] = {}; // last measured [bounds bake, threshold pass]
+    uint64_t m_OmmIndexBufferSizes[2] = {}; // cpu side OMM index data [as baked, after width compaction]
+    ommhelper::OmmArrayCache m_OmmArrayCache;
+    uint32_t m_OmmBatchRecordCounts[2] = {}; // [read, written]
+    bool m_OmmUseBatchRecords = false;
+
+    ommhelper::OmmAhsEstimator m_OmmAhsEstimator;
+    std::map<uint64_t, OmmAhsEstimate> m_OmmAhsEstimates; // by bake state hash
+    std::future<OmmAhsEstimate> m_OmmAhsEstimateTask;
+    bool m_OmmKeepBakeOutput = false; // for the AHS estimator when the cache is off
+
+    // Distance based LOD: variant N is baked at subdivision level - N * m_OmmLodLevelStep
+    uint32_t m_OmmLodNum = 1;
+    uint32_t m_OmmLodLevelStep = 2;
+    uint32_t m_OmmLodLevels[OMM_MAX_LOD_NUM] = {};
+    uint64_t m_OmmLodMemory[OMM_MAX_LOD_NUM] = {}; // OMM arrays and masked blasses
+    uint32_t m_OmmLodInstanceNum[OMM_MAX_LOD_NUM] = {}; // in the last TLAS build
+    float m_OmmLodSwitchSizes[OMM_MAX_LOD_NUM - 1] = { 0.08f, 0.02f }; // projected bounding radius (radius / distance) below which the next variant is used
+    float m_OmmLodHysteresis = 0.15f;
+    std::vector<uint8_t> m_OmmInstanceLods; // by scene instance
 
     nri::Buffer* m_OmmGpuOutputBuffers[(uint32_t)ommhelper::OmmDataLayout::GpuOutputNum] = {};
     nri::Buffer* m_OmmGpuReadbackBuffers[(uint32_t)ommhelper::OmmDataLayout::GpuOutputNum] = {};
     nri::Buffer* m_OmmGpuTransientBuffers[OMM_MAX_TRANSIENT_POOL_BUFFERS] = {};
 
-    std::vector<nri::Buffer*> m_OmmCpuUploadBuffers;
+    std::vector<nri::Buffer*> m_OmmBuildInputBuffers; // upload heaps and the device local blas build inputs filled from them
     std::vector<nri::Memory*> m_OmmBakerAllocations;
     std::vector<nri::Memory*> m_OmmTmpAllocations;
 
     //misc
     OmmNriContext m_OmmGraphicsContext;
     OmmNriContext m_OmmComputeContext;
+    OmmNriContext m_OmmCopyContext; // baker readbacks and cpu baker uploads, overlapped with bake and build work
+    nri::Buffer* m_OmmTimelineBuffer = nullptr; // resolved timestamps of the bake context and the copy context
+    std::vector<nri::Memory*> m_OmmTimelineMemories;
+    bool m_OmmPrintGpuTimeline = false; // every event, not just the queue overlap
+    OmmTimelineStats m_OmmTimelineStats = {}; // bake thread to profiler
+    std::mutex m_OmmTimelineMutex;
+    bool m_IsOmmTimelinePending = false;
+    std::vector<ommhelper::OmmBakeGeometryDesc*> m_OmmPendingReadback; // gpu baker outputs copied for the cache, not waited for yet
+    OmmBatch m_OmmPendingReadbackBatch = {};
+    uint64_t m_OmmCopyBytes[2] = {}; // [uploaded, read back]
+    double m_OmmCopyWaitTimeMs = 0.0; // cpu blocked on the copy queue
 
     struct OmmBlas
     {
         nri::AccelerationStructure* blas;
         //[!] VK Warning! VkMicromapExt wrapping is not supported yet. Use OmmHelper::DestroyMaskedGeometry instead of nri on release.
         nri::Buffer* ommArray;
+        uint32_t generation; // of its memory: a full rebuild or a re-bake pass
+        uint64_t buildId; // a new BLAS may take the address of a destroyed one
     };
-    std::map<uint64_t, OmmBlas> m_InstanceMaskToMaskedBlasData;
+    // Rebuilds are double buffered: the previous generation stays bound and every instance is swapped as soon as its new blas is built
+    std::map<uint64_t, OmmBlas> m_InstanceMaskToMaskedBlasData[OMM_MAX_LOD_NUM];
+    std::mutex m_MaskedBlasMutex; // guards the maps and the masked blas lists: the TLAS update and the ui read them while a bake thread swaps entries
     std::vector<OmmBlas> m_MaskedBlasses;
+    std::vector<OmmBlas> m_RetiredMaskedBlasses; // previous generation, destroyed once no frame in flight uses it
+    std::vector<OmmBlas> m_ReplacedMaskedBlasses; // swapped out by a re-bake, destroyed once no frame in flight uses them
+    uint32_t m_OmmGeometryGeneration = 0;
+    std::atomic<uint64_t> m_BlasBuildId = 0; // shared by all BLAS kinds, see m_BlasBuildIds
+    uint64_t m_OmmRebuildMemory[2] = {}; // [previous generation kept alive, peak of both generations]
     ommhelper::OmmBakeDesc m_OmmBakeDesc = {};
+    std::atomic<float> m_OmmBoundAlphaCutoff = ommhelper::OmmBakeDesc().alphaCutoff; // of the bound generation, any-hit shaders must use the cutoff its states were baked with
     std::string m_SceneName = "Scene";
     std::string m_OmmCacheFolderName = "_OmmCache";
+    std::string m_OmmBakeServerSocket;
+    uint32_t m_OmmPlanningBenchmarkGeometryNum = 0;
     uint32_t m_OmmUpdateProgress = 0;
+
+    // Alpha texture residency, the finest resident mip by scene texture index. Mips only stream in: each residency event
+    // re-queues the geometries whose clamped mip offset changes, re-baked at low priority between full rebuilds
+    std::vector<uint8_t> m_OmmTextureResidentMips;
+    std::vector<uint8_t> m_OmmBakeResidentMips; // snapshot taken when a bake is launched, the bake runs in the background
+    std::vector<std::pair<uint32_t, std::chrono::high_resolution_clock::time_point>> m_OmmResidencyEvents; // [texture index, time], not queued yet
+    std::map<uint32_t, std::chrono::high_resolution_clock::time_point> m_OmmRebakeQueue; // by geometry id, time of the earliest event
+    OmmRebakeStats m_OmmRebakeStats = {};
+    uint32_t m_OmmRebakeGeometryMaxNum = 16; // per re-bake pass, the rest waits for the next one
+    uint32_t m_OmmMipStreamingFrames = 0; // simulated streaming: a finer mip of every texture each N frames. 0: all mips resident
     bool m_EnableOmm = true;
     bool m_ShowFullSettings = false;
     bool m_IsOmmBakingActive = false;
@@ -812,6 +1389,9 @@ private:
 
 private:
     Profiler m_Profiler;
+    AllocationTracker m_AllocationTracker;
+    std::array<uint32_t, (uint32_t)AllocationScope::MAX_NUM> m_AllocationScopeIDs = {};
+    std::string m_TestsPath;
 };
 
 Sample::~Sample()
@@ -819,6 +1399,11 @@ Sample::~Sample()
     if (!m_Device)
         return;
 
+    StopFrameWorkers();
+
+    if (m_OmmAhsEstimateTask.valid())
+        m_OmmAhsEstimateTask.wait();
+
     NRI.WaitForIdle(*m_CommandQueue);
 
     m_DLSS.Shutdown();
@@ -831,6 +1416,10 @@ Sample::~Sample()
     m_OmmHelper.Destroy();
     m_OmmGraphicsContext.Destroy(NRI);
     m_OmmComputeContext.Destroy(NRI);
+    m_OmmCopyContext.Destroy(NRI);
+    NRI.DestroyBuffer(*m_OmmTimelineBuffer);
+    for (nri::Memory* memory : m_OmmTimelineMemories)
+        NRI.FreeMemory(*memory);
 
     for (auto& buffer : m_OmmAlphaGeometryBuffers)
         NRI.DestroyBuffer(*buffer);
@@ -839,8 +1428,11 @@ Sample::~Sample()
 
     for (Frame& frame : m_Frames)
     {
-        NRI.DestroyCommandBuffer(*frame.commandBuffer);
-        NRI.DestroyCommandAllocator(*frame.commandAllocator);
+        for (uint32_t i = 0; i < (uint32_t)FrameSection::MAX_NUM; i++)
+        {
+            NRI.DestroyCommandBuffer(*frame.commandBuffers[i]);
+            NRI.DestroyCommandAllocator(*frame.commandAllocators[i]);
+        }
         NRI.DestroyDescriptor(*frame.globalConstantBufferDescriptor);
     }
 
@@ -904,6 +1496,7 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI)
         DlssIntegration::SetupDeviceExtensions(deviceCreationDesc);
 
     NRI_ABORT_ON_FAILURE( nri::nriCreateDevice(deviceCreationDesc, m_Device) );
+    m_AdapterDesc = bestAdapterDesc;
 
     NRI_ABORT_ON_FAILURE( nri::nriGetInterface(*m_Device, NRI_INTERFACE(nri::CoreInterface), (nri::CoreInterface*)&NRI) );
     NRI_ABORT_ON_FAILURE( nri::nriGetInterface(*m_Device, NRI_INTERFACE(nri::SwapChainInterface), (nri::SwapChainInterface*)&NRI) );
@@ -1024,11 +1617,21 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI)
     UploadStaticData();
 
     InitAlphaTestedGeometry();
+    if (m_OmmPlanningBenchmarkGeometryNum)
+        RunOmmPlanningBenchmark(m_OmmPlanningBenchmarkGeometryNum);
 
+    // NRI creates the VkDevice with its own feature chain, indexTypeUint8 isn't part of it: R8 OMM indices stay off
     m_OmmHelper.Initialize(m_Device, m_DisableOmmBlasBuild);
+    m_OmmHelper.SetPrepareThreadNum(m_OmmPrepareThreadNum);
+    if (!m_OmmBakeServerSocket.empty())
+        m_OmmHelper.ConnectToBakeServer(m_OmmBakeServerSocket.c_str());
     m_Profiler.Init(m_Device);
-    m_OmmGraphicsContext.Init(NRI, m_Device, nri::CommandQueueType::GRAPHICS);
-    m_OmmComputeContext.Init(NRI, m_Device, nri::CommandQueueType::COMPUTE);
+    m_OmmGraphicsContext.Init(NRI, m_Device, nri::CommandQueueType::GRAPHICS, "graphics");
+    m_OmmComputeContext.Init(NRI, m_Device, nri::CommandQueueType::COMPUTE, "compute");
+    // Baker outputs, readbacks and build inputs cross queues without ownership transfers: on Vulkan NRI creates buffers with VK_SHARING_MODE_CONCURRENT
+    // over the families of its graphics, compute and copy queues, on D3D12 buffers decay to the common state between submissions. QueueWait orders the accesses
+    m_OmmCopyContext.Init(NRI, m_Device, nri::CommandQueueType::COPY, "copy");
+    InitOmmTimeline();
 
     m_Camera.Initialize(m_Scene.aabb.GetCenter(), m_Scene.aabb.vMin, CAMERA_RELATIVE);
     m_Scene.UnloadGeometryData();
@@ -1114,22 +1717,91 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI)
 
     m_SettingsDefault = m_Settings;
 
+    { // Before the workers start: they use the scopes but can't allocate them
+        const char* allocationScopeNames[] = { "PrepareFrame", "RenderFrame", "Profiler", "TLAS build", "AS updates job", "Tracing job", "Submit job" };
+        static_assert(sizeof(allocationScopeNames) / sizeof(allocationScopeNames[0]) == (uint32_t)AllocationScope::MAX_NUM, "allocationScopeNames mismatch");
+        for (uint32_t i = 0; i < (uint32_t)AllocationScope::MAX_NUM; i++)
+            m_AllocationScopeIDs[i] = m_AllocationTracker.AllocateScope(allocationScopeNames[i], i >= (uint32_t)AllocationScope::AccelerationStructuresJob);
+    }
+
+    StartFrameWorkers();
+
     return CreateUserInterface(*m_Device, NRI, NRI, swapChainFormat);
 }
 
-void Sample::OmmNriContext::Init(const NRIInterface& NRI, nri::Device* device, nri::CommandQueueType type)
+void Sample::OmmNriContext::Init(const NRIInterface& NRI, nri::Device* device, nri::CommandQueueType type, const char* name)
 {
     NRI_ABORT_ON_FAILURE(NRI.GetCommandQueue(*device, type, commandQueue));
-    NRI_ABORT_ON_FAILURE(NRI.CreateCommandAllocator(*commandQueue, nri::WHOLE_DEVICE_GROUP, commandAllocator));
-    NRI_ABORT_ON_FAILURE(NRI.CreateCommandBuffer(*commandAllocator, commandBuffer));
+    for (uint32_t i = 0; i < OMM_CONTEXT_BUFFERED_NUM; ++i)
+    {
+        NRI_ABORT_ON_FAILURE(NRI.CreateCommandAllocator(*commandQueue, nri::WHOLE_DEVICE_GROUP, commandAllocators[i]));
+        NRI_ABORT_ON_FAILURE(NRI.CreateCommandBuffer(*commandAllocators[i], commandBuffers[i]));
+    }
+    commandBuffer = commandBuffers[0];
     NRI_ABORT_ON_FAILURE(NRI.CreateFence(*device, 0, fence));
+
+    queueName = name;
+    if (type != nri::CommandQueueType::COPY || NRI.GetDeviceDesc(*device).graphicsAPI == nri::GraphicsAPI::VULKAN)
+    { // D3D12 copy queues need a dedicated query heap type NRI doesn't create: no copy queue timeline there, the profiler gets bake queue sections only
+        nri::QueryPoolDesc queryPoolDesc = {};
+        queryPoolDesc.queryType = nri::QueryType::TIMESTAMP;
+        queryPoolDesc.capacity = OMM_TIMELINE_EVENT_NUM * 2;
+        queryPoolDesc.physicalDeviceMask = nri::WHOLE_DEVICE_GROUP;
+        NRI_ABORT_ON_FAILURE(NRI.CreateQueryPool(*device, queryPoolDesc, timestampPool));
+    }
 }
 
 void Sample::OmmNriContext::Destroy(const NRIInterface& NRI)
 {
+    if (timestampPool)
+        NRI.DestroyQueryPool(*timestampPool);
     NRI.DestroyFence(*fence);
-    NRI.DestroyCommandBuffer(*commandBuffer);
-    NRI.DestroyCommandAllocator(*commandAllocator);
+    for (uint32_t i = 0; i < OMM_CONTEXT_BUFFERED_NUM; ++i)
+    {
+        NRI.DestroyCommandBuffer(*commandBuffers[i]);
+        NRI.DestroyCommandAllocator(*commandAllocators[i]);
+    }
+}
+
+void Sample::OmmNriContext::BeginRecording(const NRIInterface& NRI)
+{ // Allocators are used round robin: only the submission which used the next one must be complete
+    bufferId = (bufferId + 1) % OMM_CONTEXT_BUFFERED_NUM;
+    NRI.Wait(*fence, submittedFenceValues[bufferId]);
+    commandBuffer = commandBuffers[bufferId];
+    NRI.ResetCommandAllocator(*commandAllocators[bufferId]);
+    NRI.BeginCommandBuffer(*commandBuffer, nullptr, nri::WHOLE_DEVICE_GROUP);
+}
+
+uint64_t Sample::OmmNriContext::Submit(const NRIInterface& NRI, nri::Fence* waitFence, uint64_t waitValue)
+{ // Cross queue dependencies are resolved on the gpu, the calling thread isn't blocked
+    NRI.EndCommandBuffer(*commandBuffer);
+    if (waitFence)
+        NRI.QueueWait(*commandQueue, *waitFence, waitValue);
+
+    nri::QueueSubmitDesc workSubmissionDesc = {};
+    workSubmissionDesc.commandBuffers = &commandBuffer;
+    workSubmissionDesc.commandBufferNum = 1;
+    NRI.QueueSubmit(*commandQueue, workSubmissionDesc);
+    NRI.QueueSignal(*commandQueue, *fence, ++fenceValue);
+    submittedFenceValues[bufferId] = fenceValue;
+    return fenceValue;
+}
+
+uint32_t Sample::OmmNriContext::BeginEvent(const NRIInterface& NRI, OmmTimelineSection section)
+{ // Queries are reset by InitOmmTimeline() and after every readback in PrintOmmTimeline(), events past the pool capacity are dropped
+    if (!timestampPool || !isTimelineActive || events.size() == OMM_TIMELINE_EVENT_NUM)
+        return uint32_t(-1);
+
+    uint32_t eventId = (uint32_t)events.size();
+    events.push_back({ section, eventId * 2 });
+    NRI.CmdEndQuery(*commandBuffer, *timestampPool, eventId * 2);
+    return eventId;
+}
+
+void Sample::OmmNriContext::EndEvent(const NRIInterface& NRI, uint32_t eventId)
+{
+    if (eventId != uint32_t(-1))
+        NRI.CmdEndQuery(*commandBuffer, *timestampPool, events[eventId].queryOffset + 1);
 }
 
 void BindBuffersToMemory(NRIInterface& nri, nri::Device* device, nri::Buffer** buffers, size_t count, std::vector<nri::Memory*>& memories, nri::MemoryLocation location)
@@ -1143,14 +1815,51 @@ void BindBuffersToMemory(NRIInterface& nri, nri::Device* device, nri::Buffer** b
     NRI_ABORT_ON_FAILURE(nri.AllocateAndBindMemory(*device, resourceGroupDesc, memories.data() + allocationOffset));
 }
 
-nri::AccelerationStructure* Sample::GetMaskedBlas(uint64_t insatanceMask)
-{
-    const auto& it = m_InstanceMaskToMaskedBlasData.find(insatanceMask);
-    if (it != m_InstanceMaskToMaskedBlasData.end())
-        return it->second.blas;
+nri::AccelerationStructure* Sample::GetMaskedBlas(uint64_t insatanceMask, uint32_t lod, uint64_t& outBuildId)
+{ // Falls back to the closest available variant, finer first
+    std::lock_guard<std::mutex> lock(m_MaskedBlasMutex);
+    for (uint32_t i = 0; i < OMM_MAX_LOD_NUM; ++i)
+    {
+        uint32_t candidates[] = { lod - i, lod + i };
+        for (uint32_t candidate : candidates)
+        {
+            if (candidate >= OMM_MAX_LOD_NUM)
+                continue;
+
+            const auto& it = m_InstanceMaskToMaskedBlasData[candidate].find(insatanceMask);
+            if (it != m_InstanceMaskToMaskedBlasData[candidate].end())
+            {
+                outBuildId = it->second.buildId;
+                return it->second.blas;
+            }
+        }
+    }
     return nullptr;
 }
 
+uint32_t Sample::UpdateOmmInstanceLod(size_t instanceIndex, const utils::Instance& instance, const utils::Mesh& mesh)
+{ // Hysteresis around the switch sizes keeps instances near a threshold from flipping every frame
+    if (m_OmmLodNum == 1)
+        return 0;
+
+    if (m_OmmInstanceLods.size() != m_Scene.instances.size())
+        m_OmmInstanceLods.resize(m_Scene.instances.size(), 0);
+
+    float radius = mesh.aabb.GetRadius() * Max(instance.scale.x, Max(instance.scale.y, instance.scale.z));
+    float distance = Max(Length(m_Camera.GetRelative(instance.position)), NEAR_Z * m_Settings.meterToUnitsMultiplier);
+    float projectedSize = radius / distance;
+
+    uint32_t lod = std::min<uint32_t>(m_OmmInstanceLods[instanceIndex], m_OmmLodNum - 1);
+    while (lod + 1 < m_OmmLodNum && projectedSize < m_OmmLodSwitchSizes[lod] * (1.0f - m_OmmLodHysteresis))
+        lod++;
+    while (lod > 0 && projectedSize > m_OmmLodSwitchSizes[lod - 1] * (1.0f + m_OmmLodHysteresis))
+        lod--;
+
+    m_OmmInstanceLods[instanceIndex] = (uint8_t)lod;
+    m_OmmLodInstanceNum[lod]++;
+    return lod;
+}
+
 std::vector<uint32_t> FilterOutAlphaTestedGeometry(const utils::Scene& scene)
 { // Filter out alphaOpaque geometry by mesh and material IDs
     std::vector<uint32_t> result;
@@ -1181,6 +1890,12 @@ void Sample::InitAlphaTestedGeometry()
         return;
 
     m_OmmAlphaGeometry.resize(alphaInstances.size());
+    m_OmmGeometryTable.Resize(alphaInstances.size());
+
+    m_OmmTextureResidentMips.resize(m_Scene.textures.size());
+    for (size_t i = 0; i < m_Scene.textures.size(); ++i) // streamed textures start from the coarsest mip
+        m_OmmTextureResidentMips[i] = m_OmmMipStreamingFrames ? uint8_t(m_Scene.textures[i]->GetMipNum() - 1) : 0;
+    m_OmmBakeResidentMips = m_OmmTextureResidentMips;
 
     size_t positionBufferSize = 0;
     size_t indexBufferSize = 0;
@@ -1236,6 +1951,8 @@ void Sample::InitAlphaTestedGeometry()
         AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
         geometry.meshIndex = instance.meshInstanceIndex;
         geometry.materialIndex = instance.materialIndex;
+        m_OmmGeometryTable.instanceHashes[i] = GetInstanceHash(geometry.meshIndex, geometry.materialIndex);
+        m_OmmGeometryTable.primitiveNums[i] = mesh.indexNum / 3;
 
         geometry.alphaTexture = materialTextures[material.baseColorTexIndex];
         geometry.utilsTexture = m_Scene.textures[material.baseColorTexIndex];
@@ -1364,53 +2081,69 @@ inline bool AreBakerOutputsOnGPU(const ommhelper::OmmBakeGeometryDesc& instance)
     return result;
 }
 
-void Sample::FillOmmBakerInputs()
-{
-    std::map<uint64_t, size_t> materialMaskToTextureDataOffset;
-    if (m_OmmBakeDesc.type == ommhelper::OmmBakerType::CPU)
-    { // Decompress textures and store alpha channel in a separate buffer for cpu baker
-        std::set<uint32_t> uniqueMaterialIds;
-        std::vector<uint8_t> workVector;
+void Sample::FillOmmBakerInputs(const ommhelper::OmmBakeDesc& bakeDesc, const std::vector<uint32_t>& geometryIds)
+{ // All geometries, or only the given ones (ascending): the others keep their planned mips and aren't counted as texture users
+    auto IsPlanned = [&geometryIds](size_t id) { return geometryIds.empty() || std::binary_search(geometryIds.begin(), geometryIds.end(), (uint32_t)id); };
+    if (bakeDesc.type == ommhelper::OmmBakerType::CPU)
+    { // Resolve cache first. Alpha planes are decoded later, only for textures referenced by cache misses
+        const bool enablePlacement = bakeDesc.cpuFlags.enableNumaPlacement;
+        const uint32_t nodeNum = enablePlacement ? ommhelper::CpuTopology::GetNodeNum() : 1;
+
+        std::vector<uint64_t> textureKeys(m_OmmAlphaGeometry.size());
+        std::vector<uint64_t> workloads(m_OmmAlphaGeometry.size());
+        for (size_t i = 0; i < m_OmmAlphaGeometry.size(); ++i)
+        {
+            const AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
+            textureKeys[i] = m_Scene.materials[geometry.materialIndex].baseColorTexIndex;
+            workloads[i] = m_Scene.meshes[geometry.meshIndex].indexNum / 3;
+        }
+        std::vector<uint32_t> geometryToNode = ommhelper::CpuTopology::PartitionByTexture(textureKeys.data(), workloads.data(), textureKeys.size(), nodeNum);
+
+        const std::string cacheFileName = GetOmmCacheFilename();
+        const uint64_t stateMask = ommhelper::OmmCaching::CalculateSateHash(bakeDesc);
+        const uint64_t boundsStateHash = ommhelper::AlphaBoundsBaker::CalculateStateHash(bakeDesc);
+        m_OmmCpuAlphaTextures.clear();
         for (size_t i = 0; i < m_OmmAlphaGeometry.size(); ++i)
-        { // Sort out unique textures to avoid resource duplication
+        {
+            if (!IsPlanned(i))
+                continue;
+
             AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
             ommhelper::InputTexture& bakerTexure = geometry.bakeDesc.texture;
-            uint32_t materialId = geometry.materialIndex;
-
-            const utils::Material& material = m_Scene.materials[materialId];
-            utils::Texture* utilsTexture = m_Scene.textures[material.baseColorTexIndex];
+            uint32_t textureIndex = (uint32_t)textureKeys[i];
+            utils::Texture* utilsTexture = m_Scene.textures[textureIndex];
 
             uint32_t minMip = utilsTexture->GetMipNum() - 1;
-            uint32_t textureMipOffset = m_OmmBakeDesc.mipBias > minMip ? minMip : m_OmmBakeDesc.mipBias;
+            uint32_t textureMipOffset = GetOmmTextureMipOffset(bakeDesc, textureIndex, m_OmmBakeResidentMips, geometry.missingMipNum);
             uint32_t remainingMips = minMip - textureMipOffset + 1;
-            uint32_t mipRange = m_OmmBakeDesc.mipCount > remainingMips ? remainingMips : m_OmmBakeDesc.mipCount;
+            uint32_t mipRange = bakeDesc.mipCount > remainingMips ? remainingMips : bakeDesc.mipCount;
 
+            geometry.mipOffset = textureMipOffset;
             bakerTexure.mipOffset = textureMipOffset;
             bakerTexure.mipNum = mipRange;
-
-            size_t uniqueMaterialsNum = uniqueMaterialIds.size();
-            uniqueMaterialIds.insert(materialId);
-            if (uniqueMaterialsNum == uniqueMaterialIds.size())
-                continue;//duplication
-
-            for (uint32_t mip = 0; mip < mipRange; ++mip)
-            {
-                uint32_t mipId = textureMipOffset + mip;
-                detexTexture* texture = (detexTexture*)utilsTexture->mips[mipId];
-
-                PreprocessAlphaTexture(texture, workVector);
-
-                size_t rawBufferOffset = m_OmmRawAlphaChannelForCpuBaker.size();
-                m_OmmRawAlphaChannelForCpuBaker.insert(m_OmmRawAlphaChannelForCpuBaker.end(), workVector.begin(), workVector.end());
-                materialMaskToTextureDataOffset.insert(std::make_pair(uint64_t(materialId) << 32 | uint64_t(mipId), rawBufferOffset));
-                workVector.clear();
-            }
+            geometry.bakeDesc.cpuNodeId = geometryToNode[i];
+
+            // All geometries sharing a texture share its node and mip range
+            OmmCpuAlphaTexture& alphaTexture = m_OmmCpuAlphaTextures[textureIndex];
+            alphaTexture.mipOffset = textureMipOffset;
+            alphaTexture.mipNum = mipRange;
+            alphaTexture.cpuNodeId = geometryToNode[i];
+
+            uint64_t hash = GetOmmCacheHash(geometry);
+            bool isTextureNeeded = !bakeDesc.enableCache || !ommhelper::OmmCaching::LookForCache(cacheFileName.c_str(), stateMask, hash);
+            if (isTextureNeeded && bakeDesc.cpuFlags.enableAlphaBounds)
+                isTextureNeeded = !IsOmmAlphaBoundsAvailable(bakeDesc, geometry, boundsStateHash); // the threshold pass doesn't sample textures
+            if (isTextureNeeded)
+                ++alphaTexture.pendingGeometryNum;
         }
     }
 
     for (size_t i = 0; i < m_OmmAlphaGeometry.size(); ++i)
     { // Fill baking queue desc
-        bool isGpuBaker = m_OmmBakeDesc.type == ommhelper::OmmBakerType::GPU;
+        if (!IsPlanned(i))
+            continue;
+
+        bool isGpuBaker = bakeDesc.type == ommhelper::OmmBakerType::GPU;
 
         AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
         ommhelper::OmmBakeGeometryDesc& ommDesc = geometry.bakeDesc;
@@ -1424,14 +2157,14 @@ void Sample::FillOmmBakerInputs()
         {
             ommDesc.indices.nriBufferOrPtr.buffer = geometry.indices;
             ommDesc.uvs.nriBufferOrPtr.buffer = geometry.uvs;
-            uint32_t minMip = utilsTexture->GetMipNum() - 1;
-            uint32_t textureMipOffset = m_OmmBakeDesc.mipBias > minMip ? minMip : m_OmmBakeDesc.mipBias;
+            uint32_t textureMipOffset = GetOmmTextureMipOffset(bakeDesc, material.baseColorTexIndex, m_OmmBakeResidentMips, geometry.missingMipNum);
+            geometry.mipOffset = textureMipOffset;
             ommDesc.texture.mipOffset = textureMipOffset;
             ommDesc.texture.mipNum = 1; // gpu baker currently doesn't support multiple mips
             ommhelper::MipDesc& mipDesc = ommDesc.texture.mips[0];
             mipDesc.nriTextureOrPtr.texture = texture;
-            mipDesc.width = reinterpret_cast<detexTexture*>(utilsTexture->mips[bakerTexture.mipOffset])->width;;
-            mipDesc.height = reinterpret_cast<detexTexture*>(utilsTexture->mips[bakerTexture.mipOffset])->height;;
+            mipDesc.width = reinterpret_cast<detexTexture*>(utilsTexture->mips[textureMipOffset])->width;
+            mipDesc.height = reinterpret_cast<detexTexture*>(utilsTexture->mips[textureMipOffset])->height;
         }
         else
         {
@@ -1439,13 +2172,10 @@ void Sample::FillOmmBakerInputs()
             ommDesc.uvs.nriBufferOrPtr.ptr = (void*)geometry.uvData.data();
 
             for (uint32_t mip = 0; mip < bakerTexture.mipNum; ++mip)
-            {
+            { // data pointers are set in AcquireOmmCpuAlphaTextures
                 uint32_t mipId = bakerTexture.mipOffset + mip;
-                uint64_t materialMask = uint64_t(geometry.materialIndex) << 32 | uint64_t(mipId);
-                size_t texDataOffset = materialMaskToTextureDataOffset.find(materialMask)->second;
-
                 ommhelper::MipDesc& mipDesc = ommDesc.texture.mips[mip];
-                mipDesc.nriTextureOrPtr.ptr = (void*)(m_OmmRawAlphaChannelForCpuBaker.data() + texDataOffset);
+                mipDesc.nriTextureOrPtr.ptr = nullptr;
                 mipDesc.width = reinterpret_cast<detexTexture*>(utilsTexture->mips[mipId])->width;
                 mipDesc.height = reinterpret_cast<detexTexture*>(utilsTexture->mips[mipId])->height;
             }
@@ -1468,130 +2198,555 @@ void Sample::FillOmmBakerInputs()
         ommDesc.texture.format = isGpuBaker ? utilsTexture->format : nri::Format::R8_UNORM;
         ommDesc.texture.addressingMode = nri::AddressMode::REPEAT;
         ommDesc.texture.alphaChannelId = 3;
-        ommDesc.alphaCutoff = 0.5f;
+        ommDesc.alphaCutoff = bakeDesc.alphaCutoff;
         ommDesc.borderAlpha = 0.0f;
         ommDesc.alphaMode = ommhelper::OmmAlphaMode::Test;
+        m_OmmGeometryTable.instanceHashes[i] = GetOmmCacheHash(geometry);
     }
 }
 
-void PrepareOmmUsageCountsBuffers(ommhelper::OpacityMicroMapsHelper& ommHelper, ommhelper::OmmBakeGeometryDesc& desc)
-{ // Sanitize baker outputed usageCounts buffers to fit GAPI format
-    uint32_t usageCountBuffers[] = { (uint32_t)ommhelper::OmmDataLayout::DescArrayHistogram, (uint32_t)ommhelper::OmmDataLayout::IndexHistogram };
+uint32_t Sample::GetOmmTextureMipOffset(const ommhelper::OmmBakeDesc& bakeDesc, uint32_t textureIndex, const std::vector<uint8_t>& residentMips, uint32_t& outMissingMipNum)
+{ // Requested mip bias, clamped to the last mip and to the finest resident one
+    uint32_t minMip = m_Scene.textures[textureIndex]->GetMipNum() - 1;
+    uint32_t requestedMip = bakeDesc.mipBias > minMip ? minMip : bakeDesc.mipBias;
+    uint32_t residentMip = textureIndex < residentMips.size() ? std::min<uint32_t>(residentMips[textureIndex], minMip) : 0;
+    uint32_t mipOffset = std::max(requestedMip, residentMip);
+    outMissingMipNum = mipOffset - requestedMip;
+    return mipOffset;
+}
 
-    for (size_t i = 0; i < helper::GetCountOf(usageCountBuffers); ++i)
+void Sample::AcquireOmmCpuAlphaTextures(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch, const std::vector<ommhelper::OmmBakeGeometryDesc*>& bakeQueue)
+{ // Decode alpha planes on first use. Data of a node is decoded by a thread pinned to that node, so the pages are first touched there
+    const std::set<const ommhelper::OmmBakeGeometryDesc*> queued(bakeQueue.begin(), bakeQueue.end());
+    const uint32_t nodeNum = bakeDesc.cpuFlags.enableNumaPlacement ? ommhelper::CpuTopology::GetNodeNum() : 1;
+
+    std::set<uint32_t> decodedTextureIds;
+    std::vector<std::vector<uint32_t>> nodeJobs(nodeNum);
+    for (size_t i = batch.offset; i < batch.offset + batch.count; ++i)
     {
-        std::vector<uint8_t> buffer = desc.outData[usageCountBuffers[i]];
-        size_t convertedCountsSize = 0;
-        ommHelper.ConvertUsageCountsToApiFormat(nullptr, convertedCountsSize, buffer.data(), buffer.size());
-        desc.outData[usageCountBuffers[i]].resize(convertedCountsSize);
-        ommHelper.ConvertUsageCountsToApiFormat(desc.outData[usageCountBuffers[i]].data(), convertedCountsSize, buffer.data(), buffer.size());
+        const AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
+        uint32_t textureIndex = m_Scene.materials[geometry.materialIndex].baseColorTexIndex;
+        if (!queued.count(&geometry.bakeDesc) || !m_OmmCpuAlphaTextures[textureIndex].data.empty())
+            continue;
+
+        if (decodedTextureIds.insert(textureIndex).second)
+            nodeJobs[std::min(m_OmmCpuAlphaTextures[textureIndex].cpuNodeId, nodeNum - 1)].push_back(textureIndex);
+    }
+
+    auto DecodeNodeTextures = [&](uint32_t node)
+    {
+        if (nodeNum > 1) // never pin the calling thread
+            ommhelper::CpuTopology::PinCurrentThread(node);
+
+        std::vector<uint8_t> workVector;
+        for (uint32_t textureIndex : nodeJobs[node])
+        {
+            OmmCpuAlphaTexture& alphaTexture = m_OmmCpuAlphaTextures[textureIndex];
+            utils::Texture* utilsTexture = m_Scene.textures[textureIndex];
+            for (uint32_t mip = 0; mip < alphaTexture.mipNum; ++mip)
+            {
+                detexTexture* texture = (detexTexture*)utilsTexture->mips[alphaTexture.mipOffset + mip];
+                PreprocessAlphaTexture(texture, workVector);
+
+                alphaTexture.mipDataOffsets[mip] = alphaTexture.data.size();
+                alphaTexture.data.insert(alphaTexture.data.end(), workVector.begin(), workVector.end());
+                workVector.clear();
+            }
+        }
+    };
+
+    if (nodeNum == 1)
+        DecodeNodeTextures(0);
+    else
+    {
+        std::vector<std::thread> decoders;
+        for (uint32_t node = 0; node < nodeNum; ++node)
+        {
+            if (!nodeJobs[node].empty())
+                decoders.emplace_back(DecodeNodeTextures, node);
+        }
+        for (std::thread& decoder : decoders)
+            decoder.join();
+    }
+
+    for (uint32_t textureIndex : decodedTextureIds)
+    {
+        m_OmmCpuAlphaDataSizes[0] += m_OmmCpuAlphaTextures[textureIndex].data.size();
+        m_OmmCpuAlphaDataSizes[1] = std::max(m_OmmCpuAlphaDataSizes[1], m_OmmCpuAlphaDataSizes[0]);
+    }
+    m_OmmCpuAlphaDecodedTextureNum += (uint32_t)decodedTextureIds.size();
+
+    for (size_t i = batch.offset; i < batch.offset + batch.count; ++i)
+    {
+        AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
+        if (!queued.count(&geometry.bakeDesc))
+            continue;
+
+        const OmmCpuAlphaTexture& alphaTexture = m_OmmCpuAlphaTextures[m_Scene.materials[geometry.materialIndex].baseColorTexIndex];
+        ommhelper::InputTexture& bakerTexture = geometry.bakeDesc.texture;
+        for (uint32_t mip = 0; mip < bakerTexture.mipNum; ++mip)
+            bakerTexture.mips[mip].nriTextureOrPtr.ptr = (void*)(alphaTexture.data.data() + alphaTexture.mipDataOffsets[mip]);
     }
 }
 
-void PrepareCpuBuilderInputs(NRIInterface& NRI, const OmmBatch& batch, std::vector<AlphaTestedGeometry>& geometries)
-{ // Copy raw mask data to the upload heaps to use during micromap and blas build
+void Sample::ReleaseOmmCpuAlphaTextures(const OmmBatch& batch, const std::vector<ommhelper::OmmBakeGeometryDesc*>& bakeQueue)
+{ // Free alpha planes as soon as the last geometry baking from them is done
+    const std::set<const ommhelper::OmmBakeGeometryDesc*> queued(bakeQueue.begin(), bakeQueue.end());
     for (size_t i = batch.offset; i < batch.offset + batch.count; ++i)
     {
-        AlphaTestedGeometry& geometry = geometries[i];
-        const ommhelper::OmmBakeGeometryDesc& bakeResult = geometry.bakeDesc;
-        if (bakeResult.outData[(uint32_t)ommhelper::OmmDataLayout::DescArrayHistogram].empty())
+        AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
+        if (!queued.count(&geometry.bakeDesc))
             continue;
 
-        ommhelper::MaskedGeometryBuildDesc& buildDesc = geometry.buildDesc;
-        for (uint32_t y = 0; y < (uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum; ++y)
-        {
-            nri::Buffer* buffer = buildDesc.inputs.buffers[y].buffer;
-            uint64_t mapSize = (uint64_t)bakeResult.outData[y].size();
-            void* map = NRI.MapBuffer(*buffer, 0, mapSize);
-            memcpy(map, bakeResult.outData[y].data(), bakeResult.outData[y].size());
-            NRI.UnmapBuffer(*buildDesc.inputs.buffers[y].buffer);
+        OmmCpuAlphaTexture& alphaTexture = m_OmmCpuAlphaTextures[m_Scene.materials[geometry.materialIndex].baseColorTexIndex];
+        if (alphaTexture.pendingGeometryNum)
+            --alphaTexture.pendingGeometryNum;
+
+        if (!alphaTexture.pendingGeometryNum && !alphaTexture.data.empty())
+        { // a cache read failing after the lookup can bring a texture back, it is decoded again then
+            m_OmmCpuAlphaDataSizes[0] -= alphaTexture.data.size();
+            alphaTexture.data.clear();
+            alphaTexture.data.shrink_to_fit();
         }
+
+        for (uint32_t mip = 0; mip < geometry.bakeDesc.texture.mipNum; ++mip)
+            geometry.bakeDesc.texture.mips[mip].nriTextureOrPtr.ptr = nullptr;
     }
 }
 
-void Sample::FillOmmBlasBuildQueue(const OmmBatch& batch, std::vector<ommhelper::MaskedGeometryBuildDesc*>& outBuildQueue)
+bool Sample::IsOmmAlphaBoundsAvailable(const ommhelper::OmmBakeDesc& bakeDesc, const AlphaTestedGeometry& geometry, uint64_t boundsStateHash)
 {
-    outBuildQueue.clear();
-    outBuildQueue.reserve(batch.count);
+    uint64_t hash = GetOmmCacheHash(geometry);
+    if (m_OmmAlphaBounds.count(std::make_pair(boundsStateHash, hash)))
+        return true;
+    return bakeDesc.enableCache && ommhelper::OmmCaching::LookForCache(GetOmmAlphaBoundsFilename().c_str(), boundsStateHash, hash);
+}
 
-    size_t uploadBufferOffset = m_OmmCpuUploadBuffers.size();
-    for (size_t id = batch.offset; id < batch.offset + batch.count; ++id)
-    {
-        AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
-        ommhelper::OmmBakeGeometryDesc& bakeResult = geometry.bakeDesc;
-        ommhelper::MaskedGeometryBuildDesc& buildDesc = geometry.buildDesc;
-        const utils::Mesh& mesh = m_Scene.meshes[geometry.meshIndex];
+bool Sample::ReadOmmAlphaBoundsFromCache(uint64_t hash, uint64_t boundsStateHash, ommhelper::OmmAlphaBounds& outBounds)
+{ // Bounds share the mask cache format: bounds go to the ArrayData slot, levels to the DescArray slot
+    const std::string cacheFileName = GetOmmAlphaBoundsFilename();
+    ommhelper::OmmCaching::OmmData data = {};
+    if (!ommhelper::OmmCaching::ReadMaskFromCache(cacheFileName.c_str(), data, boundsStateHash, hash, nullptr))
+        return false;
+
+    outBounds.bounds.resize(data.sizes[(uint32_t)ommhelper::OmmDataLayout::ArrayData]);
+    outBounds.levels.resize(data.sizes[(uint32_t)ommhelper::OmmDataLayout::DescArray]);
+    data.data[(uint32_t)ommhelper::OmmDataLayout::ArrayData] = outBounds.bounds.data();
+    data.data[(uint32_t)ommhelper::OmmDataLayout::DescArray] = outBounds.levels.data();
+    if (!ommhelper::OmmCaching::ReadMaskFromCache(cacheFileName.c_str(), data, boundsStateHash, hash, nullptr))
+        return false;
+
+    uint64_t boundsSize = 0;
+    for (uint8_t level : outBounds.levels)
+        boundsSize += 1ull << (2 * level);
+    return boundsSize == outBounds.bounds.size();
+}
 
-        ommhelper::InputBuffer& vertices = buildDesc.inputs.vertices;
-        vertices.nriBufferOrPtr.buffer = geometry.positions;
-        vertices.format = geometry.vertexFormat;
-        vertices.stride = sizeof(float3);
-        vertices.numElements = mesh.vertexNum;
-        vertices.offset = geometry.positionOffset;
-        vertices.bufferSize = geometry.positionBufferSize;
-        vertices.offsetInStruct = 0;
+void Sample::BakeOmmCpuFromAlphaBounds(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch, const std::vector<ommhelper::OmmBakeGeometryDesc*>& bakeQueue)
+{ // Bounds come from memory or from the bounds cache, only the rest samples alpha textures. The threshold pass never does
+    const std::set<const ommhelper::OmmBakeGeometryDesc*> queued(bakeQueue.begin(), bakeQueue.end());
+    const uint64_t boundsStateHash = ommhelper::AlphaBoundsBaker::CalculateStateHash(bakeDesc);
 
-        ommhelper::InputBuffer& indices = buildDesc.inputs.indices;
-        indices = bakeResult.indices;
-        indices.nriBufferOrPtr.buffer = geometry.indices;
+    std::vector<ommhelper::OmmBakeGeometryDesc*> boundsQueue;
+    std::vector<std::pair<uint64_t, uint64_t>> boundsKeys;
+    for (size_t i = batch.offset; i < batch.offset + batch.count; ++i)
+    {
+        AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
+        if (!queued.count(&geometry.bakeDesc))
+            continue;
 
-        if (bakeResult.outData[(uint32_t)ommhelper::OmmDataLayout::IndexHistogram].empty())
+        uint64_t hash = GetOmmCacheHash(geometry);
+        std::pair<uint64_t, uint64_t> key = std::make_pair(boundsStateHash, hash);
+        if (m_OmmAlphaBounds.count(key))
+        {
+            ++m_OmmAlphaBoundsCounts[2];
             continue;
+        }
 
-        buildDesc.inputs.ommIndexFormat = bakeResult.outOmmIndexFormat;
+        ommhelper::OmmAlphaBounds bounds;
+        if (bakeDesc.enableCache && ReadOmmAlphaBoundsFromCache(hash, boundsStateHash, bounds))
+        {
+            m_OmmAlphaBoundsSize += bounds.GetSize();
+            m_OmmAlphaBounds[key] = std::move(bounds);
+            ++m_OmmAlphaBoundsCounts[1];
+            continue;
+        }
+
+        boundsQueue.push_back(&geometry.bakeDesc);
+        boundsKeys.push_back(key);
+    }
+
+    if (!boundsQueue.empty())
+    {
+        AcquireOmmCpuAlphaTextures(bakeDesc, batch, boundsQueue);
+        auto boundsStart = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < boundsQueue.size(); ++i)
+            ommhelper::AlphaBoundsBaker::Bake(*boundsQueue[i], bakeDesc, m_OmmAlphaBounds[boundsKeys[i]], 0);
+        std::chrono::duration<double, std::milli> boundsTime = std::chrono::high_resolution_clock::now() - boundsStart;
+        m_OmmAlphaBoundsTimeMs[0] += boundsTime.count();
+        ReleaseOmmCpuAlphaTextures(batch, boundsQueue);
+
+        if (bakeDesc.enableCache)
+            ommhelper::OmmCaching::CreateFolder(m_OmmCacheFolderName.c_str());
+
+        for (const std::pair<uint64_t, uint64_t>& key : boundsKeys)
+        {
+            const ommhelper::OmmAlphaBounds& bounds = m_OmmAlphaBounds[key];
+            m_OmmAlphaBoundsSize += bounds.GetSize();
+            ++m_OmmAlphaBoundsCounts[0];
+            if (!bakeDesc.enableCache || bounds.bounds.empty())
+                continue;
+
+            ommhelper::OmmCaching::OmmData data = {};
+            data.data[(uint32_t)ommhelper::OmmDataLayout::ArrayData] = (void*)bounds.bounds.data();
+            data.sizes[(uint32_t)ommhelper::OmmDataLayout::ArrayData] = bounds.bounds.size();
+            data.data[(uint32_t)ommhelper::OmmDataLayout::DescArray] = (void*)bounds.levels.data();
+            data.sizes[(uint32_t)ommhelper::OmmDataLayout::DescArray] = bounds.levels.size();
+            ommhelper::OmmCaching::SaveMasksToDisc(GetOmmAlphaBoundsFilename().c_str(), data, key.first, key.second, 0);
+        }
+    }
+
+    auto thresholdStart = std::chrono::high_resolution_clock::now();
+    for (size_t i = batch.offset; i < batch.offset + batch.count; ++i)
+    {
+        AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
+        if (!queued.count(&geometry.bakeDesc))
+            continue;
+
+        const ommhelper::OmmAlphaBounds& bounds = m_OmmAlphaBounds[std::make_pair(boundsStateHash, GetOmmCacheHash(geometry))];
+        ommhelper::AlphaBoundsBaker::Threshold(bounds, bakeDesc.alphaCutoff, bakeDesc, geometry.bakeDesc, 0);
+    }
+    std::chrono::duration<double, std::milli> thresholdTime = std::chrono::high_resolution_clock::now() - thresholdStart;
+    m_OmmAlphaBoundsTimeMs[1] += thresholdTime.count();
+}
+
+void Sample::ReleaseStaleOmmAlphaBounds(const ommhelper::OmmBakeDesc& bakeDesc)
+{ // Bounds stay resident for re-thresholding while everything but the cutoff, format and index flags matches one of the LODs
+    std::set<uint64_t> boundsStateHashes;
+    if (bakeDesc.type == ommhelper::OmmBakerType::CPU && bakeDesc.cpuFlags.enableAlphaBounds)
+    {
+        ommhelper::OmmBakeDesc lodDesc = bakeDesc;
+        for (uint32_t lod = 0; lod < m_OmmLodNum && lod * m_OmmLodLevelStep < bakeDesc.subdivisionLevel; ++lod)
+        {
+            lodDesc.subdivisionLevel = bakeDesc.subdivisionLevel - lod * m_OmmLodLevelStep;
+            boundsStateHashes.insert(ommhelper::AlphaBoundsBaker::CalculateStateHash(lodDesc));
+        }
+    }
+
+    for (auto it = m_OmmAlphaBounds.begin(); it != m_OmmAlphaBounds.end();)
+    {
+        if (boundsStateHashes.count(it->first.first))
+        {
+            ++it;
+            continue;
+        }
+        m_OmmAlphaBoundsSize -= it->second.GetSize();
+        it = m_OmmAlphaBounds.erase(it);
+    }
+}
+
+void PrepareOmmUsageCountsBuffers(ommhelper::OpacityMicroMapsHelper& ommHelper, ommhelper::OmmBakeGeometryDesc& desc)
+{ // Sanitize baker outputed usageCounts buffers to fit GAPI format
+    uint32_t usageCountBuffers[] = { (uint32_t)ommhelper::OmmDataLayout::DescArrayHistogram, (uint32_t)ommhelper::OmmDataLayout::IndexHistogram };
+
+    for (size_t i = 0; i < helper::GetCountOf(usageCountBuffers); ++i)
+    {
+        std::vector<uint8_t> buffer = desc.outData[usageCountBuffers[i]];
+        size_t convertedCountsSize = 0;
+        ommHelper.ConvertUsageCountsToApiFormat(nullptr, convertedCountsSize, buffer.data(), buffer.size());
+        desc.outData[usageCountBuffers[i]].resize(convertedCountsSize);
+        ommHelper.ConvertUsageCountsToApiFormat(desc.outData[usageCountBuffers[i]].data(), convertedCountsSize, buffer.data(), buffer.size());
+    }
+}
+
+uint64_t PrepareCpuBuilderInputs(NRIInterface& NRI, nri::CommandBuffer* commandBuffer, const OmmBatch& batch, std::vector<AlphaTestedGeometry>& geometries)
+{ // Copy raw mask data to the upload heaps and record the upload to the device local build inputs
+    uint64_t uploadSize = 0;
+    for (size_t i = batch.offset; i < batch.offset + batch.count; ++i)
+    {
+        AlphaTestedGeometry& geometry = geometries[i];
+        const ommhelper::OmmBakeGeometryDesc& bakeResult = geometry.bakeDesc;
+        if (bakeResult.outData[(uint32_t)ommhelper::OmmDataLayout::DescArrayHistogram].empty())
+            continue;
+
+        ommhelper::MaskedGeometryBuildDesc& buildDesc = geometry.buildDesc;
+        for (uint32_t y = 0; y < (uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum; ++y)
+        {
+            nri::Buffer* buffer = geometry.stagingBuffers[y];
+            if (!buffer)
+                continue; // OMM array comes from the cache
+
+            uint64_t mapSize = (uint64_t)bakeResult.outData[y].size();
+            void* map = NRI.MapBuffer(*buffer, 0, mapSize);
+            memcpy(map, bakeResult.outData[y].data(), bakeResult.outData[y].size());
+            NRI.UnmapBuffer(*buffer);
+
+            NRI.CmdCopyBuffer(*commandBuffer, *buildDesc.inputs.buffers[y].buffer, 0, 0, *buffer, 0, 0, mapSize);
+            uploadSize += mapSize;
+        }
+    }
+    return uploadSize;
+}
+
+void Sample::FillOmmBlasGeometryInputs(AlphaTestedGeometry& geometry)
+{
+    const ommhelper::OmmBakeGeometryDesc& bakeResult = geometry.bakeDesc;
+    ommhelper::MaskedGeometryBuildDesc& buildDesc = geometry.buildDesc;
+    const utils::Mesh& mesh = m_Scene.meshes[geometry.meshIndex];
+
+    ommhelper::InputBuffer& vertices = buildDesc.inputs.vertices;
+    vertices.nriBufferOrPtr.buffer = geometry.positions;
+    vertices.format = geometry.vertexFormat;
+    vertices.stride = sizeof(float3);
+    vertices.numElements = mesh.vertexNum;
+    vertices.offset = geometry.positionOffset;
+    vertices.bufferSize = geometry.positionBufferSize;
+    vertices.offsetInStruct = 0;
+
+    ommhelper::InputBuffer& indices = buildDesc.inputs.indices;
+    indices = bakeResult.indices;
+    indices.nriBufferOrPtr.buffer = geometry.indices;
+
+    for (uint32_t j = 0; j < (uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum; ++j)
+        geometry.stagingBuffers[j] = nullptr;
+}
+
+void Sample::FillOmmArraySerializationInputs(AlphaTestedGeometry& geometry)
+{
+    ommhelper::MaskedGeometryBuildDesc& buildDesc = geometry.buildDesc;
+    buildDesc.inputs.serializedOmmArray = nullptr;
+    buildDesc.inputs.serializedOmmArraySize = 0;
+    buildDesc.inputs.serializeOmmArray = false;
+    if (m_OmmArrayCache.Read(GetOmmCacheHash(geometry), geometry.serializedOmmArray))
+    {
+        buildDesc.inputs.serializedOmmArray = geometry.serializedOmmArray.data();
+        buildDesc.inputs.serializedOmmArraySize = geometry.serializedOmmArray.size();
+    }
+    else
+        buildDesc.inputs.serializeOmmArray = m_OmmArrayCache.IsEnabled();
+}
+
+uint64_t Sample::FillOmmBlasBuildQueue(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch, std::vector<ommhelper::MaskedGeometryBuildDesc*>& outBuildQueue)
+{ // Returns the copy queue fence value the build has to wait for, 0 if nothing is uploaded
+    outBuildQueue.clear();
+    outBuildQueue.reserve(batch.count);
+
+    // Geometry inputs, index compaction and histogram conversion are independent per geometry and run on the prepare threads.
+    // Cache reads, statistics and buffer allocations follow in a serial pass in id order, so the memory layout doesn't depend on scheduling
+    const bool force32bitIndices = bakeDesc.type == ommhelper::OmmBakerType::GPU ? bakeDesc.gpuFlags.force32bitIndices : bakeDesc.cpuFlags.force32bitIndices;
+    std::vector<uint64_t> indexBufferSizes(batch.count * 2, 0); // [before, after] compaction, cpu side outputs only
+    ommhelper::ParallelFor(batch.count, m_OmmHelper.GetPrepareThreadNum(), [&](size_t i)
+    {
+        AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[batch.offset + i];
+        ommhelper::OmmBakeGeometryDesc& bakeResult = geometry.bakeDesc;
+        ommhelper::MaskedGeometryBuildDesc& buildDesc = geometry.buildDesc;
+        FillOmmBlasGeometryInputs(geometry);
+
+        if (bakeResult.outData[(uint32_t)ommhelper::OmmDataLayout::IndexHistogram].empty())
+            return;
+
+        if (!AreBakerOutputsOnGPU(bakeResult))
+        { // index width stage: gpu resident outputs keep the gpu baker choice (16 bit unless forced)
+            indexBufferSizes[i * 2] = bakeResult.outData[(uint32_t)ommhelper::OmmDataLayout::Indices].size();
+            if (!force32bitIndices)
+                m_OmmHelper.CompactOmmIndices(bakeResult);
+            indexBufferSizes[i * 2 + 1] = bakeResult.outData[(uint32_t)ommhelper::OmmDataLayout::Indices].size();
+        }
+
+        buildDesc.inputs.ommIndexFormat = bakeResult.outOmmIndexFormat;
         buildDesc.inputs.ommIndexStride = bakeResult.outOmmIndexStride;
 
         PrepareOmmUsageCountsBuffers(m_OmmHelper, bakeResult);
 
+        buildDesc.inputs.descArrayHistogram = bakeResult.outData[(uint32_t)ommhelper::OmmDataLayout::DescArrayHistogram].data();
+        buildDesc.inputs.descArrayHistogramNum = bakeResult.outDescArrayHistogramCount;
+
+        buildDesc.inputs.indexHistogram = bakeResult.outData[(uint32_t)ommhelper::OmmDataLayout::IndexHistogram].data();
+        buildDesc.inputs.indexHistogramNum = bakeResult.outIndexHistogramCount;
+    });
+
+    std::vector<nri::Buffer*> stagingBuffers;
+    std::vector<nri::Buffer*> inputBuffers;
+    bool hasGpuResidentOutputs = false;
+    for (size_t i = 0; i < batch.count; ++i)
+    {
+        AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[batch.offset + i];
+        ommhelper::OmmBakeGeometryDesc& bakeResult = geometry.bakeDesc;
+        ommhelper::MaskedGeometryBuildDesc& buildDesc = geometry.buildDesc;
+        if (bakeResult.outData[(uint32_t)ommhelper::OmmDataLayout::IndexHistogram].empty())
+            continue;
+
+        m_OmmIndexBufferSizes[0] += indexBufferSizes[i * 2];
+        m_OmmIndexBufferSizes[1] += indexBufferSizes[i * 2 + 1];
+        FillOmmArraySerializationInputs(geometry);
+
         if (AreBakerOutputsOnGPU(bakeResult))
         {
+            hasGpuResidentOutputs = true;
             for (uint32_t j = 0; j < (uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum; ++j)
                 buildDesc.inputs.buffers[j] = bakeResult.gpuBuffers[j];
         }
         else
-        { // Create upload buffers to store baker output during ommArray/blas creation
+        { // Create device local buffers to store baker output during ommArray/blas creation, filled from the upload heaps on the copy queue
             nri::BufferDesc bufferDesc = {};
             bufferDesc.physicalDeviceMask = 0;
-            bufferDesc.usageMask = nri::BufferUsageBits::SHADER_RESOURCE;
 
             for (uint32_t j = 0; j < (uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum; ++j)
             {
+                buildDesc.inputs.buffers[j] = {};
+                if (buildDesc.inputs.serializedOmmArray && j != (uint32_t)ommhelper::OmmDataLayout::Indices)
+                    continue; // only the blas reads baker output then
+
                 bufferDesc.size = bakeResult.outData[j].size();
                 buildDesc.inputs.buffers[j].dataSize = bufferDesc.size;
                 buildDesc.inputs.buffers[j].bufferSize = bufferDesc.size;
+
+                bufferDesc.usageMask = nri::BufferUsageBits::SHADER_RESOURCE;
                 NRI.CreateBuffer(*m_Device, bufferDesc, buildDesc.inputs.buffers[j].buffer);
-                m_OmmCpuUploadBuffers.push_back(buildDesc.inputs.buffers[j].buffer);
+                inputBuffers.push_back(buildDesc.inputs.buffers[j].buffer);
+
+                bufferDesc.usageMask = nri::BufferUsageBits::NONE;
+                NRI.CreateBuffer(*m_Device, bufferDesc, geometry.stagingBuffers[j]);
+                stagingBuffers.push_back(geometry.stagingBuffers[j]);
             }
         }
+        outBuildQueue.push_back(&buildDesc);
+    }
 
-        buildDesc.inputs.descArrayHistogram = bakeResult.outData[(uint32_t)ommhelper::OmmDataLayout::DescArrayHistogram].data();
-        buildDesc.inputs.descArrayHistogramNum = bakeResult.outDescArrayHistogramCount;
+    if (m_OmmUseBatchRecords && bakeDesc.enableCache && !hasGpuResidentOutputs)
+        SaveOmmBatchRecord(bakeDesc, batch); // histograms and indices are in their final format now
 
-        buildDesc.inputs.indexHistogram = bakeResult.outData[(uint32_t)ommhelper::OmmDataLayout::IndexHistogram].data();
-        buildDesc.inputs.indexHistogramNum = bakeResult.outIndexHistogramCount;
+    if (stagingBuffers.empty())
+        return 0;
+
+    { // Bind cpu baker output memories. Both sets live until the build is finished
+        BindBuffersToMemory(NRI, m_Device, stagingBuffers.data(), stagingBuffers.size(), m_OmmTmpAllocations, nri::MemoryLocation::HOST_UPLOAD);
+        BindBuffersToMemory(NRI, m_Device, inputBuffers.data(), inputBuffers.size(), m_OmmTmpAllocations, nri::MemoryLocation::DEVICE);
+        m_OmmBuildInputBuffers.insert(m_OmmBuildInputBuffers.end(), stagingBuffers.begin(), stagingBuffers.end());
+        m_OmmBuildInputBuffers.insert(m_OmmBuildInputBuffers.end(), inputBuffers.begin(), inputBuffers.end());
+    }
+
+    WaitForOmmCopies();
+    m_OmmCopyContext.BeginRecording(NRI);
+    {
+        uint32_t eventId = m_OmmCopyContext.BeginEvent(NRI, OmmTimelineSection::Upload);
+        m_OmmCopyBytes[0] += PrepareCpuBuilderInputs(NRI, m_OmmCopyContext.commandBuffer, batch, m_OmmAlphaGeometry);
+        m_OmmCopyContext.EndEvent(NRI, eventId);
+    }
+    return m_OmmCopyContext.Submit(NRI);
+}
+
+uint64_t Sample::FillOmmBlasBuildQueueFromRecord(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch, const OmmBatchRecord& record, std::vector<ommhelper::MaskedGeometryBuildDesc*>& outBuildQueue)
+{ // The gpu data chunk is read straight into one upload buffer and copied with a single command
+    outBuildQueue.clear();
+    outBuildQueue.reserve(batch.count);
+
+    nri::Buffer* stagingBuffer = nullptr;
+    nri::Buffer* inputBuffer = nullptr;
+    if (record.gpuDataSize)
+    {
+        nri::BufferDesc bufferDesc = {};
+        bufferDesc.physicalDeviceMask = 0;
+        bufferDesc.size = record.gpuDataSize;
+
+        bufferDesc.usageMask = nri::BufferUsageBits::NONE;
+        NRI.CreateBuffer(*m_Device, bufferDesc, stagingBuffer);
+        BindBuffersToMemory(NRI, m_Device, &stagingBuffer, 1, m_OmmTmpAllocations, nri::MemoryLocation::HOST_UPLOAD);
+
+        bufferDesc.usageMask = nri::BufferUsageBits::SHADER_RESOURCE;
+        NRI.CreateBuffer(*m_Device, bufferDesc, inputBuffer);
+        BindBuffersToMemory(NRI, m_Device, &inputBuffer, 1, m_OmmTmpAllocations, nri::MemoryLocation::DEVICE);
+
+        m_OmmBuildInputBuffers.push_back(stagingBuffer);
+        m_OmmBuildInputBuffers.push_back(inputBuffer);
+
+        ommhelper::OmmCaching::OmmData data = {};
+        data.data[(uint32_t)OmmBatchRecordChunk::GpuData] = NRI.MapBuffer(*stagingBuffer, 0, record.gpuDataSize);
+        bool isRead = ommhelper::OmmCaching::ReadMaskFromCache(GetOmmBatchRecordFilename().c_str(), data, GetOmmBatchRecordStateHash(bakeDesc), GetOmmBatchHash(batch), nullptr);
+        NRI.UnmapBuffer(*stagingBuffer);
+        if (!isRead)
+        {
+            printf("[FAIL]: Batch record lost after its lookup, batch [%llu, %llu) is built without OMMs\n", (unsigned long long)batch.offset, (unsigned long long)(batch.offset + batch.count));
+            return 0;
+        }
+    }
+
+    for (size_t i = 0; i < batch.count; ++i)
+    {
+        AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[batch.offset + i];
+        ommhelper::OmmBakeGeometryDesc& bakeResult = geometry.bakeDesc;
+        ommhelper::MaskedGeometryBuildDesc& buildDesc = geometry.buildDesc;
+        const OmmBatchRecordEntry& entry = record.entries[i];
+        FillOmmBlasGeometryInputs(geometry);
+
+        if (!entry.histogramSizes[1])
+            continue;
+
+        bakeResult.outOmmIndexFormat = (nri::Format)entry.ommIndexFormat;
+        bakeResult.outOmmIndexStride = entry.ommIndexStride;
+        bakeResult.outDescArrayHistogramCount = entry.histogramNums[0];
+        bakeResult.outIndexHistogramCount = entry.histogramNums[1];
+
+        buildDesc.inputs.ommIndexFormat = bakeResult.outOmmIndexFormat;
+        buildDesc.inputs.ommIndexStride = bakeResult.outOmmIndexStride;
+        FillOmmArraySerializationInputs(geometry);
+
+        for (uint32_t j = 0; j < (uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum; ++j)
+        {
+            ommhelper::GpuBakerBuffer& input = buildDesc.inputs.buffers[j];
+            input.buffer = inputBuffer;
+            input.bufferSize = record.gpuDataSize;
+            input.dataSize = entry.sizes[j];
+            input.offset = entry.offsets[j];
+        }
+
+        buildDesc.inputs.descArrayHistogram = (void*)(record.histograms.data() + entry.histogramOffsets[0]);
+        buildDesc.inputs.descArrayHistogramNum = entry.histogramNums[0];
+
+        buildDesc.inputs.indexHistogram = (void*)(record.histograms.data() + entry.histogramOffsets[1]);
+        buildDesc.inputs.indexHistogramNum = entry.histogramNums[1];
         outBuildQueue.push_back(&buildDesc);
     }
 
-    if (m_OmmCpuUploadBuffers.empty() == false)
-    { // Bind cpu baker output memories
-        size_t uploadBufferCount = m_OmmCpuUploadBuffers.size() - uploadBufferOffset;
-        BindBuffersToMemory(NRI, m_Device, m_OmmCpuUploadBuffers.data() + uploadBufferOffset, uploadBufferCount, m_OmmTmpAllocations, nri::MemoryLocation::HOST_UPLOAD);
-        PrepareCpuBuilderInputs(NRI, batch, m_OmmAlphaGeometry);
+    if (!stagingBuffer)
+        return 0;
+
+    WaitForOmmCopies();
+    m_OmmCopyContext.BeginRecording(NRI);
+    {
+        uint32_t eventId = m_OmmCopyContext.BeginEvent(NRI, OmmTimelineSection::Upload);
+        NRI.CmdCopyBuffer(*m_OmmCopyContext.commandBuffer, *inputBuffer, 0, 0, *stagingBuffer, 0, 0, record.gpuDataSize);
+        m_OmmCopyContext.EndEvent(NRI, eventId);
+        m_OmmCopyBytes[0] += record.gpuDataSize;
     }
+    return m_OmmCopyContext.Submit(NRI);
+}
 
+void Sample::ReleaseOmmBakeOutputs(const OmmBatch& batch, uint32_t lod)
+{
     for (size_t id = batch.offset; id < batch.offset + batch.count; ++id)
-    { // Release raw cpu side data. In case of cpu baker it's in the upload heaps, in case of gpu it's already saved as cache
+    { // Release raw cpu side data. In case of cpu baker it's in the build inputs, in case of gpu it's already saved as cache
         AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
         ommhelper::OmmBakeGeometryDesc& bakeResult = geometry.bakeDesc;
+        if (lod == 0) // the AHS estimator evaluates the finest variant
+            geometry.retainedOmmIndexStride = bakeResult.outOmmIndexStride;
         for (uint32_t k = 0; k < (uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum; ++k)
         {
+            if (lod == 0)
+            {
+                geometry.retainedOmmData[k].clear();
+                geometry.retainedOmmData[k].shrink_to_fit();
+                if (m_OmmKeepBakeOutput)
+                    std::swap(geometry.retainedOmmData[k], bakeResult.outData[k]);
+            }
+
              bakeResult.outData[k].resize(0);
              bakeResult.outData[k].shrink_to_fit();
         }
     }
 }
 
-void CopyBatchToReadBackBuffer(const NRIInterface& NRI, nri::CommandBuffer* commandBuffer, ommhelper::OmmBakeGeometryDesc& firstInBatch, ommhelper::OmmBakeGeometryDesc& lastInBatch, uint32_t bufferId)
+uint64_t CopyBatchToReadBackBuffer(const NRIInterface& NRI, nri::CommandBuffer* commandBuffer, ommhelper::OmmBakeGeometryDesc& firstInBatch, ommhelper::OmmBakeGeometryDesc& lastInBatch, uint32_t bufferId)
 {
     ommhelper::GpuBakerBuffer& firstResource = firstInBatch.gpuBuffers[bufferId];
     ommhelper::GpuBakerBuffer& lastResource = lastInBatch.gpuBuffers[bufferId];
@@ -1604,6 +2759,7 @@ void CopyBatchToReadBackBuffer(const NRIInterface& NRI, nri::CommandBuffer* comm
 
     size_t size = (lastResource.offset + lastResource.dataSize) - firstResource.offset;//total size of baker output for the batch
     NRI.CmdCopyBuffer(*commandBuffer, *dst, 0, dstOffset, *src, 0, srcOffset, size);
+    return size;
 }
 
 void CopyFromReadBackBuffer(const NRIInterface& NRI, ommhelper::OmmBakeGeometryDesc& desc, size_t id)
@@ -1623,50 +2779,52 @@ void CopyFromReadBackBuffer(const NRIInterface& NRI, ommhelper::OmmBakeGeometryD
     NRI.UnmapBuffer(*readback);
 }
 
-OmmGpuBakerPrebuildMemoryStats Sample::GetGpuBakerPrebuildMemoryStats(bool printStats)
-{
+OmmGpuBakerPrebuildMemoryStats GetGpuBakerPrebuildMemoryStats(OmmGeometryTable& table, size_t sizeAlignment)
+{ // Queued sizes are aligned in place, the rest are zero
     OmmGpuBakerPrebuildMemoryStats result = {};
-    uint32_t sizeAlignment = NRI.GetDeviceDesc(*m_Device).storageBufferOffsetAlignment;
-    for (size_t i = 0; i < m_OmmAlphaGeometry.size(); ++i)
+    for (uint32_t y = 0; y < (uint32_t)ommhelper::OmmDataLayout::GpuOutputNum; ++y)
     {
-        AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
-        ommhelper::OmmBakeGeometryDesc& instance = geometry.bakeDesc;
-        ommhelper::OmmBakeGeometryDesc::GpuBakerPrebuildInfo& gpuBakerPreBuildInfo = instance.gpuBakerPreBuildInfo;
-
-        for (uint32_t y = 0; y < (uint32_t)ommhelper::OmmDataLayout::GpuOutputNum; ++y)
+        std::vector<uint64_t>& sizes = table.dataSizes[y];
+        for (uint32_t id : table.queue)
         {
-            gpuBakerPreBuildInfo.dataSizes[y] = helper::Align(gpuBakerPreBuildInfo.dataSizes[y], sizeAlignment);
-            result.outputTotalSizes[y] += gpuBakerPreBuildInfo.dataSizes[y];
-            result.outputMaxSizes[y] = std::max<size_t>(gpuBakerPreBuildInfo.dataSizes[y], result.outputMaxSizes[y]);
-            result.total += gpuBakerPreBuildInfo.dataSizes[y];
+            sizes[id] = helper::Align(sizes[id], sizeAlignment);
+            result.outputTotalSizes[y] += sizes[id];
+            result.outputMaxSizes[y] = std::max<size_t>(sizes[id], result.outputMaxSizes[y]);
         }
+        result.total += result.outputTotalSizes[y];
+    }
 
-        for (size_t y = 0; y < OMM_MAX_TRANSIENT_POOL_BUFFERS; ++y)
+    for (size_t y = 0; y < OMM_MAX_TRANSIENT_POOL_BUFFERS; ++y)
+    {
+        std::vector<uint64_t>& sizes = table.transientBufferSizes[y];
+        for (uint32_t id : table.queue)
         {
-            gpuBakerPreBuildInfo.transientBufferSizes[y] = helper::Align(gpuBakerPreBuildInfo.transientBufferSizes[y], sizeAlignment);
-            result.maxTransientBufferSizes[y] = std::max(result.maxTransientBufferSizes[y], gpuBakerPreBuildInfo.transientBufferSizes[y]);
+            sizes[id] = helper::Align(sizes[id], sizeAlignment);
+            result.maxTransientBufferSizes[y] = std::max<size_t>(result.maxTransientBufferSizes[y], sizes[id]);
         }
     }
+    return result;
+}
 
-    auto toBytes = [](size_t sizeInMb) -> size_t { return sizeInMb * 1024 * 1024; };
-    const size_t defaultSizes[] = { toBytes(64), toBytes(5), toBytes(5), toBytes(5), toBytes(5), 1024 };
+OmmGpuBakerPrebuildMemoryStats Sample::GetGpuBakerPrebuildMemoryStats(const ommhelper::OmmBakeDesc& bakeDesc, bool printStats)
+{
+    OmmGpuBakerPrebuildMemoryStats result = GetGpuBakerPrebuildMemoryStats(m_OmmGeometryTable, NRI.GetDeviceDesc(*m_Device).storageBufferOffsetAlignment);
 
-    if (m_OmmBakeDesc.type == ommhelper::OmmBakerType::GPU && printStats)
+    if (bakeDesc.type == ommhelper::OmmBakerType::GPU && printStats)
     {
         uint64_t totalPrimitiveNum = 0;
         uint64_t maxPrimitiveNum = 0;
-        for (auto& geomtry : m_OmmAlphaGeometry)
+        for (uint32_t primitiveNum : m_OmmGeometryTable.primitiveNums)
         {
-            uint64_t numPrimitives = geomtry.bakeDesc.indices.numElements / 3;
-            totalPrimitiveNum += numPrimitives;
-            maxPrimitiveNum = std::max<uint64_t>(maxPrimitiveNum, numPrimitives);
+            totalPrimitiveNum += primitiveNum;
+            maxPrimitiveNum = std::max<uint64_t>(maxPrimitiveNum, primitiveNum);
         }
 
         auto toMb = [](size_t sizeInBytes) -> double { return double(sizeInBytes) / 1024.0 / 1024.0; };
         printf("\n[OMM][GPU] PreBake Stats:\n");
-        printf("Mask Format: [%s]\n", m_OmmBakeDesc.format == ommhelper::OmmFormats::OC1_2_STATE ? "OC1_2_STATE" : "OC1_4_STATE");
-        printf("Subdivision Level: [%lu]\n", m_OmmBakeDesc.subdivisionLevel);
-        printf("Mip Bias: [%lu]\n", m_OmmBakeDesc.mipBias);
+        printf("Mask Format: [%s]\n", bakeDesc.format == ommhelper::OmmFormats::OC1_2_STATE ? "OC1_2_STATE" : "OC1_4_STATE");
+        printf("Subdivision Level: [%lu]\n", bakeDesc.subdivisionLevel);
+        printf("Mip Bias: [%lu]\n", bakeDesc.mipBias);
         printf("Num Geometries: [%llu]\n", m_OmmAlphaGeometry.size());
         printf("Num Primitives: Max:[%llu],  Total:[%llu]\n", maxPrimitiveNum, totalPrimitiveNum);
         printf("Baker output memeory requested(mb): (total)%.3f\n", toMb(result.total));
@@ -1677,22 +2835,40 @@ OmmGpuBakerPrebuildMemoryStats Sample::GetGpuBakerPrebuildMemoryStats(bool print
     return result;
 }
 
-std::vector<OmmBatch> GetGpuBakerBatches(const std::vector<AlphaTestedGeometry>& geometries, const OmmGpuBakerPrebuildMemoryStats& memoryStats, const size_t batchSize)
+void Sample::GatherOmmGpuBakerSizes()
+{ // Prebuild info of the queued descriptors, copied once to the hot table
+    for (uint32_t id : m_OmmGeometryTable.queue)
+    {
+        const ommhelper::OmmBakeGeometryDesc::GpuBakerPrebuildInfo& info = m_OmmAlphaGeometry[id].bakeDesc.gpuBakerPreBuildInfo;
+        for (uint32_t y = 0; y < (uint32_t)ommhelper::OmmDataLayout::GpuOutputNum; ++y)
+            m_OmmGeometryTable.dataSizes[y][id] = info.dataSizes[y];
+        for (size_t y = 0; y < OMM_MAX_TRANSIENT_POOL_BUFFERS; ++y)
+            m_OmmGeometryTable.transientBufferSizes[y][id] = info.transientBufferSizes[y];
+    }
+}
+
+std::vector<ommhelper::OmmBakeGeometryDesc*> Sample::QueueOmmGpuBake(const std::vector<uint32_t>& ids)
+{
+    m_OmmGeometryTable.SetQueue(ids);
+    std::vector<ommhelper::OmmBakeGeometryDesc*> queue(ids.size());
+    for (size_t i = 0; i < ids.size(); ++i)
+        queue[i] = &m_OmmAlphaGeometry[ids[i]].bakeDesc;
+    return queue;
+}
+
+std::vector<OmmBatch> GetGpuBakerBatches(const OmmGeometryTable& table, const OmmGpuBakerPrebuildMemoryStats& memoryStats, const size_t batchSize)
 {
-    const size_t batchMaxSize = batchSize > geometries.size() ? geometries.size() : batchSize;
+    const size_t geometryNum = table.GetSize();
+    const size_t batchMaxSize = batchSize > geometryNum ? geometryNum : batchSize;
     std::vector<OmmBatch> batches(1);
     size_t accumulation[(uint32_t)ommhelper::OmmDataLayout::GpuOutputNum] = {};
-    for (size_t i = 0; i < geometries.size(); ++i)
+    for (size_t i = 0; i < geometryNum; ++i)
     {
-        const AlphaTestedGeometry& geometry = geometries[i];
-        const ommhelper::OmmBakeGeometryDesc& bakeDesc = geometry.bakeDesc;
-        const ommhelper::OmmBakeGeometryDesc::GpuBakerPrebuildInfo& info = bakeDesc.gpuBakerPreBuildInfo;
-
         bool isAnyOverLimit = false;
         size_t nextSizes[(uint32_t)ommhelper::OmmDataLayout::GpuOutputNum] = {};
         for (uint32_t y = 0; y < (uint32_t)ommhelper::OmmDataLayout::GpuOutputNum; ++y)
         {
-            nextSizes[y] = accumulation[y] + info.dataSizes[y];
+            nextSizes[y] = accumulation[y] + table.dataSizes[y][i];
             isAnyOverLimit |= nextSizes[y] > memoryStats.outputMaxSizes[y];
         }
 
@@ -1700,7 +2876,7 @@ std::vector<OmmBatch> GetGpuBakerBatches(const std::vector<AlphaTestedGeometry>&
         {
             batches.push_back({ i, 1 });
             for (uint32_t y = 0; y < (uint32_t)ommhelper::OmmDataLayout::GpuOutputNum; ++y)
-                accumulation[y] = info.dataSizes[y];
+                accumulation[y] = table.dataSizes[y][i];
             continue;
         }
 
@@ -1710,7 +2886,7 @@ std::vector<OmmBatch> GetGpuBakerBatches(const std::vector<AlphaTestedGeometry>&
         ++batches.back().count;
         if (batches.back().count >= batchMaxSize)
         {
-            if (i + 1 < geometries.size())
+            if (i + 1 < geometryNum)
             {
                 batches.push_back({ i + 1, 0 });
                 for (uint32_t y = 0; y < (uint32_t)ommhelper::OmmDataLayout::GpuOutputNum; ++y)
@@ -1722,6 +2898,73 @@ std::vector<OmmBatch> GetGpuBakerBatches(const std::vector<AlphaTestedGeometry>&
     return batches;
 }
 
+void Sample::RunOmmPlanningBenchmark(uint32_t geometryNum)
+{ // Cpu side only: the cache skip scan, memory stats and batching of BakeOmmLod on a synthetic table, half of it cached
+    const uint32_t iterationNum = 8;
+    const size_t sizeAlignment = NRI.GetDeviceDesc(*m_Device).storageBufferOffsetAlignment;
+
+    OmmGeometryTable table;
+    table.Resize(geometryNum);
+    std::set<uint64_t> cachedHashes;
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    auto next = [&seed]() -> uint64_t { seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17; return seed; };
+    for (uint32_t id = 0; id < geometryNum; ++id)
+    {
+        table.instanceHashes[id] = GetInstanceHash(id, uint32_t(next() % 64));
+        table.primitiveNums[id] = 2 + uint32_t(next() % 65536);
+        if (next() & 1)
+            cachedHashes.insert(table.instanceHashes[id]);
+    }
+
+    double passTimes[3] = {}; // [scan, memory stats, batching]
+    size_t queueNum = 0;
+    size_t batchNum = 0;
+    for (uint32_t iteration = 0; iteration < iterationNum; ++iteration)
+    {
+        auto scanStart = std::chrono::high_resolution_clock::now();
+        std::vector<uint32_t> queueIds;
+        queueIds.reserve(geometryNum);
+        for (uint32_t id = 0; id < geometryNum; ++id)
+        {
+            if (cachedHashes.find(table.instanceHashes[id]) == cachedHashes.end())
+                queueIds.push_back(id);
+        }
+        table.SetQueue(queueIds);
+        std::chrono::duration<double, std::milli> scanTime = std::chrono::high_resolution_clock::now() - scanStart;
+
+        for (uint32_t id : table.queue)
+        { // stands in for GatherOmmGpuBakerSizes, prebuild info is not available without the baker
+            const uint64_t primitiveNum = table.primitiveNums[id];
+            for (uint32_t y = 0; y < (uint32_t)ommhelper::OmmDataLayout::GpuOutputNum; ++y)
+                table.dataSizes[y][id] = primitiveNum * (y + 1) * 4;
+            for (size_t y = 0; y < OMM_MAX_TRANSIENT_POOL_BUFFERS; ++y)
+                table.transientBufferSizes[y][id] = primitiveNum * 16;
+        }
+
+        auto statsStart = std::chrono::high_resolution_clock::now();
+        OmmGpuBakerPrebuildMemoryStats memoryStats = GetGpuBakerPrebuildMemoryStats(table, sizeAlignment);
+        std::chrono::duration<double, std::milli> statsTime = std::chrono::high_resolution_clock::now() - statsStart;
+
+        auto batchingStart = std::chrono::high_resolution_clock::now();
+        std::vector<OmmBatch> batches = GetGpuBakerBatches(table, memoryStats, 1);
+        std::chrono::duration<double, std::milli> batchingTime = std::chrono::high_resolution_clock::now() - batchingStart;
+
+        passTimes[0] += scanTime.count();
+        passTimes[1] += statsTime.count();
+        passTimes[2] += batchingTime.count();
+        queueNum = table.queue.size();
+        batchNum = batches.size();
+        table.ClearQueue();
+    }
+
+    const size_t hotSize = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t) * ((uint32_t)ommhelper::OmmDataLayout::GpuOutputNum + OMM_MAX_TRANSIENT_POOL_BUFFERS);
+    auto toNs = [&](double timeMs) -> double { return timeMs * 1e6 / double(iterationNum) / double(geometryNum); };
+    printf("[OMM] Planning benchmark: %u geometries, %llu queued, %llu batches\n", geometryNum, (unsigned long long)queueNum, (unsigned long long)batchNum);
+    printf("[OMM] Planning benchmark: scan %.3f ms (%.1f ns/geometry), memory stats %.3f ms (%.1f ns/geometry), batching %.3f ms (%.1f ns/geometry)\n",
+        passTimes[0] / iterationNum, toNs(passTimes[0]), passTimes[1] / iterationNum, toNs(passTimes[1]), passTimes[2] / iterationNum, toNs(passTimes[2]));
+    printf("[OMM] Planning benchmark: hot fields %llu bytes/geometry, cold store %llu bytes/geometry\n", (unsigned long long)hotSize, (unsigned long long)sizeof(AlphaTestedGeometry));
+}
+
 void Sample::CreateAndBindGpuBakerReadbackBuffer(const OmmGpuBakerPrebuildMemoryStats& memoryStats)
 { // for caching gpu produced omm_sdk output
     size_t dataTypeBegin = (size_t)ommhelper::OmmDataLayout::ArrayData;
@@ -1741,16 +2984,15 @@ void Sample::CreateAndBindGpuBakerReadbackBuffer(const OmmGpuBakerPrebuildMemory
 
     { // bind baker instances to the buffer
         size_t perDataTypeOffsets[(size_t)ommhelper::OmmDataLayout::GpuOutputNum] = {};
-        for (size_t id = 0; id < m_OmmAlphaGeometry.size(); ++id)
+        for (uint32_t id : m_OmmGeometryTable.queue)
         {
-            AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
-            ommhelper::OmmBakeGeometryDesc& desc = geometry.bakeDesc;
+            ommhelper::OmmBakeGeometryDesc& desc = m_OmmAlphaGeometry[id].bakeDesc;
             for (size_t i = dataTypeBegin; i < dataTypeEnd; ++i)
             {
                 ommhelper::GpuBakerBuffer& resource = desc.readBackBuffers[i];
                 size_t& offset = perDataTypeOffsets[i];
 
-                resource.dataSize = desc.gpuBakerPreBuildInfo.dataSizes[i];
+                resource.dataSize = m_OmmGeometryTable.dataSizes[i][id];
                 resource.buffer = m_OmmGpuReadbackBuffers[i];
                 resource.bufferSize = memoryStats.outputTotalSizes[i];
                 resource.offset = offset;
@@ -1773,17 +3015,15 @@ void Sample::CreateAndBindGpuBakerArrayDataBuffer(const OmmGpuBakerPrebuildMemor
     BindBuffersToMemory(NRI, m_Device, &m_OmmGpuOutputBuffers[arrayDataId], 1, m_OmmBakerAllocations, nri::MemoryLocation::DEVICE);
 
     size_t offset = 0;
-    for (size_t id = 0; id < m_OmmAlphaGeometry.size(); ++id)
+    for (uint32_t id : m_OmmGeometryTable.queue)
     {
-        AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
-        ommhelper::OmmBakeGeometryDesc& desc = geometry.bakeDesc;
-        ommhelper::GpuBakerBuffer& resource = desc.gpuBuffers[arrayDataId];
+        ommhelper::GpuBakerBuffer& resource = m_OmmAlphaGeometry[id].bakeDesc.gpuBuffers[arrayDataId];
 
-        resource.dataSize = desc.gpuBakerPreBuildInfo.dataSizes[arrayDataId];
+        resource.dataSize = m_OmmGeometryTable.dataSizes[arrayDataId][id];
         resource.buffer = m_OmmGpuOutputBuffers[arrayDataId];
         resource.bufferSize = memoryStats.outputTotalSizes[arrayDataId];
         resource.offset = offset;
-        offset += desc.gpuBakerPreBuildInfo.dataSizes[arrayDataId];
+        offset += resource.dataSize;
     }
 }
 
@@ -1833,20 +3073,19 @@ void Sample::CreateAndBindGpuBakerSatitcBuffers(const OmmGpuBakerPrebuildMemoryS
 
     size_t gpuOffsetsPerType[(uint32_t)ommhelper::OmmDataLayout::GpuOutputNum] = {};
     size_t readBackOffsetsPerType[(uint32_t)ommhelper::OmmDataLayout::GpuOutputNum] = {};
-    for (size_t id = 0; id < m_OmmAlphaGeometry.size(); ++id)
+    for (uint32_t id : m_OmmGeometryTable.queue)
     {
-        AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
-        ommhelper::OmmBakeGeometryDesc& desc = geometry.bakeDesc;
+        ommhelper::OmmBakeGeometryDesc& desc = m_OmmAlphaGeometry[id].bakeDesc;
         for (uint32_t j = staticDataBegin; j < (uint32_t)ommhelper::OmmDataLayout::GpuOutputNum; ++j)
         {
             ommhelper::GpuBakerBuffer& resource = desc.gpuBuffers[j];
             size_t& offset = gpuOffsetsPerType[j];
 
-            desc.gpuBuffers[j].dataSize = desc.gpuBakerPreBuildInfo.dataSizes[j];
+            resource.dataSize = m_OmmGeometryTable.dataSizes[j][id];
             resource.buffer = m_OmmGpuOutputBuffers[j];
             resource.bufferSize = memoryStats.outputTotalSizes[j];
             resource.offset = offset;
-            offset += desc.gpuBakerPreBuildInfo.dataSizes[j];
+            offset += resource.dataSize;
         }
 
         for (uint32_t j = postBakeReadbackDataBegin; j < (uint32_t)ommhelper::OmmDataLayout::GpuOutputNum; ++j)
@@ -1854,7 +3093,7 @@ void Sample::CreateAndBindGpuBakerSatitcBuffers(const OmmGpuBakerPrebuildMemoryS
             ommhelper::GpuBakerBuffer& resource = desc.readBackBuffers[j];
             size_t& offset = readBackOffsetsPerType[j];
 
-            resource.dataSize = desc.gpuBakerPreBuildInfo.dataSizes[j];
+            resource.dataSize = m_OmmGeometryTable.dataSizes[j][id];
             resource.buffer = m_OmmGpuReadbackBuffers[j];
             resource.bufferSize = memoryStats.outputTotalSizes[j];
             resource.offset = offset;
@@ -1871,17 +3110,17 @@ void Sample::CreateAndBindGpuBakerSatitcBuffers(const OmmGpuBakerPrebuildMemoryS
     }
 }
 
-void Sample::SaveMaskCache(const OmmBatch& batch)
+void Sample::SaveMaskCache(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch)
 {
     std::string cacheFileName = GetOmmCacheFilename();
     ommhelper::OmmCaching::CreateFolder(m_OmmCacheFolderName.c_str());
-    uint64_t stateMask = ommhelper::OmmCaching::CalculateSateHash(m_OmmBakeDesc);
+    uint64_t stateMask = ommhelper::OmmCaching::CalculateSateHash(bakeDesc);
 
     for (size_t id = batch.offset; id < batch.offset + batch.count; ++id)
     {
         AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
         ommhelper::OmmBakeGeometryDesc& bakeResults = geometry.bakeDesc;
-        uint64_t hash = GetInstanceHash(geometry.meshIndex, geometry.materialIndex);
+        uint64_t hash = GetOmmCacheHash(geometry);
 
         bool isDataValid = true;
         ommhelper::OmmCaching::OmmData data;
@@ -1896,9 +3135,155 @@ void Sample::SaveMaskCache(const OmmBatch& batch)
     }
 }
 
-void Sample::InitializeOmmGeometryFromCache(const OmmBatch& batch, std::vector<ommhelper::OmmBakeGeometryDesc*>& outBakeQueue)
+void Sample::SaveOmmArrayCache(const OmmBatch& batch)
+{
+    for (size_t id = batch.offset; id < batch.offset + batch.count; ++id)
+    {
+        const AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
+        m_OmmArrayCache.Save(GetOmmCacheHash(geometry), geometry.buildDesc.outputs.serializedOmmArray);
+    }
+}
+
+uint64_t Sample::GetOmmBatchRecordStateHash(const ommhelper::OmmBakeDesc& bakeDesc)
+{ // Records are device specific: API histogram format, supported index widths and upload alignment
+    const nri::DeviceDesc& deviceDesc = NRI.GetDeviceDesc(*m_Device);
+    uint64_t deviceState = uint64_t(deviceDesc.graphicsAPI) << 32 | uint64_t(deviceDesc.storageBufferOffsetAlignment);
+    return ommhelper::OmmCaching::CalculateSateHash(bakeDesc) ^ (deviceState * 1099511628211ull);
+}
+
+uint64_t Sample::GetOmmBatchHash(const OmmBatch& batch)
+{ // A record matches the planned batch only if it holds the same geometries in the same order
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t id = batch.offset; id < batch.offset + batch.count; ++id)
+        hash = (hash ^ m_OmmGeometryTable.instanceHashes[id]) * 1099511628211ull;
+    return hash;
+}
+
+inline bool IsRangeInside(uint64_t offset, uint64_t size, uint64_t totalSize)
+{
+    return size <= totalSize && offset <= totalSize - size;
+}
+
+bool Sample::IsOmmBatchRecordEntryValid(const OmmBatchRecordEntry& entry, const OmmBatchRecord& record)
+{ // A truncated or stale record must not slice the chunks out of bounds. The whole record is discarded otherwise
+    if (!entry.histogramSizes[1])
+        return true; // no OMMs, nothing is read
+
+    for (uint32_t j = 0; j < (uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum; ++j)
+    {
+        if (!IsRangeInside(entry.offsets[j], entry.sizes[j], record.gpuDataSize))
+            return false;
+    }
+
+    for (uint32_t j = 0; j < 2; ++j)
+    {
+        if (!IsRangeInside(entry.histogramOffsets[j], entry.histogramSizes[j], record.histograms.size()))
+            return false;
+    }
+
+    nri::Format ommIndexFormat = (nri::Format)entry.ommIndexFormat;
+    return m_OmmHelper.IsOmmIndexFormatSupported(ommIndexFormat) && entry.ommIndexStride == ommhelper::GetOmmIndexStride(ommIndexFormat);
+}
+
+bool Sample::ReadOmmBatchRecord(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch, OmmBatchRecord& outRecord)
+{ // Entries and histograms only. The gpu data chunk is read by FillOmmBlasBuildQueueFromRecord
+    outRecord = {};
+    if (!m_OmmUseBatchRecords || !bakeDesc.enableCache || m_DisableOmmBlasBuild)
+        return false;
+
+    const std::string cacheFileName = GetOmmBatchRecordFilename();
+    const uint64_t stateMask = GetOmmBatchRecordStateHash(bakeDesc);
+    const uint64_t hash = GetOmmBatchHash(batch);
+
+    ommhelper::OmmCaching::OmmData data = {};
+    if (!ommhelper::OmmCaching::ReadMaskFromCache(cacheFileName.c_str(), data, stateMask, hash, nullptr))
+        return false;
+
+    if (data.sizes[(uint32_t)OmmBatchRecordChunk::Entries] != batch.count * sizeof(OmmBatchRecordEntry))
+        return false;
+
+    outRecord.entries.resize(batch.count);
+    outRecord.histograms.resize(data.sizes[(uint32_t)OmmBatchRecordChunk::Histograms]);
+    outRecord.gpuDataSize = data.sizes[(uint32_t)OmmBatchRecordChunk::GpuData];
+    data.data[(uint32_t)OmmBatchRecordChunk::Entries] = outRecord.entries.data();
+    data.data[(uint32_t)OmmBatchRecordChunk::Histograms] = outRecord.histograms.data();
+    if (!ommhelper::OmmCaching::ReadMaskFromCache(cacheFileName.c_str(), data, stateMask, hash, nullptr))
+        return false;
+
+    for (size_t i = 0; i < batch.count; ++i)
+    {
+        const AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[batch.offset + i];
+        if (outRecord.entries[i].instanceHash != GetOmmCacheHash(geometry) || !IsOmmBatchRecordEntryValid(outRecord.entries[i], outRecord))
+            return false;
+    }
+
+    outRecord.isValid = true;
+    m_OmmBatchRecordCounts[0]++;
+    return true;
+}
+
+void Sample::SaveOmmBatchRecord(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch)
+{ // Bake outputs after API conversion and index compaction, laid out as the upload buffer of the batch
+    const std::string cacheFileName = GetOmmBatchRecordFilename();
+    const uint64_t stateMask = GetOmmBatchRecordStateHash(bakeDesc);
+    const uint64_t hash = GetOmmBatchHash(batch);
+    if (ommhelper::OmmCaching::LookForCache(cacheFileName.c_str(), stateMask, hash))
+        return;
+
+    const uint64_t alignment = NRI.GetDeviceDesc(*m_Device).storageBufferOffsetAlignment;
+    const uint32_t histogramBuffers[] = { (uint32_t)ommhelper::OmmDataLayout::DescArrayHistogram, (uint32_t)ommhelper::OmmDataLayout::IndexHistogram };
+
+    std::vector<OmmBatchRecordEntry> entries(batch.count);
+    std::vector<uint8_t> histograms;
+    std::vector<uint8_t> gpuData;
+    for (size_t i = 0; i < batch.count; ++i)
+    {
+        const AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[batch.offset + i];
+        const ommhelper::OmmBakeGeometryDesc& bakeResult = geometry.bakeDesc;
+        OmmBatchRecordEntry& entry = entries[i];
+        entry = {};
+        entry.instanceHash = GetOmmCacheHash(geometry);
+        if (bakeResult.outData[(uint32_t)ommhelper::OmmDataLayout::IndexHistogram].empty())
+            continue;
+
+        for (uint32_t j = 0; j < (uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum; ++j)
+        {
+            const std::vector<uint8_t>& outData = bakeResult.outData[j];
+            entry.offsets[j] = helper::Align((uint64_t)gpuData.size(), alignment);
+            entry.sizes[j] = outData.size();
+            gpuData.resize(entry.offsets[j] + entry.sizes[j]);
+            memcpy(gpuData.data() + entry.offsets[j], outData.data(), outData.size());
+        }
+
+        for (uint32_t j = 0; j < helper::GetCountOf(histogramBuffers); ++j)
+        {
+            const std::vector<uint8_t>& outData = bakeResult.outData[histogramBuffers[j]];
+            entry.histogramOffsets[j] = histograms.size();
+            entry.histogramSizes[j] = outData.size();
+            histograms.insert(histograms.end(), outData.begin(), outData.end());
+        }
+        entry.histogramNums[0] = bakeResult.outDescArrayHistogramCount;
+        entry.histogramNums[1] = bakeResult.outIndexHistogramCount;
+        entry.ommIndexFormat = (uint32_t)bakeResult.outOmmIndexFormat;
+        entry.ommIndexStride = (uint32_t)bakeResult.outOmmIndexStride;
+    }
+
+    ommhelper::OmmCaching::OmmData data = {};
+    data.data[(uint32_t)OmmBatchRecordChunk::Entries] = entries.data();
+    data.sizes[(uint32_t)OmmBatchRecordChunk::Entries] = entries.size() * sizeof(OmmBatchRecordEntry);
+    data.data[(uint32_t)OmmBatchRecordChunk::Histograms] = histograms.data();
+    data.sizes[(uint32_t)OmmBatchRecordChunk::Histograms] = histograms.size();
+    data.data[(uint32_t)OmmBatchRecordChunk::GpuData] = gpuData.data();
+    data.sizes[(uint32_t)OmmBatchRecordChunk::GpuData] = gpuData.size();
+
+    ommhelper::OmmCaching::CreateFolder(m_OmmCacheFolderName.c_str());
+    ommhelper::OmmCaching::SaveMasksToDisc(cacheFileName.c_str(), data, stateMask, hash, 0);
+    m_OmmBatchRecordCounts[1]++;
+}
+
+void Sample::InitializeOmmGeometryFromCache(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch, std::vector<ommhelper::OmmBakeGeometryDesc*>& outBakeQueue)
 { // Init geometry from cache. If cache not found add it to baking queue
-    if (m_OmmBakeDesc.enableCache == false)
+    if (bakeDesc.enableCache == false)
     {
         for (size_t i = batch.offset; i < batch.offset + batch.count; ++i)
             outBakeQueue.push_back(&m_OmmAlphaGeometry[i].bakeDesc);
@@ -1906,13 +3291,13 @@ void Sample::InitializeOmmGeometryFromCache(const OmmBatch& batch, std::vector<o
     }
 
     printf("Read cache. ");
-    uint64_t stateMask = ommhelper::OmmCaching::CalculateSateHash(m_OmmBakeDesc);
+    uint64_t stateMask = ommhelper::OmmCaching::CalculateSateHash(bakeDesc);
     for (size_t i = batch.offset; i < batch.offset + batch.count; ++i)
     {
         AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
         ommhelper::OmmBakeGeometryDesc& instance = geometry.bakeDesc;
 
-        uint64_t hash = GetInstanceHash(geometry.meshIndex, geometry.materialIndex);
+        uint64_t hash = GetOmmCacheHash(geometry);
         ommhelper::OmmCaching::OmmData data = {};
         if (ommhelper::OmmCaching::ReadMaskFromCache(GetOmmCacheFilename().c_str(), data, stateMask, hash, nullptr))
         {
@@ -1922,7 +3307,7 @@ void Sample::InitializeOmmGeometryFromCache(const OmmBatch& batch, std::vector<o
                 data.data[j] = instance.outData[j].data();
             }
             ommhelper::OmmCaching::ReadMaskFromCache(GetOmmCacheFilename().c_str(), data, stateMask, hash, (uint16_t*)&instance.outOmmIndexFormat);
-            instance.outOmmIndexStride = instance.outOmmIndexFormat == nri::Format::R16_UINT ? sizeof(uint16_t) : sizeof(uint32_t);
+            instance.outOmmIndexStride = ommhelper::GetOmmIndexStride(instance.outOmmIndexFormat);
             instance.outDescArrayHistogramCount = uint32_t(data.sizes[(uint32_t)ommhelper::OmmDataLayout::DescArrayHistogram] / (uint64_t)sizeof(ommCpuOpacityMicromapUsageCount));
             instance.outIndexHistogramCount = uint32_t(data.sizes[(uint32_t)ommhelper::OmmDataLayout::IndexHistogram] / (uint64_t)sizeof(ommCpuOpacityMicromapUsageCount));
         }
@@ -1931,131 +3316,683 @@ void Sample::InitializeOmmGeometryFromCache(const OmmBatch& batch, std::vector<o
     }
 }
 
-inline void SubmitQueueWorkAndWait(const NRIInterface& NRI, nri::CommandBuffer* commandBuffer, nri::CommandQueue* queue, nri::Fence* fence, uint64_t& currentFenceValue)
+void Sample::WaitForOmmCopies()
 {
-    nri::QueueSubmitDesc workSubmissionDesc = {};
-    workSubmissionDesc.commandBuffers = &commandBuffer;
-    workSubmissionDesc.commandBufferNum = 1;
-    NRI.QueueSubmit(*queue, workSubmissionDesc);
-    NRI.QueueSignal(*queue, *fence, ++currentFenceValue);
-    NRI.Wait(*fence, currentFenceValue);
+    auto waitStart = std::chrono::high_resolution_clock::now();
+    m_OmmCopyContext.Wait(NRI);
+    std::chrono::duration<double, std::milli> waitTime = std::chrono::high_resolution_clock::now() - waitStart;
+    m_OmmCopyWaitTimeMs += waitTime.count();
 }
 
-void Sample::RunOmmSetupPass(OmmNriContext& context, ommhelper::OmmBakeGeometryDesc** queue, size_t count, OmmGpuBakerPrebuildMemoryStats& memoryStats)
-{ // Run prepass to get correct size of omm array data buffer
-    NRI.ResetCommandAllocator(*context.commandAllocator);
-    NRI.BeginCommandBuffer(*context.commandBuffer, nullptr, nri::WHOLE_DEVICE_GROUP);
+void Sample::InitOmmTimeline()
+{
+    nri::BufferDesc bufferDesc = {};
+    bufferDesc.physicalDeviceMask = 0;
+    bufferDesc.size = 2 * OMM_TIMELINE_EVENT_NUM * 2 * sizeof(uint64_t);
+    bufferDesc.usageMask = nri::BufferUsageBits::NONE;
+    NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_OmmTimelineBuffer));
+    BindBuffersToMemory(NRI, m_Device, &m_OmmTimelineBuffer, 1, m_OmmTimelineMemories, nri::MemoryLocation::HOST_READBACK);
+
+    // The only waited reset. Later ones are recorded behind the readback of each timeline, while all queues are idle anyway
+    OmmNriContext* contexts[] = { &m_OmmGraphicsContext, &m_OmmComputeContext, &m_OmmCopyContext };
+    m_OmmGraphicsContext.BeginRecording(NRI);
+    for (OmmNriContext* timelineContext : contexts)
     {
-        m_OmmHelper.BakeOpacityMicroMapsGpu(context.commandBuffer, queue, count, m_OmmBakeDesc, ommhelper::OmmGpuBakerPass::Setup);
-        CopyBatchToReadBackBuffer(NRI, context.commandBuffer, *queue[0], *queue[count - 1], (uint32_t)ommhelper::OmmDataLayout::GpuPostBuildInfo);
+        if (timelineContext->timestampPool)
+            NRI.CmdResetQueries(*m_OmmGraphicsContext.commandBuffer, *timelineContext->timestampPool, 0, OMM_TIMELINE_EVENT_NUM * 2);
     }
-    NRI.EndCommandBuffer(*context.commandBuffer);
-    SubmitQueueWorkAndWait(NRI, context.commandBuffer, context.commandQueue, context.fence, context.fenceValue);
-    m_OmmHelper.GpuPostBakeCleanUp();
+    m_OmmGraphicsContext.Submit(NRI);
+    m_OmmGraphicsContext.Wait(NRI);
+}
+
+void Sample::BeginOmmTimeline(OmmNriContext& context)
+{ // Nothing is submitted: the pools are reset already, so the bake starts without a round trip
+    OmmNriContext* contexts[] = { &context, &m_OmmCopyContext };
+    for (OmmNriContext* timelineContext : contexts)
+    {
+        timelineContext->events.clear();
+        timelineContext->isTimelineActive = true;
+    }
+}
+
+void Sample::PrintOmmTimeline(OmmNriContext& context)
+{ // Both queues are idle here. Their timestamps share the device clock, so busy intervals are compared directly
+    OmmNriContext* contexts[] = { &context, &m_OmmCopyContext };
+    const uint32_t contextQueryNum = OMM_TIMELINE_EVENT_NUM * 2;
+    m_OmmCopyContext.Wait(NRI);
+    context.BeginRecording(NRI);
+    for (uint32_t i = 0; i < helper::GetCountOf(contexts); ++i)
+    {
+        contexts[i]->isTimelineActive = false;
+        if (contexts[i]->timestampPool && !contexts[i]->events.empty())
+        { // query commands on one queue execute in order: the reset follows the copy and is done before the next bake starts
+            NRI.CmdCopyQueries(*context.commandBuffer, *contexts[i]->timestampPool, 0, (uint32_t)contexts[i]->events.size() * 2, *m_OmmTimelineBuffer, i * contextQueryNum * sizeof(uint64_t));
+            NRI.CmdResetQueries(*context.commandBuffer, *contexts[i]->timestampPool, 0, contextQueryNum);
+        }
+    }
+    context.Submit(NRI);
+    context.Wait(NRI);
+
+    struct Interval
+    {
+        uint64_t begin;
+        uint64_t end;
+        OmmTimelineSection section;
+        uint32_t contextId;
+    };
+    std::vector<Interval> intervals;
+    const uint64_t* timestamps = (const uint64_t*)NRI.MapBuffer(*m_OmmTimelineBuffer, 0, helper::GetCountOf(contexts) * contextQueryNum * sizeof(uint64_t));
+    for (uint32_t i = 0; i < helper::GetCountOf(contexts); ++i)
+    {
+        for (const OmmTimelineEvent& event : contexts[i]->events)
+        {
+            const uint64_t* eventTimestamps = timestamps + i * contextQueryNum + event.queryOffset;
+            if (eventTimestamps[1] > eventTimestamps[0])
+                intervals.push_back({ eventTimestamps[0], eventTimestamps[1], event.section, i });
+        }
+    }
+    NRI.UnmapBuffer(*m_OmmTimelineBuffer);
+    if (intervals.empty())
+        return;
+
+    std::sort(intervals.begin(), intervals.end(), [](const Interval& a, const Interval& b) { return a.begin < b.begin; });
+    const double msPerTick = 1000.0 / double(NRI.GetDeviceDesc(*m_Device).timestampFrequencyHz);
+    const uint64_t origin = intervals[0].begin;
+
+    uint64_t busyTicks[2] = {};
+    uint64_t busyEnds[2] = {}; // intervals of a queue don't overlap, they are submitted in order
+    uint64_t sectionTicks[(uint32_t)OmmTimelineSection::MAX_NUM] = {};
+    std::vector<std::pair<uint64_t, uint64_t>> busy[2];
+    for (const Interval& interval : intervals)
+    {
+        sectionTicks[(uint32_t)interval.section] += interval.end - interval.begin;
+        if (m_OmmPrintGpuTimeline)
+        {
+            printf("[OMM]   %-8s %-10s %9.3f - %9.3f ms\n", contexts[interval.contextId]->queueName, OMM_TIMELINE_SECTION_NAMES[(uint32_t)interval.section], double(interval.begin - origin) * msPerTick,
+                double(interval.end - origin) * msPerTick);
+        }
+        uint64_t begin = std::max(interval.begin, busyEnds[interval.contextId]);
+        if (interval.end > begin)
+        {
+            busyTicks[interval.contextId] += interval.end - begin;
+            busy[interval.contextId].push_back({ begin, interval.end });
+            busyEnds[interval.contextId] = interval.end;
+        }
+    }
+
+    uint64_t overlapTicks = 0;
+    for (size_t i = 0, j = 0; i < busy[0].size() && j < busy[1].size();)
+    { // sorted, disjoint per queue
+        uint64_t begin = std::max(busy[0][i].first, busy[1][j].first);
+        uint64_t end = std::min(busy[0][i].second, busy[1][j].second);
+        if (end > begin)
+            overlapTicks += end - begin;
+        if (busy[0][i].second < busy[1][j].second)
+            ++i;
+        else
+            ++j;
+    }
+
+    printf("[OMM] GPU timeline: %s queue %.1f ms busy, copy queue %.1f ms busy, %.1f ms overlapped", context.queueName, double(busyTicks[0]) * msPerTick,
+        double(busyTicks[1]) * msPerTick, double(overlapTicks) * msPerTick);
+    if (!m_OmmCopyContext.timestampPool)
+        printf(" (copy queue timestamps need Vulkan)");
+    if (context.events.size() == OMM_TIMELINE_EVENT_NUM || m_OmmCopyContext.events.size() == OMM_TIMELINE_EVENT_NUM)
+        printf(" (truncated at %u events per queue)", OMM_TIMELINE_EVENT_NUM);
+    printf("\n");
+
+    { // Taken by the profiler on the main thread. LODs finished in between are summed
+        std::lock_guard<std::mutex> lock(m_OmmTimelineMutex);
+        if (!m_IsOmmTimelinePending)
+            m_OmmTimelineStats = {};
+        for (uint32_t i = 0; i < (uint32_t)OmmTimelineSection::MAX_NUM; ++i)
+            m_OmmTimelineStats.sectionTimeMs[i] += double(sectionTicks[i]) * msPerTick;
+        m_OmmTimelineStats.copyOverlapTimeMs += double(overlapTicks) * msPerTick;
+        m_OmmTimelineStats.hasCopyTimestamps = m_OmmCopyContext.timestampPool != nullptr;
+        m_IsOmmTimelinePending = true;
+    }
+}
+
+void Sample::UpdateOmmTimelineEvents()
+{ // Main thread: profiler events are read by the ui, so bake threads leave them alone
+    static const uint32_t eventIDs[] =
+    {
+        m_Profiler.AllocateEvent("OMM GPU: setup"),
+        m_Profiler.AllocateEvent("OMM GPU: bake"),
+        m_Profiler.AllocateEvent("OMM GPU: build"),
+        m_Profiler.AllocateEvent("OMM GPU: serialize"),
+        m_Profiler.AllocateEvent("OMM GPU: readback"),
+        m_Profiler.AllocateEvent("OMM GPU: upload"),
+        m_Profiler.AllocateEvent("OMM GPU: copy overlap"),
+    };
+
+    std::lock_guard<std::mutex> lock(m_OmmTimelineMutex);
+    if (!m_IsOmmTimelinePending)
+        return;
+
+    m_IsOmmTimelinePending = false;
+    const uint32_t sectionNum = (uint32_t)OmmTimelineSection::MAX_NUM;
+    for (uint32_t i = 0; i < sectionNum; ++i)
+    {
+        bool isCopySection = i >= (uint32_t)OmmTimelineSection::Readback;
+        if (!isCopySection || m_OmmTimelineStats.hasCopyTimestamps)
+            m_Profiler.UpdateCpuEvent(eventIDs[i], m_OmmTimelineStats.sectionTimeMs[i]);
+    }
+    if (m_OmmTimelineStats.hasCopyTimestamps)
+        m_Profiler.UpdateCpuEvent(eventIDs[sectionNum], m_OmmTimelineStats.copyOverlapTimeMs);
+}
+
+void Sample::RunOmmSetupPass(OmmNriContext& context, const ommhelper::OmmBakeDesc& bakeDesc, ommhelper::OmmBakeGeometryDesc** queue, size_t count, OmmGpuBakerPrebuildMemoryStats& memoryStats)
+{ // Run prepass to get correct size of omm array data buffer
+    context.BeginRecording(NRI);
+    {
+        uint32_t eventId = context.BeginEvent(NRI, OmmTimelineSection::Setup);
+        RecordOmmGpuBakerPass(context, bakeDesc, queue, count, ommhelper::OmmGpuBakerPass::Setup);
+        context.EndEvent(NRI, eventId);
+    }
+    uint64_t setupFenceValue = context.Submit(NRI);
+
+    WaitForOmmCopies();
+    m_OmmCopyContext.BeginRecording(NRI);
+    {
+        uint32_t eventId = m_OmmCopyContext.BeginEvent(NRI, OmmTimelineSection::Readback);
+        m_OmmCopyBytes[1] += CopyBatchToReadBackBuffer(NRI, m_OmmCopyContext.commandBuffer, *queue[0], *queue[count - 1], (uint32_t)ommhelper::OmmDataLayout::GpuPostBuildInfo);
+        m_OmmCopyContext.EndEvent(NRI, eventId);
+    }
+    m_OmmCopyContext.Submit(NRI, context.fence, setupFenceValue);
+    WaitForOmmCopies();
+    m_OmmHelper.GpuPostBakeCleanUp();
 
     for (size_t i = 0; i < count; ++i)
-    { // Get actual data sizes from postbuild info
+    { // Get actual data sizes from postbuild info. The queue matches the one of the geometry table
         ommhelper::OmmBakeGeometryDesc& desc = *queue[i];
         CopyFromReadBackBuffer(NRI, desc, (uint32_t)ommhelper::OmmDataLayout::GpuPostBuildInfo);
         ommGpuPostDispatchInfo postbildInfo = *(ommGpuPostDispatchInfo*)desc.outData[(uint32_t)ommhelper::OmmDataLayout::GpuPostBuildInfo].data();
-        desc.gpuBakerPreBuildInfo.dataSizes[(uint32_t)ommhelper::OmmDataLayout::ArrayData] = postbildInfo.outOmmArraySizeInBytes;
+        m_OmmGeometryTable.dataSizes[(uint32_t)ommhelper::OmmDataLayout::ArrayData][m_OmmGeometryTable.queue[i]] = postbildInfo.outOmmArraySizeInBytes;
     }
-    memoryStats = GetGpuBakerPrebuildMemoryStats(true);
+    memoryStats = GetGpuBakerPrebuildMemoryStats(bakeDesc, m_OmmTimestampPool == nullptr); // quiet while tuning
 }
 
-void Sample::BakeOmmGpu(OmmNriContext& context, std::vector<ommhelper::OmmBakeGeometryDesc*>& batch)
-{
-    NRI.ResetCommandAllocator(*context.commandAllocator);
-    NRI.BeginCommandBuffer(*context.commandBuffer, nullptr, nri::WHOLE_DEVICE_GROUP);
+void Sample::RecordOmmGpuBakerPass(OmmNriContext& context, const ommhelper::OmmBakeDesc& bakeDesc, ommhelper::OmmBakeGeometryDesc** queue, size_t count, ommhelper::OmmGpuBakerPass pass)
+{ // Bracketed by timestamps while the baker is being tuned
+    const uint32_t queryOffset = pass == ommhelper::OmmGpuBakerPass::Setup ? 0 : 2;
+    if (m_OmmTimestampPool)
     {
-        m_OmmHelper.BakeOpacityMicroMapsGpu(context.commandBuffer, batch.data(), batch.size(), m_OmmBakeDesc, ommhelper::OmmGpuBakerPass::Bake);
-        CopyBatchToReadBackBuffer(NRI, context.commandBuffer, *batch[0], *batch.back(), (uint32_t)ommhelper::OmmDataLayout::DescArrayHistogram);
-        CopyBatchToReadBackBuffer(NRI, context.commandBuffer, *batch[0], *batch.back(), (uint32_t)ommhelper::OmmDataLayout::IndexHistogram);
-        CopyBatchToReadBackBuffer(NRI, context.commandBuffer, *batch[0], *batch.back(), (uint32_t)ommhelper::OmmDataLayout::GpuPostBuildInfo);
+        NRI.CmdResetQueries(*context.commandBuffer, *m_OmmTimestampPool, queryOffset, 2);
+        NRI.CmdEndQuery(*context.commandBuffer, *m_OmmTimestampPool, queryOffset);
     }
-    NRI.EndCommandBuffer(*context.commandBuffer);
-    SubmitQueueWorkAndWait(NRI, context.commandBuffer, context.commandQueue, context.fence, context.fenceValue);
-    m_OmmHelper.GpuPostBakeCleanUp();
 
-    if (m_OmmBakeDesc.enableCache)
+    m_OmmHelper.BakeOpacityMicroMapsGpu(context.commandBuffer, queue, count, bakeDesc, pass);
+
+    if (m_OmmTimestampPool)
     {
-        printf("Readback. ");
-        NRI.ResetCommandAllocator(*context.commandAllocator);
-        NRI.BeginCommandBuffer(*context.commandBuffer, nullptr, nri::WHOLE_DEVICE_GROUP);
-        {
-            for (size_t i = 0; i < batch.size(); ++i)
-            { // Get actual data sizes from postbuild info
-                ommhelper::OmmBakeGeometryDesc& desc = *batch[i];
-                CopyFromReadBackBuffer(NRI, desc, (uint32_t)ommhelper::OmmDataLayout::GpuPostBuildInfo);
-                ommGpuPostDispatchInfo postbildInfo = *(ommGpuPostDispatchInfo*)desc.outData[(uint32_t)ommhelper::OmmDataLayout::GpuPostBuildInfo].data();
-
-                desc.gpuBuffers[(uint32_t)ommhelper::OmmDataLayout::ArrayData].dataSize = postbildInfo.outOmmArraySizeInBytes;
-                desc.readBackBuffers[(uint32_t)ommhelper::OmmDataLayout::ArrayData].dataSize = postbildInfo.outOmmArraySizeInBytes;
-                desc.gpuBuffers[(uint32_t)ommhelper::OmmDataLayout::DescArray].dataSize = postbildInfo.outOmmDescSizeInBytes;
-                desc.readBackBuffers[(uint32_t)ommhelper::OmmDataLayout::DescArray].dataSize = postbildInfo.outOmmDescSizeInBytes;
-            }
+        NRI.CmdEndQuery(*context.commandBuffer, *m_OmmTimestampPool, queryOffset + 1);
+        NRI.CmdCopyQueries(*context.commandBuffer, *m_OmmTimestampPool, queryOffset, 2, *m_OmmTimestampBuffer, queryOffset * sizeof(uint64_t));
+    }
+}
 
-            {
-                CopyBatchToReadBackBuffer(NRI, context.commandBuffer, *batch[0], *batch.back(), (uint32_t)ommhelper::OmmDataLayout::ArrayData);
-                CopyBatchToReadBackBuffer(NRI, context.commandBuffer, *batch[0], *batch.back(), (uint32_t)ommhelper::OmmDataLayout::DescArray);
-                CopyBatchToReadBackBuffer(NRI, context.commandBuffer, *batch[0], *batch.back(), (uint32_t)ommhelper::OmmDataLayout::Indices);
-            }
+void Sample::PrepareOmmGpuBakerTextures(OmmNriContext& context, const std::vector<ommhelper::OmmBakeGeometryDesc*>& queue)
+{ // One proxy per texture: all geometries sampling it share the baked mip. Alpha is decoded the same way as for the cpu baker
+    const std::set<const ommhelper::OmmBakeGeometryDesc*> queued(queue.begin(), queue.end());
+    std::map<uint32_t, std::vector<ommhelper::OmmBakeGeometryDesc*>> textureToGeometries;
+    for (AlphaTestedGeometry& geometry : m_OmmAlphaGeometry)
+    {
+        if (queued.count(&geometry.bakeDesc))
+            textureToGeometries[m_Scene.materials[geometry.materialIndex].baseColorTexIndex].push_back(&geometry.bakeDesc);
+    }
+
+    for (const auto& it : textureToGeometries)
+    {
+        const ommhelper::InputTexture& bakerTexture = it.second[0]->texture;
+        nri::TextureSubresourceUploadDesc subresource = {};
+        m_Scene.textures[it.first]->GetSubresource(subresource, bakerTexture.mipOffset, 0);
+        m_OmmGpuTextureSizes[0] += subresource.slicePitch;
+    }
+
+    if (!m_OmmUseAlphaProxies)
+        return;
+
+    std::vector<nri::Texture*> textures;
+    std::vector<std::vector<uint8_t>> alphaPlanes;
+    std::vector<uint32_t> rowPitches;
+    for (const auto& it : textureToGeometries)
+    {
+        const ommhelper::InputTexture& bakerTexture = it.second[0]->texture;
+        std::vector<uint8_t>& alphaPlane = alphaPlanes.emplace_back();
+        PreprocessAlphaTexture((detexTexture*)m_Scene.textures[it.first]->mips[bakerTexture.mipOffset], alphaPlane);
+
+        const uint16_t width = (uint16_t)bakerTexture.mips[0].width;
+        const uint16_t height = (uint16_t)bakerTexture.mips[0].height;
+        nri::Texture* texture = nullptr;
+        NRI_ABORT_ON_FAILURE(NRI.CreateTexture(*m_Device, nri::Texture2D(nri::Format::R8_UNORM, width, height, 1, 1, nri::TextureUsageBits::SHADER_RESOURCE), texture));
+        textures.push_back(texture);
+        rowPitches.push_back(width);
+        m_OmmAlphaProxyTextures[it.first] = texture;
+        m_OmmGpuTextureSizes[1] += alphaPlane.size();
+
+        for (ommhelper::OmmBakeGeometryDesc* desc : it.second)
+        { // the proxy holds the baked mip only
+            desc->texture.mips[0].nriTextureOrPtr.texture = texture;
+            desc->texture.mipOffset = 0;
+            desc->texture.format = nri::Format::R8_UNORM;
+            desc->texture.alphaChannelId = 0;
         }
-        NRI.EndCommandBuffer(*context.commandBuffer);
-        SubmitQueueWorkAndWait(NRI, context.commandBuffer, context.commandQueue, context.fence, context.fenceValue);
     }
 
+    nri::ResourceGroupDesc resourceGroupDesc = {};
+    resourceGroupDesc.textures = textures.data();
+    resourceGroupDesc.textureNum = (uint32_t)textures.size();
+    resourceGroupDesc.memoryLocation = nri::MemoryLocation::DEVICE;
+    size_t allocationOffset = m_OmmBakerAllocations.size();
+    m_OmmBakerAllocations.resize(allocationOffset + NRI.CalculateAllocationNumber(*m_Device, resourceGroupDesc), nullptr);
+    NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_OmmBakerAllocations.data() + allocationOffset));
+
+    std::vector<nri::TextureSubresourceUploadDesc> subresources(textures.size());
+    std::vector<nri::TextureUploadDesc> uploadDescs(textures.size());
+    for (size_t i = 0; i < textures.size(); ++i)
+    {
+        subresources[i] = { alphaPlanes[i].data(), 1, rowPitches[i], (uint32_t)alphaPlanes[i].size() };
+        uploadDescs[i] = { &subresources[i], textures[i], nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE, 1, 1 };
+    }
+    NRI_ABORT_ON_FAILURE(NRI.UploadData(*context.commandQueue, uploadDescs.data(), (uint32_t)uploadDescs.size(), nullptr, 0));
+}
+
+void Sample::BakeOmmGpu(OmmNriContext& context, const ommhelper::OmmBakeDesc& bakeDesc, std::vector<ommhelper::OmmBakeGeometryDesc*>& batch)
+{ // Readbacks run on the copy queue. The cache readback isn't waited for here, it overlaps with the blas build
+    context.BeginRecording(NRI);
+    {
+        uint32_t eventId = context.BeginEvent(NRI, OmmTimelineSection::Bake);
+        RecordOmmGpuBakerPass(context, bakeDesc, batch.data(), batch.size(), ommhelper::OmmGpuBakerPass::Bake);
+        context.EndEvent(NRI, eventId);
+    }
+    uint64_t bakeFenceValue = context.Submit(NRI);
+
+    WaitForOmmCopies();
+    m_OmmCopyContext.BeginRecording(NRI);
+    {
+        uint32_t eventId = m_OmmCopyContext.BeginEvent(NRI, OmmTimelineSection::Readback);
+        m_OmmCopyBytes[1] += CopyBatchToReadBackBuffer(NRI, m_OmmCopyContext.commandBuffer, *batch[0], *batch.back(), (uint32_t)ommhelper::OmmDataLayout::DescArrayHistogram);
+        m_OmmCopyBytes[1] += CopyBatchToReadBackBuffer(NRI, m_OmmCopyContext.commandBuffer, *batch[0], *batch.back(), (uint32_t)ommhelper::OmmDataLayout::IndexHistogram);
+        m_OmmCopyBytes[1] += CopyBatchToReadBackBuffer(NRI, m_OmmCopyContext.commandBuffer, *batch[0], *batch.back(), (uint32_t)ommhelper::OmmDataLayout::GpuPostBuildInfo);
+        m_OmmCopyContext.EndEvent(NRI, eventId);
+    }
+    m_OmmCopyContext.Submit(NRI, context.fence, bakeFenceValue);
+    WaitForOmmCopies();
+    m_OmmHelper.GpuPostBakeCleanUp();
+
     for (size_t i = 0; i < batch.size(); ++i)
     {
         ommhelper::OmmBakeGeometryDesc& desc = *batch[i];
         CopyFromReadBackBuffer(NRI, desc, (uint32_t)ommhelper::OmmDataLayout::DescArrayHistogram);
         CopyFromReadBackBuffer(NRI, desc, (uint32_t)ommhelper::OmmDataLayout::IndexHistogram);
+    }
 
-        if (m_OmmBakeDesc.enableCache)
+    if (bakeDesc.enableCache)
+    {
+        printf("Readback. ");
+        for (size_t i = 0; i < batch.size(); ++i)
+        { // Get actual data sizes from postbuild info
+            ommhelper::OmmBakeGeometryDesc& desc = *batch[i];
+            CopyFromReadBackBuffer(NRI, desc, (uint32_t)ommhelper::OmmDataLayout::GpuPostBuildInfo);
+            ommGpuPostDispatchInfo postbildInfo = *(ommGpuPostDispatchInfo*)desc.outData[(uint32_t)ommhelper::OmmDataLayout::GpuPostBuildInfo].data();
+
+            desc.gpuBuffers[(uint32_t)ommhelper::OmmDataLayout::ArrayData].dataSize = postbildInfo.outOmmArraySizeInBytes;
+            desc.readBackBuffers[(uint32_t)ommhelper::OmmDataLayout::ArrayData].dataSize = postbildInfo.outOmmArraySizeInBytes;
+            desc.gpuBuffers[(uint32_t)ommhelper::OmmDataLayout::DescArray].dataSize = postbildInfo.outOmmDescSizeInBytes;
+            desc.readBackBuffers[(uint32_t)ommhelper::OmmDataLayout::DescArray].dataSize = postbildInfo.outOmmDescSizeInBytes;
+        }
+
+        m_OmmCopyContext.BeginRecording(NRI);
         {
-            CopyFromReadBackBuffer(NRI, desc, (uint32_t)ommhelper::OmmDataLayout::ArrayData);
-            CopyFromReadBackBuffer(NRI, desc, (uint32_t)ommhelper::OmmDataLayout::DescArray);
-            CopyFromReadBackBuffer(NRI, desc, (uint32_t)ommhelper::OmmDataLayout::Indices);
+            uint32_t eventId = m_OmmCopyContext.BeginEvent(NRI, OmmTimelineSection::Readback);
+            m_OmmCopyBytes[1] += CopyBatchToReadBackBuffer(NRI, m_OmmCopyContext.commandBuffer, *batch[0], *batch.back(), (uint32_t)ommhelper::OmmDataLayout::ArrayData);
+            m_OmmCopyBytes[1] += CopyBatchToReadBackBuffer(NRI, m_OmmCopyContext.commandBuffer, *batch[0], *batch.back(), (uint32_t)ommhelper::OmmDataLayout::DescArray);
+            m_OmmCopyBytes[1] += CopyBatchToReadBackBuffer(NRI, m_OmmCopyContext.commandBuffer, *batch[0], *batch.back(), (uint32_t)ommhelper::OmmDataLayout::Indices);
+            m_OmmCopyContext.EndEvent(NRI, eventId);
         }
+        m_OmmCopyContext.Submit(NRI);
+        m_OmmPendingReadback = batch;
     }
 }
 
-void Sample::OmmGeometryUpdate(OmmNriContext& context, bool doBatching)
+void Sample::FinishOmmGpuReadback(const ommhelper::OmmBakeDesc& bakeDesc, const OmmBatch& batch)
+{ // Gpu baker outputs are cached once their readback lands. The next batch may be baked already, its readback stays in flight
+    if (m_OmmPendingReadback.empty() || m_OmmPendingReadbackBatch.offset != batch.offset)
+        return;
+
+    WaitForOmmCopies();
+    for (ommhelper::OmmBakeGeometryDesc* desc : m_OmmPendingReadback)
+    {
+        CopyFromReadBackBuffer(NRI, *desc, (uint32_t)ommhelper::OmmDataLayout::ArrayData);
+        CopyFromReadBackBuffer(NRI, *desc, (uint32_t)ommhelper::OmmDataLayout::DescArray);
+        CopyFromReadBackBuffer(NRI, *desc, (uint32_t)ommhelper::OmmDataLayout::Indices);
+    }
+    m_OmmPendingReadback.clear();
+    SaveMaskCache(bakeDesc, batch);
+}
+
+const BakerScratchMemoryBudget OmmTunedScratchBudgets[] = { BakerScratchMemoryBudget::MB_32, BakerScratchMemoryBudget::MB_64, BakerScratchMemoryBudget::MB_128,
+    BakerScratchMemoryBudget::MB_256, BakerScratchMemoryBudget::MB_512, BakerScratchMemoryBudget::MB_1024 };
+const uint32_t OmmTunedScratchBudgetSizesMb[] = { 32, 64, 128, 256, 512, 1024 };
+
+uint32_t GetScratchMemoryBudgetMb(BakerScratchMemoryBudget budget)
 {
-    ReleaseMaskedGeometry();
-    FillOmmBakerInputs();
+    for (uint32_t i = 0; i < helper::GetCountOf(OmmTunedScratchBudgets); ++i)
+    {
+        if (OmmTunedScratchBudgets[i] == budget)
+            return OmmTunedScratchBudgetSizesMb[i];
+    }
+    return 0;
+}
+
+uint64_t Sample::GetOmmGpuTuningStateHash(const ommhelper::OmmBakeDesc& bakeDesc, bool allowRaster)
+{ // The tuned knobs are left out. The rest of the bake state, the device and the memory budget select the record
+    ommhelper::OmmBakeDesc stateDesc = bakeDesc;
+    stateDesc.gpuFlags.computeOnlyWorkload = true;
+
+    const nri::DeviceDesc& deviceDesc = NRI.GetDeviceDesc(*m_Device);
+    uint64_t deviceState = uint64_t(m_AdapterDesc.vendor) << 48 | uint64_t(m_AdapterDesc.deviceId) << 16 | uint64_t(deviceDesc.graphicsAPI) << 8 | (allowRaster ? 1 : 0);
+    uint64_t tuningState = uint64_t(m_OmmGpuTuningMemoryBudgetMb) << 1 | (m_OmmUseAlphaProxies ? 1 : 0);
+
+    uint64_t hash = ommhelper::OmmCaching::CalculateSateHash(stateDesc);
+    hash = (hash ^ deviceState) * 1099511628211ull;
+    hash = (hash ^ tuningState) * 1099511628211ull;
+    return hash;
+}
+
+double Sample::TimeOmmGpuBakerVariant(OmmNriContext& context, const ommhelper::OmmBakeDesc& bakeDesc, const std::vector<uint32_t>& queueIds, uint64_t& outMemorySize)
+{ // Same passes and buffers as BakeOmmLod, timed on the gpu. Returns 0 if the baker buffers don't fit the memory budget
+    const uint64_t memoryBudget = uint64_t(m_OmmGpuTuningMemoryBudgetMb) * 1024 * 1024;
+    FillOmmBakerInputs(bakeDesc, queueIds);
+    std::vector<ommhelper::OmmBakeGeometryDesc*> queue = QueueOmmGpuBake(queueIds);
+    PrepareOmmGpuBakerTextures(context, queue);
+    m_OmmHelper.GetGpuBakerPrebuildInfo(queue.data(), queue.size(), bakeDesc);
+    GatherOmmGpuBakerSizes();
+    OmmGpuBakerPrebuildMemoryStats memoryStats = GetGpuBakerPrebuildMemoryStats(bakeDesc, false);
+
+    outMemorySize = 0;
+    for (size_t i = 0; i < OMM_MAX_TRANSIENT_POOL_BUFFERS; ++i)
+        outMemorySize += memoryStats.maxTransientBufferSizes[i];
+
+    double timeMs = 0.0;
+    if (outMemorySize <= memoryBudget)
+    { // array data size is known after the setup pass
+        CreateAndBindGpuBakerSatitcBuffers(memoryStats);
+        RunOmmSetupPass(context, bakeDesc, queue.data(), queue.size(), memoryStats);
+        outMemorySize += memoryStats.total;
+        if (outMemorySize <= memoryBudget)
+        {
+            CreateAndBindGpuBakerArrayDataBuffer(memoryStats);
+            BakeOmmGpu(context, bakeDesc, queue);
+
+            const uint64_t* timestamps = (const uint64_t*)NRI.MapBuffer(*m_OmmTimestampBuffer, 0, 4 * sizeof(uint64_t));
+            uint64_t ticks = (timestamps[1] - timestamps[0]) + (timestamps[3] - timestamps[2]);
+            NRI.UnmapBuffer(*m_OmmTimestampBuffer);
+            timeMs = double(ticks) * 1000.0 / double(NRI.GetDeviceDesc(*m_Device).timestampFrequencyHz);
+        }
+    }
+    ReleaseBakingResources();
+    return timeMs;
+}
+
+void Sample::TuneOmmGpuBaker(OmmNriContext& context, ommhelper::OmmBakeDesc& bakeDesc, bool allowRaster)
+{ // Times every baker variant on a sample of the scene and writes the fastest one fitting the memory budget to "bakeDesc".
+  // Runs on the bake thread: m_OmmBakeDesc gets the result from ApplyOmmGpuBakerTuning on the ui thread
+    if (m_OmmAlphaGeometry.empty())
+        return;
+
+    const std::string cacheFileName = GetOmmGpuTuningFilename();
+    const uint64_t stateMask = GetOmmGpuTuningStateHash(bakeDesc, allowRaster);
+    const uint64_t hash = GetOmmBatchHash({ 0, m_OmmAlphaGeometry.size() }); // the whole scene
+
+    OmmGpuBakerTuning tuning = {};
+    bool isCached = false;
+    {
+        ommhelper::OmmCaching::OmmData data = {};
+        if (ommhelper::OmmCaching::ReadMaskFromCache(cacheFileName.c_str(), data, stateMask, hash, nullptr) && data.sizes[0] == sizeof(OmmGpuBakerTuning))
+        {
+            data.data[0] = &tuning;
+            isCached = ommhelper::OmmCaching::ReadMaskFromCache(cacheFileName.c_str(), data, stateMask, hash, nullptr);
+        }
+    }
+
+    if (!isCached)
+    {
+        const std::vector<uint32_t>& primitiveNums = m_OmmGeometryTable.primitiveNums;
+        std::vector<uint32_t> order(primitiveNums.size());
+        for (uint32_t i = 0; i < (uint32_t)order.size(); ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&primitiveNums](uint32_t a, uint32_t b) { return primitiveNums[a] < primitiveNums[b]; });
+
+        // Evenly spread over the primitive count range, in scene order: baker buffers are bound per geometry in that order
+        const size_t sampleNum = std::min<size_t>(order.size(), OMM_GPU_TUNING_SAMPLE_NUM);
+        std::vector<uint32_t> sample(sampleNum);
+        for (size_t i = 0; i < sampleNum; ++i)
+            sample[i] = order[sampleNum > 1 ? i * (order.size() - 1) / (sampleNum - 1) : 0];
+        std::sort(sample.begin(), sample.end());
+
+        nri::QueryPoolDesc queryPoolDesc = {};
+        queryPoolDesc.queryType = nri::QueryType::TIMESTAMP;
+        queryPoolDesc.capacity = 4;
+        queryPoolDesc.physicalDeviceMask = nri::WHOLE_DEVICE_GROUP;
+        NRI_ABORT_ON_FAILURE(NRI.CreateQueryPool(*m_Device, queryPoolDesc, m_OmmTimestampPool));
+
+        nri::BufferDesc bufferDesc = {};
+        bufferDesc.physicalDeviceMask = 0;
+        bufferDesc.size = 4 * sizeof(uint64_t);
+        bufferDesc.usageMask = nri::BufferUsageBits::NONE;
+        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_OmmTimestampBuffer));
+        std::vector<nri::Memory*> timestampMemories;
+        BindBuffersToMemory(NRI, m_Device, &m_OmmTimestampBuffer, 1, timestampMemories, nri::MemoryLocation::HOST_READBACK);
+
+        ommhelper::OmmBakeDesc variantDesc = bakeDesc;
+        variantDesc.enableCache = false; // outputs of the sample are dropped
+        const bool isRasterAvailable = allowRaster && variantDesc.subdivisionLevel <= 9; // raster path is limited to level 9
+
+        printf("[OMM] Tuning the GPU baker on %llu / %llu geometries, %u MB memory budget\n", (unsigned long long)sample.size(), (unsigned long long)m_OmmAlphaGeometry.size(), m_OmmGpuTuningMemoryBudgetMb);
+        tuning.sampleGeometryNum = (uint32_t)sample.size();
+        for (uint32_t computeOnly = isRasterAvailable ? 0 : 1; computeOnly < 2; ++computeOnly)
+        {
+            for (uint32_t budgetId = 0; budgetId < helper::GetCountOf(OmmTunedScratchBudgets); ++budgetId)
+            {
+                variantDesc.gpuFlags.computeOnlyWorkload = computeOnly != 0;
+                variantDesc.gpuFlags.scratchMemoryBudget = OmmTunedScratchBudgets[budgetId];
+
+                uint64_t memorySize = 0;
+                if (tuning.variantNum == 0)
+                    TimeOmmGpuBakerVariant(context, variantDesc, sample, memorySize); // warm up: first use of the baker pipelines and textures
+                double timeMs = TimeOmmGpuBakerVariant(context, variantDesc, sample, memorySize);
+                ++tuning.variantNum;
+
+                printf("[OMM]   %s, %4u MB scratch: ", computeOnly ? "compute" : "raster ", OmmTunedScratchBudgetSizesMb[budgetId]);
+                if (timeMs == 0.0)
+                {
+                    printf("%.1f MB, over budget\n", double(memorySize) / (1024.0 * 1024.0));
+                    continue;
+                }
+                printf("%.2f ms, %.1f MB\n", timeMs, double(memorySize) / (1024.0 * 1024.0));
+
+                if (tuning.bakeTimeMs == 0.0 || timeMs < tuning.bakeTimeMs)
+                {
+                    tuning.scratchMemoryBudget = (uint64_t)OmmTunedScratchBudgets[budgetId];
+                    tuning.memorySize = memorySize;
+                    tuning.bakeTimeMs = timeMs;
+                    tuning.computeOnlyWorkload = computeOnly;
+                }
+            }
+        }
+
+        NRI.DestroyQueryPool(*m_OmmTimestampPool);
+        NRI.DestroyBuffer(*m_OmmTimestampBuffer);
+        for (nri::Memory* memory : timestampMemories)
+            NRI.FreeMemory(*memory);
+        m_OmmTimestampPool = nullptr;
+        m_OmmTimestampBuffer = nullptr;
+
+        if (tuning.bakeTimeMs > 0.0)
+        {
+            ommhelper::OmmCaching::OmmData data = {};
+            data.data[0] = &tuning;
+            data.sizes[0] = sizeof(OmmGpuBakerTuning);
+            ommhelper::OmmCaching::CreateFolder(m_OmmCacheFolderName.c_str());
+            ommhelper::OmmCaching::SaveMasksToDisc(cacheFileName.c_str(), data, stateMask, hash, 0);
+        }
+    }
+
+    m_PendingOmmGpuBakerTuning = tuning;
+    m_IsOmmGpuBakerTuningPending = true;
+    if (tuning.bakeTimeMs == 0.0)
+    {
+        printf("[OMM] GPU baker tuning: no variant fits %u MB, settings are kept\n", m_OmmGpuTuningMemoryBudgetMb);
+        return;
+    }
+
+    bakeDesc.gpuFlags.computeOnlyWorkload = tuning.computeOnlyWorkload != 0;
+    bakeDesc.gpuFlags.scratchMemoryBudget = BakerScratchMemoryBudget(tuning.scratchMemoryBudget);
+    printf("[OMM] GPU baker tuning (%s): %s, %u MB scratch. Sample of %u geometries: %.2f ms, %.1f MB\n", isCached ? "cached" : "measured",
+        tuning.computeOnlyWorkload ? "compute" : "raster", GetScratchMemoryBudgetMb(bakeDesc.gpuFlags.scratchMemoryBudget), tuning.sampleGeometryNum,
+        tuning.bakeTimeMs, double(tuning.memorySize) / (1024.0 * 1024.0));
+}
+
+void Sample::ApplyOmmGpuBakerTuning()
+{ // Ui thread, no bake running. Later bakes and re-bakes start from the tuned knobs
+    if (!m_IsOmmGpuBakerTuningPending)
+        return;
+
+    m_IsOmmGpuBakerTuningPending = false;
+    m_OmmGpuBakerTuning = m_PendingOmmGpuBakerTuning;
+    if (m_OmmGpuBakerTuning.bakeTimeMs == 0.0)
+        return;
+
+    m_OmmBakeDesc.gpuFlags.computeOnlyWorkload = m_OmmGpuBakerTuning.computeOnlyWorkload != 0;
+    m_OmmBakeDesc.gpuFlags.scratchMemoryBudget = BakerScratchMemoryBudget(m_OmmGpuBakerTuning.scratchMemoryBudget);
+}
+
+uint32_t Sample::OmmGeometryUpdate(OmmNriContext& context, const ommhelper::OmmBakeDesc& bakeDesc, bool doBatching)
+{ // Each LOD is a full bake and build pass at its own subdivision level, cached separately. Returns the generation to retire
+    const uint32_t previousGeneration = m_OmmGeometryGeneration;
+    {
+        std::lock_guard<std::mutex> lock(m_MaskedBlasMutex);
+        m_RetiredMaskedBlasses.insert(m_RetiredMaskedBlasses.end(), m_MaskedBlasses.begin(), m_MaskedBlasses.end());
+        m_MaskedBlasses.clear();
+    }
+    m_OmmRebuildMemory[0] = 0;
+    for (uint32_t generation : GetOmmRetiredGenerations(previousGeneration))
+        m_OmmRebuildMemory[0] += m_OmmHelper.GetGeometryMemorySize(generation);
+    m_OmmGeometryGeneration = m_OmmHelper.BeginGeometryGeneration();
+    ReleaseStaleOmmAlphaBounds(bakeDesc);
+
+    ommhelper::OmmBakeDesc lodDesc = bakeDesc; // m_OmmBakeDesc belongs to the ui thread
+    if (lodDesc.type == ommhelper::OmmBakerType::GPU && m_OmmAutoTuneGpuBaker)
+        TuneOmmGpuBaker(context, lodDesc, &context == &m_OmmGraphicsContext); // the async rebuild runs on a compute queue
+
+    const uint32_t subdivisionLevel = bakeDesc.subdivisionLevel;
+    for (uint32_t lod = 0; lod < OMM_MAX_LOD_NUM; ++lod)
+    {
+        m_OmmLodLevels[lod] = 0;
+        m_OmmLodMemory[lod] = 0;
+    }
+
+    for (uint32_t lod = 0; lod < m_OmmLodNum; ++lod)
+    {
+        uint32_t levelOffset = lod * m_OmmLodLevelStep;
+        if (levelOffset >= subdivisionLevel)
+            break; // no coarser level left
+
+        lodDesc.subdivisionLevel = subdivisionLevel - levelOffset;
+        m_OmmLodLevels[lod] = lodDesc.subdivisionLevel;
+        if (m_OmmLodNum > 1)
+            printf("[OMM] LOD %u: subdivision level %u\n", lod, lodDesc.subdivisionLevel);
+
+        BakeOmmLod(context, lodDesc, { lod, m_OmmGeometryGeneration, false }, doBatching);
+
+        if (m_OmmLodNum > 1)
+            printf("[OMM] LOD %u: %.1f MB of OMM arrays and blasses\n", lod, double(m_OmmLodMemory[lod]) / (1024.0 * 1024.0));
+    }
+
+    { // Instances without a new variant fall back to regular geometry only now
+        std::lock_guard<std::mutex> lock(m_MaskedBlasMutex);
+        for (auto& instanceMaskToMaskedBlas : m_InstanceMaskToMaskedBlasData)
+        {
+            for (auto it = instanceMaskToMaskedBlas.begin(); it != instanceMaskToMaskedBlas.end();)
+                it = it->second.generation == m_OmmGeometryGeneration ? std::next(it) : instanceMaskToMaskedBlas.erase(it);
+        }
+        m_OmmBoundAlphaCutoff = bakeDesc.alphaCutoff; // only the new generation is bound from here on
+    }
+
+    m_OmmRebuildMemory[1] = m_OmmRebuildMemory[0] + m_OmmHelper.GetGeometryMemorySize(m_OmmGeometryGeneration);
+    if (m_OmmRebuildMemory[0])
+    {
+        printf("[OMM] Rebuild kept %.1f MB of previous masked geometry bound, peak %.1f MB\n", double(m_OmmRebuildMemory[0]) / (1024.0 * 1024.0),
+            double(m_OmmRebuildMemory[1]) / (1024.0 * 1024.0));
+    }
+    return previousGeneration;
+}
+
+void Sample::BakeOmmLod(OmmNriContext& context, const ommhelper::OmmBakeDesc& bakeDesc, const OmmBuildTarget& target, bool doBatching, const std::vector<uint32_t>& geometryIds)
+{ // All geometries, or only the given ones (ascending) for a targeted re-bake
+    FillOmmBakerInputs(bakeDesc, geometryIds);
+    BeginOmmTimeline(context);
+    const uint32_t cpuPlacementId = bakeDesc.cpuFlags.enableNumaPlacement ? 1 : 0;
+    m_OmmCpuBakeTimeMs[cpuPlacementId] = 0.0;
+    m_OmmCpuBakePrimitiveNum[cpuPlacementId] = 0;
+    const uint32_t prepareThreadNum = m_OmmHelper.GetPrepareThreadNum();
+    double prepareTimeMs = 0.0;
+    m_OmmAlphaBoundsCounts[0] = m_OmmAlphaBoundsCounts[1] = m_OmmAlphaBoundsCounts[2] = 0;
+    m_OmmAlphaBoundsTimeMs[0] = m_OmmAlphaBoundsTimeMs[1] = 0.0;
+    const uint32_t gpuTextureId = m_OmmUseAlphaProxies ? 1 : 0;
+    m_OmmGpuBakeTimeMs[gpuTextureId] = 0.0;
+    m_OmmGpuTextureSizes[0] = m_OmmGpuTextureSizes[1] = 0;
+    m_OmmIndexBufferSizes[0] = m_OmmIndexBufferSizes[1] = 0;
+    m_OmmBatchRecordCounts[0] = m_OmmBatchRecordCounts[1] = 0;
+    m_OmmArrayCache.Begin(GetOmmArrayCacheFilename(), ommhelper::OmmCaching::CalculateSateHash(bakeDesc), m_DisableOmmBlasBuild ? nullptr : &m_OmmHelper, bakeDesc.enableCache);
+    m_OmmCpuAlphaDataSizes[0] = m_OmmCpuAlphaDataSizes[1] = 0;
+    m_OmmCpuAlphaDecodedTextureNum = 0;
+    m_OmmCopyBytes[0] = m_OmmCopyBytes[1] = 0;
+    m_OmmCopyWaitTimeMs = 0.0;
     OmmGpuBakerPrebuildMemoryStats memoryStats = {};
-    std::vector<OmmBatch> batches = GetGpuBakerBatches(m_OmmAlphaGeometry, memoryStats, 1);
+    std::vector<OmmBatch> batches;
+    if (geometryIds.empty())
+        batches = GetGpuBakerBatches(m_OmmGeometryTable, memoryStats, 1);
+    else
+    { // one batch per geometry, the rest of the scene is neither baked nor built
+        for (uint32_t id : geometryIds)
+            batches.push_back({ id, 1 });
+    }
 
-    if (m_OmmBakeDesc.type == ommhelper::OmmBakerType::GPU)
+    if (bakeDesc.type == ommhelper::OmmBakerType::GPU)
     {
-        std::vector<ommhelper::OmmBakeGeometryDesc*> queue;
-        uint64_t stateMask = ommhelper::OmmCaching::CalculateSateHash(m_OmmBakeDesc);
+        const std::string cacheFileName = GetOmmCacheFilename();
+        const uint64_t stateMask = ommhelper::OmmCaching::CalculateSateHash(bakeDesc);
 
-        for (size_t instanceId = 0; instanceId < m_OmmAlphaGeometry.size(); ++instanceId)
+        std::vector<uint32_t> queueIds;
+        for (uint32_t id = 0; id < (uint32_t)m_OmmGeometryTable.GetSize(); ++id)
         { // skip prepass for instances with cache
-            AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[instanceId];
-            uint64_t hash = GetInstanceHash(geometry.meshIndex, geometry.materialIndex);
-            if (ommhelper::OmmCaching::LookForCache(GetOmmCacheFilename().c_str(), stateMask, hash) && m_OmmBakeDesc.enableCache)
+            if (!geometryIds.empty() && !std::binary_search(geometryIds.begin(), geometryIds.end(), id))
                 continue;
-            queue.push_back(&geometry.bakeDesc);
+            if (bakeDesc.enableCache && ommhelper::OmmCaching::LookForCache(cacheFileName.c_str(), stateMask, m_OmmGeometryTable.instanceHashes[id]))
+                continue;
+            queueIds.push_back(id);
         }
 
-        if (queue.empty() == false)
+        if (queueIds.empty() == false)
         { // perform setup pass
-            m_OmmHelper.GetGpuBakerPrebuildInfo(queue.data(), queue.size(), m_OmmBakeDesc);
-            memoryStats = GetGpuBakerPrebuildMemoryStats(false); // arrayData size calculation is conservative here
+            std::vector<ommhelper::OmmBakeGeometryDesc*> queue = QueueOmmGpuBake(queueIds);
+            PrepareOmmGpuBakerTextures(context, queue);
+            m_OmmHelper.GetGpuBakerPrebuildInfo(queue.data(), queue.size(), bakeDesc);
+            GatherOmmGpuBakerSizes();
+            memoryStats = GetGpuBakerPrebuildMemoryStats(bakeDesc, false); // arrayData size calculation is conservative here
 
             CreateAndBindGpuBakerSatitcBuffers(memoryStats); // create buffers which sizes are correctly calculated in GetGpuBakerPrebuildInfo()
             { // get actual arrayData buffer sizes. GetGpuBakerPrebuildInfo() returns conservative arrayData size estimation
-                RunOmmSetupPass(context, queue.data(), queue.size(), memoryStats);
+                RunOmmSetupPass(context, bakeDesc, queue.data(), queue.size(), memoryStats);
             }
             CreateAndBindGpuBakerArrayDataBuffer(memoryStats);
 
-            if (m_OmmBakeDesc.enableCache)
+            if (bakeDesc.enableCache)
                 CreateAndBindGpuBakerReadbackBuffer(memoryStats);
 
-            if (doBatching)
+            if (doBatching && geometryIds.empty())
             {
                 batches.clear();
                 batches.push_back({ 0, m_OmmAlphaGeometry.size() });
@@ -2063,25 +4000,50 @@ void Sample::OmmGeometryUpdate(OmmNriContext& context, bool doBatching)
         }
     }
 
+    OmmPendingBuild pendingBuild = {};
     for (size_t batchId = 0; batchId < batches.size(); ++batchId)
     {
         const OmmBatch& batch = batches[batchId];
         printf("\r%s\r[OMM] Batch [%llu / %llu]: ", std::string(100, ' ').c_str(), batchId + 1, batches.size());
         std::vector<ommhelper::OmmBakeGeometryDesc*> bakeQueue;
-        InitializeOmmGeometryFromCache(batch, bakeQueue);
+        OmmBatchRecord record = {};
+        if (ReadOmmBatchRecord(bakeDesc, batch, record))
+            printf("Read batch record. ");
+        else
+            InitializeOmmGeometryFromCache(bakeDesc, batch, bakeQueue);
 
         if (!bakeQueue.empty())
         {
             printf("Bake. ");
-            if (m_OmmBakeDesc.type == ommhelper::OmmBakerType::GPU)
-                BakeOmmGpu(context, bakeQueue);
+            if (bakeDesc.type == ommhelper::OmmBakerType::GPU)
+            { // Queued behind the pending build, which reads other ranges of the baker buffers. Its readback owns the copy queue until it's saved
+                FinishOmmGpuReadback(bakeDesc, pendingBuild.batch);
+                auto bakeStart = std::chrono::high_resolution_clock::now();
+                BakeOmmGpu(context, bakeDesc, bakeQueue);
+                m_OmmPendingReadbackBatch = batch;
+                std::chrono::duration<double, std::milli> bakeTime = std::chrono::high_resolution_clock::now() - bakeStart;
+                m_OmmGpuBakeTimeMs[m_OmmAlphaProxyTextures.empty() ? 0 : 1] += bakeTime.count();
+            }
+            else if (bakeDesc.cpuFlags.enableAlphaBounds)
+                BakeOmmCpuFromAlphaBounds(bakeDesc, batch, bakeQueue);
             else
-                m_OmmHelper.BakeOpacityMicroMapsCpu(bakeQueue.data(), bakeQueue.size(), m_OmmBakeDesc);
+            { // overlaps with the pending build
+                AcquireOmmCpuAlphaTextures(bakeDesc, batch, bakeQueue);
+                auto bakeStart = std::chrono::high_resolution_clock::now();
+                m_OmmHelper.BakeOpacityMicroMapsCpu(bakeQueue.data(), bakeQueue.size(), bakeDesc);
+                std::chrono::duration<double, std::milli> bakeTime = std::chrono::high_resolution_clock::now() - bakeStart;
+                ReleaseOmmCpuAlphaTextures(batch, bakeQueue);
+
+                uint32_t placementId = bakeDesc.cpuFlags.enableNumaPlacement ? 1 : 0;
+                m_OmmCpuBakeTimeMs[placementId] += bakeTime.count();
+                for (const ommhelper::OmmBakeGeometryDesc* desc : bakeQueue)
+                    m_OmmCpuBakePrimitiveNum[placementId] += desc->indices.numElements / 3;
+            }
 
-            if (m_OmmBakeDesc.enableCache)
-            {
+            if (bakeDesc.enableCache && m_OmmPendingReadback.empty())
+            { // gpu baker outputs are saved when their readback is finished
                 printf("Save cache. ");
-                SaveMaskCache(batch);
+                SaveMaskCache(bakeDesc, batch);
             }
         }
 
@@ -2089,76 +4051,360 @@ void Sample::OmmGeometryUpdate(OmmNriContext& context, bool doBatching)
         {
             printf("Build. ");
 
-            std::vector<ommhelper::MaskedGeometryBuildDesc*> buildQueue = {};
-            FillOmmBlasBuildQueue(batch, buildQueue);
-
-            NRI.ResetCommandAllocator(*context.commandAllocator);
-            NRI.BeginCommandBuffer(*context.commandBuffer, nullptr, nri::WHOLE_DEVICE_GROUP);
+            OmmPendingBuild build = {};
+            build.batch = batch;
+            build.target = target;
+            size_t buildInputBufferNum = m_OmmBuildInputBuffers.size();
+            size_t tmpAllocationNum = m_OmmTmpAllocations.size();
+            uint64_t uploadFenceValue = 0; // the upload overlaps with the pending build
+            auto prepareStart = std::chrono::high_resolution_clock::now();
+            if (record.isValid)
+                uploadFenceValue = FillOmmBlasBuildQueueFromRecord(bakeDesc, batch, record, build.buildQueue);
+            else
+                uploadFenceValue = FillOmmBlasBuildQueue(bakeDesc, batch, build.buildQueue);
+            std::chrono::duration<double, std::milli> prepareTime = std::chrono::high_resolution_clock::now() - prepareStart;
+            prepareTimeMs += prepareTime.count();
+            build.record = std::move(record);
+            build.buildInputBufferNum = m_OmmBuildInputBuffers.size() - buildInputBufferNum;
+            build.tmpAllocationNum = m_OmmTmpAllocations.size() - tmpAllocationNum;
+            build.isActive = true;
+
+            FinishOmmBlasBuild(context, bakeDesc, pendingBuild);
+            context.BeginRecording(NRI);
             {
-                m_OmmHelper.BuildMaskedGeometry(buildQueue.data(), buildQueue.size(), context.commandBuffer);
+                prepareStart = std::chrono::high_resolution_clock::now();
+                m_OmmHelper.GetBlasPrebuildInfo(build.buildQueue.data(), build.buildQueue.size());
+                prepareTime = std::chrono::high_resolution_clock::now() - prepareStart;
+                prepareTimeMs += prepareTime.count();
+
+                uint32_t eventId = context.BeginEvent(NRI, OmmTimelineSection::Build);
+                m_OmmHelper.BuildMaskedGeometry(build.buildQueue.data(), build.buildQueue.size(), context.commandBuffer);
+                context.EndEvent(NRI, eventId);
             }
-            NRI.EndCommandBuffer(*context.commandBuffer);
-            SubmitQueueWorkAndWait(NRI, context.commandBuffer, context.commandQueue, context.fence, context.fenceValue);
+            context.Submit(NRI, uploadFenceValue ? m_OmmCopyContext.fence : nullptr, uploadFenceValue);
+            pendingBuild = std::move(build);
+        }
+        else
+            FinishOmmGpuReadback(bakeDesc, batch);
 
-            for (size_t id = batch.offset; id < batch.offset + batch.count; ++id)
-            {
-                AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
-                ommhelper::MaskedGeometryBuildDesc& buildDesc = geometry.buildDesc;
-                if (!buildDesc.outputs.blas)
-                    continue;
+        m_OmmUpdateProgress += (uint32_t)batch.count;
+    }
+    FinishOmmBlasBuild(context, bakeDesc, pendingBuild);
+    printf("\n");
+    PrintOmmTimeline(context);
 
-                uint64_t mask = GetInstanceHash(m_OmmAlphaGeometry[id].meshIndex, m_OmmAlphaGeometry[id].materialIndex);
-                OmmBlas ommBlas = { buildDesc.outputs.blas, buildDesc.outputs.ommArray };
-                m_InstanceMaskToMaskedBlasData.insert(std::make_pair(mask, ommBlas));
-                m_MaskedBlasses.push_back({ buildDesc.outputs.blas, buildDesc.outputs.ommArray });
-            }
-        }
+    if (bakeDesc.type == ommhelper::OmmBakerType::CPU && m_OmmCpuBakeTimeMs[cpuPlacementId] > 0.0)
+    {
+        double timeMs = m_OmmCpuBakeTimeMs[cpuPlacementId];
+        printf("[OMM] CPU bake (%s, %u node(s)): %llu primitives in %.1f ms [%.2f Mprim/s]\n", cpuPlacementId ? "pinned" : "unpinned",
+            cpuPlacementId ? ommhelper::CpuTopology::GetNodeNum() : 1u, m_OmmCpuBakePrimitiveNum[cpuPlacementId], timeMs, double(m_OmmCpuBakePrimitiveNum[cpuPlacementId]) / (timeMs * 1000.0));
+    }
 
-        // Free cpu side memories with batch lifecycle
-        for (auto& buffer : m_OmmCpuUploadBuffers)
-            NRI.DestroyBuffer(*buffer);
-        m_OmmCpuUploadBuffers.resize(0); m_OmmCpuUploadBuffers.shrink_to_fit();
+    if (prepareTimeMs > 0.0)
+    {
+        m_OmmBuildPrepareTimeMs[prepareThreadNum] = prepareTimeMs;
+        printf("[OMM] Build preparation (%u threads): %.1f ms", prepareThreadNum, prepareTimeMs);
+        auto serial = m_OmmBuildPrepareTimeMs.find(1);
+        if (prepareThreadNum != 1 && serial != m_OmmBuildPrepareTimeMs.end())
+            printf(" [%.2fx vs 1 thread]", serial->second / prepareTimeMs);
+        printf("\n");
+    }
 
-        for (auto& memory : m_OmmTmpAllocations)
-            NRI.FreeMemory(*memory);
-        m_OmmTmpAllocations.resize(0); m_OmmTmpAllocations.shrink_to_fit();
+    if (bakeDesc.type == ommhelper::OmmBakerType::CPU && bakeDesc.cpuFlags.enableAlphaBounds)
+    {
+        printf("[OMM] Alpha bounds: %u baked in %.1f ms, %u read from cache, %u reused, %.1f MB resident. Threshold at %.2f: %.1f ms\n", m_OmmAlphaBoundsCounts[0],
+            m_OmmAlphaBoundsTimeMs[0], m_OmmAlphaBoundsCounts[1], m_OmmAlphaBoundsCounts[2], double(m_OmmAlphaBoundsSize) / (1024.0 * 1024.0), bakeDesc.alphaCutoff, m_OmmAlphaBoundsTimeMs[1]);
+    }
 
-        m_OmmUpdateProgress += (uint32_t)batch.count;
+    if (bakeDesc.type == ommhelper::OmmBakerType::GPU && m_OmmGpuBakeTimeMs[gpuTextureId] > 0.0)
+    {
+        printf("[OMM] GPU bake (%s): %.1f ms, sampled mips %.1f MB", gpuTextureId ? "alpha proxies" : "material textures", m_OmmGpuBakeTimeMs[gpuTextureId],
+            double(m_OmmGpuTextureSizes[gpuTextureId]) / (1024.0 * 1024.0));
+        if (gpuTextureId)
+            printf(" (material textures %.1f MB)", double(m_OmmGpuTextureSizes[0]) / (1024.0 * 1024.0));
+        printf("\n");
+    }
+
+    if (bakeDesc.type == ommhelper::OmmBakerType::CPU)
+    {
+        printf("[OMM] CPU alpha planes: %u / %u textures decoded, peak %.1f MB\n", m_OmmCpuAlphaDecodedTextureNum, (uint32_t)m_OmmCpuAlphaTextures.size(),
+            double(m_OmmCpuAlphaDataSizes[1]) / (1024.0 * 1024.0));
+    }
+
+    if (m_OmmArrayCache.GetReadNum() || m_OmmArrayCache.GetMissNum())
+        printf("[OMM] OMM arrays: %u deserialized, %u built\n", m_OmmArrayCache.GetReadNum(), m_OmmArrayCache.GetMissNum());
+
+    if (m_OmmBatchRecordCounts[0] || m_OmmBatchRecordCounts[1])
+        printf("[OMM] Batch records: %u read, %u written\n", m_OmmBatchRecordCounts[0], m_OmmBatchRecordCounts[1]);
+
+    if (m_OmmCopyBytes[0] || m_OmmCopyBytes[1])
+    {
+        printf("[OMM] Copy queue: %.1f MB uploaded, %.1f MB read back, %.1f ms blocked on transfers\n", double(m_OmmCopyBytes[0]) / (1024.0 * 1024.0),
+            double(m_OmmCopyBytes[1]) / (1024.0 * 1024.0), m_OmmCopyWaitTimeMs);
+    }
+
+    if (m_OmmIndexBufferSizes[0])
+    {
+        printf("[OMM] Index buffers: %.1f KB -> %.1f KB (saved %.1f KB)\n", double(m_OmmIndexBufferSizes[0]) / 1024.0, double(m_OmmIndexBufferSizes[1]) / 1024.0,
+            double(m_OmmIndexBufferSizes[0] - m_OmmIndexBufferSizes[1]) / 1024.0);
     }
-    printf("\n");
 
     ReleaseBakingResources();
     m_OmmUpdateProgress = 0;
 }
 
-void Sample::RebuildOmmGeometryAsync(uint32_t const* frameId)
+void Sample::FinishOmmBlasBuild(OmmNriContext& context, const ommhelper::OmmBakeDesc& bakeDesc, OmmPendingBuild& build)
 {
-    uint32_t fistFrame = *frameId;
-    uint32_t endFrame = fistFrame + BUFFERED_FRAME_MAX_NUM;
-    m_InstanceMaskToMaskedBlasData.clear(); // stop using masked geometry here
+    if (!build.isActive)
+        return;
 
-    while (*frameId < endFrame)
-        Sleep(1);
+    FinishOmmGpuReadback(bakeDesc, build.batch); // overlapped with the build
+    context.Wait(NRI);
+
+    if (m_OmmArrayCache.IsEnabled())
+    { // Serialization sizes are known only after the build
+        context.BeginRecording(NRI);
+        {
+            uint32_t eventId = context.BeginEvent(NRI, OmmTimelineSection::Serialize);
+            m_OmmHelper.SerializeOmmArrays(build.buildQueue.data(), build.buildQueue.size(), context.commandBuffer);
+            context.EndEvent(NRI, eventId);
+        }
+        context.Submit(NRI);
+        context.Wait(NRI);
+
+        m_OmmHelper.ReadSerializedOmmArrays(build.buildQueue.data(), build.buildQueue.size());
+        SaveOmmArrayCache(build.batch);
+    }
 
-    OmmGeometryUpdate(m_OmmComputeContext, false);
+    for (size_t id = build.batch.offset; id < build.batch.offset + build.batch.count; ++id)
+    {
+        AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
+        ommhelper::MaskedGeometryBuildDesc& buildDesc = geometry.buildDesc;
+        geometry.serializedOmmArray.clear();
+        geometry.serializedOmmArray.shrink_to_fit();
+        buildDesc.outputs.serializedOmmArray.clear();
+        buildDesc.outputs.serializedOmmArray.shrink_to_fit();
+        buildDesc.inputs.serializedOmmArray = nullptr;
+        if (!buildDesc.outputs.blas)
+            continue;
+
+        uint64_t mask = GetInstanceHash(m_OmmAlphaGeometry[id].meshIndex, m_OmmAlphaGeometry[id].materialIndex);
+        const OmmBuildTarget& target = build.target;
+        OmmBlas ommBlas = { buildDesc.outputs.blas, buildDesc.outputs.ommArray, target.generation, ++m_BlasBuildId };
+        { // swap in right away, the previous generation variant is retired with its generation
+            std::lock_guard<std::mutex> lock(m_MaskedBlasMutex);
+            std::map<uint64_t, OmmBlas>& instanceMaskToMaskedBlas = m_InstanceMaskToMaskedBlasData[target.lod];
+            auto it = instanceMaskToMaskedBlas.find(mask);
+            if (it == instanceMaskToMaskedBlas.end())
+                instanceMaskToMaskedBlas.insert(std::make_pair(mask, ommBlas));
+            else if (target.isRebake)
+            { // a re-bake replaces a bound variant, its memory is released once nothing else lives in its generation
+                m_ReplacedMaskedBlasses.push_back(it->second);
+                it->second = ommBlas;
+            }
+            else if (it->second.generation != target.generation)
+                it->second = ommBlas;
+            m_MaskedBlasses.push_back(ommBlas);
+        }
+        m_OmmLodMemory[target.lod] += buildDesc.prebuildInfo.ommArraySize + buildDesc.prebuildInfo.blasSize;
+    }
+    ReleaseOmmBakeOutputs(build.batch, build.target.lod);
+
+    // Free cpu side memories with batch lifecycle. The next batch may have appended its uploads already
+    for (size_t i = 0; i < build.buildInputBufferNum; ++i)
+        NRI.DestroyBuffer(*m_OmmBuildInputBuffers[i]);
+    m_OmmBuildInputBuffers.erase(m_OmmBuildInputBuffers.begin(), m_OmmBuildInputBuffers.begin() + build.buildInputBufferNum);
+
+    for (size_t i = 0; i < build.tmpAllocationNum; ++i)
+        NRI.FreeMemory(*m_OmmTmpAllocations[i]);
+    m_OmmTmpAllocations.erase(m_OmmTmpAllocations.begin(), m_OmmTmpAllocations.begin() + build.tmpAllocationNum);
+
+    build = {};
+}
+
+void Sample::RebuildOmmGeometryAsync(ommhelper::OmmBakeDesc bakeDesc)
+{ // Masked geometry stays bound during the rebuild, the previous generation is retired after the last swap
+    uint32_t previousGeneration = OmmGeometryUpdate(m_OmmComputeContext, bakeDesc, false);
+    WaitForMaskedGeometrySwap();
+    ReleaseRetiredMaskedGeometry(previousGeneration);
+}
+
+void Sample::WaitForMaskedGeometrySwap()
+{ // After a swap: frames started so far may have bound the swapped out variants, later ones can't see them. Waits until the gpu has finished the latest one
+    NRI.Wait(*m_FrameFence, 1 + m_StartedFrameIndex);
 }
 
 void Sample::RebuildOmmGeometry()
 {
+    m_FrameSubmitWorker.Wait();
     NRI.WaitForIdle(*m_CommandQueue);
-    OmmGeometryUpdate(m_OmmGraphicsContext, true);
+    uint32_t previousGeneration = OmmGeometryUpdate(m_OmmGraphicsContext, m_OmmBakeDesc, true);
+    ReleaseRetiredMaskedGeometry(previousGeneration); // no frames were submitted since the wait
+}
+
+void Sample::RebakeOmmGeometryAsync(ommhelper::OmmBakeDesc bakeDesc, std::map<uint32_t, std::chrono::high_resolution_clock::time_point> rebakes)
+{ // Every LOD of the given geometries only, in a generation of their own. The replaced variants stay bound until swapped
+    std::vector<uint32_t> geometryIds;
+    uint64_t primitiveNum = 0;
+    for (const auto& it : rebakes)
+    {
+        geometryIds.push_back(it.first);
+        primitiveNum += m_OmmGeometryTable.primitiveNums[it.first];
+    }
+
+    auto passStart = std::chrono::high_resolution_clock::now();
+    const uint32_t passGeneration = m_OmmHelper.BeginGeometryGeneration(); // the replaced variants can be freed without the rest of the scene
+    for (uint32_t lod = 0; lod < m_OmmLodNum && m_OmmLodLevels[lod]; ++lod)
+    {
+        bakeDesc.subdivisionLevel = m_OmmLodLevels[lod];
+        BakeOmmLod(m_OmmComputeContext, bakeDesc, { lod, passGeneration, true }, false, geometryIds);
+    }
+    auto passEnd = std::chrono::high_resolution_clock::now();
+
+    OmmRebakeStats& stats = m_OmmRebakeStats;
+    std::chrono::duration<double, std::milli> passTime = passEnd - passStart;
+    stats.passTimeMs = passTime.count();
+    stats.geometryNum[0] += (uint32_t)geometryIds.size();
+    stats.geometryNum[1] = (uint32_t)geometryIds.size();
+    stats.primitiveNum[0] += primitiveNum;
+    stats.primitiveNum[1] = primitiveNum;
+    stats.latencyMs[0] = stats.latencyMs[1] = 0.0;
+    for (const auto& it : rebakes)
+    {
+        std::chrono::duration<double, std::milli> latency = passEnd - it.second;
+        stats.latencyMs[0] += latency.count() / double(rebakes.size());
+        stats.latencyMs[1] = std::max(stats.latencyMs[1], latency.count());
+    }
+    printf("[OMM] Re-bake: %u geometries, %llu primitives in %.1f ms. Residency event to swap in: %.1f ms average, %.1f ms max\n", stats.geometryNum[1],
+        (unsigned long long)primitiveNum, stats.passTimeMs, stats.latencyMs[0], stats.latencyMs[1]);
+
+    WaitForMaskedGeometrySwap();
+
+    std::vector<OmmBlas> replacedBlasses;
+    std::set<uint32_t> releasedGenerations;
+    {
+        std::lock_guard<std::mutex> lock(m_MaskedBlasMutex);
+        replacedBlasses.swap(m_ReplacedMaskedBlasses);
+        for (const OmmBlas& replaced : replacedBlasses)
+        {
+            m_MaskedBlasses.erase(std::remove_if(m_MaskedBlasses.begin(), m_MaskedBlasses.end(), [&](const OmmBlas& ommBlas) { return ommBlas.blas == replaced.blas; }), m_MaskedBlasses.end());
+            releasedGenerations.insert(replaced.generation);
+        }
+
+        // A generation goes with its last variant: earlier passes fully re-baked since, or the full rebuild when every geometry was
+        for (const OmmBlas& ommBlas : m_MaskedBlasses)
+            releasedGenerations.erase(ommBlas.generation);
+    }
+
+    for (const OmmBlas& replaced : replacedBlasses)
+        m_OmmHelper.DestroyMaskedGeometry(replaced.blas, replaced.ommArray);
+    for (uint32_t generation : releasedGenerations)
+        m_OmmHelper.ReleaseGeometryMemory(generation);
+}
+
+void Sample::OnOmmTextureMipResident(uint32_t textureIndex, uint32_t mip)
+{ // Texture streaming hook: the mip and all coarser ones are resident. Queued for re-bakes between bakes only
+    if (textureIndex >= m_OmmTextureResidentMips.size() || mip >= m_OmmTextureResidentMips[textureIndex])
+        return;
+
+    m_OmmTextureResidentMips[textureIndex] = (uint8_t)mip;
+    m_OmmResidencyEvents.push_back(std::make_pair(textureIndex, std::chrono::high_resolution_clock::now()));
+    m_OmmRebakeStats.eventNum++;
+}
+
+void Sample::StepOmmMipStreaming(uint32_t frameId)
+{ // Simulated streaming, after the first bake: every partially resident texture gets its next finer mip
+    uint32_t firstFrame = m_OmmBakeDesc.buildFrameId;
+    if (!m_OmmMipStreamingFrames || frameId <= firstFrame || (frameId - firstFrame) % m_OmmMipStreamingFrames)
+        return;
+
+    for (uint32_t i = 0; i < (uint32_t)m_OmmTextureResidentMips.size(); ++i)
+    {
+        if (m_OmmTextureResidentMips[i])
+            OnOmmTextureMipResident(i, m_OmmTextureResidentMips[i] - 1u);
+    }
+}
+
+std::map<uint32_t, std::chrono::high_resolution_clock::time_point> Sample::QueueOmmRebakes()
+{ // Called while no bake is running, so the mip offsets planned by the last one are stable. Returns the oldest requests, up to a pass
+    if (m_OmmResidencyEvents.empty() && m_OmmRebakeQueue.empty())
+        return {};
+
+    if (m_OmmLodLevels[0] == 0)
+    { // nothing baked yet, the first bake reads the current residency
+        m_OmmResidencyEvents.clear();
+        return {};
+    }
+
+    for (const auto& event : m_OmmResidencyEvents)
+    {
+        uint32_t missingMipNum = 0;
+        uint32_t mipOffset = GetOmmTextureMipOffset(m_OmmBakeDesc, event.first, m_OmmTextureResidentMips, missingMipNum);
+        for (uint32_t id = 0; id < (uint32_t)m_OmmAlphaGeometry.size(); ++id)
+        { // only the geometries whose clamped mip offset changes, the requested mip may be resident already
+            const AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
+            if (m_Scene.materials[geometry.materialIndex].baseColorTexIndex == event.first && geometry.mipOffset != mipOffset)
+                m_OmmRebakeQueue.insert(std::make_pair(id, event.second)); // keeps the earliest event
+        }
+    }
+    m_OmmResidencyEvents.clear();
+
+    std::vector<std::pair<std::chrono::high_resolution_clock::time_point, uint32_t>> order;
+    for (const auto& it : m_OmmRebakeQueue)
+        order.push_back(std::make_pair(it.second, it.first));
+    size_t passSize = std::min(order.size(), (size_t)m_OmmRebakeGeometryMaxNum);
+    std::partial_sort(order.begin(), order.begin() + passSize, order.end());
+
+    std::map<uint32_t, std::chrono::high_resolution_clock::time_point> rebakes;
+    for (size_t i = 0; i < passSize; ++i)
+    {
+        rebakes.insert(std::make_pair(order[i].second, order[i].first));
+        m_OmmRebakeQueue.erase(order[i].second);
+    }
+    return rebakes;
 }
 
 void Sample::ReleaseMaskedGeometry()
 {
-    for (auto& resource : m_MaskedBlasses)
-        m_OmmHelper.DestroyMaskedGeometry(resource.blas, resource.ommArray);
-
-    m_InstanceMaskToMaskedBlasData.clear();
-    m_MaskedBlasses.clear();
+    {
+        std::lock_guard<std::mutex> lock(m_MaskedBlasMutex);
+        for (auto& instanceMaskToMaskedBlas : m_InstanceMaskToMaskedBlasData)
+            instanceMaskToMaskedBlas.clear();
+
+        for (auto& resource : m_MaskedBlasses)
+            m_OmmHelper.DestroyMaskedGeometry(resource.blas, resource.ommArray);
+        for (auto& resource : m_RetiredMaskedBlasses)
+            m_OmmHelper.DestroyMaskedGeometry(resource.blas, resource.ommArray);
+        m_MaskedBlasses.clear();
+        m_RetiredMaskedBlasses.clear();
+        m_ReplacedMaskedBlasses.clear(); // still in m_MaskedBlasses
+    }
     m_OmmHelper.ReleaseGeometryMemory();
 }
 
+std::set<uint32_t> Sample::GetOmmRetiredGenerations(uint32_t generation)
+{ // The full rebuild generation and the re-bake passes made on top of it
+    std::set<uint32_t> generations = { generation };
+    std::lock_guard<std::mutex> lock(m_MaskedBlasMutex);
+    for (const OmmBlas& resource : m_RetiredMaskedBlasses)
+        generations.insert(resource.generation);
+    return generations;
+}
+
+void Sample::ReleaseRetiredMaskedGeometry(uint32_t generation)
+{ // Objects first, then the memory of their generations
+    std::set<uint32_t> generations = GetOmmRetiredGenerations(generation);
+    std::vector<OmmBlas> retiredBlasses;
+    {
+        std::lock_guard<std::mutex> lock(m_MaskedBlasMutex);
+        retiredBlasses.swap(m_RetiredMaskedBlasses);
+    }
+    for (auto& resource : retiredBlasses)
+        m_OmmHelper.DestroyMaskedGeometry(resource.blas, resource.ommArray);
+    for (uint32_t retiredGeneration : generations)
+        m_OmmHelper.ReleaseGeometryMemory(retiredGeneration);
+}
+
 void Sample::ReleaseBakingResources()
 {
     for (AlphaTestedGeometry& geometry : m_OmmAlphaGeometry)
@@ -2167,8 +4413,12 @@ void Sample::ReleaseBakingResources()
         geometry.buildDesc = {};
     }
 
-    m_OmmRawAlphaChannelForCpuBaker.resize(0);
-    m_OmmRawAlphaChannelForCpuBaker.shrink_to_fit();
+    m_OmmCpuAlphaTextures.clear();
+    m_OmmGeometryTable.ClearQueue();
+
+    for (auto& it : m_OmmAlphaProxyTextures)
+        NRI.DestroyTexture(*it.second);
+    m_OmmAlphaProxyTextures.clear();
 
     // Destroy buffers
     auto DestroyBuffers = [](NRIInterface& nri, nri::Buffer** buffers, uint32_t count)
@@ -2186,9 +4436,9 @@ void Sample::ReleaseBakingResources()
     DestroyBuffers(NRI, m_OmmGpuReadbackBuffers, (uint32_t)ommhelper::OmmDataLayout::GpuOutputNum);
     DestroyBuffers(NRI, m_OmmGpuTransientBuffers, OMM_MAX_TRANSIENT_POOL_BUFFERS);
 
-    for (auto& buffer : m_OmmCpuUploadBuffers)
+    for (auto& buffer : m_OmmBuildInputBuffers)
         NRI.DestroyBuffer(*buffer);
-    m_OmmCpuUploadBuffers.resize(0); m_OmmCpuUploadBuffers.shrink_to_fit();
+    m_OmmBuildInputBuffers.resize(0); m_OmmBuildInputBuffers.shrink_to_fit();
 
     // Release memories
     for (auto& memory : m_OmmTmpAllocations)
@@ -2221,11 +4471,13 @@ bool IsRebuildAvailable(ommhelper::OmmBakeDesc& updated, ommhelper::OmmBakeDesc&
     result |= updated.dynamicSubdivisionScale != current.dynamicSubdivisionScale;
     result |= updated.filter != current.filter;
     result |= updated.format != current.format;
+    result |= updated.alphaCutoff != current.alphaCutoff;
     
     result |= updated.type != current.type;
     if (current.type == ommhelper::OmmBakerType::GPU)
     {
         result |= updated.gpuFlags.computeOnlyWorkload != current.gpuFlags.computeOnlyWorkload;
+        result |= updated.gpuFlags.scratchMemoryBudget != current.gpuFlags.scratchMemoryBudget;
         result |= updated.gpuFlags.enablePostBuildInfo != current.gpuFlags.enablePostBuildInfo;
         result |= updated.gpuFlags.enableTexCoordDeduplication != current.gpuFlags.enableTexCoordDeduplication;
         result |= updated.gpuFlags.force32bitIndices != current.gpuFlags.force32bitIndices;
@@ -2239,6 +4491,9 @@ bool IsRebuildAvailable(ommhelper::OmmBakeDesc& updated, ommhelper::OmmBakeDesc&
         result |= updated.cpuFlags.enableDuplicateDetection != current.cpuFlags.enableDuplicateDetection;
         result |= updated.cpuFlags.enableNearDuplicateDetection != current.cpuFlags.enableNearDuplicateDetection;
         result |= updated.cpuFlags.force32bitIndices != current.cpuFlags.force32bitIndices;
+        result |= updated.cpuFlags.enableNumaPlacement != current.cpuFlags.enableNumaPlacement;
+        result |= updated.cpuFlags.splitWorkLog2 != current.cpuFlags.splitWorkLog2;
+        result |= updated.cpuFlags.enableAlphaBounds != current.cpuFlags.enableAlphaBounds;
     }
 
     result |= ((current.enableCache == false) && updated.enableCache);
@@ -2246,9 +4501,231 @@ bool IsRebuildAvailable(ommhelper::OmmBakeDesc& updated, ommhelper::OmmBakeDesc&
     return result;
 }
 
+inline float3 TransformAffine(const float4x4& m, const float3& p, float w)
+{
+    return float3(m.col0.x * p.x + m.col1.x * p.y + m.col2.x * p.z + m.col3.x * w,
+                  m.col0.y * p.x + m.col1.y * p.y + m.col2.y * p.z + m.col3.y * w,
+                  m.col0.z * p.x + m.col1.z * p.y + m.col2.z * p.z + m.col3.z * w);
+}
+
+void Sample::BuildOmmAhsEstimatorScene()
+{ // World space alpha tested instances, transformed the same way as the static BLAS geometry
+    std::map<uint64_t, uint32_t> geometryIds;
+    for (uint32_t i = 0; i < (uint32_t)m_OmmAlphaGeometry.size(); ++i)
+        geometryIds[GetInstanceHash(m_OmmAlphaGeometry[i].meshIndex, m_OmmAlphaGeometry[i].materialIndex)] = i;
+
+    static_assert(sizeof(utils::Index) == sizeof(uint32_t), "AHS estimator expects 32 bit indices");
+    std::vector<float> positions;
+    for (const utils::Instance& instance : m_Scene.instances)
+    {
+        const auto& it = geometryIds.find(GetInstanceHash(instance.meshInstanceIndex, instance.materialIndex));
+        if (it == geometryIds.end() || m_Scene.materials[instance.materialIndex].IsOff())
+            continue;
+
+        const utils::Mesh& mesh = m_Scene.meshes[instance.meshInstanceIndex];
+        float4x4 mObjectToWorld = instance.rotation;
+        if (instance.scale != float3(1.0f))
+        {
+            float4x4 translation;
+            translation.SetupByTranslation(ToFloat(instance.position) - mesh.aabb.GetCenter());
+
+            float4x4 translationInv = translation;
+            translationInv.InvertOrtho();
+
+            float4x4 scale;
+            scale.SetupByScale(instance.scale);
+
+            mObjectToWorld = mObjectToWorld * translationInv * scale * translation;
+        }
+        mObjectToWorld.AddTranslation(ToFloat(instance.position));
+
+        positions.resize(mesh.vertexNum * 3);
+        for (uint32_t v = 0; v < mesh.vertexNum; ++v)
+        {
+            const float* position = m_Scene.unpackedVertices[mesh.vertexOffset + v].position;
+            float3 worldPosition = TransformAffine(mObjectToWorld, float3(position[0], position[1], position[2]), 1.0f);
+            positions[v * 3 + 0] = worldPosition.x;
+            positions[v * 3 + 1] = worldPosition.y;
+            positions[v * 3 + 2] = worldPosition.z;
+        }
+
+        const uint32_t* indices = (const uint32_t*)(m_Scene.indices.data() + mesh.indexOffset);
+        m_OmmAhsEstimator.AddTriangles(positions.data(), indices, mesh.indexNum / 3, it->second);
+    }
+    m_OmmAhsEstimator.Build();
+}
+
+uint32_t Sample::SetOmmAhsEstimatorData(const ommhelper::OmmBakeDesc& bakeDesc)
+{ // Bake output of the configuration: kept in memory or read from the cache
+    m_OmmAhsEstimator.ClearOmmData();
+
+    const std::string cacheFileName = GetOmmCacheFilename();
+    const uint64_t stateMask = ommhelper::OmmCaching::CalculateSateHash(bakeDesc);
+    uint32_t ommGeometryNum = 0;
+    for (uint32_t i = 0; i < (uint32_t)m_OmmAlphaGeometry.size(); ++i)
+    {
+        const AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
+        std::vector<uint8_t> cachedData[(uint32_t)ommhelper::OmmDataLayout::CpuMaxNum];
+        const std::vector<uint8_t>* data = geometry.retainedOmmData;
+        uint32_t indexStride = geometry.retainedOmmIndexStride;
+
+        if (data[(uint32_t)ommhelper::OmmDataLayout::Indices].empty())
+        {
+            uint64_t hash = GetOmmCacheHash(geometry);
+            ommhelper::OmmCaching::OmmData cacheData = {};
+            if (!bakeDesc.enableCache || !ommhelper::OmmCaching::ReadMaskFromCache(cacheFileName.c_str(), cacheData, stateMask, hash, nullptr))
+                continue;
+
+            for (uint32_t j = 0; j < (uint32_t)ommhelper::OmmDataLayout::CpuMaxNum; ++j)
+            {
+                cachedData[j].resize(cacheData.sizes[j]);
+                cacheData.data[j] = cachedData[j].data();
+            }
+            uint16_t ommIndexFormat = 0;
+            ommhelper::OmmCaching::ReadMaskFromCache(cacheFileName.c_str(), cacheData, stateMask, hash, &ommIndexFormat);
+            indexStride = ommhelper::GetOmmIndexStride((nri::Format)ommIndexFormat);
+            data = cachedData;
+        }
+
+        ommhelper::OmmAhsOmmData ommData = {};
+        ommData.arrayData = data[(uint32_t)ommhelper::OmmDataLayout::ArrayData].data();
+        ommData.arrayDataSize = data[(uint32_t)ommhelper::OmmDataLayout::ArrayData].size();
+        ommData.descArray = data[(uint32_t)ommhelper::OmmDataLayout::DescArray].data();
+        ommData.descArraySize = data[(uint32_t)ommhelper::OmmDataLayout::DescArray].size();
+        ommData.indices = data[(uint32_t)ommhelper::OmmDataLayout::Indices].data();
+        ommData.indexDataSize = data[(uint32_t)ommhelper::OmmDataLayout::Indices].size();
+        ommData.indexStride = indexStride;
+        m_OmmAhsEstimator.SetOmmData(i, ommData);
+        ++ommGeometryNum;
+    }
+    return ommGeometryNum;
+}
+
+void Sample::GenerateOmmAhsEstimatorRays(std::vector<ommhelper::OmmAhsRay>& outRays)
+{ // Pinhole primary rays for the current camera, matching GetCameraRay. Positions are converted from camera relative to world space
+    const uint32_t gridW = 256;
+    const uint32_t gridH = 144;
+
+    float project[3];
+    float4 frustum;
+    uint32_t flags = 0;
+    DecomposeProjection(NDC_D3D, NDC_D3D, m_Camera.state.mViewToClip, &flags, nullptr, nullptr, frustum.pv, project, nullptr);
+    bool isOrtho = (flags & PROJ_ORTHO) != 0;
+    float nearZ = (m_PositiveZ ? 1.0f : -1.0f) * NEAR_Z * m_Settings.meterToUnitsMultiplier;
+    float3 viewDir = float3(m_Camera.state.mViewToWorld.GetCol2().xmm) * (m_PositiveZ ? -1.0f : 1.0f);
+    float3 relativeOffset = m_Camera.GetRelative(double3::Zero());
+
+    for (uint32_t y = 0; y < gridH; ++y)
+    {
+        for (uint32_t x = 0; x < gridW; ++x)
+        {
+            float2 uv = float2((float(x) + 0.5f) / float(gridW), (float(y) + 0.5f) / float(gridH));
+            float3 Xv;
+            Xv.x = (uv.x * frustum.z + frustum.x) * (isOrtho ? -1.0f : nearZ);
+            Xv.y = (uv.y * frustum.w + frustum.y) * (isOrtho ? -1.0f : nearZ);
+            Xv.z = nearZ;
+
+            float3 origin = TransformAffine(m_Camera.state.mViewToWorld, Xv, 1.0f) - relativeOffset;
+            float3 direction = isOrtho ? -viewDir : Normalize(TransformAffine(m_Camera.state.mViewToWorld, Xv, 0.0f));
+
+            ommhelper::OmmAhsRay& ray = outRays.emplace_back();
+            memcpy(ray.origin, &origin.x, sizeof(ray.origin));
+            memcpy(ray.direction, &direction.x, sizeof(ray.direction));
+        }
+    }
+}
+
+void Sample::EstimateOmmAnyHitSavings()
+{ // Cameras are the test snapshots, or the current camera if there are none. Rays are generated here, the rest runs on m_OmmAhsEstimateTask
+    std::vector<std::vector<ommhelper::OmmAhsRay>> rays;
+    std::vector<float3> sunDirections;
+
+    const Settings settingsBackup = m_Settings;
+    std::vector<uint8_t> cameraBackup(Camera::GetStateSize());
+    memcpy(cameraBackup.data(), m_Camera.GetState(), cameraBackup.size());
+
+    const uint32_t testByteSize = sizeof(m_Settings) + Camera::GetStateSize();
+    FILE* fp = fopen(GetTestsPath().c_str(), "rb");
+    for (uint32_t test = 0; ; ++test)
+    {
+        if (fp)
+        {
+            size_t elemNum = fseek(fp, test * testByteSize, SEEK_SET) == 0 ? fread(&m_Settings, sizeof(m_Settings), 1, fp) : 0;
+            if (elemNum == 1)
+                elemNum = fread(m_Camera.GetState(), Camera::GetStateSize(), 1, fp);
+            if (elemNum != 1)
+                break;
+        }
+        else if (test != 0)
+            break;
+
+        GenerateOmmAhsEstimatorRays(rays.emplace_back());
+        sunDirections.push_back(GetSunDirection());
+    }
+    if (fp)
+        fclose(fp);
+
+    m_Settings = settingsBackup;
+    memcpy(m_Camera.GetState(), cameraBackup.data(), cameraBackup.size());
+
+    m_OmmAhsEstimateTask = std::async(std::launch::async, &Sample::EstimateOmmAnyHitSavingsAsync, this, std::move(rays), std::move(sunDirections), m_OmmBakeDesc);
+}
+
+OmmAhsEstimate Sample::EstimateOmmAnyHitSavingsAsync(std::vector<std::vector<ommhelper::OmmAhsRay>> rays, std::vector<float3> sunDirections, ommhelper::OmmBakeDesc bakeDesc)
+{ // OMM geometry isn't rebuilt while this runs: bakes wait for the estimate like for any other async task
+    if (!m_OmmAhsEstimator.IsBuilt())
+        BuildOmmAhsEstimatorScene();
+
+    OmmAhsEstimate estimate = {};
+    estimate.ommGeometryNum = SetOmmAhsEstimatorData(bakeDesc);
+    estimate.stateHash = ommhelper::OmmCaching::CalculateSateHash(bakeDesc);
+
+    for (size_t camera = 0; camera < rays.size(); ++camera)
+    {
+        ommhelper::OmmAhsStats stats = m_OmmAhsEstimator.Trace(rays[camera].data(), rays[camera].size(), &sunDirections[camera].x, 0);
+        ommhelper::OmmAhsRayStats* dst[] = { &estimate.stats.primary, &estimate.stats.shadow };
+        const ommhelper::OmmAhsRayStats* src[] = { &stats.primary, &stats.shadow };
+        for (uint32_t i = 0; i < helper::GetCountOf(dst); ++i)
+        {
+            dst[i]->rayNum += src[i]->rayNum;
+            dst[i]->candidateNum += src[i]->candidateNum;
+            dst[i]->resolvedOpaqueNum += src[i]->resolvedOpaqueNum;
+            dst[i]->resolvedTransparentNum += src[i]->resolvedTransparentNum;
+            dst[i]->anyHitNum += src[i]->anyHitNum;
+        }
+        estimate.cameraNum++;
+    }
+
+    static const char* bakerNames[] = { "GPU", "CPU" };
+    static const char* formatNames[] = { "OC1_2", "OC1_4" };
+    char label[128];
+    snprintf(label, sizeof(label), "%s %s L%u mip %u", bakerNames[(uint32_t)bakeDesc.type], formatNames[(uint32_t)bakeDesc.format], bakeDesc.subdivisionLevel, bakeDesc.mipBias);
+    estimate.label = label;
+    return estimate;
+}
+
+bool Sample::UpdateOmmAhsEstimate()
+{ // Returns true while the estimate is running
+    if (!m_OmmAhsEstimateTask.valid())
+        return false;
+    if (m_OmmAhsEstimateTask.wait_for(std::chrono::microseconds(0)) != std::future_status::ready)
+        return true;
+
+    OmmAhsEstimate estimate = m_OmmAhsEstimateTask.get();
+    m_OmmAhsEstimates[estimate.stateHash] = estimate;
+
+    printf("[OMM] AHS estimate [%s]: %u camera(s), %u / %u geometries with OMMs. Primary: %.1f%% of %llu any-hits removed. Shadow: %.1f%% of %llu any-hits removed\n",
+        estimate.label.c_str(), estimate.cameraNum, estimate.ommGeometryNum, (uint32_t)m_OmmAlphaGeometry.size(),
+        estimate.stats.primary.GetReduction() * 100.0, (unsigned long long)estimate.stats.primary.candidateNum,
+        estimate.stats.shadow.GetReduction() * 100.0, (unsigned long long)estimate.stats.shadow.candidateNum);
+    return false;
+}
+
 void Sample::AppendOmmImguiSettings()
 {
     static ommhelper::OmmBakeDesc bakeDesc = m_OmmBakeDesc;
+    static bool autoTuneGpuBaker = m_OmmAutoTuneGpuBaker;
+    static int tuningMemoryBudgetMb = (int)m_OmmGpuTuningMemoryBudgetMb;
 
     ImGui::PushStyleColor(ImGuiCol_Text, UI_HEADER);
     ImGui::PushStyleColor(ImGuiCol_Header, UI_HEADER_BACKGROUND);
@@ -2261,7 +4738,14 @@ void Sample::AppendOmmImguiSettings()
         {
             ImGui::Checkbox("Enable OMMs", &m_EnableOmm);
             ImGui::SameLine();
-            ImGui::Text("[Masked Geometry Num: %llu]", m_MaskedBlasses.size());
+            size_t maskedGeometryNum = 0;
+            {
+                std::lock_guard<std::mutex> lock(m_MaskedBlasMutex);
+                maskedGeometryNum = m_MaskedBlasses.size();
+            }
+            ImGui::Text("[Masked Geometry Num: %llu]", (unsigned long long)maskedGeometryNum);
+            if (m_OmmRebuildMemory[0])
+                ImGui::Text("Last rebuild: %.1f MB of previous masked geometry kept bound, peak %.1f MB", double(m_OmmRebuildMemory[0]) / (1024.0 * 1024.0), double(m_OmmRebuildMemory[1]) / (1024.0 * 1024.0));
             ImVec4 color = m_Settings.highLightAhs ? ImVec4(1.0f, 0.0f, 1.0f, 1.0f) : ImVec4(1.0f, 1.0f, 1.0f, 1.0f);
             ImGui::PushStyleColor(ImGuiCol_Text, color);
             ImGui::Checkbox("Highlight AHS", &m_Settings.highLightAhs);
@@ -2291,21 +4775,79 @@ void Sample::AppendOmmImguiSettings()
                 ImGui::Checkbox("DuplicateDetection", &cpuFlags.enableDuplicateDetection);
                 ImGui::SameLine();
                 ImGui::Checkbox("NearDuplicateDetection", &cpuFlags.enableNearDuplicateDetection);
+
+                ImGui::Checkbox("NUMA Placement", &cpuFlags.enableNumaPlacement);
+                ImGui::SameLine();
+                ImGui::Text("[Nodes: %u]", ommhelper::CpuTopology::GetNodeNum());
+
+                int32_t splitWorkLog2 = (int32_t)cpuFlags.splitWorkLog2;
+                ImGui::PushItemWidth(ImGui::CalcItemWidth() * 0.66f);
+                ImGui::SliderInt("Split work [log2]", &splitWorkLog2, 0, 40);
+                ImGui::PopItemWidth();
+                cpuFlags.splitWorkLog2 = (uint32_t)splitWorkLog2;
+                for (uint32_t placementId = 0; placementId < 2; ++placementId)
+                {
+                    double timeMs = m_OmmCpuBakeTimeMs[placementId];
+                    if (timeMs > 0.0)
+                        ImGui::Text("%s: %.1f ms [%.2f Mprim/s]", placementId ? "Pinned" : "Unpinned", timeMs, double(m_OmmCpuBakePrimitiveNum[placementId]) / (timeMs * 1000.0));
+                }
+
+                ImGui::Checkbox("Alpha Bounds (cutoff agnostic)", &cpuFlags.enableAlphaBounds);
+                if (m_OmmAlphaBoundsSize)
+                {
+                    ImGui::Text("Bounds: %.1f MB resident, bake %.1f ms, threshold %.1f ms", double(m_OmmAlphaBoundsSize) / (1024.0 * 1024.0),
+                        m_OmmAlphaBoundsTimeMs[0], m_OmmAlphaBoundsTimeMs[1]);
+                }
             }
             else //if GPU
             {
                 ommhelper::GpuBakerFlags& gpuFlags = bakeDesc.gpuFlags;
-                maxSubdivisionLevel = gpuFlags.computeOnlyWorkload ? 12 : 9;//gpu baker in raster mode is limited to level 9
+                if (autoTuneGpuBaker && m_OmmAutoTuneGpuBaker)
+                { // tuned knobs follow the last bake, they don't ask for a rebuild
+                    gpuFlags.computeOnlyWorkload = m_OmmBakeDesc.gpuFlags.computeOnlyWorkload;
+                    gpuFlags.scratchMemoryBudget = m_OmmBakeDesc.gpuFlags.scratchMemoryBudget;
+                }
+                const bool isComputeAvailable = gpuFlags.computeOnlyWorkload || autoTuneGpuBaker; // the tuner skips raster above level 9 and on the async queue
+                maxSubdivisionLevel = isComputeAvailable ? 12 : 9;//gpu baker in raster mode is limited to level 9
                 ImGui::Checkbox("SpecialIndices", &gpuFlags.enableSpecialIndices);
                 ImGui::SameLine();
-                ImGui::Checkbox("Compute", &gpuFlags.computeOnlyWorkload);
-                ImGui::SameLine();
+                if (!autoTuneGpuBaker)
+                {
+                    ImGui::Checkbox("Compute", &gpuFlags.computeOnlyWorkload);
+                    ImGui::SameLine();
+                }
                 bool prevAsyncValue = m_EnableAsync;
                 ImGui::Checkbox("Async", &m_EnableAsync);
-                if (prevAsyncValue != m_EnableAsync)
+                if (prevAsyncValue != m_EnableAsync && !autoTuneGpuBaker)
                     gpuFlags.computeOnlyWorkload = m_EnableAsync ? true : gpuFlags.computeOnlyWorkload;
-                m_EnableAsync = gpuFlags.computeOnlyWorkload && m_EnableAsync;
-                maxSubdivisionScale = gpuFlags.computeOnlyWorkload ? maxSubdivisionScale : 9.0f;
+                m_EnableAsync = (gpuFlags.computeOnlyWorkload || autoTuneGpuBaker) && m_EnableAsync;
+                maxSubdivisionScale = isComputeAvailable ? maxSubdivisionScale : 9.0f;
+
+                ImGui::Checkbox("Auto-tune", &autoTuneGpuBaker);
+                if (autoTuneGpuBaker)
+                {
+                    ImGui::SameLine();
+                    ImGui::PushItemWidth(ImGui::CalcItemWidth() * 0.33f);
+                    ImGui::InputInt("Memory Budget [MB]", &tuningMemoryBudgetMb, 64);
+                    ImGui::PopItemWidth();
+                    tuningMemoryBudgetMb = tuningMemoryBudgetMb < 64 ? 64 : tuningMemoryBudgetMb;
+                    if (m_OmmGpuBakerTuning.bakeTimeMs > 0.0)
+                    {
+                        ImGui::Text("Tuned: %s, %u MB scratch [%.2f ms, %.1f MB on %u geometries]", m_OmmGpuBakerTuning.computeOnlyWorkload ? "compute" : "raster",
+                            GetScratchMemoryBudgetMb(BakerScratchMemoryBudget(m_OmmGpuBakerTuning.scratchMemoryBudget)), m_OmmGpuBakerTuning.bakeTimeMs,
+                            double(m_OmmGpuBakerTuning.memorySize) / (1024.0 * 1024.0), m_OmmGpuBakerTuning.sampleGeometryNum);
+                    }
+                }
+
+                ImGui::Checkbox("Alpha Proxies (R8)", &m_OmmUseAlphaProxies);
+                for (uint32_t textureId = 0; textureId < 2; ++textureId)
+                {
+                    double timeMs = m_OmmGpuBakeTimeMs[textureId];
+                    if (timeMs > 0.0)
+                        ImGui::Text("%s: %.1f ms", textureId ? "Alpha proxies" : "Material textures", timeMs);
+                }
+                if (m_OmmGpuTextureSizes[1])
+                    ImGui::Text("Sampled mips: %.1f MB -> %.1f MB", double(m_OmmGpuTextureSizes[0]) / (1024.0 * 1024.0), double(m_OmmGpuTextureSizes[1]) / (1024.0 * 1024.0));
             }
 
             static int ommFormatSelection = (int)bakeDesc.format;
@@ -2318,6 +4860,7 @@ void Sample::AppendOmmImguiSettings()
             static const char* vmFilterNames[] = { "Nearest", "Linear", };
             ImGui::PushItemWidth(ImGui::CalcItemWidth() * 0.66f);
             ImGui::Combo("Alpha Test Filter", &ommFilterSelection, vmFilterNames, helper::GetCountOf(ommFormatNames));
+            ImGui::SliderFloat("Alpha Cutoff", &bakeDesc.alphaCutoff, 0.0f, 1.0f, "%.2f");
             ImGui::PopItemWidth();
 
             static int mipBias = bakeDesc.mipBias;
@@ -2350,6 +4893,20 @@ void Sample::AppendOmmImguiSettings()
             ImGui::PopItemWidth();
             mipBias = mipBias < 0 ? 0 : mipBias;
             mipBias = mipBias > 15 ? 15 : mipBias;
+
+            static int lodNum = m_OmmLodNum;
+            ImGui::PushItemWidth(ImGui::CalcItemWidth() * 0.33f);
+            sprintf(buffer, "LOD Variants [1 : %u] ", OMM_MAX_LOD_NUM);
+            ImGui::InputInt(buffer, &lodNum);
+            ImGui::PopItemWidth();
+            lodNum = lodNum < 1 ? 1 : lodNum;
+            lodNum = lodNum > (int)OMM_MAX_LOD_NUM ? (int)OMM_MAX_LOD_NUM : lodNum;
+
+            static int prepareThreadNum = (int)m_OmmPrepareThreadNum;
+            ImGui::PushItemWidth(ImGui::CalcItemWidth() * 0.33f);
+            ImGui::InputInt("Build Prepare Threads [0: all]", &prepareThreadNum);
+            ImGui::PopItemWidth();
+            prepareThreadNum = prepareThreadNum < 0 ? 0 : prepareThreadNum;
             static bool enableCaching = bakeDesc.enableCache;
 
             if (isCpuBaker)
@@ -2370,12 +4927,15 @@ void Sample::AppendOmmImguiSettings()
             bakeDesc.type = ommhelper::OmmBakerType(ommBakerTypeSelection);
             bakeDesc.enableCache = enableCaching;
 
-            bool isRebuildAvailable = IsRebuildAvailable(bakeDesc, m_OmmBakeDesc);
+            bool isRebuildAvailable = IsRebuildAvailable(bakeDesc, m_OmmBakeDesc) || (uint32_t)lodNum != m_OmmLodNum;
+            isRebuildAvailable |= !isCpuBaker && (autoTuneGpuBaker != m_OmmAutoTuneGpuBaker || (autoTuneGpuBaker && (uint32_t)tuningMemoryBudgetMb != m_OmmGpuTuningMemoryBudgetMb));
 
             static std::future<void> asyncUpdateTask = {};
-            bool isAsyncActive = false;
-            if (asyncUpdateTask.valid())
+            bool isAsyncActive = UpdateOmmAhsEstimate(); // the estimate reads OMM geometry, bakes wait for it
+            if (asyncUpdateTask.valid() && !isAsyncActive)
                 isAsyncActive = asyncUpdateTask.wait_for(std::chrono::microseconds(0)) != std::future_status::ready && asyncUpdateTask.valid();
+            if (!isAsyncActive)
+                ApplyOmmGpuBakerTuning();
 
             const static ImU32 greyColor = ImGui::GetColorU32(ImVec4(0.3f, 0.3f, 0.3f, 1.0f));
             const static ImU32 greenColor = ImGui::GetColorU32(ImVec4(0.0f, 0.6f, 0.0f, 1.0f));
@@ -2383,6 +4943,18 @@ void Sample::AppendOmmImguiSettings()
 
             static uint32_t frameId = 0;
             bool forceRebuild = frameId == m_OmmBakeDesc.buildFrameId;
+            StepOmmMipStreaming(frameId);
+            if (!isAsyncActive && !forceRebuild && (m_OmmBakeDesc.type == ommhelper::OmmBakerType::CPU || m_EnableAsync))
+            { // Low priority: re-bakes wait for full rebuilds and never stall the frame. Without async they wait for the next full rebuild
+                std::map<uint32_t, std::chrono::high_resolution_clock::time_point> rebakes = QueueOmmRebakes();
+                if (!rebakes.empty())
+                {
+                    m_OmmBakeResidentMips = m_OmmTextureResidentMips;
+                    asyncUpdateTask = std::async(std::launch::async, &Sample::RebakeOmmGeometryAsync, this, m_OmmBakeDesc, std::move(rebakes));
+                    isAsyncActive = true;
+                }
+            }
+
             {
                 ImU32 buttonColor = isRebuildAvailable ? greenColor : greyColor;
                 buttonColor = isAsyncActive ? redColor : buttonColor;
@@ -2391,20 +4963,90 @@ void Sample::AppendOmmImguiSettings()
                 if ((ImGui::Button("Bake OMMs") || forceRebuild) && !isAsyncActive)
                 {
                     m_OmmBakeDesc = bakeDesc;
+                    m_OmmLodNum = (uint32_t)lodNum;
+                    m_OmmAutoTuneGpuBaker = autoTuneGpuBaker;
+                    m_OmmGpuTuningMemoryBudgetMb = (uint32_t)tuningMemoryBudgetMb;
+                    m_OmmPrepareThreadNum = (uint32_t)prepareThreadNum; // doesn't change the results, applied with the next bake only
+                    m_OmmHelper.SetPrepareThreadNum(m_OmmPrepareThreadNum);
+
+                    m_OmmBakeResidentMips = m_OmmTextureResidentMips; // a full bake plans every geometry from the current residency
+                    m_OmmResidencyEvents.clear();
+                    m_OmmRebakeQueue.clear();
 
                     bool launchAsyncTask = (m_EnableAsync && !isCpuBaker) || isCpuBaker;
                     if (launchAsyncTask)
-                        asyncUpdateTask  = std::async(std::launch::async, &Sample::RebuildOmmGeometryAsync, this, &frameId);
+                        asyncUpdateTask  = std::async(std::launch::async, &Sample::RebuildOmmGeometryAsync, this, m_OmmBakeDesc);
                     else
+                    {
                         RebuildOmmGeometry();
+                        ApplyOmmGpuBakerTuning();
+                    }
                 }
                 ImGui::PopStyleColor();
 
                 ImGui::SameLine();
                 ImGui::Checkbox("Use OMM Cache", &enableCaching);
+                if (enableCaching)
+                {
+                    ImGui::SameLine();
+                    ImGui::Checkbox("Batch Records", &m_OmmUseBatchRecords);
+                }
 
                 if (isAsyncActive)
                     ImGui::ProgressBar(float(m_OmmUpdateProgress) / float(m_OmmAlphaGeometry.size()));
+                else if (m_OmmIndexBufferSizes[0])
+                    ImGui::Text("OMM indices: %.1f KB (saved %.1f KB)", double(m_OmmIndexBufferSizes[1]) / 1024.0, double(m_OmmIndexBufferSizes[0] - m_OmmIndexBufferSizes[1]) / 1024.0);
+
+                if (m_OmmRebakeStats.eventNum && !isAsyncActive)
+                {
+                    const OmmRebakeStats& stats = m_OmmRebakeStats;
+                    ImGui::Text("Mip residency: %u events, %u geometries re-baked (%llu prims), %u queued", stats.eventNum, stats.geometryNum[0],
+                        (unsigned long long)stats.primitiveNum[0], (uint32_t)m_OmmRebakeQueue.size());
+                    if (stats.geometryNum[1])
+                        ImGui::Text("Last re-bake: %u geometries in %.1f ms, latency %.1f ms [max %.1f ms]", stats.geometryNum[1], stats.passTimeMs, stats.latencyMs[0], stats.latencyMs[1]);
+                }
+
+                if (!isAsyncActive)
+                { // the async rebuild writes them, shown between rebuilds only
+                    auto serial = m_OmmBuildPrepareTimeMs.find(1);
+                    for (const auto& it : m_OmmBuildPrepareTimeMs)
+                    {
+                        ImGui::Text("Build preparation, %u threads: %.1f ms", it.first, it.second);
+                        if (serial != m_OmmBuildPrepareTimeMs.end() && it.first != 1)
+                        {
+                            ImGui::SameLine();
+                            ImGui::Text("[%.2fx]", serial->second / it.second);
+                        }
+                    }
+                }
+            }
+
+            if (m_OmmLodNum > 1 && !isAsyncActive)
+            { // Switch sizes apply immediately, no rebake needed
+                ImGui::PushItemWidth(ImGui::CalcItemWidth() * 0.66f);
+                ImGui::SliderFloat2("LOD Switch Sizes", m_OmmLodSwitchSizes, 0.001f, 0.5f, "%.3f", ImGuiSliderFlags_Logarithmic);
+                ImGui::SliderFloat("LOD Hysteresis", &m_OmmLodHysteresis, 0.0f, 0.5f, "%.2f");
+                ImGui::PopItemWidth();
+
+                for (uint32_t lod = 0; lod < m_OmmLodNum && m_OmmLodLevels[lod]; ++lod)
+                {
+                    ImGui::Text("LOD %u [level %u]: %u instances, %.1f MB", lod, m_OmmLodLevels[lod], m_OmmLodInstanceNum[lod],
+                        double(m_OmmLodMemory[lod]) / (1024.0 * 1024.0));
+                }
+            }
+
+            { // CPU reference traversal over the test cameras, estimates the last baked configuration
+                if (ImGui::Button("Estimate AHS savings") && !isAsyncActive)
+                    EstimateOmmAnyHitSavings();
+                ImGui::SameLine();
+                ImGui::Checkbox("Keep bake output", &m_OmmKeepBakeOutput);
+
+                for (const auto& it : m_OmmAhsEstimates)
+                {
+                    const OmmAhsEstimate& estimate = it.second;
+                    ImGui::Text("%s: primary -%.1f%%, shadow -%.1f%% AHS [%u cameras]", estimate.label.c_str(),
+                        estimate.stats.primary.GetReduction() * 100.0, estimate.stats.shadow.GetReduction() * 100.0, estimate.cameraNum);
+                }
             }
             ++frameId;
         }
@@ -0,0 +1,148 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+// Global operator new / delete replacements feeding GetThreadAllocationCounters(). Every overload is replaced, so no allocation
+// bypasses the counters and nothing allocated here is freed by the default implementation (or the other way around)
+
+#include "AllocationTracker.hpp"
+#include <algorithm>
+
+#ifdef _WIN32
+    #include <malloc.h>
+#endif
+
+static void* TrackedAllocate(size_t size)
+{
+    AllocationCounters& counters = GetThreadAllocationCounters();
+    counters.num++;
+    counters.bytes += size;
+    return malloc(size ? size : 1);
+}
+
+static void* TrackedAllocateAligned(size_t size, std::align_val_t alignment)
+{ // over-aligned types: alignment is a power of two larger than __STDCPP_DEFAULT_NEW_ALIGNMENT__
+    AllocationCounters& counters = GetThreadAllocationCounters();
+    counters.num++;
+    counters.bytes += size;
+#ifdef _WIN32
+    return _aligned_malloc(size ? size : 1, (size_t)alignment);
+#else
+    void* ptr = nullptr;
+    return posix_memalign(&ptr, std::max((size_t)alignment, sizeof(void*)), size ? size : 1) == 0 ? ptr : nullptr;
+#endif
+}
+
+static void FreeAligned(void* ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+void* operator new(size_t size)
+{
+    if (void* ptr = TrackedAllocate(size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    if (void* ptr = TrackedAllocate(size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    if (void* ptr = TrackedAllocateAligned(size, alignment))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    if (void* ptr = TrackedAllocateAligned(size, alignment))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return TrackedAllocate(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return TrackedAllocate(size); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return TrackedAllocateAligned(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return TrackedAllocateAligned(size, alignment); }
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { free(ptr); }
+
+void operator delete(void* ptr, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(ptr); }
+
+uint32_t AllocationTracker::AllocateScope(const char* scopeName, bool isWorkerJob)
+{
+    uint32_t id = (uint32_t)m_Scopes.size();
+    AllocationScopeStats stats;
+    stats.name = scopeName;
+    stats.isWorkerJob = isWorkerJob;
+    m_Scopes.push_back(stats);
+    return id;
+}
+
+void AllocationTracker::GatherWorkerJob(uint32_t scopeID)
+{
+    AllocationScopeStats& stats = m_Scopes[scopeID];
+    stats.gathered.num += stats.frame.num;
+    stats.gathered.bytes += stats.frame.bytes;
+    m_WorkerFrame.num += stats.frame.num;
+    m_WorkerFrame.bytes += stats.frame.bytes;
+    stats.frame = {};
+}
+
+void AllocationTracker::BeginFrame()
+{
+    m_FrameBegin = GetThreadAllocationCounters();
+}
+
+void AllocationTracker::EndFrame(uint32_t frameIndex)
+{
+    const AllocationCounters& end = GetThreadAllocationCounters();
+    m_LastFrame.num = end.num - m_FrameBegin.num + m_WorkerFrame.num;
+    m_LastFrame.bytes = end.bytes - m_FrameBegin.bytes + m_WorkerFrame.bytes;
+    m_WorkerFrame = {};
+
+    for (AllocationScopeStats& stats : m_Scopes)
+    {
+        AllocationCounters& frame = stats.isWorkerJob ? stats.gathered : stats.frame; // a running job can still write "frame"
+        stats.lastFrame = frame;
+        stats.total += frame.num;
+        frame = {};
+    }
+
+    if (assertNoAllocations && frameIndex >= warmUpFrameNum && m_LastFrame.num)
+    {
+        printf("[FAIL]: %llu heap allocations (%llu bytes) in steady state frame %u\n", (unsigned long long)m_LastFrame.num, (unsigned long long)m_LastFrame.bytes, frameIndex);
+        for (const AllocationScopeStats& stats : m_Scopes)
+        {
+            if (stats.lastFrame.num)
+                printf("    %s: %llu (%llu bytes)\n", stats.name.c_str(), (unsigned long long)stats.lastFrame.num, (unsigned long long)stats.lastFrame.bytes);
+        }
+        std::abort();
+    }
+}
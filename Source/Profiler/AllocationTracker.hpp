@@ -0,0 +1,91 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <new>
+#include <string>
+#include <vector>
+
+// Heap allocations made through operator new are counted per thread: the render thread statistics
+// don't include background work like the async OMM rebuild or the cpu baker workers.
+// Frame recording jobs on other threads are counted by their worker job scopes, which the render thread gathers after waiting for the job.
+// The global operator new / delete replacements live in AllocationTracker.cpp.
+
+struct AllocationCounters
+{
+    uint64_t num = 0;
+    uint64_t bytes = 0;
+};
+
+inline AllocationCounters& GetThreadAllocationCounters()
+{
+    static thread_local AllocationCounters counters;
+    return counters;
+}
+
+struct AllocationScopeStats
+{
+    std::string name;
+    AllocationCounters lastFrame; // inclusive: nested scopes are counted by their parents too
+    AllocationCounters frame;
+    AllocationCounters gathered; // worker jobs: "frame" is owned by the worker until gathered
+    uint64_t total = 0;
+    bool isWorkerJob = false;
+};
+
+class AllocationTracker
+{
+public:
+    struct Scope
+    {
+        Scope(AllocationTracker& tracker, uint32_t scopeID) :
+            m_Tracker(tracker),
+            m_ScopeID(scopeID),
+            m_Begin(GetThreadAllocationCounters()) {};
+
+        ~Scope()
+        {
+            const AllocationCounters& end = GetThreadAllocationCounters();
+            AllocationScopeStats& stats = m_Tracker.m_Scopes[m_ScopeID];
+            stats.frame.num += end.num - m_Begin.num;
+            stats.frame.bytes += end.bytes - m_Begin.bytes;
+        }
+
+    private:
+        AllocationTracker& m_Tracker;
+        uint32_t m_ScopeID;
+        AllocationCounters m_Begin;
+    };
+
+    // Scopes must be allocated up front on the render thread: the scope list can't grow while other threads use it
+    uint32_t AllocateScope(const char* scopeName, bool isWorkerJob = false);
+
+    // Render thread, once the job has finished: its allocations are counted into the current frame
+    void GatherWorkerJob(uint32_t scopeID);
+
+    void BeginFrame();
+    void EndFrame(uint32_t frameIndex);
+
+    const AllocationCounters& GetLastFrame() const { return m_LastFrame; };
+    const AllocationScopeStats* GetScopes(size_t& count) const { count = m_Scopes.size(); return m_Scopes.data(); };
+
+    // Steady state frames (after warm up) must not allocate: reports the offending scopes and aborts
+    bool assertNoAllocations = false;
+    uint32_t warmUpFrameNum = 16;
+
+private:
+    std::vector<AllocationScopeStats> m_Scopes;
+    AllocationCounters m_FrameBegin;
+    AllocationCounters m_LastFrame;
+    AllocationCounters m_WorkerFrame;
+};
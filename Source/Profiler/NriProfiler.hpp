@@ -12,10 +12,15 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
 #include <string>
 #include <vector>
 #include <array>
+#include <mutex>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
 #include "NRI.h"
 #include "NRI/Include/Extensions/NRIHelper.h"
 
 #define PROFILER_BUFFERED_FRAME_NUM 3 //TODO: this should be part of the profiler initialization.
+#define PROFILER_MAX_EVENT_NUM 128
 
 struct ProfilerEvent
 { // TODO: simplify
@@ -74,9 +79,11 @@ public:
     uint32_t AllocateEvent(const char* eventName);
     uint32_t BeginTimestamp(ProfilerContext* ctx, uint32_t eventID);
     void EndTimestamp(ProfilerContext* ctx, uint32_t timestampID);
+    void UpdateCpuEvent(uint32_t eventID, double elapsedTimeMs); // for events not timed by the profiler queries, like command buffer recording or OMM bakes
     void ProcessContexts(const nri::QueueSubmitDesc& desc);
+    void SnapshotEvents(); // render thread only, while no other thread records or submits
 
-    const ProfilerEvent* GetPerformanceEvents(size_t& count) const { count = m_Events.size(); return m_Events.data(); };
+    const ProfilerEvent* GetPerformanceEvents(size_t& count) const { count = m_SnapshotEventNum; return m_SnapshotEvents.data(); };
 
     void Destroy();
 
@@ -86,11 +93,17 @@ private:
         , public nri::HelperInterface
     {};
 
-    std::array<std::vector<ProfilerContext>, PROFILER_BUFFERED_FRAME_NUM> m_Contexts{};
+    std::array<std::vector<ProfilerContext>, PROFILER_BUFFERED_FRAME_NUM> m_Contexts{}; // pooled, only the first m_ContextNums are in use
+    std::array<uint32_t, PROFILER_BUFFERED_FRAME_NUM> m_ContextNums{};
+    std::vector<uint64_t> m_ResolvedQueries;
     std::array<nri::QueryPool*, PROFILER_BUFFERED_FRAME_NUM> m_QueryPools{};
     std::array<nri::Buffer*, PROFILER_BUFFERED_FRAME_NUM> m_QueryBuffers{};
     std::vector<nri::Memory*> m_Memories;
-    std::vector<ProfilerEvent> m_Events;
+    std::array<ProfilerEvent, PROFILER_MAX_EVENT_NUM> m_Events{}; // fixed storage: events are allocated lazily while other recording threads update theirs
+    std::atomic<uint32_t> m_EventNum{ 0 };
+    std::mutex m_EventMutex;
+    std::array<ProfilerEvent, PROFILER_MAX_EVENT_NUM> m_SnapshotEvents{}; // what the UI reads: the live events change while the submit worker ends the frame
+    uint32_t m_SnapshotEventNum = 0;
 
     NRIInterface m_NRI;
 
@@ -98,7 +111,7 @@ private:
 
     const uint32_t m_QueriesNum = 16;
     const uint32_t m_QueryBufferSize = m_QueriesNum * sizeof(uint64_t);
-    uint32_t m_CurrentTimestampID = uint32_t(-1);
+    std::atomic<uint32_t> m_CurrentTimestampID{ uint32_t(-1) }; // contexts of a frame can be recorded on different threads
     uint32_t m_CurrentFrameID = uint32_t(-1);
     uint32_t m_BufferedFrameID;
     uint32_t m_OldestBufferedFrameID;
@@ -109,15 +122,14 @@ void Profiler::ResolveBufferedFrame()
     if (m_CurrentFrameID < (PROFILER_BUFFERED_FRAME_NUM - 1))
         return;
 
-    std::vector<uint64_t> dstBuffer;
-    dstBuffer.resize(m_QueriesNum);
+    std::vector<uint64_t>& dstBuffer = m_ResolvedQueries;
 
     void* srcBuffer = m_NRI.MapBuffer(*m_QueryBuffers[m_OldestBufferedFrameID], 0, m_QueryBufferSize);
     memcpy_s(dstBuffer.data(), dstBuffer.size() * sizeof(uint64_t), srcBuffer, m_QueryBufferSize);
     m_NRI.UnmapBuffer(*m_QueryBuffers[m_OldestBufferedFrameID]);
 
     std::vector<ProfilerContext>& targetFrameContexts = m_Contexts[m_OldestBufferedFrameID];
-    for (uint32_t i = 0; i < helper::GetCountOf(targetFrameContexts); ++i)
+    for (uint32_t i = 0; i < m_ContextNums[m_OldestBufferedFrameID]; ++i)
     {
         ProfilerContext& ctx = targetFrameContexts[i];
         for (uint32_t j = 0; j < helper::GetCountOf(ctx.timestamps); j++)
@@ -139,24 +151,38 @@ void Profiler::ResolveBufferedFrame()
             }
         }
     }
-    targetFrameContexts.resize(0);
+    m_ContextNums[m_OldestBufferedFrameID] = 0; // contexts and their timestamps keep their capacity
 }
 
 uint32_t Profiler::AllocateEvent(const char* eventName)
 {
-    uint32_t id = helper::GetCountOf(m_Events);
+    std::lock_guard<std::mutex> lock(m_EventMutex);
+
+    uint32_t id = m_EventNum;
+    if (id == PROFILER_MAX_EVENT_NUM)
+    {
+        printf("[FAIL]: Profiler is out of events, raise PROFILER_MAX_EVENT_NUM\n");
+        abort();
+    }
+
     ProfilerEvent perfevent;
     perfevent.name = eventName;
-    m_Events.push_back(perfevent);
+    m_Events[id] = perfevent;
+    m_EventNum = id + 1; // published after the event is written
     return id;
 }
 
 ProfilerContext* Profiler::BeginContext(nri::CommandBuffer* commandBuffer)
 {
-    ProfilerContext ctx;
+    std::vector<ProfilerContext>& contexts = m_Contexts[m_BufferedFrameID];
+    uint32_t& contextNum = m_ContextNums[m_BufferedFrameID];
+    if (contextNum == contexts.size())
+        contexts.emplace_back();
+
+    ProfilerContext& ctx = contexts[contextNum++];
+    ctx.timestamps.clear();
     ctx.commandBuffer = commandBuffer;
-    m_Contexts[m_BufferedFrameID].push_back(ctx);
-    return &m_Contexts[m_BufferedFrameID].back();
+    return &ctx;
 }
 
 void Profiler::Init(nri::Device* device)
@@ -173,6 +199,14 @@ void Profiler::Init(nri::Device* device)
     bufferDesc.structureStride = sizeof(uint64_t);
     for (uint32_t i = 0; i < PROFILER_BUFFERED_FRAME_NUM; ++i)
         NRI_ABORT_ON_FAILURE(m_NRI.CreateBuffer(*device, bufferDesc, m_QueryBuffers[i]));
+    m_ResolvedQueries.resize(m_QueriesNum);
+
+    // Returned context pointers must stay valid for the whole frame
+    for (uint32_t i = 0; i < PROFILER_BUFFERED_FRAME_NUM; ++i)
+    {
+        m_Contexts[i].reserve(16);
+        m_ContextNums[i] = 0;
+    }
 
     nri::ResourceGroupDesc rgDesc = {};
     rgDesc.bufferNum = PROFILER_BUFFERED_FRAME_NUM;
@@ -222,22 +256,24 @@ void Profiler::Init(nri::Device* device)
 
 void Profiler::ProcessContexts(const nri::QueueSubmitDesc& desc)
 {
+    // In place: submitted contexts are moved to the front in submission order, the rest stays pooled
     std::vector<ProfilerContext>& contexts = m_Contexts[m_BufferedFrameID];
-    std::vector<ProfilerContext> sortedContexts = {};
+    uint32_t& contextNum = m_ContextNums[m_BufferedFrameID];
+    uint32_t sortedNum = 0;
 
     for (uint32_t i = 0; i < desc.commandBufferNum; ++i)
     {
         const nri::CommandBuffer* cmdBuffer = desc.commandBuffers[i];
-        for (auto ctx : contexts)
+        for (uint32_t j = sortedNum; j < contextNum; ++j)
         {
-            if (ctx.commandBuffer == cmdBuffer)
+            if (contexts[j].commandBuffer == cmdBuffer)
             {
-                sortedContexts.push_back(ctx);
+                std::swap(contexts[sortedNum++], contexts[j]);
                 break;
             }
         }
     }
-    contexts = sortedContexts;
+    contextNum = sortedNum;
 }
 
 void Profiler::BeginFrame()
@@ -249,6 +285,13 @@ void Profiler::BeginFrame()
     ResolveBufferedFrame();
 }
 
+void Profiler::SnapshotEvents()
+{
+    m_SnapshotEventNum = m_EventNum;
+    for (uint32_t i = 0; i < m_SnapshotEventNum; i++)
+        m_SnapshotEvents[i] = m_Events[i];
+}
+
 void Profiler::EndFrame(nri::CommandBuffer* lastCommandBufferToExecute)
 {
     uint32_t numQueries = (m_CurrentTimestampID + 1) * 2;
@@ -258,10 +301,11 @@ void Profiler::EndFrame(nri::CommandBuffer* lastCommandBufferToExecute)
 
 uint32_t Profiler::BeginTimestamp(ProfilerContext* ctx, uint32_t eventID)
 {
-    ctx->timestamps.push_back(ProfilerTimestamp(eventID, ++m_CurrentTimestampID));
-    m_NRI.CmdEndQuery(*ctx->commandBuffer, *m_QueryPools[m_BufferedFrameID], m_CurrentTimestampID * 2);
+    uint32_t timestampID = ++m_CurrentTimestampID;
+    ctx->timestamps.push_back(ProfilerTimestamp(eventID, timestampID));
+    m_NRI.CmdEndQuery(*ctx->commandBuffer, *m_QueryPools[m_BufferedFrameID], timestampID * 2);
 
-    return m_CurrentTimestampID;
+    return timestampID;
 }
 
 void Profiler::EndTimestamp(ProfilerContext* ctx, uint32_t timestampID)
@@ -269,6 +313,11 @@ void Profiler::EndTimestamp(ProfilerContext* ctx, uint32_t timestampID)
     m_NRI.CmdEndQuery(*ctx->commandBuffer, *m_QueryPools[m_BufferedFrameID], timestampID * 2 + 1);
 }
 
+void Profiler::UpdateCpuEvent(uint32_t eventID, double elapsedTimeMs)
+{
+    m_Events[eventID].Update(elapsedTimeMs);
+}
+
 void Profiler::Destroy()
 {
     for (auto& buffer : m_QueryBuffers)
@@ -279,6 +328,14 @@ void Profiler::Destroy()
         m_NRI.FreeMemory(*memory);
     m_Memories.resize(0);
     m_Memories.shrink_to_fit();
-    m_Events.resize(0);
-    m_Events.shrink_to_fit();
+    m_Events.fill(ProfilerEvent());
+    m_EventNum = 0;
+    for (uint32_t i = 0; i < PROFILER_BUFFERED_FRAME_NUM; ++i)
+    {
+        m_Contexts[i].clear();
+        m_Contexts[i].shrink_to_fit();
+        m_ContextNums[i] = 0;
+    }
+    m_ResolvedQueries.clear();
+    m_ResolvedQueries.shrink_to_fit();
 };
\ No newline at end of file
@@ -220,6 +220,15 @@ void Sample::GenerateGeometry(utils::Scene& scene)
 
 void Sample::PrepareFrame(uint32_t frameIndex)
 {
+    // A frame is measured from PrepareFrame to the next PrepareFrame, framework work in between included
+    if (frameIndex)
+        m_AllocationTracker.EndFrame(frameIndex - 1);
+    m_AllocationTracker.BeginFrame();
+
+    AllocationTracker::Scope allocationScope(m_AllocationTracker, m_AllocationScopeIDs[(uint32_t)AllocationScope::PrepareFrame]);
+
+    m_UpdateBegin = std::chrono::high_resolution_clock::now();
+
     m_ForceHistoryReset = false;
     m_SettingsPrev = m_Settings;
     m_Camera.SavePreviousState();
@@ -287,6 +296,41 @@ void Sample::PrepareFrame(uint32_t frameIndex)
                     ImGui::Text("%6.3f(ms)", events[i].GetSmootherDelta());
                 }
                 ImGui::EndTable();
+
+                const AllocationCounters& frameAllocations = m_AllocationTracker.GetLastFrame();
+                ImGui::Text("Heap allocations: %llu / frame (%.1f KB)", (unsigned long long)frameAllocations.num, double(frameAllocations.bytes) / 1024.0);
+                size_t allocationScopeNum = 0;
+                const AllocationScopeStats* allocationScopes = m_AllocationTracker.GetScopes(allocationScopeNum);
+                for (size_t i = 0; i < allocationScopeNum; ++i)
+                {
+                    if (allocationScopes[i].lastFrame.num)
+                        ImGui::Text("    %s: %llu (%llu B)", allocationScopes[i].name.c_str(), (unsigned long long)allocationScopes[i].lastFrame.num, (unsigned long long)allocationScopes[i].lastFrame.bytes);
+                }
+
+                ImGui::Checkbox("Parallel command recording", &m_EnableParallelRecording);
+                if (m_EnableParallelRecording)
+                {
+                    ImGui::SameLine();
+                    ImGui::Checkbox("Pipelined update", &m_EnablePipelinedUpdate);
+                }
+                ImGui::Checkbox("Batched morph update", &m_EnableBatchedMorphUpdate);
+                ImGui::Checkbox("Shader permutations", &m_EnableShaderPermutations);
+                ImGui::SameLine();
+                ImGui::Text("(%u pipelines, %.1f ms to create)", m_TracePermutationNum, m_TracePermutationCreationTimeMs);
+                if (m_MorphUpdateStats.meshNum)
+                {
+                    ImGui::Text("Morph update: %u meshes, %u dispatches, %u barriers, %u BLAS builds", m_MorphUpdateStats.meshNum,
+                        m_MorphUpdateStats.dispatchNum, m_MorphUpdateStats.barrierNum, m_MorphUpdateStats.blasBuildNum);
+                }
+                ImGui::Text("Instance data upload: %.1f KB / frame (%u static records uploaded once)", double(m_InstanceDataUploadBytes) / 1024.0, m_StaticInstanceRecordNum);
+                ImGui::Checkbox("TLAS skip / refit", &m_EnableTlasUpdatePolicy);
+                const char* tlasNames[] = { "World", "Emissive" };
+                for (uint32_t i = 0; i < helper::GetCountOf(m_TlasStates); ++i)
+                {
+                    const TlasState& state = m_TlasStates[i];
+                    ImGui::Text("TLAS %s: %u rebuilds, %u refits, %u skips (~%.1f ms saved)", tlasNames[i],
+                        state.actionNum[(uint32_t)TlasBuildAction::Rebuild], state.actionNum[(uint32_t)TlasBuildAction::Update], state.actionNum[(uint32_t)TlasBuildAction::Skip], state.savedMs);
+                }
                 ImGui::Separator();
             }
             ImGui::PopID();
@@ -1091,11 +1135,7 @@ void Sample::PrepareFrame(uint32_t frameIndex)
                             float buttonWidth = 25.0f * float(GetWindowResolution().x) / float(GetOutputResolution().x);
 
                             char s[64];
-                            std::string sceneName = std::string(utils::GetFileName(m_SceneFile));
-                            size_t dotPos = sceneName.find_last_of(".");
-                            if (dotPos != std::string::npos)
-                                sceneName = sceneName.substr(0, dotPos) + ".bin";
-                            const std::string path = utils::GetFullPath(sceneName, utils::DataFolder::TESTS);
+                            const std::string& path = GetTestsPath();
                             const uint32_t testByteSize = sizeof(m_Settings) + Camera::GetStateSize();
 
                             // Get number of tests
@@ -1614,8 +1654,11 @@ void Sample::CreateCommandBuffers()
 {
     for (Frame& frame : m_Frames)
     {
-        NRI_ABORT_ON_FAILURE(NRI.CreateCommandAllocator(*m_CommandQueue, nri::WHOLE_DEVICE_GROUP, frame.commandAllocator));
-        NRI_ABORT_ON_FAILURE(NRI.CreateCommandBuffer(*frame.commandAllocator, frame.commandBuffer));
+        for (uint32_t i = 0; i < (uint32_t)FrameSection::MAX_NUM; i++)
+        {
+            NRI_ABORT_ON_FAILURE(NRI.CreateCommandAllocator(*m_CommandQueue, nri::WHOLE_DEVICE_GROUP, frame.commandAllocators[i]));
+            NRI_ABORT_ON_FAILURE(NRI.CreateCommandBuffer(*frame.commandAllocators[i], frame.commandBuffers[i]));
+        }
     }
 }
 
@@ -1691,6 +1734,7 @@ void Sample::CreatePipelines()
 {
     if (!m_Pipelines.empty())
     {
+        m_FrameSubmitWorker.Wait();
         NRI.WaitForIdle(*m_CommandQueue);
 
         for (uint32_t i = 0; i < m_Pipelines.size(); i++)
@@ -1784,6 +1828,40 @@ void Sample::CreatePipelines()
         NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, pipelineDesc, pipeline));
         m_Pipelines.push_back(pipeline);
     }
+
+    { // Trace permutations: stored after the generic pipelines, looked up through "m_TracePermutations"
+        m_TracePermutations.Clear();
+        m_TracePermutationCreationTimeMs = 0.0;
+        m_TracePermutationNum = 0;
+
+        for (uint32_t pass = 0; pass < (uint32_t)TracePass::MAX_NUM; pass++)
+        {
+            for (uint32_t bits = 0; bits < TRACE_PERMUTATION_MAX_NUM; bits++)
+            {
+                if (!TracePermutationKey::IsValid((TracePass)pass, bits))
+                    continue;
+
+                const TracePermutationKey key = { bits };
+                char shaderName[64];
+                key.GetShaderName((TracePass)pass, shaderName, sizeof(shaderName));
+
+                // Shaders are compiled ahead of time, this is the driver compilation to the native ISA
+                auto begin = std::chrono::high_resolution_clock::now();
+                pipelineDesc.computeShader = utils::LoadShader(deviceDesc.graphicsAPI, shaderName, shaderCodeStorage);
+                NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, pipelineDesc, pipeline));
+                double timeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+
+                m_Pipelines.push_back(pipeline);
+                m_TracePermutations.Set((TracePass)pass, key, pipeline);
+
+                printf("Trace permutation %s: pipeline created in %.1f ms\n", shaderName, timeMs);
+                m_TracePermutationCreationTimeMs += timeMs;
+                m_TracePermutationNum++;
+            }
+        }
+
+        printf("Trace permutations: %u pipelines created in %.1f ms\n", m_TracePermutationNum, m_TracePermutationCreationTimeMs);
+    }
 }
 
 void Sample::CreateAccelerationStructures()
@@ -2173,6 +2251,8 @@ void Sample::CreateAccelerationStructures()
     NRI.DestroyCommandBuffer(*commandBuffer);
     NRI.DestroyCommandAllocator(*commandAllocator);
 
+    m_BlasBuildIds.resize(m_AccelerationStructures.size(), 0);
+
     double totalTime = m_Timer.GetTimeStamp() - stamp1;
 
     printf(
@@ -2284,9 +2364,15 @@ void Sample::CreateResources(nri::Format swapChainFormat)
 
     const uint16_t w = (uint16_t)m_RenderResolution.x;
     const uint16_t h = (uint16_t)m_RenderResolution.y;
-    const uint64_t instanceDataSize = m_Scene.instances.size() * sizeof(InstanceData);
-    const uint64_t worldScratchBufferSize = NRI.GetAccelerationStructureBuildScratchBufferSize(*Get(AccelerationStructure::TLAS_World));
-    const uint64_t lightScratchBufferSize = NRI.GetAccelerationStructureBuildScratchBufferSize(*Get(AccelerationStructure::TLAS_Emissive));
+    // Instance records, followed by a transform record per dynamic instance
+    m_InstanceRecordMaxNum = (uint32_t)m_Scene.instances.size();
+    for (const utils::Instance& instance : m_Scene.instances)
+        m_InstanceRecordMaxNum += instance.allowUpdate ? 1 : 0;
+    m_IsStaticInstanceDataUploaded = false;
+
+    const uint64_t instanceDataSize = m_InstanceRecordMaxNum * sizeof(InstanceData);
+    const uint64_t worldScratchBufferSize = std::max(NRI.GetAccelerationStructureBuildScratchBufferSize(*Get(AccelerationStructure::TLAS_World)), NRI.GetAccelerationStructureUpdateScratchBufferSize(*Get(AccelerationStructure::TLAS_World)));
+    const uint64_t lightScratchBufferSize = std::max(NRI.GetAccelerationStructureBuildScratchBufferSize(*Get(AccelerationStructure::TLAS_Emissive)), NRI.GetAccelerationStructureUpdateScratchBufferSize(*Get(AccelerationStructure::TLAS_Emissive)));
 
     std::vector<DescriptorDesc> descriptorDescs;
 
@@ -3068,8 +3154,39 @@ void Sample::UploadStaticData()
     NRI_ABORT_ON_FAILURE(NRI.UploadData(*m_CommandQueue, textureData.data(), helper::GetCountOf(textureData), dataDescArray, helper::GetCountOf(dataDescArray)));
 }
 
-void Sample::BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex)
+TlasBuildAction Sample::ChooseTlasBuildAction(TlasState& state, const TlasInstanceHash& hash)
 {
+    TlasBuildAction action = TlasBuildAction::Skip;
+    bool isCountedRefit = false;
+    if (!m_EnableTlasUpdatePolicy || !state.isBuilt || hash.topology != state.topologyHash)
+        action = TlasBuildAction::Rebuild; // instance set or BLAS handles changed (i.e. masked BLAS swapped in), refit can't handle it
+    else if (hash.transform != state.transformHash || hash.blasBuild != state.blasBuildHash)
+    {
+        action = state.refitNum < TLAS_MAX_REFIT_NUM ? TlasBuildAction::Update : TlasBuildAction::Rebuild;
+        isCountedRefit = true;
+    }
+    else if (hash.origin != state.originHash)
+        action = TlasBuildAction::Update; // all instances moved by the same offset
+
+    if (action == TlasBuildAction::Rebuild)
+        state.refitNum = 0;
+    else if (isCountedRefit)
+        state.refitNum++;
+
+    state.topologyHash = hash.topology;
+    state.transformHash = hash.transform;
+    state.blasBuildHash = hash.blasBuild;
+    state.originHash = hash.origin;
+    state.isBuilt = true;
+    state.actionNum[(uint32_t)action]++;
+
+    return action;
+}
+
+void Sample::BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex, ProfilerContext* profilerContext)
+{
+    AllocationTracker::Scope allocationScope(m_AllocationTracker, m_AllocationScopeIDs[(uint32_t)AllocationScope::TlasBuild]);
+
     bool isAnimatedObjects = m_Settings.animatedObjects;
     if (m_Settings.blink)
     {
@@ -3077,26 +3194,47 @@ void Sample::BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffe
         isAnimatedObjects &= WaveTriangle(period) > 0.5;
     }
 
+    for (uint32_t& instanceNum : m_OmmLodInstanceNum)
+        instanceNum = 0;
+
     uint64_t tlasCount = m_Scene.instances.size();
     uint64_t tlasDataSize = tlasCount * sizeof(nri::GeometryObjectInstance);
     uint64_t tlasDataOffset = tlasDataSize * bufferedFrameIndex;
-    uint64_t instanceDataSize = tlasCount * sizeof(InstanceData);
+    uint64_t instanceDataSize = m_InstanceRecordMaxNum * sizeof(InstanceData);
     uint64_t instanceDataOffset = instanceDataSize * bufferedFrameIndex;
     uint64_t staticInstanceCount = m_Scene.instances.size() - m_AnimatedInstances.size();
     uint64_t instanceCount = staticInstanceCount + (isAnimatedObjects ? m_Settings.animatedObjectNum : 0);
 
-    auto instanceData = (InstanceData*)NRI.MapBuffer(*Get(Buffer::InstanceDataStaging), instanceDataOffset, instanceDataSize);
+    // Static instance records don't change: they are uploaded once, then only dynamic records and their transforms
+    const bool isStaticInstanceDataUploaded = m_IsStaticInstanceDataUploaded;
+
+    uint32_t dynamicInstanceNum = 0;
+    for (size_t i = m_ProxyInstancesNum; i < instanceCount; i++)
+    {
+        const utils::Instance& instance = m_Scene.instances[i];
+        if (instance.allowUpdate && !m_Scene.materials[instance.materialIndex].IsOff())
+            dynamicInstanceNum++;
+    }
+
+    auto instanceDataBegin = (InstanceData*)NRI.MapBuffer(*Get(Buffer::InstanceDataStaging), instanceDataOffset, instanceDataSize);
+    InstanceData* instanceData = instanceDataBegin + (isStaticInstanceDataUploaded ? m_StaticInstanceRecordNum : 0);
+    uint32_t transformIndex = 0;
     auto worldTlasData = (nri::GeometryObjectInstance*)NRI.MapBuffer(*Get(Buffer::WorldTlasDataStaging), tlasDataOffset, tlasDataSize);
     auto lightTlasData = (nri::GeometryObjectInstance*)NRI.MapBuffer(*Get(Buffer::LightTlasDataStaging), tlasDataOffset, tlasDataSize);
 
     uint32_t instanceIndex = 0;
     uint32_t worldGeometryObjectsNum = 0;
     uint32_t lightGeometryObjectsNum = 0;
+    TlasInstanceHash worldTlasHash;
+    TlasInstanceHash lightTlasHash;
 
     float4x4 mCameraTranslation = float4x4::Identity();
     mCameraTranslation.AddTranslation( m_Camera.GetRelative(double3::Zero()) );
     mCameraTranslation.Transpose3x4();
 
+    worldTlasHash.SetOrigin(m_Camera.GetRelative(double3::Zero()));
+    lightTlasHash.SetOrigin(m_Camera.GetRelative(double3::Zero()));
+
     // Add static opaque (includes emissives)
     if (m_OpaqueObjectsNum)
     {
@@ -3108,6 +3246,7 @@ void Sample::BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffe
         geometryObjectInstance.accelerationStructureHandle = NRI.GetAccelerationStructureHandle(*Get(AccelerationStructure::BLAS_StaticOpaque), 0);
 
         *worldTlasData++ = geometryObjectInstance;
+        worldTlasHash.Add(geometryObjectInstance, m_BlasBuildIds[(uint32_t)AccelerationStructure::BLAS_StaticOpaque], float4x4::Identity(), double3::Zero());
         instanceIndex += m_OpaqueObjectsNum;
         worldGeometryObjectsNum++;
     }
@@ -3123,6 +3262,7 @@ void Sample::BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffe
         geometryObjectInstance.accelerationStructureHandle = NRI.GetAccelerationStructureHandle(*Get(AccelerationStructure::BLAS_StaticTransparent), 0);
 
         *worldTlasData++ = geometryObjectInstance;
+        worldTlasHash.Add(geometryObjectInstance, m_BlasBuildIds[(uint32_t)AccelerationStructure::BLAS_StaticTransparent], float4x4::Identity(), double3::Zero());
         instanceIndex += m_TransparentObjectsNum;
         worldGeometryObjectsNum++;
 
@@ -3140,6 +3280,7 @@ void Sample::BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffe
         geometryObjectInstance.accelerationStructureHandle = NRI.GetAccelerationStructureHandle(*Get(AccelerationStructure::BLAS_StaticEmissive), 0);
 
         *lightTlasData++ = geometryObjectInstance;
+        lightTlasHash.Add(geometryObjectInstance, m_BlasBuildIds[(uint32_t)AccelerationStructure::BLAS_StaticEmissive], float4x4::Identity(), double3::Zero());
         instanceIndex += m_EmissiveObjectsNum;
         lightGeometryObjectsNum++;
     }
@@ -3148,6 +3289,14 @@ void Sample::BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffe
     // IMPORTANT: instance data order must match geometry layout in BLAS-es
     for (uint32_t mode = (uint32_t)AccelerationStructure::BLAS_StaticOpaque; mode <= (uint32_t)AccelerationStructure::BLAS_Other; mode++)
     {
+        if (mode == (uint32_t)AccelerationStructure::BLAS_Other)
+        {
+            m_StaticInstanceRecordNum = uint32_t(instanceData - instanceDataBegin);
+            transformIndex = m_StaticInstanceRecordNum + dynamicInstanceNum;
+        }
+        else if (isStaticInstanceDataUploaded)
+            continue;
+
         for (size_t i = m_ProxyInstancesNum; i < instanceCount; i++)
         {
             utils::Instance& instance = m_Scene.instances[i];
@@ -3178,6 +3327,7 @@ void Sample::BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffe
             }
 
             float4x4 mObjectToWorld = float4x4::Identity();
+            float4x4 mObjectToWorldRotation = float4x4::Identity(); // world space, no translation
             float4x4 mOverloadedMatrix = float4x4::Identity();
             bool isLeftHanded = false;
 
@@ -3206,6 +3356,7 @@ void Sample::BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffe
                     mObjectToWorld = mObjectToWorld * transform;
                     mObjectToWorldPrev = mObjectToWorldPrev * transform;
                 }
+                mObjectToWorldRotation = mObjectToWorld;
 
                 mObjectToWorld.AddTranslation( m_Camera.GetRelative(instance.position) );
                 mObjectToWorldPrev.AddTranslation( m_Camera.GetRelative(instance.positionPrev) );
@@ -3265,16 +3416,31 @@ void Sample::BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffe
             if (material.IsHair())
                 flags |= FLAG_HAIR;
 
-            instanceData->mOverloadedMatrix0 = mOverloadedMatrix.col0;
-            instanceData->mOverloadedMatrix1 = mOverloadedMatrix.col1;
-            instanceData->mOverloadedMatrix2 = mOverloadedMatrix.col2;
-            instanceData->baseColorAndMetalnessScale = material.baseColorAndMetalnessScale;
-            instanceData->emissionAndRoughnessScale = material.emissiveAndRoughnessScale;
-            instanceData->textureOffsetAndFlags = baseTextureIndex | ( flags << FLAG_FIRST_BIT );
-            instanceData->primitiveOffset = meshInstance.primitiveOffset;
-            instanceData->morphedPrimitiveOffset = meshInstance.morphedPrimitiveOffset;
-            instanceData->invScale = (isLeftHanded ? -1.0f : 1.0f) / Max(scale.x, Max(scale.y, scale.z));
-            instanceData++;
+            InstanceDataDesc instanceDataDesc = {};
+            instanceDataDesc.isStatic = !instance.allowUpdate;
+            if (instanceDataDesc.isStatic)
+            {
+                const float4 rows[] = { mOverloadedMatrix.col0, mOverloadedMatrix.col1, mOverloadedMatrix.col2 };
+                for (uint32_t r = 0; r < 3; r++)
+                {
+                    instanceDataDesc.rotation[r][0] = rows[r].x;
+                    instanceDataDesc.rotation[r][1] = rows[r].y;
+                    instanceDataDesc.rotation[r][2] = rows[r].z;
+                }
+            }
+            else
+            {
+                EncodeInstanceTransform(mOverloadedMatrix.col0, mOverloadedMatrix.col1, mOverloadedMatrix.col2, instanceDataBegin[transformIndex]);
+                instanceDataDesc.transformIndex = transformIndex++;
+            }
+            memcpy(instanceDataDesc.baseColorAndMetalnessScale, material.baseColorAndMetalnessScale.pv, sizeof(instanceDataDesc.baseColorAndMetalnessScale));
+            memcpy(instanceDataDesc.emissionAndRoughnessScale, material.emissiveAndRoughnessScale.pv, sizeof(instanceDataDesc.emissionAndRoughnessScale));
+            instanceDataDesc.invScale = (isLeftHanded ? -1.0f : 1.0f) / Max(scale.x, Max(scale.y, scale.z));
+            instanceDataDesc.textureOffsetAndFlags = baseTextureIndex | ( flags << FLAG_FIRST_BIT );
+            instanceDataDesc.primitiveOffset = meshInstance.primitiveOffset;
+            instanceDataDesc.morphedPrimitiveOffset = meshInstance.morphedPrimitiveOffset;
+
+            EncodeInstanceData(instanceDataDesc, *instanceData++);
 
             // Add dynamic geometry
             if (instance.allowUpdate)
@@ -3286,16 +3452,24 @@ void Sample::BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffe
                 geometryObjectInstance.shaderBindingTableLocalOffset = 0;
                 geometryObjectInstance.flags = nri::TopLevelInstanceBits::TRIANGLE_CULL_DISABLE | (material.IsAlphaOpaque() ? nri::TopLevelInstanceBits::NONE : nri::TopLevelInstanceBits::FORCE_OPAQUE);
                 geometryObjectInstance.accelerationStructureHandle = NRI.GetAccelerationStructureHandle(*m_AccelerationStructures[meshInstance.blasIndex], 0);
+                uint64_t blasBuildId = m_BlasBuildIds[meshInstance.blasIndex];
 
-                nri::AccelerationStructure* blas = m_EnableOmm ? GetMaskedBlas(GetInstanceHash(instance.meshInstanceIndex, instance.materialIndex)) : nullptr;
+                nri::AccelerationStructure* blas = nullptr;
+                if (m_EnableOmm && material.IsAlphaOpaque()) // alpha tested
+                {
+                    uint32_t ommLod = UpdateOmmInstanceLod(i, instance, m_Scene.meshes[meshInstance.meshIndex]);
+                    blas = GetMaskedBlas(GetInstanceHash(instance.meshInstanceIndex, instance.materialIndex), ommLod, blasBuildId);
+                }
                 geometryObjectInstance.accelerationStructureHandle = blas ? NRI.GetAccelerationStructureHandle(*blas, 0) : geometryObjectInstance.accelerationStructureHandle;
 
                 *worldTlasData++ = geometryObjectInstance;
+                worldTlasHash.Add(geometryObjectInstance, blasBuildId, mObjectToWorldRotation, instance.position);
                 worldGeometryObjectsNum++;
 
                 if (flags == FLAG_FORCED_EMISSION || material.IsEmissive())
                 {
                     *lightTlasData++ = geometryObjectInstance;
+                    lightTlasHash.Add(geometryObjectInstance, blasBuildId, mObjectToWorldRotation, instance.position);
                     lightGeometryObjectsNum++;
                 }
             }
@@ -3314,9 +3488,55 @@ void Sample::BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffe
     nri::TransitionBarrierDesc transitionBarriers = {transition1, nullptr, helper::GetCountOf(transition1), 0};
     NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
 
-    NRI.CmdCopyBuffer(commandBuffer, *Get(Buffer::InstanceData), 0, 0, *Get(Buffer::InstanceDataStaging), 0, instanceDataOffset, instanceDataSize);
-    NRI.CmdBuildTopLevelAccelerationStructure(commandBuffer, worldGeometryObjectsNum, *Get(Buffer::WorldTlasDataStaging), tlasDataOffset, TLAS_BUILD_BITS, *Get(AccelerationStructure::TLAS_World), *Get(Buffer::WorldScratch), 0);
-    NRI.CmdBuildTopLevelAccelerationStructure(commandBuffer, lightGeometryObjectsNum, *Get(Buffer::LightTlasDataStaging), tlasDataOffset, TLAS_BUILD_BITS, *Get(AccelerationStructure::TLAS_Emissive), *Get(Buffer::LightScratch), 0);
+    const uint64_t uploadOffset = (isStaticInstanceDataUploaded ? m_StaticInstanceRecordNum : 0) * sizeof(InstanceData);
+    const uint64_t uploadSize = transformIndex * sizeof(InstanceData) - uploadOffset;
+    if (uploadSize)
+        NRI.CmdCopyBuffer(commandBuffer, *Get(Buffer::InstanceData), 0, uploadOffset, *Get(Buffer::InstanceDataStaging), 0, instanceDataOffset + uploadOffset, uploadSize);
+
+    m_IsStaticInstanceDataUploaded = true;
+    m_InstanceDataUploadBytes = uploadSize;
+
+    // Skip, refit or rebuild each TLAS
+    static const uint32_t tlasEventIDs[][2] =
+    { // rebuild, update
+        { m_Profiler.AllocateEvent("TLAS World: rebuild"), m_Profiler.AllocateEvent("TLAS World: update") },
+        { m_Profiler.AllocateEvent("TLAS Emissive: rebuild"), m_Profiler.AllocateEvent("TLAS Emissive: update") },
+    };
+    const AccelerationStructure tlases[] = { AccelerationStructure::TLAS_World, AccelerationStructure::TLAS_Emissive };
+    const Buffer tlasDataBuffers[] = { Buffer::WorldTlasDataStaging, Buffer::LightTlasDataStaging };
+    const Buffer scratchBuffers[] = { Buffer::WorldScratch, Buffer::LightScratch };
+    const TlasInstanceHash* tlasHashes[] = { &worldTlasHash, &lightTlasHash };
+    const uint32_t tlasInstanceNums[] = { worldGeometryObjectsNum, lightGeometryObjectsNum };
+
+    size_t eventNum = 0;
+    const ProfilerEvent* events = m_Profiler.GetPerformanceEvents(eventNum);
+    for (uint32_t i = 0; i < helper::GetCountOf(tlases); i++)
+    {
+        TlasState& state = m_TlasStates[i];
+        TlasBuildAction action = ChooseTlasBuildAction(state, *tlasHashes[i]);
+
+        // Savings are estimated from the last measured rebuild and update times
+        double rebuildMs = events[tlasEventIDs[i][0]].GetSmoothDelta();
+        double updateMs = events[tlasEventIDs[i][1]].GetSmoothDelta();
+        if (action == TlasBuildAction::Skip)
+            state.savedMs += rebuildMs;
+        else if (action == TlasBuildAction::Update && updateMs != 0.0)
+            state.savedMs += std::max(rebuildMs - updateMs, 0.0);
+
+        if (action == TlasBuildAction::Skip)
+            continue;
+
+        bool isRebuild = action == TlasBuildAction::Rebuild;
+        uint32_t timestampID = m_Profiler.BeginTimestamp(profilerContext, tlasEventIDs[i][isRebuild ? 0 : 1]);
+        {
+            nri::AccelerationStructure& tlas = *Get(tlases[i]);
+            if (isRebuild)
+                NRI.CmdBuildTopLevelAccelerationStructure(commandBuffer, tlasInstanceNums[i], *Get(tlasDataBuffers[i]), tlasDataOffset, TLAS_BUILD_BITS, tlas, *Get(scratchBuffers[i]), 0);
+            else
+                NRI.CmdUpdateTopLevelAccelerationStructure(commandBuffer, tlasInstanceNums[i], *Get(tlasDataBuffers[i]), tlasDataOffset, TLAS_BUILD_BITS, tlas, tlas, *Get(scratchBuffers[i]), 0);
+        }
+        m_Profiler.EndTimestamp(profilerContext, timestampID);
+    }
 
     const nri::BufferTransitionBarrierDesc transition2[] =
     {
@@ -3440,6 +3660,7 @@ void Sample::UpdateConstantBuffer(uint32_t frameIndex, uint32_t maxAccumulatedFr
         data->gTrimLobe                                     = m_Settings.specularLobeTrimming ? 1 : 0;
         data->gHighlightAhs = (uint32_t)m_Settings.highLightAhs;
         data->gAhsDynamicMip = (uint32_t)m_Settings.ahsDynamicMipSelection;
+        data->gAlphaCutoff = m_OmmBoundAlphaCutoff; // any-hit and OMM states must agree, m_OmmBakeDesc may already describe a rebuild in progress
 
         // Ambient
         data->gAmbientMaxAccumulatedFramesNum               = m_ForceHistoryReset ? 0 : float(maxAccumulatedFrameNum);
@@ -3513,18 +3734,77 @@ void Sample::RestoreBindings(nri::CommandBuffer& commandBuffer, const Frame& fra
 
 void Sample::RenderFrame(uint32_t frameIndex)
 {
-    m_Profiler.BeginFrame();
-    std::array<nri::TextureTransitionBarrierDesc, MAX_TEXTURE_TRANSITIONS_NUM> optimizedTransitions = {};
+    AllocationTracker::Scope allocationScope(m_AllocationTracker, m_AllocationScopeIDs[(uint32_t)AllocationScope::RenderFrame]);
+
+    m_StartedFrameIndex = frameIndex; // before anything of the frame can look up masked geometry
+
+    // Pipelined update: the previous frame can still be recorded and submitted.
+    // "m_FrameRecordingDesc" is a single snapshot, not double buffered: it's only rewritten below because of this wait
+    m_FrameSubmitWorker.Wait();
+    m_AllocationTracker.GatherWorkerJob(m_AllocationScopeIDs[(uint32_t)AllocationScope::TracingJob]);
+    m_AllocationTracker.GatherWorkerJob(m_AllocationScopeIDs[(uint32_t)AllocationScope::SubmitJob]);
+    {
+        AllocationTracker::Scope profilerAllocationScope(m_AllocationTracker, m_AllocationScopeIDs[(uint32_t)AllocationScope::Profiler]);
+        m_Profiler.BeginFrame();
+
+        // CPU times of the previous frame
+        static const uint32_t cpuEventIDs[] =
+        {
+            m_Profiler.AllocateEvent("CPU: AS updates"),
+            m_Profiler.AllocateEvent("CPU: Tracing & post"),
+            m_Profiler.AllocateEvent("CPU: Present & UI"),
+            m_Profiler.AllocateEvent("CPU: Frame recording"),
+            m_Profiler.AllocateEvent("CPU: Main thread"),
+            m_Profiler.AllocateEvent("CPU: Input to present"),
+        };
+        if (frameIndex)
+        {
+            const uint32_t sectionNum = (uint32_t)FrameSection::MAX_NUM;
+            for (uint32_t i = 0; i < sectionNum; i++)
+                m_Profiler.UpdateCpuEvent(cpuEventIDs[i], m_FrameSectionRecordingTimeMs[i]);
+            m_Profiler.UpdateCpuEvent(cpuEventIDs[sectionNum], m_FrameRecordingTimeMs);
+            m_Profiler.UpdateCpuEvent(cpuEventIDs[sectionNum + 1], m_MainThreadTimeMs);
+            m_Profiler.UpdateCpuEvent(cpuEventIDs[sectionNum + 2], m_InputToPresentTimeMs);
+        }
+        UpdateOmmTimelineEvents();
+
+        // The UI and the TLAS heuristics of the next frame read this copy, the submit worker of this frame ends it
+        m_Profiler.SnapshotEvents();
+    }
+
+    if (m_FrameLatencyReportFrameNum && frameIndex)
+    {
+        static uint32_t reportFrameNum = 0;
+        static double frameTimeMs = 0.0;
+        static double mainThreadTimeMs = 0.0;
+        static double inputToPresentTimeMs = 0.0;
+
+        reportFrameNum++;
+        frameTimeMs += m_Timer.GetFrameTime();
+        mainThreadTimeMs += m_MainThreadTimeMs;
+        inputToPresentTimeMs += m_InputToPresentTimeMs;
+
+        if (reportFrameNum == m_FrameLatencyReportFrameNum)
+        {
+            double n = double(reportFrameNum);
+            printf("Frames %u-%u (%s update): cpu frame %.3f ms, main thread %.3f ms, input to present %.3f ms\n", frameIndex - reportFrameNum, frameIndex - 1,
+                m_EnablePipelinedUpdate && m_EnableParallelRecording ? "pipelined" : "serial", frameTimeMs / n, mainThreadTimeMs / n, inputToPresentTimeMs / n);
+
+            reportFrameNum = 0;
+            frameTimeMs = 0.0;
+            mainThreadTimeMs = 0.0;
+            inputToPresentTimeMs = 0.0;
+        }
+    }
 
     const uint32_t bufferedFrameIndex = frameIndex % BUFFERED_FRAME_MAX_NUM;
     const Frame& frame = m_Frames[bufferedFrameIndex];
-    const bool isEven = !(frameIndex & 0x1);
-    nri::CommandBuffer& commandBuffer = *frame.commandBuffer;
 
     if (frameIndex >= BUFFERED_FRAME_MAX_NUM)
     {
         NRI.Wait(*m_FrameFence, 1 + frameIndex - BUFFERED_FRAME_MAX_NUM);
-        NRI.ResetCommandAllocator(*frame.commandAllocator);
+        for (nri::CommandAllocator* commandAllocator : frame.commandAllocators)
+            NRI.ResetCommandAllocator(*commandAllocator);
     }
 
     // Global history reset
@@ -3664,42 +3944,218 @@ void Sample::RenderFrame(uint32_t frameIndex)
 
     UpdateConstantBuffer(frameIndex, maxAccumulatedFrameNum);
 
-    uint32_t kDummyDynamicConstantOffset = 0;
+    // Denoiser settings following the accumulation of this frame
+    nrd::HitDistanceParameters hitDistanceParameters = {};
+    hitDistanceParameters.A = m_Settings.hitDistScale * m_Settings.meterToUnitsMultiplier;
+    m_ReblurSettings.hitDistanceParameters = hitDistanceParameters;
+
+    m_ReblurSettings.maxAccumulatedFrameNum = maxAccumulatedFrameNum;
+    m_ReblurSettings.maxFastAccumulatedFrameNum = maxFastAccumulatedFrameNum;
+    m_ReblurSettings.checkerboardMode = m_Settings.tracingMode == RESOLUTION_HALF ? nrd::CheckerboardMode::WHITE : nrd::CheckerboardMode::OFF;
+    m_ReblurSettings.enableMaterialTestForDiffuse = true;
+    m_ReblurSettings.enableMaterialTestForSpecular = false;
+
+    m_RelaxSettings.diffuseMaxAccumulatedFrameNum = maxAccumulatedFrameNum;
+    m_RelaxSettings.diffuseMaxFastAccumulatedFrameNum = maxFastAccumulatedFrameNum;
+    m_RelaxSettings.specularMaxAccumulatedFrameNum = maxAccumulatedFrameNum;
+    m_RelaxSettings.specularMaxFastAccumulatedFrameNum = maxFastAccumulatedFrameNum;
+    m_RelaxSettings.checkerboardMode = m_Settings.tracingMode == RESOLUTION_HALF ? nrd::CheckerboardMode::WHITE : nrd::CheckerboardMode::OFF;
+    m_RelaxSettings.enableMaterialTestForDiffuse = true;
+    m_RelaxSettings.enableMaterialTestForSpecular = false;
+
+    // Snapshot: "Tracing" can still be recorded while PrepareFrame of the next frame updates the live state
+    FrameRecordingDesc& desc = m_FrameRecordingDesc;
+    desc.settings = m_Settings;
+    desc.relaxSettings = m_RelaxSettings;
+    desc.reblurSettings = m_ReblurSettings;
+    desc.referenceSettings = m_ReferenceSettings;
+    desc.commonSettings = commonSettings;
+    desc.userPool = userPool;
+    desc.updateBegin = m_UpdateBegin;
+    desc.viewportJitter = m_Camera.state.viewportJitter;
+    desc.rectW = rectW;
+    desc.rectH = rectH;
+    desc.rectGridW = rectGridW;
+    desc.rectGridH = rectGridH;
+    desc.windowGridW = windowGridW;
+    desc.windowGridH = windowGridH;
+    desc.forceHistoryReset = m_ForceHistoryReset;
+    desc.resolve = m_Resolve;
+    desc.showValidation = m_DebugNRD && m_ShowValidationOverlay;
+    desc.useShaderPermutations = m_EnableShaderPermutations;
+
+    { // Profiler contexts are created up front: the profiler can't do it on the worker threads
+        AllocationTracker::Scope profilerAllocationScope(m_AllocationTracker, m_AllocationScopeIDs[(uint32_t)AllocationScope::Profiler]);
+        for (uint32_t i = 0; i < (uint32_t)FrameSection::MAX_NUM; i++)
+            m_FrameSectionProfilerContexts[i] = m_Profiler.BeginContext(frame.commandBuffers[i]);
+    }
 
-    NRI.BeginCommandBuffer(commandBuffer, m_DescriptorPool, 0);
+    // Sections before "Present" are recorded on the workers, "Present" is recorded here in the meantime
+    m_FrameRecordingBegin = std::chrono::high_resolution_clock::now();
+    if (m_EnableParallelRecording)
     {
-        ProfilerContext* context01 = m_Profiler.BeginContext(&commandBuffer);
-        // All-in-one pipeline layout
-        NRI.CmdSetPipelineLayout(commandBuffer, *m_PipelineLayout);
+        for (FrameWorker& worker : m_FrameSectionWorkers)
+            worker.Post(frameIndex);
+
+        RecordFrameSection(FrameSection::Present, frameIndex);
 
-        NRI.CmdSetDescriptorSet(commandBuffer, 0, *frame.globalConstantBufferDescriptorSet, nullptr);
+        // "AccelerationStructures" reads the live scene, which PrepareFrame animates
+        m_FrameSectionWorkers[(uint32_t)FrameSection::AccelerationStructures].Wait();
+        m_AllocationTracker.GatherWorkerJob(m_AllocationScopeIDs[(uint32_t)AllocationScope::AccelerationStructuresJob]);
 
-        // Update morph animation
-        if (m_Settings.activeAnimation < m_Scene.animations.size() && m_Scene.animations[m_Settings.activeAnimation].morphMeshInstances.size() && (!m_Settings.pauseAnimation || !m_SettingsPrev.pauseAnimation || frameIndex == 0))
+        if (m_EnablePipelinedUpdate)
+            m_FrameSubmitWorker.Post(frameIndex); // the tracing and submit jobs are gathered by the next frame
+        else
         {
-            const utils::Animation& animation = m_Scene.animations[m_Settings.activeAnimation];
-            uint32_t animCurrBufferIndex = frameIndex & 0x1;
-            uint32_t animPrevBufferIndex = frameIndex == 0 ? animCurrBufferIndex : 1 - animCurrBufferIndex;
+            m_FrameSectionWorkers[(uint32_t)FrameSection::Tracing].Wait();
+            m_AllocationTracker.GatherWorkerJob(m_AllocationScopeIDs[(uint32_t)AllocationScope::TracingJob]);
+            SubmitFrame(frameIndex);
+        }
+    }
+    else
+    {
+        for (uint32_t i = 0; i < (uint32_t)FrameSection::MAX_NUM; i++)
+            RecordFrameSection((FrameSection)i, frameIndex);
 
-            { // Update vertices
-                helper::Annotation annotation(NRI, commandBuffer, "Morph mesh: update vertices");
+        SubmitFrame(frameIndex);
+    }
+
+    m_MainThreadTimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_UpdateBegin).count();
+
+    // Cap FPS if requested
+    float msLimit = m_Settings.limitFps ? 1000.0f / m_Settings.maxFps : 0.0f;
+    double lastFrameTimeStamp = m_Timer.GetLastFrameTimeStamp();
+
+    while (m_Timer.GetTimeStamp() - lastFrameTimeStamp < msLimit)
+        ;
+}
+
+void Sample::SubmitFrame(uint32_t frameIndex)
+{ // on the submit worker if the update is pipelined: only the snapshot and the frame resources can be used
+    const Frame& frame = m_Frames[frameIndex % BUFFERED_FRAME_MAX_NUM];
+    m_FrameRecordingTimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_FrameRecordingBegin).count();
+
+    nri::CommandBuffer& lastCommandBuffer = *frame.commandBuffers[(uint32_t)FrameSection::Present];
+    m_Profiler.EndFrame(&lastCommandBuffer);
+    NRI.EndCommandBuffer(lastCommandBuffer);
+
+    nri::QueueSubmitDesc queueSubmitDesc = {};
+    queueSubmitDesc.commandBuffers = frame.commandBuffers.data();
+    queueSubmitDesc.commandBufferNum = (uint32_t)FrameSection::MAX_NUM;
+    NRI.QueueSubmit(*m_CommandQueue, queueSubmitDesc);
+
+    NRI.SwapChainPresent(*m_SwapChain);
+
+    NRI.QueueSignal(*m_CommandQueue, *m_FrameFence, 1 + frameIndex);
+
+    m_InputToPresentTimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_FrameRecordingDesc.updateBegin).count();
+}
+
+void Sample::StartFrameWorkers()
+{
+    for (uint32_t i = 0; i < (uint32_t)m_FrameSectionWorkers.size(); i++)
+    {
+        FrameSection section = (FrameSection)i;
+        uint32_t allocationScopeID = m_AllocationScopeIDs[(uint32_t)AllocationScope::AccelerationStructuresJob + i];
+        m_FrameSectionWorkers[i].Start([this, section, allocationScopeID](uint32_t frameIndex)
+        {
+            AllocationTracker::Scope allocationScope(m_AllocationTracker, allocationScopeID);
+            RecordFrameSection(section, frameIndex);
+        });
+    }
+
+    m_FrameSubmitWorker.Start([this](uint32_t frameIndex)
+    {
+        m_FrameSectionWorkers[(uint32_t)FrameSection::Tracing].Wait();
+
+        AllocationTracker::Scope allocationScope(m_AllocationTracker, m_AllocationScopeIDs[(uint32_t)AllocationScope::SubmitJob]);
+        SubmitFrame(frameIndex);
+    });
+}
+
+void Sample::StopFrameWorkers()
+{
+    m_FrameSubmitWorker.Stop(); // waits for the section workers
+    for (FrameWorker& worker : m_FrameSectionWorkers)
+        worker.Stop();
+}
+
+void Sample::RecordFrameSection(FrameSection section, uint32_t frameIndex)
+{
+    auto begin = std::chrono::high_resolution_clock::now();
+
+    const Frame& frame = m_Frames[frameIndex % BUFFERED_FRAME_MAX_NUM];
+    nri::CommandBuffer& commandBuffer = *frame.commandBuffers[(uint32_t)section];
+    ProfilerContext* profilerContext = m_FrameSectionProfilerContexts[(uint32_t)section];
+
+    NRI.BeginCommandBuffer(commandBuffer, m_DescriptorPool, 0);
+    if (section == FrameSection::AccelerationStructures)
+        RecordAccelerationStructureUpdates(commandBuffer, profilerContext, frameIndex);
+    else if (section == FrameSection::Tracing)
+        RecordTracingAndPost(commandBuffer, profilerContext, frameIndex);
+    else
+        RecordPresent(commandBuffer);
+
+    // The last command buffer is closed in SubmitFrame, after the profiler resolves the queries of all sections
+    if (section != FrameSection::Present)
+        NRI.EndCommandBuffer(commandBuffer);
+
+    m_FrameSectionRecordingTimeMs[(uint32_t)section] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+}
+
+void Sample::RecordAccelerationStructureUpdates(nri::CommandBuffer& commandBuffer, ProfilerContext* profilerContext, uint32_t frameIndex)
+{
+    const uint32_t bufferedFrameIndex = frameIndex % BUFFERED_FRAME_MAX_NUM;
+    const Frame& frame = m_Frames[bufferedFrameIndex];
+
+    // All-in-one pipeline layout
+    NRI.CmdSetPipelineLayout(commandBuffer, *m_PipelineLayout);
+
+    NRI.CmdSetDescriptorSet(commandBuffer, 0, *frame.globalConstantBufferDescriptorSet, nullptr);
+
+    // Update morph animation
+    if (m_Settings.activeAnimation < m_Scene.animations.size() && m_Scene.animations[m_Settings.activeAnimation].morphMeshInstances.size() && (!m_Settings.pauseAnimation || !m_SettingsPrev.pauseAnimation || frameIndex == 0))
+    {
+        const utils::Animation& animation = m_Scene.animations[m_Settings.activeAnimation];
+        uint32_t animCurrBufferIndex = frameIndex & 0x1;
+        uint32_t animPrevBufferIndex = frameIndex == 0 ? animCurrBufferIndex : 1 - animCurrBufferIndex;
+
+        // Work tables are flattened: each stage updates up to "MORPH_BATCH_MAX_MESHES_NUM" meshes per dispatch
+        const uint32_t meshNum = (uint32_t)animation.morphMeshInstances.size();
+        const uint32_t batchMeshNum = m_EnableBatchedMorphUpdate ? MORPH_BATCH_MAX_MESHES_NUM : 1;
+
+        MorphUpdateStats stats = {};
+        stats.meshNum = meshNum;
 
+        { // Update vertices
+            helper::Annotation annotation(NRI, commandBuffer, "Morph mesh: update vertices");
+
+            {
+                const nri::BufferTransitionBarrierDesc bufferTransitions[] =
                 {
-                    const nri::BufferTransitionBarrierDesc bufferTransitions[] =
-                    {
-                        // Output
-                        {Get(Buffer::MorphedPositions), nri::AccessBits::SHADER_RESOURCE,  nri::AccessBits::SHADER_RESOURCE_STORAGE},
-                        {Get(Buffer::MorphedAttributes), nri::AccessBits::SHADER_RESOURCE,  nri::AccessBits::SHADER_RESOURCE_STORAGE},
-                    };
+                    // Output
+                    {Get(Buffer::MorphedPositions), nri::AccessBits::SHADER_RESOURCE,  nri::AccessBits::SHADER_RESOURCE_STORAGE},
+                    {Get(Buffer::MorphedAttributes), nri::AccessBits::SHADER_RESOURCE,  nri::AccessBits::SHADER_RESOURCE_STORAGE},
+                };
 
-                    nri::TransitionBarrierDesc transitionBarriers = { bufferTransitions, nullptr, helper::GetCountOf(bufferTransitions), 0};
-                    NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
-                }
+                nri::TransitionBarrierDesc transitionBarriers = { bufferTransitions, nullptr, helper::GetCountOf(bufferTransitions), 0};
+                NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+                stats.barrierNum++;
+            }
+
+            NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::MorphMeshUpdateVertices));
 
-                NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::MorphMeshUpdateVertices));
+            for (uint32_t batchBegin = 0; batchBegin < meshNum; batchBegin += batchMeshNum)
+            {
+                const uint32_t batchEnd = GetMorphBatchEnd(batchBegin, batchMeshNum, meshNum);
+
+                MorphMeshUpdateVerticesConstants constants = {};
+                constants.gVerticesMeshNum = batchEnd - batchBegin;
 
-                for (const utils::WeightTrackMorphMeshIndex& weightTrackMeshInstance : animation.morphMeshInstances)
+                uint32_t groupNum = 0;
+                for (uint32_t j = batchBegin; j < batchEnd; j++)
                 {
+                    const utils::WeightTrackMorphMeshIndex& weightTrackMeshInstance = animation.morphMeshInstances[j];
                     const utils::WeightsAnimationTrack& weightsTrack = animation.weightTracks[weightTrackMeshInstance.weightTrackIndex];
                     const utils::MeshInstance& meshInstance = m_Scene.meshInstances[weightTrackMeshInstance.meshInstanceIndex];
                     const utils::Mesh& mesh = m_Scene.meshes[meshInstance.meshIndex];
@@ -3710,614 +4166,632 @@ void Sample::RenderFrame(uint32_t frameIndex)
                         totalWeight += weightsTrack.activeValues[i].second;
                     float renormalizeScale = 1.0f / totalWeight;
 
-                    MorphMeshUpdateVerticesConstants constants = {};
+                    MorphMeshVerticesWork& work = constants.gVerticesWork[j - batchBegin];
                     for (uint32_t i = 0; i < numShaderMorphTargets; i++)
                     {
                         uint32_t morphTargetIndex = weightsTrack.activeValues[i].first;
                         uint32_t morphTargetVertexOffset = mesh.morphTargetVertexOffset + morphTargetIndex * mesh.vertexNum;
 
-                        constants.gIndices[i / MORPH_ELEMENTS_PER_ROW_NUM].pv[i % MORPH_ELEMENTS_PER_ROW_NUM] = morphTargetVertexOffset;
-                        constants.gWeights[i / MORPH_ELEMENTS_PER_ROW_NUM].pv[i % MORPH_ELEMENTS_PER_ROW_NUM] = renormalizeScale * weightsTrack.activeValues[i].second;
-        }
-                    constants.gNumWeights = numShaderMorphTargets;
-                    constants.gNumVertices = mesh.vertexNum;
-                    constants.gPositionCurrFrameOffset = m_Scene.morphedVerticesNum * animCurrBufferIndex + meshInstance.morphedVertexOffset;
-                    constants.gAttributesOutputOffset = meshInstance.morphedVertexOffset;
-
-                    uint32_t dynamicConstantBufferOffset = m_DynamicConstantBufferAllocator.Allocate(constants);
-                    NRI.CmdSetDescriptorSet(commandBuffer, 3, *Get(DescriptorSet::MorphTargetPose3), &dynamicConstantBufferOffset);
+                        work.indices[i / MORPH_ELEMENTS_PER_ROW_NUM].pv[i % MORPH_ELEMENTS_PER_ROW_NUM] = morphTargetVertexOffset;
+                        work.weights[i / MORPH_ELEMENTS_PER_ROW_NUM].pv[i % MORPH_ELEMENTS_PER_ROW_NUM] = renormalizeScale * weightsTrack.activeValues[i].second;
+                    }
+                    work.weightNum = numShaderMorphTargets;
+                    work.vertexNum = mesh.vertexNum;
+                    work.positionCurrFrameOffset = m_Scene.morphedVerticesNum * animCurrBufferIndex + meshInstance.morphedVertexOffset;
+                    work.attributesOutputOffset = meshInstance.morphedVertexOffset;
 
-                    constexpr uint32_t kNumThreads = 256;
-                    NRI.CmdDispatch(commandBuffer, (mesh.vertexNum + kNumThreads - 1) / kNumThreads, 1, 1);
+                    AddMorphBatchMesh(constants.gVerticesFirstGroup, j - batchBegin, mesh.vertexNum, groupNum);
                 }
 
-                {
-            const nri::BufferTransitionBarrierDesc bufferTransitions[] =
+                uint32_t dynamicConstantBufferOffset = m_DynamicConstantBufferAllocator.Allocate(constants);
+                NRI.CmdSetDescriptorSet(commandBuffer, 3, *Get(DescriptorSet::MorphTargetPose3), &dynamicConstantBufferOffset);
+
+                NRI.CmdDispatch(commandBuffer, groupNum, 1, 1);
+                stats.dispatchNum++;
+            }
+
             {
-                        // Input
-                        {Get(Buffer::MorphedPositions), nri::AccessBits::SHADER_RESOURCE_STORAGE,  nri::AccessBits::SHADER_RESOURCE},
-                        {Get(Buffer::MorphedAttributes), nri::AccessBits::SHADER_RESOURCE_STORAGE,  nri::AccessBits::SHADER_RESOURCE},
+                const nri::BufferTransitionBarrierDesc bufferTransitions[] =
+                {
+                    // Input
+                    {Get(Buffer::MorphedPositions), nri::AccessBits::SHADER_RESOURCE_STORAGE,  nri::AccessBits::SHADER_RESOURCE},
+                    {Get(Buffer::MorphedAttributes), nri::AccessBits::SHADER_RESOURCE_STORAGE,  nri::AccessBits::SHADER_RESOURCE},
 
-                        // Output
-                        {Get(Buffer::PrimitiveData), nri::AccessBits::SHADER_RESOURCE, nri::AccessBits::SHADER_RESOURCE_STORAGE},
-                        {Get(Buffer::MorphedPrimitivePrevData), nri::AccessBits::SHADER_RESOURCE, nri::AccessBits::SHADER_RESOURCE_STORAGE},
-            };
+                    // Output
+                    {Get(Buffer::PrimitiveData), nri::AccessBits::SHADER_RESOURCE, nri::AccessBits::SHADER_RESOURCE_STORAGE},
+                    {Get(Buffer::MorphedPrimitivePrevData), nri::AccessBits::SHADER_RESOURCE, nri::AccessBits::SHADER_RESOURCE_STORAGE},
+                };
 
-                    nri::TransitionBarrierDesc transitionBarriers = { bufferTransitions, nullptr, helper::GetCountOf(bufferTransitions), 0 };
-                    NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
-                }
+                nri::TransitionBarrierDesc transitionBarriers = { bufferTransitions, nullptr, helper::GetCountOf(bufferTransitions), 0 };
+                NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+                stats.barrierNum++;
             }
+        }
+
+        { // Update primitives
+            helper::Annotation annotation(NRI, commandBuffer, "Morph mesh: update primitives");
 
-            { // Update primitives
-                helper::Annotation annotation(NRI, commandBuffer, "Morph mesh: update primitives");
+            NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::MorphMeshUpdatePrimitives));
 
-                NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::MorphMeshUpdatePrimitives));
+            for (uint32_t batchBegin = 0; batchBegin < meshNum; batchBegin += batchMeshNum)
+            {
+                const uint32_t batchEnd = GetMorphBatchEnd(batchBegin, batchMeshNum, meshNum);
+
+                MorphMeshUpdatePrimitivesConstants constants = {};
+                constants.gPrimitivesMeshNum = batchEnd - batchBegin;
 
-                for (const utils::WeightTrackMorphMeshIndex& weightTrackMeshInstance : animation.morphMeshInstances)
+                uint32_t groupNum = 0;
+                for (uint32_t j = batchBegin; j < batchEnd; j++)
                 {
-                    const utils::MeshInstance& meshInstance = m_Scene.meshInstances[weightTrackMeshInstance.meshInstanceIndex];
+                    const utils::MeshInstance& meshInstance = m_Scene.meshInstances[animation.morphMeshInstances[j].meshInstanceIndex];
                     const utils::Mesh& mesh = m_Scene.meshes[meshInstance.meshIndex];
                     uint32_t numPrimitives = mesh.indexNum / 3;
 
-                    MorphMeshUpdatePrimitivesConstants constants = {};
-                    constants.gPositionFrameOffsets.x = m_Scene.morphedVerticesNum * animCurrBufferIndex + meshInstance.morphedVertexOffset;
-                    constants.gPositionFrameOffsets.y = m_Scene.morphedVerticesNum * animPrevBufferIndex + meshInstance.morphedVertexOffset;
-                    constants.gNumPrimitives = numPrimitives;
-                    constants.gIndexOffset = mesh.morphMeshIndexOffset;
-                    constants.gAttributesOffset = meshInstance.morphedVertexOffset;
-                    constants.gPrimitiveOffset = meshInstance.primitiveOffset;
-                    constants.gMorphedPrimitiveOffset = meshInstance.morphedPrimitiveOffset;
+                    MorphMeshPrimitivesWork& work = constants.gPrimitivesWork[j - batchBegin];
+                    work.positionFrameOffsets.x = m_Scene.morphedVerticesNum * animCurrBufferIndex + meshInstance.morphedVertexOffset;
+                    work.positionFrameOffsets.y = m_Scene.morphedVerticesNum * animPrevBufferIndex + meshInstance.morphedVertexOffset;
+                    work.primitiveNum = numPrimitives;
+                    work.indexOffset = mesh.morphMeshIndexOffset;
+                    work.attributesOffset = meshInstance.morphedVertexOffset;
+                    work.primitiveOffset = meshInstance.primitiveOffset;
+                    work.morphedPrimitiveOffset = meshInstance.morphedPrimitiveOffset;
 
-                    uint32_t dynamicConstantBufferOffset = m_DynamicConstantBufferAllocator.Allocate(constants);
-                    NRI.CmdSetDescriptorSet(commandBuffer, 3, *Get(DescriptorSet::MorphTargetUpdatePrimitives3), &dynamicConstantBufferOffset);
-
-                    constexpr uint32_t kNumThreads = 256;
-                    NRI.CmdDispatch(commandBuffer, (numPrimitives + kNumThreads - 1) / kNumThreads, 1, 1);
+                    AddMorphBatchMesh(constants.gPrimitivesFirstGroup, j - batchBegin, numPrimitives, groupNum);
                 }
-            }
 
-            { // Update BLAS
-                helper::Annotation annotation(NRI, commandBuffer, "Morph mesh: BLAS");
+                uint32_t dynamicConstantBufferOffset = m_DynamicConstantBufferAllocator.Allocate(constants);
+                NRI.CmdSetDescriptorSet(commandBuffer, 3, *Get(DescriptorSet::MorphTargetUpdatePrimitives3), &dynamicConstantBufferOffset);
 
-                size_t scratchOffset = 0;
-                for (const utils::WeightTrackMorphMeshIndex& weightTrackMeshInstance : animation.morphMeshInstances)
-                {
-                    const utils::MeshInstance& meshInstance = m_Scene.meshInstances[weightTrackMeshInstance.meshInstanceIndex];
-                    const utils::Mesh& mesh = m_Scene.meshes[meshInstance.meshIndex];
+                NRI.CmdDispatch(commandBuffer, groupNum, 1, 1);
+                stats.dispatchNum++;
+            }
+        }
+        { // Update BLAS
+            helper::Annotation annotation(NRI, commandBuffer, "Morph mesh: BLAS");
 
-                    nri::GeometryObject geometryObject = {};
-                    geometryObject.type = nri::GeometryType::TRIANGLES;
-                    geometryObject.flags = nri::BottomLevelGeometryBits::NONE; // will be set in TLAS instance
-                    geometryObject.triangles.vertexBuffer = Get(Buffer::MorphedPositions);
-                    geometryObject.triangles.vertexStride = sizeof(float[4]); // underlying storage is RGBA32_SFLOAT for UAV
-                    geometryObject.triangles.vertexOffset = geometryObject.triangles.vertexStride * (m_Scene.morphedVerticesNum * animCurrBufferIndex + meshInstance.morphedVertexOffset);
-                    geometryObject.triangles.vertexNum = mesh.vertexNum;
-                    geometryObject.triangles.vertexFormat = nri::Format::RGB32_SFLOAT;
-                    geometryObject.triangles.indexBuffer = Get(Buffer::MorphMeshIndices);
-                    geometryObject.triangles.indexOffset = mesh.morphMeshIndexOffset * sizeof(utils::Index);
-                    geometryObject.triangles.indexNum = mesh.indexNum;
-                    geometryObject.triangles.indexType = sizeof(utils::Index) == 2 ? nri::IndexType::UINT16 : nri::IndexType::UINT32;
-
-                    nri::AccelerationStructure& accelerationStructure = *m_AccelerationStructures[meshInstance.blasIndex];
-                    NRI.CmdBuildBottomLevelAccelerationStructure(commandBuffer, 1, &geometryObject, BLAS_DEFORMABLE_MESH_BUILD_BITS, accelerationStructure, *Get(Buffer::MorphMeshScratch), scratchOffset);
-
-                    uint64_t size = NRI.GetAccelerationStructureBuildScratchBufferSize(accelerationStructure);
-                    scratchOffset += helper::Align(size, 256);
-                }
+            // Builds are recorded back to back into disjoint scratch ranges, without barriers in between
+            size_t scratchOffset = 0;
+            for (const utils::WeightTrackMorphMeshIndex& weightTrackMeshInstance : animation.morphMeshInstances)
+            {
+                const utils::MeshInstance& meshInstance = m_Scene.meshInstances[weightTrackMeshInstance.meshInstanceIndex];
+                const utils::Mesh& mesh = m_Scene.meshes[meshInstance.meshIndex];
+
+                nri::GeometryObject geometryObject = {};
+                geometryObject.type = nri::GeometryType::TRIANGLES;
+                geometryObject.flags = nri::BottomLevelGeometryBits::NONE; // will be set in TLAS instance
+                geometryObject.triangles.vertexBuffer = Get(Buffer::MorphedPositions);
+                geometryObject.triangles.vertexStride = sizeof(float[4]); // underlying storage is RGBA32_SFLOAT for UAV
+                geometryObject.triangles.vertexOffset = geometryObject.triangles.vertexStride * (m_Scene.morphedVerticesNum * animCurrBufferIndex + meshInstance.morphedVertexOffset);
+                geometryObject.triangles.vertexNum = mesh.vertexNum;
+                geometryObject.triangles.vertexFormat = nri::Format::RGB32_SFLOAT;
+                geometryObject.triangles.indexBuffer = Get(Buffer::MorphMeshIndices);
+                geometryObject.triangles.indexOffset = mesh.morphMeshIndexOffset * sizeof(utils::Index);
+                geometryObject.triangles.indexNum = mesh.indexNum;
+                geometryObject.triangles.indexType = sizeof(utils::Index) == 2 ? nri::IndexType::UINT16 : nri::IndexType::UINT32;
+
+                nri::AccelerationStructure& accelerationStructure = *m_AccelerationStructures[meshInstance.blasIndex];
+                NRI.CmdBuildBottomLevelAccelerationStructure(commandBuffer, 1, &geometryObject, BLAS_DEFORMABLE_MESH_BUILD_BITS, accelerationStructure, *Get(Buffer::MorphMeshScratch), scratchOffset);
+                m_BlasBuildIds[meshInstance.blasIndex] = ++m_BlasBuildId; // only TLASes referencing this BLAS get refitted
+                stats.blasBuildNum++;
+
+                uint64_t size = NRI.GetAccelerationStructureBuildScratchBufferSize(accelerationStructure);
+                scratchOffset += helper::Align(size, 256);
+            }
 
+            {
+                const nri::BufferTransitionBarrierDesc bufferTransitions[] =
                 {
-                    const nri::BufferTransitionBarrierDesc bufferTransitions[] =
-                    {
-                        {Get(Buffer::PrimitiveData), nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE},
-                        {Get(Buffer::MorphedPrimitivePrevData), nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE},
-                    };
+                    {Get(Buffer::PrimitiveData), nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE},
+                    {Get(Buffer::MorphedPrimitivePrevData), nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE},
+                };
 
-                    nri::TransitionBarrierDesc transitionBarriers = { bufferTransitions, nullptr, helper::GetCountOf(bufferTransitions), 0 };
-                    NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
-                }
+                nri::TransitionBarrierDesc transitionBarriers = { bufferTransitions, nullptr, helper::GetCountOf(bufferTransitions), 0 };
+                NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+                stats.barrierNum++;
             }
         }
 
-        { // TLAS
-            helper::Annotation annotation(NRI, commandBuffer, "TLAS");
-
-            BuildTopLevelAccelerationStructure(commandBuffer, bufferedFrameIndex);
+        if (m_MorphUpdateReport && std::memcmp(&stats, &m_MorphUpdateStats, sizeof(stats)))
+        {
+            printf("Morph update (%s): %u meshes, %u dispatches, %u barriers, %u BLAS builds\n", m_EnableBatchedMorphUpdate ? "batched" : "per mesh",
+                stats.meshNum, stats.dispatchNum, stats.barrierNum, stats.blasBuildNum);
         }
+        m_MorphUpdateStats = stats;
+    }
 
-        NRI.CmdSetDescriptorSet(commandBuffer, 2, *Get(DescriptorSet::RayTracing2), nullptr);
+    { // TLAS
+        helper::Annotation annotation(NRI, commandBuffer, "TLAS");
 
-        // Trace ambient // TODO: replace with a hash-grid based radiance cache
-        if (m_Settings.ambient)
-        {
-            helper::Annotation annotation(NRI, commandBuffer, "Trace ambient");
-            static uint32_t eventID = m_Profiler.AllocateEvent("Trace ambient");
-            uint32_t timesampID = m_Profiler.BeginTimestamp(context01, eventID);
+        BuildTopLevelAccelerationStructure(commandBuffer, bufferedFrameIndex, profilerContext);
+    }
+}
 
-            const TextureState transitions[] =
-            {
-                // Output
-                {Texture::Ambient, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-            };
+void Sample::RecordTracingAndPost(nri::CommandBuffer& commandBuffer, ProfilerContext* profilerContext, uint32_t frameIndex)
+{
+    std::array<nri::TextureTransitionBarrierDesc, MAX_TEXTURE_TRANSITIONS_NUM> optimizedTransitions = {};
 
-            nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
-            NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+    const Frame& frame = m_Frames[frameIndex % BUFFERED_FRAME_MAX_NUM];
+    const bool isEven = !(frameIndex & 0x1);
 
-            NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::TraceAmbient));
-            NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(DescriptorSet::TraceAmbient1), &kDummyDynamicConstantOffset);
+    // Only the snapshot is read here: PrepareFrame of the next frame can run in the meantime
+    FrameRecordingDesc& desc = m_FrameRecordingDesc;
+    NrdUserPool& userPool = desc.userPool;
+    nrd::CommonSettings commonSettings = desc.commonSettings; // modified by the reference denoiser
+    const uint32_t rectW = desc.rectW;
+    const uint32_t rectH = desc.rectH;
+    const uint32_t rectGridW = desc.rectGridW;
+    const uint32_t rectGridH = desc.rectGridH;
+    uint32_t windowGridW = desc.windowGridW;
+    uint32_t windowGridH = desc.windowGridH;
 
-            NRI.CmdDispatch(commandBuffer, 2, 2, 1);
-            m_Profiler.EndTimestamp(context01, timesampID);
-        }
+    uint32_t kDummyDynamicConstantOffset = 0;
 
-        { // Trace opaque
-            helper::Annotation annotation(NRI, commandBuffer, "Trace opaque");
-            static uint32_t eventID = m_Profiler.AllocateEvent("Trace opaque");
-            uint32_t timesampID = m_Profiler.BeginTimestamp(context01, eventID);
+    RestoreBindings(commandBuffer, frame);
 
-            const TextureState transitions[] =
-            {
-                // Input
-                {Texture::ComposedDiff, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::ComposedSpec_ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::Ambient, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                // Output
-                {Texture::Mv, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::Normal_Roughness, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::BaseColor_Metalness, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::DirectLighting, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::DirectEmission, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::PsrThroughput, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::Unfiltered_ShadowData, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::Unfiltered_Shadow_Translucency, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::Unfiltered_Diff, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::Unfiltered_Spec, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+    // Trace ambient // TODO: replace with a hash-grid based radiance cache
+    if (desc.settings.ambient)
+    {
+        helper::Annotation annotation(NRI, commandBuffer, "Trace ambient");
+        static uint32_t eventID = m_Profiler.AllocateEvent("Trace ambient");
+        uint32_t timesampID = m_Profiler.BeginTimestamp(profilerContext, eventID);
+
+        const TextureState transitions[] =
+        {
+            // Output
+            {Texture::Ambient, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+        };
+
+        nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
+        NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+
+        NRI.CmdSetPipeline(commandBuffer, *GetTracePipeline(TracePass::Ambient, Pipeline::TraceAmbient, desc));
+        NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(DescriptorSet::TraceAmbient1), &kDummyDynamicConstantOffset);
+
+        NRI.CmdDispatch(commandBuffer, 2, 2, 1);
+        m_Profiler.EndTimestamp(profilerContext, timesampID);
+    }
+
+    { // Trace opaque
+        helper::Annotation annotation(NRI, commandBuffer, "Trace opaque");
+        static uint32_t eventID = m_Profiler.AllocateEvent("Trace opaque");
+        uint32_t timesampID = m_Profiler.BeginTimestamp(profilerContext, eventID);
+
+        const TextureState transitions[] =
+        {
+            // Input
+            {Texture::ComposedDiff, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::ComposedSpec_ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::Ambient, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            // Output
+            {Texture::Mv, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::Normal_Roughness, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::BaseColor_Metalness, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::DirectLighting, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::DirectEmission, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::PsrThroughput, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::Unfiltered_ShadowData, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::Unfiltered_Shadow_Translucency, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::Unfiltered_Diff, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::Unfiltered_Spec, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
 #if( NRD_MODE == SH )
-                {Texture::Unfiltered_DiffSh, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::Unfiltered_SpecSh, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::Unfiltered_DiffSh, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::Unfiltered_SpecSh, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
 #endif
-            };
-            nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
-            NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+        };
+        nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
+        NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
 
-            NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::TraceOpaque));
-            NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(DescriptorSet::TraceOpaque1), &kDummyDynamicConstantOffset);
+        NRI.CmdSetPipeline(commandBuffer, *GetTracePipeline(TracePass::Opaque, Pipeline::TraceOpaque, desc));
+        NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(DescriptorSet::TraceOpaque1), &kDummyDynamicConstantOffset);
 
-            uint32_t rectWmod = uint32_t(m_RenderResolution.x * m_Settings.resolutionScale + 0.5f);
-            uint32_t rectHmod = uint32_t(m_RenderResolution.y * m_Settings.resolutionScale + 0.5f);
-            uint32_t rectGridWmod = (rectWmod + 15) / 16;
-            uint32_t rectGridHmod = (rectHmod + 15) / 16;
+        uint32_t rectWmod = uint32_t(m_RenderResolution.x * desc.settings.resolutionScale + 0.5f);
+        uint32_t rectHmod = uint32_t(m_RenderResolution.y * desc.settings.resolutionScale + 0.5f);
+        uint32_t rectGridWmod = (rectWmod + 15) / 16;
+        uint32_t rectGridHmod = (rectHmod + 15) / 16;
 
-            NRI.CmdDispatch(commandBuffer, rectGridWmod, rectGridHmod, 1);
-            m_Profiler.EndTimestamp(context01, timesampID);
-        }
+        NRI.CmdDispatch(commandBuffer, rectGridWmod, rectGridHmod, 1);
+        m_Profiler.EndTimestamp(profilerContext, timesampID);
+    }
 
-    #if( NRD_MODE != OCCLUSION && NRD_MODE != DIRECTIONAL_OCCLUSION )
-        { // Shadow denoising
-            helper::Annotation annotation(NRI, commandBuffer, "Shadow denoising");
+#if( NRD_MODE != OCCLUSION && NRD_MODE != DIRECTIONAL_OCCLUSION )
+    { // Shadow denoising
+        helper::Annotation annotation(NRI, commandBuffer, "Shadow denoising");
 
-            nrd::SigmaSettings shadowSettings = {};
-            nrd::Identifier denoiser = NRD_ID(SIGMA_SHADOW_TRANSLUCENCY);
+        nrd::SigmaSettings shadowSettings = {};
+        nrd::Identifier denoiser = NRD_ID(SIGMA_SHADOW_TRANSLUCENCY);
 
-            m_NRD.SetDenoiserSettings(denoiser, &shadowSettings);
-            m_NRD.Denoise(&denoiser, 1, commandBuffer, userPool);
+        m_NRD.SetDenoiserSettings(denoiser, &shadowSettings);
+        m_NRD.Denoise(&denoiser, 1, commandBuffer, userPool);
 
-            //RestoreBindings(commandBuffer, frame); // Bindings will be restored in the next section
-        }
-    #endif
+        //RestoreBindings(commandBuffer, frame); // Bindings will be restored in the next section
+    }
+#endif
 
-        { // Opaque Denoising
-            helper::Annotation annotation(NRI, commandBuffer, "Opaque denoising");
+    { // Opaque Denoising
+        helper::Annotation annotation(NRI, commandBuffer, "Opaque denoising");
 
-            float radiusResolutionScale = 1.0f;
-            if (m_Settings.adaptRadiusToResolution)
-                radiusResolutionScale = float(m_Settings.resolutionScale * m_RenderResolution.y) / 1440.0f;
+        float radiusResolutionScale = 1.0f;
+        if (desc.settings.adaptRadiusToResolution)
+            radiusResolutionScale = float(desc.settings.resolutionScale * m_RenderResolution.y) / 1440.0f;
 
-            if (m_Settings.denoiser == DENOISER_REBLUR || m_Settings.denoiser == DENOISER_REFERENCE)
-            {
-                nrd::HitDistanceParameters hitDistanceParameters = {};
-                hitDistanceParameters.A = m_Settings.hitDistScale * m_Settings.meterToUnitsMultiplier;
-                m_ReblurSettings.hitDistanceParameters = hitDistanceParameters;
-
-                m_ReblurSettings.maxAccumulatedFrameNum = maxAccumulatedFrameNum;
-                m_ReblurSettings.maxFastAccumulatedFrameNum = maxFastAccumulatedFrameNum;
-                m_ReblurSettings.checkerboardMode = m_Settings.tracingMode == RESOLUTION_HALF ? nrd::CheckerboardMode::WHITE : nrd::CheckerboardMode::OFF;
-                m_ReblurSettings.enableMaterialTestForDiffuse = true;
-                m_ReblurSettings.enableMaterialTestForSpecular = false;
-
-                nrd::ReblurSettings settings = m_ReblurSettings;
-                settings.blurRadius *= radiusResolutionScale;
-                settings.diffusePrepassBlurRadius *= radiusResolutionScale;
-                settings.specularPrepassBlurRadius *= radiusResolutionScale;
-                settings.historyFixStrideBetweenSamples *= radiusResolutionScale;
-
-            #if( NRD_MODE == SH || NRD_MODE == DIRECTIONAL_OCCLUSION )
-                // High quality SG resolve allows to use more relaxed normal weights
-                if (m_Resolve)
-                    settings.lobeAngleFraction *= 1.333f;
-            #endif
+        if (desc.settings.denoiser == DENOISER_REBLUR || desc.settings.denoiser == DENOISER_REFERENCE)
+        {
+            nrd::ReblurSettings settings = desc.reblurSettings;
+            settings.blurRadius *= radiusResolutionScale;
+            settings.diffusePrepassBlurRadius *= radiusResolutionScale;
+            settings.specularPrepassBlurRadius *= radiusResolutionScale;
+            settings.historyFixStrideBetweenSamples *= radiusResolutionScale;
+
+        #if( NRD_MODE == SH || NRD_MODE == DIRECTIONAL_OCCLUSION )
+            // High quality SG resolve allows to use more relaxed normal weights
+            if (desc.resolve)
+                settings.lobeAngleFraction *= 1.333f;
+        #endif
 
 #if( NRD_MODE == OCCLUSION )
 #if( NRD_COMBINED == 1 )
-                const nrd::Identifier denoisers[] = {NRD_ID(REBLUR_DIFFUSE_SPECULAR_OCCLUSION)};
+            const nrd::Identifier denoisers[] = {NRD_ID(REBLUR_DIFFUSE_SPECULAR_OCCLUSION)};
 #else
-                const nrd::Identifier denoisers[] = {NRD_ID(REBLUR_DIFFUSE_OCCLUSION), NRD_ID(REBLUR_SPECULAR_OCCLUSION)};
+            const nrd::Identifier denoisers[] = {NRD_ID(REBLUR_DIFFUSE_OCCLUSION), NRD_ID(REBLUR_SPECULAR_OCCLUSION)};
 #endif
 #elif( NRD_MODE == SH )
 #if( NRD_COMBINED == 1 )
-                const nrd::Identifier denoisers[] = {NRD_ID(REBLUR_DIFFUSE_SPECULAR_SH)};
+            const nrd::Identifier denoisers[] = {NRD_ID(REBLUR_DIFFUSE_SPECULAR_SH)};
 #else
-                const nrd::Identifier denoisers[] = {NRD_ID(REBLUR_DIFFUSE_SH), NRD_ID(REBLUR_SPECULAR_SH)};
+            const nrd::Identifier denoisers[] = {NRD_ID(REBLUR_DIFFUSE_SH), NRD_ID(REBLUR_SPECULAR_SH)};
 #endif
 #elif( NRD_MODE == DIRECTIONAL_OCCLUSION )
-                const nrd::Identifier denoisers[] = {NRD_ID(REBLUR_DIFFUSE_DIRECTIONAL_OCCLUSION)};
+            const nrd::Identifier denoisers[] = {NRD_ID(REBLUR_DIFFUSE_DIRECTIONAL_OCCLUSION)};
 #else
 #if( NRD_COMBINED == 1 )
-                const nrd::Identifier denoisers[] = {NRD_ID(REBLUR_DIFFUSE_SPECULAR)};
+            const nrd::Identifier denoisers[] = {NRD_ID(REBLUR_DIFFUSE_SPECULAR)};
 #else
-                const nrd::Identifier denoisers[] = {NRD_ID(REBLUR_DIFFUSE), NRD_ID(REBLUR_SPECULAR)};
+            const nrd::Identifier denoisers[] = {NRD_ID(REBLUR_DIFFUSE), NRD_ID(REBLUR_SPECULAR)};
 #endif
 #endif
 
-                for (uint32_t i = 0; i < helper::GetCountOf(denoisers); i++)
-                    m_NRD.SetDenoiserSettings(denoisers[i], &settings);
+            for (uint32_t i = 0; i < helper::GetCountOf(denoisers); i++)
+                m_NRD.SetDenoiserSettings(denoisers[i], &settings);
 
-                m_NRD.Denoise(denoisers, helper::GetCountOf(denoisers), commandBuffer, userPool);
-            }
-            else if (m_Settings.denoiser == DENOISER_RELAX)
-            {
-                m_RelaxSettings.diffuseMaxAccumulatedFrameNum = maxAccumulatedFrameNum;
-                m_RelaxSettings.diffuseMaxFastAccumulatedFrameNum = maxFastAccumulatedFrameNum;
-                m_RelaxSettings.specularMaxAccumulatedFrameNum = maxAccumulatedFrameNum;
-                m_RelaxSettings.specularMaxFastAccumulatedFrameNum = maxFastAccumulatedFrameNum;
-                m_RelaxSettings.checkerboardMode = m_Settings.tracingMode == RESOLUTION_HALF ? nrd::CheckerboardMode::WHITE : nrd::CheckerboardMode::OFF;
-                m_RelaxSettings.enableMaterialTestForDiffuse = true;
-                m_RelaxSettings.enableMaterialTestForSpecular = false;
-
-                nrd::RelaxDiffuseSpecularSettings settings = m_RelaxSettings;
-                settings.diffusePrepassBlurRadius *= radiusResolutionScale;
-                settings.specularPrepassBlurRadius *= radiusResolutionScale;
-                settings.historyFixStrideBetweenSamples *= radiusResolutionScale;
+            m_NRD.Denoise(denoisers, helper::GetCountOf(denoisers), commandBuffer, userPool);
+        }
+        else if (desc.settings.denoiser == DENOISER_RELAX)
+        {
+            nrd::RelaxDiffuseSpecularSettings settings = desc.relaxSettings;
+            settings.diffusePrepassBlurRadius *= radiusResolutionScale;
+            settings.specularPrepassBlurRadius *= radiusResolutionScale;
+            settings.historyFixStrideBetweenSamples *= radiusResolutionScale;
 
 #if( NRD_COMBINED == 1 )
-                    #if( NRD_MODE == SH )
-                        const nrd::Identifier denoisers[] = {NRD_ID(RELAX_DIFFUSE_SPECULAR_SH)};
-                    #else
-                        const nrd::Identifier denoisers[] = {NRD_ID(RELAX_DIFFUSE_SPECULAR)};
-                    #endif
+                #if( NRD_MODE == SH )
+                    const nrd::Identifier denoisers[] = {NRD_ID(RELAX_DIFFUSE_SPECULAR_SH)};
+                #else
+                    const nrd::Identifier denoisers[] = {NRD_ID(RELAX_DIFFUSE_SPECULAR)};
+                #endif
 
-                    m_NRD.SetDenoiserSettings(denoisers[0], &settings);
+                m_NRD.SetDenoiserSettings(denoisers[0], &settings);
 #else
-                nrd::RelaxDiffuseSettings diffuseSettings = {};
-                diffuseSettings.antilagSettings = settings.antilagSettings;
-                diffuseSettings.prepassBlurRadius = settings.diffusePrepassBlurRadius;
-                diffuseSettings.diffuseMaxAccumulatedFrameNum = settings.diffuseMaxAccumulatedFrameNum;
-                diffuseSettings.diffuseMaxFastAccumulatedFrameNum = settings.diffuseMaxFastAccumulatedFrameNum;
-                diffuseSettings.diffusePhiLuminance = settings.diffusePhiLuminance;
-                diffuseSettings.diffuseLobeAngleFraction = settings.diffuseLobeAngleFraction;
-                diffuseSettings.historyFixEdgeStoppingNormalPower = settings.historyFixEdgeStoppingNormalPower;
-                diffuseSettings.historyFixStrideBetweenSamples = settings.historyFixStrideBetweenSamples;
-                diffuseSettings.historyFixFrameNum = settings.historyFixFrameNum;
-                diffuseSettings.historyClampingColorBoxSigmaScale = settings.historyClampingColorBoxSigmaScale;
-                diffuseSettings.spatialVarianceEstimationHistoryThreshold = settings.spatialVarianceEstimationHistoryThreshold;
-                diffuseSettings.atrousIterationNum = settings.atrousIterationNum;
-                diffuseSettings.minLuminanceWeight = settings.diffuseMinLuminanceWeight;
-                diffuseSettings.depthThreshold = settings.depthThreshold;
-                diffuseSettings.confidenceDrivenRelaxationMultiplier = settings.confidenceDrivenRelaxationMultiplier;
-                diffuseSettings.confidenceDrivenLuminanceEdgeStoppingRelaxation = settings.confidenceDrivenLuminanceEdgeStoppingRelaxation;
-                diffuseSettings.confidenceDrivenNormalEdgeStoppingRelaxation = settings.confidenceDrivenNormalEdgeStoppingRelaxation;
-                diffuseSettings.checkerboardMode = settings.checkerboardMode;
-                diffuseSettings.hitDistanceReconstructionMode = settings.hitDistanceReconstructionMode;
-                diffuseSettings.enableAntiFirefly = settings.enableAntiFirefly;
-                diffuseSettings.enableReprojectionTestSkippingWithoutMotion = settings.enableReprojectionTestSkippingWithoutMotion;
-                diffuseSettings.enableMaterialTest = settings.enableMaterialTestForDiffuse;
-
-                nrd::RelaxSpecularSettings specularSettings = {};
-                specularSettings.antilagSettings = specularSettings.antilagSettings;
-                specularSettings.prepassBlurRadius = settings.specularPrepassBlurRadius;
-                specularSettings.specularMaxAccumulatedFrameNum = settings.specularMaxAccumulatedFrameNum;
-                specularSettings.specularMaxFastAccumulatedFrameNum = settings.specularMaxFastAccumulatedFrameNum;
-                specularSettings.specularPhiLuminance = settings.specularPhiLuminance;
-                specularSettings.diffuseLobeAngleFraction = settings.diffuseLobeAngleFraction;
-                specularSettings.specularLobeAngleFraction = settings.specularLobeAngleFraction;
-                specularSettings.roughnessFraction = settings.roughnessFraction;
-                specularSettings.specularVarianceBoost = settings.specularVarianceBoost;
-                specularSettings.specularLobeAngleSlack = settings.specularLobeAngleSlack;
-                specularSettings.historyFixEdgeStoppingNormalPower = settings.historyFixEdgeStoppingNormalPower;
-                specularSettings.historyFixStrideBetweenSamples = settings.historyFixStrideBetweenSamples;
-                specularSettings.historyFixFrameNum = settings.historyFixFrameNum;
-                specularSettings.historyClampingColorBoxSigmaScale = settings.historyClampingColorBoxSigmaScale;
-                specularSettings.spatialVarianceEstimationHistoryThreshold = settings.spatialVarianceEstimationHistoryThreshold;
-                specularSettings.atrousIterationNum = settings.atrousIterationNum;
-                specularSettings.minLuminanceWeight = settings.specularMinLuminanceWeight;
-                specularSettings.depthThreshold = settings.depthThreshold;
-                specularSettings.confidenceDrivenRelaxationMultiplier = settings.confidenceDrivenRelaxationMultiplier;
-                specularSettings.confidenceDrivenLuminanceEdgeStoppingRelaxation = settings.confidenceDrivenLuminanceEdgeStoppingRelaxation;
-                specularSettings.confidenceDrivenNormalEdgeStoppingRelaxation = settings.confidenceDrivenNormalEdgeStoppingRelaxation;
-                specularSettings.luminanceEdgeStoppingRelaxation = settings.luminanceEdgeStoppingRelaxation;
-                specularSettings.normalEdgeStoppingRelaxation = settings.normalEdgeStoppingRelaxation;
-                specularSettings.roughnessEdgeStoppingRelaxation = settings.roughnessEdgeStoppingRelaxation;
-                specularSettings.checkerboardMode = m_Settings.tracingMode == RESOLUTION_HALF ? nrd::CheckerboardMode::BLACK : nrd::CheckerboardMode::OFF;
-                specularSettings.hitDistanceReconstructionMode = settings.hitDistanceReconstructionMode;
-                specularSettings.enableAntiFirefly = settings.enableAntiFirefly;
-                specularSettings.enableReprojectionTestSkippingWithoutMotion = settings.enableReprojectionTestSkippingWithoutMotion;
-                specularSettings.enableRoughnessEdgeStopping = settings.enableRoughnessEdgeStopping;
-                specularSettings.enableMaterialTest = settings.enableMaterialTestForSpecular;
+            nrd::RelaxDiffuseSettings diffuseSettings = {};
+            diffuseSettings.antilagSettings = settings.antilagSettings;
+            diffuseSettings.prepassBlurRadius = settings.diffusePrepassBlurRadius;
+            diffuseSettings.diffuseMaxAccumulatedFrameNum = settings.diffuseMaxAccumulatedFrameNum;
+            diffuseSettings.diffuseMaxFastAccumulatedFrameNum = settings.diffuseMaxFastAccumulatedFrameNum;
+            diffuseSettings.diffusePhiLuminance = settings.diffusePhiLuminance;
+            diffuseSettings.diffuseLobeAngleFraction = settings.diffuseLobeAngleFraction;
+            diffuseSettings.historyFixEdgeStoppingNormalPower = settings.historyFixEdgeStoppingNormalPower;
+            diffuseSettings.historyFixStrideBetweenSamples = settings.historyFixStrideBetweenSamples;
+            diffuseSettings.historyFixFrameNum = settings.historyFixFrameNum;
+            diffuseSettings.historyClampingColorBoxSigmaScale = settings.historyClampingColorBoxSigmaScale;
+            diffuseSettings.spatialVarianceEstimationHistoryThreshold = settings.spatialVarianceEstimationHistoryThreshold;
+            diffuseSettings.atrousIterationNum = settings.atrousIterationNum;
+            diffuseSettings.minLuminanceWeight = settings.diffuseMinLuminanceWeight;
+            diffuseSettings.depthThreshold = settings.depthThreshold;
+            diffuseSettings.confidenceDrivenRelaxationMultiplier = settings.confidenceDrivenRelaxationMultiplier;
+            diffuseSettings.confidenceDrivenLuminanceEdgeStoppingRelaxation = settings.confidenceDrivenLuminanceEdgeStoppingRelaxation;
+            diffuseSettings.confidenceDrivenNormalEdgeStoppingRelaxation = settings.confidenceDrivenNormalEdgeStoppingRelaxation;
+            diffuseSettings.checkerboardMode = settings.checkerboardMode;
+            diffuseSettings.hitDistanceReconstructionMode = settings.hitDistanceReconstructionMode;
+            diffuseSettings.enableAntiFirefly = settings.enableAntiFirefly;
+            diffuseSettings.enableReprojectionTestSkippingWithoutMotion = settings.enableReprojectionTestSkippingWithoutMotion;
+            diffuseSettings.enableMaterialTest = settings.enableMaterialTestForDiffuse;
+
+            nrd::RelaxSpecularSettings specularSettings = {};
+            specularSettings.antilagSettings = specularSettings.antilagSettings;
+            specularSettings.prepassBlurRadius = settings.specularPrepassBlurRadius;
+            specularSettings.specularMaxAccumulatedFrameNum = settings.specularMaxAccumulatedFrameNum;
+            specularSettings.specularMaxFastAccumulatedFrameNum = settings.specularMaxFastAccumulatedFrameNum;
+            specularSettings.specularPhiLuminance = settings.specularPhiLuminance;
+            specularSettings.diffuseLobeAngleFraction = settings.diffuseLobeAngleFraction;
+            specularSettings.specularLobeAngleFraction = settings.specularLobeAngleFraction;
+            specularSettings.roughnessFraction = settings.roughnessFraction;
+            specularSettings.specularVarianceBoost = settings.specularVarianceBoost;
+            specularSettings.specularLobeAngleSlack = settings.specularLobeAngleSlack;
+            specularSettings.historyFixEdgeStoppingNormalPower = settings.historyFixEdgeStoppingNormalPower;
+            specularSettings.historyFixStrideBetweenSamples = settings.historyFixStrideBetweenSamples;
+            specularSettings.historyFixFrameNum = settings.historyFixFrameNum;
+            specularSettings.historyClampingColorBoxSigmaScale = settings.historyClampingColorBoxSigmaScale;
+            specularSettings.spatialVarianceEstimationHistoryThreshold = settings.spatialVarianceEstimationHistoryThreshold;
+            specularSettings.atrousIterationNum = settings.atrousIterationNum;
+            specularSettings.minLuminanceWeight = settings.specularMinLuminanceWeight;
+            specularSettings.depthThreshold = settings.depthThreshold;
+            specularSettings.confidenceDrivenRelaxationMultiplier = settings.confidenceDrivenRelaxationMultiplier;
+            specularSettings.confidenceDrivenLuminanceEdgeStoppingRelaxation = settings.confidenceDrivenLuminanceEdgeStoppingRelaxation;
+            specularSettings.confidenceDrivenNormalEdgeStoppingRelaxation = settings.confidenceDrivenNormalEdgeStoppingRelaxation;
+            specularSettings.luminanceEdgeStoppingRelaxation = settings.luminanceEdgeStoppingRelaxation;
+            specularSettings.normalEdgeStoppingRelaxation = settings.normalEdgeStoppingRelaxation;
+            specularSettings.roughnessEdgeStoppingRelaxation = settings.roughnessEdgeStoppingRelaxation;
+            specularSettings.checkerboardMode = desc.settings.tracingMode == RESOLUTION_HALF ? nrd::CheckerboardMode::BLACK : nrd::CheckerboardMode::OFF;
+            specularSettings.hitDistanceReconstructionMode = settings.hitDistanceReconstructionMode;
+            specularSettings.enableAntiFirefly = settings.enableAntiFirefly;
+            specularSettings.enableReprojectionTestSkippingWithoutMotion = settings.enableReprojectionTestSkippingWithoutMotion;
+            specularSettings.enableRoughnessEdgeStopping = settings.enableRoughnessEdgeStopping;
+            specularSettings.enableMaterialTest = settings.enableMaterialTestForSpecular;
 
 #if( NRD_MODE == SH )
-                const nrd::Identifier denoisers[] = { NRD_ID(RELAX_DIFFUSE_SH), NRD_ID(RELAX_SPECULAR_SH) };
+            const nrd::Identifier denoisers[] = { NRD_ID(RELAX_DIFFUSE_SH), NRD_ID(RELAX_SPECULAR_SH) };
 #else
-                const nrd::Identifier denoisers[] = { NRD_ID(RELAX_DIFFUSE), NRD_ID(RELAX_SPECULAR) };
+            const nrd::Identifier denoisers[] = { NRD_ID(RELAX_DIFFUSE), NRD_ID(RELAX_SPECULAR) };
 #endif
 
-                    m_NRD.SetDenoiserSettings(denoisers[0], &diffuseSettings);
-                    m_NRD.SetDenoiserSettings(denoisers[1], &specularSettings);
-                #endif
-
-                m_NRD.Denoise(denoisers, helper::GetCountOf(denoisers), commandBuffer, userPool);
-            }
+                m_NRD.SetDenoiserSettings(denoisers[0], &diffuseSettings);
+                m_NRD.SetDenoiserSettings(denoisers[1], &specularSettings);
+            #endif
 
-            RestoreBindings(commandBuffer, frame);
+            m_NRD.Denoise(denoisers, helper::GetCountOf(denoisers), commandBuffer, userPool);
         }
 
-        { // Composition
-            helper::Annotation annotation(NRI, commandBuffer, "Composition");
+        RestoreBindings(commandBuffer, frame);
+    }
+
+    { // Composition
+        helper::Annotation annotation(NRI, commandBuffer, "Composition");
+
+        const TextureState transitions[] =
+        {
+            // Input
+            {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::Normal_Roughness, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::BaseColor_Metalness, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::DirectLighting, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::DirectEmission, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::PsrThroughput, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::Ambient, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::Shadow, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::Diff, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::Spec, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+        #if( NRD_MODE == SH )
+            {Texture::DiffSh, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::SpecSh, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+        #endif
+            // Output
+            {Texture::ComposedDiff, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::ComposedSpec_ViewZ, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+        };
+        nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
+        NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+
+        NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::Composition));
+        NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(DescriptorSet::Composition1), &kDummyDynamicConstantOffset);
+
+        NRI.CmdDispatch(commandBuffer, rectGridW, rectGridH, 1);
+    }
+
+    { // Trace transparent
+        helper::Annotation annotation(NRI, commandBuffer, "Trace transparent");
+        static uint32_t eventID = m_Profiler.AllocateEvent("Trace transparent");
+        uint32_t timesampID = m_Profiler.BeginTimestamp(profilerContext, eventID);
+
+        const TextureState transitions[] =
+        {
+            // Input
+            {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::ComposedDiff, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::ComposedSpec_ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            // Output
+            {Texture::Composed_ViewZ, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::Mv, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+        };
+        nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
+        NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+
+        NRI.CmdSetPipeline(commandBuffer, *GetTracePipeline(TracePass::Transparent, Pipeline::TraceTransparent, desc));
+        NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(DescriptorSet::TraceTransparent1), &kDummyDynamicConstantOffset);
+
+        NRI.CmdDispatch(commandBuffer, rectGridW, rectGridH, 1);
+        m_Profiler.EndTimestamp(profilerContext, timesampID);
+    }
+
+    if (desc.settings.denoiser == DENOISER_REFERENCE)
+    { // Reference
+        helper::Annotation annotation(NRI, commandBuffer, "Reference denoising");
+
+        commonSettings.resolutionScale[0] = 1.0f;
+        commonSettings.resolutionScale[1] = 1.0f;
+        commonSettings.splitScreen = desc.settings.separator;
+
+        nrd::Identifier denoiser = NRD_ID(REFERENCE);
+
+        m_NRD.SetCommonSettings(commonSettings);
+        m_NRD.SetDenoiserSettings(denoiser, &desc.referenceSettings);
+        m_NRD.Denoise(&denoiser, 1, commandBuffer, userPool);
+
+        RestoreBindings(commandBuffer, frame);
+    }
+
+    if (desc.settings.DLSS)
+    {
+        { // Pre
+            helper::Annotation annotation(NRI, commandBuffer, "Pre Dlss");
 
             const TextureState transitions[] =
             {
                 // Input
-                {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::Normal_Roughness, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::BaseColor_Metalness, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::DirectLighting, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::DirectEmission, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::PsrThroughput, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::Ambient, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::Shadow, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::Diff, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::Spec, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-            #if( NRD_MODE == SH )
-                {Texture::DiffSh, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::SpecSh, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-            #endif
+                {Texture::Mv, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Composed_ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
                 // Output
-                {Texture::ComposedDiff, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::ComposedSpec_ViewZ, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+                {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+                {Texture::Unfiltered_ShadowData, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+                {Texture::DlssInput, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
             };
             nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
             NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
 
-            NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::Composition));
-            NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(DescriptorSet::Composition1), &kDummyDynamicConstantOffset);
+            NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::PreDlss));
+            NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(DescriptorSet::PreDlss1), &kDummyDynamicConstantOffset);
 
             NRI.CmdDispatch(commandBuffer, rectGridW, rectGridH, 1);
         }
 
-        { // Trace transparent
-            helper::Annotation annotation(NRI, commandBuffer, "Trace transparent");
-            static uint32_t eventID = m_Profiler.AllocateEvent("Trace transparent");
-            uint32_t timesampID = m_Profiler.BeginTimestamp(context01, eventID);
+        { // DLSS
+            helper::Annotation annotation(NRI, commandBuffer, "Dlss");
 
             const TextureState transitions[] =
             {
                 // Input
                 {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::ComposedDiff, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::ComposedSpec_ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Unfiltered_ShadowData, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::DlssInput, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
                 // Output
-                {Texture::Composed_ViewZ, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::Mv, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+                {Texture::DlssOutput, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
             };
             nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
             NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
 
-            NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::TraceTransparent));
-            NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(DescriptorSet::TraceTransparent1), &kDummyDynamicConstantOffset);
-
-            NRI.CmdDispatch(commandBuffer, rectGridW, rectGridH, 1);
-            m_Profiler.EndTimestamp(context01, timesampID);
-        }
-
-        if (m_Settings.denoiser == DENOISER_REFERENCE)
-        { // Reference
-            helper::Annotation annotation(NRI, commandBuffer, "Reference denoising");
-
-            commonSettings.resolutionScale[0] = 1.0f;
-            commonSettings.resolutionScale[1] = 1.0f;
-            commonSettings.splitScreen = m_Settings.separator;
-
-            nrd::Identifier denoiser = NRD_ID(REFERENCE);
-
-            m_NRD.SetCommonSettings(commonSettings);
-            m_NRD.SetDenoiserSettings(denoiser, &m_ReferenceSettings);
-            m_NRD.Denoise(&denoiser, 1, commandBuffer, userPool);
-
-            RestoreBindings(commandBuffer, frame);
+            DlssDispatchDesc dlssDesc = {};
+            dlssDesc.texOutput = { Get(Texture::DlssOutput), Get(Descriptor::DlssOutput_StorageTexture), GetFormat(Texture::DlssOutput), {GetOutputResolution().x, GetOutputResolution().y} };
+            dlssDesc.texInput = { Get(Texture::DlssInput), Get(Descriptor::DlssInput_Texture), GetFormat(Texture::DlssInput), {m_RenderResolution.x, m_RenderResolution.y} };
+            dlssDesc.texMv = { Get(Texture::Unfiltered_ShadowData), Get(Descriptor::Unfiltered_ShadowData_Texture), GetFormat(Texture::Unfiltered_ShadowData), {m_RenderResolution.x, m_RenderResolution.y} };
+            dlssDesc.texDepth = { Get(Texture::ViewZ), Get(Descriptor::ViewZ_Texture), GetFormat(Texture::ViewZ), {m_RenderResolution.x, m_RenderResolution.y} };
+            dlssDesc.sharpness = desc.settings.sharpness;
+            dlssDesc.currentRenderResolution = { rectW, rectH };
+            dlssDesc.motionVectorScale[0] = 1.0f;
+            dlssDesc.motionVectorScale[1] = 1.0f;
+            dlssDesc.jitter[0] = -desc.viewportJitter.x;
+            dlssDesc.jitter[1] = -desc.viewportJitter.y;
+            dlssDesc.reset = desc.forceHistoryReset;
+
+            m_DLSS.Evaluate(&commandBuffer, dlssDesc);
+
+            RestoreBindings(commandBuffer, frame); // TODO: is it needed?
         }
 
-        if (m_Settings.DLSS)
-        {
-            { // Pre
-                helper::Annotation annotation(NRI, commandBuffer, "Pre Dlss");
+        { // After
+            helper::Annotation annotation(NRI, commandBuffer, "After Dlss");
 
-                const TextureState transitions[] =
-                {
-                    // Input
-                    {Texture::Mv, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    {Texture::Composed_ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    // Output
-                    {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                    {Texture::Unfiltered_ShadowData, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                    {Texture::DlssInput, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                };
-                nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
-                NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
-
-                NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::PreDlss));
-                NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(DescriptorSet::PreDlss1), &kDummyDynamicConstantOffset);
-
-                NRI.CmdDispatch(commandBuffer, rectGridW, rectGridH, 1);
-            }
-
-            { // DLSS
-                helper::Annotation annotation(NRI, commandBuffer, "Dlss");
-
-                const TextureState transitions[] =
-                {
-                    // Input
-                    {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    {Texture::Unfiltered_ShadowData, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    {Texture::DlssInput, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    // Output
-                    {Texture::DlssOutput, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                };
-                nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
-                NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
-
-                DlssDispatchDesc dlssDesc = {};
-                dlssDesc.texOutput = { Get(Texture::DlssOutput), Get(Descriptor::DlssOutput_StorageTexture), GetFormat(Texture::DlssOutput), {GetOutputResolution().x, GetOutputResolution().y} };
-                dlssDesc.texInput = { Get(Texture::DlssInput), Get(Descriptor::DlssInput_Texture), GetFormat(Texture::DlssInput), {m_RenderResolution.x, m_RenderResolution.y} };
-                dlssDesc.texMv = { Get(Texture::Unfiltered_ShadowData), Get(Descriptor::Unfiltered_ShadowData_Texture), GetFormat(Texture::Unfiltered_ShadowData), {m_RenderResolution.x, m_RenderResolution.y} };
-                dlssDesc.texDepth = { Get(Texture::ViewZ), Get(Descriptor::ViewZ_Texture), GetFormat(Texture::ViewZ), {m_RenderResolution.x, m_RenderResolution.y} };
-                dlssDesc.sharpness = m_Settings.sharpness;
-                dlssDesc.currentRenderResolution = { rectW, rectH };
-                dlssDesc.motionVectorScale[0] = 1.0f;
-                dlssDesc.motionVectorScale[1] = 1.0f;
-                dlssDesc.jitter[0] = -m_Camera.state.viewportJitter.x;
-                dlssDesc.jitter[1] = -m_Camera.state.viewportJitter.y;
-                dlssDesc.reset = m_ForceHistoryReset;
-
-                m_DLSS.Evaluate(&commandBuffer, dlssDesc);
-
-                RestoreBindings(commandBuffer, frame); // TODO: is it needed?
-            }
-
-            { // After
-                helper::Annotation annotation(NRI, commandBuffer, "After Dlss");
-
-                const TextureState transitions[] =
-                {
-                    // Input
-                    {Texture::DlssOutput, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    {Texture::Validation, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    // Output
-                    {Texture::Final, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                };
-                nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
-                NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+            const TextureState transitions[] =
+            {
+                // Input
+                {Texture::DlssOutput, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Validation, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                // Output
+                {Texture::Final, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            };
+            nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
+            NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
 
-                NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::AfterDlss));
-                NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(DescriptorSet::AfterDlss1), &kDummyDynamicConstantOffset);
+            NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::AfterDlss));
+            NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(DescriptorSet::AfterDlss1), &kDummyDynamicConstantOffset);
 
-                NRI.CmdDispatch(commandBuffer, windowGridW, windowGridH, 1);
-            }
+            NRI.CmdDispatch(commandBuffer, windowGridW, windowGridH, 1);
         }
-        else
-        {
-            const Texture taaSrc = isEven ? Texture::TaaHistoryPrev : Texture::TaaHistory;
-            const Texture taaDst = isEven ? Texture::TaaHistory : Texture::TaaHistoryPrev;
-
-            { // Temporal
-                helper::Annotation annotation(NRI, commandBuffer, "Temporal");
-
-                const TextureState transitions[] =
-                {
-                    // Input
-                    {Texture::Mv, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    {Texture::Composed_ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    {taaSrc, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    // Output
-                    {taaDst, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                };
-                nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
-                NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
-
-                NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::Temporal));
-                NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(isEven ? DescriptorSet::Temporal1a : DescriptorSet::Temporal1b), &kDummyDynamicConstantOffset);
-
-                NRI.CmdDispatch(commandBuffer, rectGridW, rectGridH, 1);
-            }
-
-            { // Upsample, copy and split screen
-                helper::Annotation annotation(NRI, commandBuffer, "Upsample");
+    }
+    else
+    {
+        const Texture taaSrc = isEven ? Texture::TaaHistoryPrev : Texture::TaaHistory;
+        const Texture taaDst = isEven ? Texture::TaaHistory : Texture::TaaHistoryPrev;
 
-                const TextureState transitions[] =
-                {
-                    // Input
-                    {taaDst, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    {Texture::Validation, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    // Output
-                    {Texture::Final, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                };
-                nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
-                NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+        { // Temporal
+            helper::Annotation annotation(NRI, commandBuffer, "Temporal");
 
-                bool isValidation = m_DebugNRD && m_ShowValidationOverlay;
-                bool isNis = m_Settings.NIS && m_Settings.separator == 0.0f && !isValidation;
-                if (isNis)
-                {
-                    NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::UpsampleNis));
-                    NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(isEven ? DescriptorSet::UpsampleNis1a : DescriptorSet::UpsampleNis1b), &kDummyDynamicConstantOffset);
+            const TextureState transitions[] =
+            {
+                // Input
+                {Texture::Mv, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Composed_ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {taaSrc, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                // Output
+                {taaDst, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            };
+            nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
+            NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
 
-                    // See NIS_Config.h
-                    windowGridW = (GetWindowResolution().x + 31) / 32;
-                    windowGridH = (GetWindowResolution().y + 31) / 32;
-                }
-                else
-                {
-                    NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::Upsample));
-                    NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(isEven ? DescriptorSet::Upsample1a : DescriptorSet::Upsample1b), &kDummyDynamicConstantOffset);
-                }
+            NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::Temporal));
+            NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(isEven ? DescriptorSet::Temporal1a : DescriptorSet::Temporal1b), &kDummyDynamicConstantOffset);
 
-                NRI.CmdDispatch(commandBuffer, windowGridW, windowGridH, 1);
-            }
+            NRI.CmdDispatch(commandBuffer, rectGridW, rectGridH, 1);
         }
 
-        const uint32_t backBufferIndex = NRI.AcquireNextSwapChainTexture(*m_SwapChain);
-        const BackBuffer* backBuffer = &m_SwapChainBuffers[backBufferIndex];
+        { // Upsample, copy and split screen
+            helper::Annotation annotation(NRI, commandBuffer, "Upsample");
 
-        { // Copy to back-buffer
-            const nri::TextureTransitionBarrierDesc transitions[] =
+            const TextureState transitions[] =
             {
-                nri::TextureTransitionFromState(GetState(Texture::Final), nri::AccessBits::COPY_SOURCE, nri::TextureLayout::GENERAL),
-                nri::TextureTransition(backBuffer->texture, nri::AccessBits::UNKNOWN, nri::AccessBits::COPY_DESTINATION, nri::TextureLayout::UNKNOWN, nri::TextureLayout::GENERAL),
+                // Input
+                {taaDst, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Validation, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                // Output
+                {Texture::Final, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
             };
-            nri::TransitionBarrierDesc transitionBarriers = {nullptr, transitions, 0, helper::GetCountOf(transitions)};
+            nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
             NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
 
-            NRI.CmdCopyTexture(commandBuffer, *backBuffer->texture, 0, nullptr, *Get(Texture::Final), 0, nullptr);
-        }
-
-        { // UI
-            const nri::TextureTransitionBarrierDesc beforeTransitions = nri::TextureTransition(backBuffer->texture, nri::AccessBits::COPY_DESTINATION, nri::AccessBits::COLOR_ATTACHMENT, nri::TextureLayout::GENERAL, nri::TextureLayout::COLOR_ATTACHMENT);
-            nri::TransitionBarrierDesc transitionBarriers = {nullptr, &beforeTransitions, 0, 1};
-            NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+            bool isValidation = desc.showValidation;
+            bool isNis = desc.settings.NIS && desc.settings.separator == 0.0f && !isValidation;
+            if (isNis)
+            {
+                NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::UpsampleNis));
+                NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(isEven ? DescriptorSet::UpsampleNis1a : DescriptorSet::UpsampleNis1b), &kDummyDynamicConstantOffset);
 
-            NRI.CmdBeginRenderPass(commandBuffer, *backBuffer->frameBufferUI, nri::RenderPassBeginFlag::SKIP_FRAME_BUFFER_CLEAR);
-            RenderUserInterface(*m_Device, commandBuffer);
-            NRI.CmdEndRenderPass(commandBuffer);
+                // See NIS_Config.h
+                windowGridW = (GetWindowResolution().x + 31) / 32;
+                windowGridH = (GetWindowResolution().y + 31) / 32;
+            }
+            else
+            {
+                NRI.CmdSetPipeline(commandBuffer, *Get(Pipeline::Upsample));
+                NRI.CmdSetDescriptorSet(commandBuffer, 1, *Get(isEven ? DescriptorSet::Upsample1a : DescriptorSet::Upsample1b), &kDummyDynamicConstantOffset);
+            }
 
-            const nri::TextureTransitionBarrierDesc afterTransitions = nri::TextureTransition(backBuffer->texture, nri::AccessBits::COLOR_ATTACHMENT, nri::AccessBits::UNKNOWN, nri::TextureLayout::COLOR_ATTACHMENT, nri::TextureLayout::PRESENT);
-            transitionBarriers = {nullptr, &afterTransitions, 0, 1};
-            NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+            NRI.CmdDispatch(commandBuffer, windowGridW, windowGridH, 1);
         }
     }
-    m_Profiler.EndFrame(&commandBuffer);
-    NRI.EndCommandBuffer(commandBuffer);
 
-    nri::QueueSubmitDesc queueSubmitDesc = {};
-    queueSubmitDesc.commandBuffers = &frame.commandBuffer;
-    queueSubmitDesc.commandBufferNum = 1;
-    NRI.QueueSubmit(*m_CommandQueue, queueSubmitDesc);
+    { // Hand over to "Present", which doesn't use tracked texture states
+        const TextureState transitions[] =
+        {
+            {Texture::Final, nri::AccessBits::COPY_SOURCE, nri::TextureLayout::GENERAL},
+        };
+        nri::TransitionBarrierDesc transitionBarriers = {nullptr, optimizedTransitions.data(), 0, BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions)};
+        NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+    }
+}
 
-    NRI.SwapChainPresent(*m_SwapChain);
+void Sample::RecordPresent(nri::CommandBuffer& commandBuffer)
+{
+    const uint32_t backBufferIndex = NRI.AcquireNextSwapChainTexture(*m_SwapChain);
+    const BackBuffer* backBuffer = &m_SwapChainBuffers[backBufferIndex];
 
-    NRI.QueueSignal(*m_CommandQueue, *m_FrameFence, 1 + frameIndex);
+    { // Copy to back-buffer
+        // "Final" is already a copy source, see "RecordTracingAndPost"
+        const nri::TextureTransitionBarrierDesc transition = nri::TextureTransition(backBuffer->texture, nri::AccessBits::UNKNOWN, nri::AccessBits::COPY_DESTINATION, nri::TextureLayout::UNKNOWN, nri::TextureLayout::GENERAL);
+        nri::TransitionBarrierDesc transitionBarriers = {nullptr, &transition, 0, 1};
+        NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
 
-    // Cap FPS if requested
-    float msLimit = m_Settings.limitFps ? 1000.0f / m_Settings.maxFps : 0.0f;
-    double lastFrameTimeStamp = m_Timer.GetLastFrameTimeStamp();
+        NRI.CmdCopyTexture(commandBuffer, *backBuffer->texture, 0, nullptr, *Get(Texture::Final), 0, nullptr);
+    }
 
-    while (m_Timer.GetTimeStamp() - lastFrameTimeStamp < msLimit)
-        ;
+    { // UI
+        const nri::TextureTransitionBarrierDesc beforeTransitions = nri::TextureTransition(backBuffer->texture, nri::AccessBits::COPY_DESTINATION, nri::AccessBits::COLOR_ATTACHMENT, nri::TextureLayout::GENERAL, nri::TextureLayout::COLOR_ATTACHMENT);
+        nri::TransitionBarrierDesc transitionBarriers = {nullptr, &beforeTransitions, 0, 1};
+        NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+
+        NRI.CmdBeginRenderPass(commandBuffer, *backBuffer->frameBufferUI, nri::RenderPassBeginFlag::SKIP_FRAME_BUFFER_CLEAR);
+        RenderUserInterface(*m_Device, commandBuffer);
+        NRI.CmdEndRenderPass(commandBuffer);
+
+        const nri::TextureTransitionBarrierDesc afterTransitions = nri::TextureTransition(backBuffer->texture, nri::AccessBits::COLOR_ATTACHMENT, nri::AccessBits::UNKNOWN, nri::TextureLayout::COLOR_ATTACHMENT, nri::TextureLayout::PRESENT);
+        transitionBarriers = {nullptr, &afterTransitions, 0, 1};
+        NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+    }
 }
\ No newline at end of file
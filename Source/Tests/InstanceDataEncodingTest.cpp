@@ -0,0 +1,166 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+// InstanceDataEncoding.hpp against the documented contract: FP16 round trips within "GetHalfErrorBound", out of range values clamped
+// to +/-65504, denormals as multiples of 2^-24, and transform records bit cast into the 12 dwords of an instance record
+
+#include "MathLib/MathLib.h"
+#include "../Shaders/Include/Shared.hlsli"
+#include "InstanceDataEncoding.hpp"
+#include "TestCommon.h"
+
+static float RoundTrip(float value)
+{
+    return HalfToFloat(FloatToHalf(value));
+}
+
+static bool IsWithinErrorBound(float value)
+{
+    return fabsf(RoundTrip(value) - value) <= GetHalfErrorBound(value);
+}
+
+static bool TestRoundTrip()
+{ // every exponent of the FP16 range, both signs, mantissas off the FP16 grid
+    uint32_t seed = 1;
+    for (int32_t exponent = -24; exponent <= 15; ++exponent)
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            float mantissa = 1.0f + float(seed >> 8) / 16777216.0f;
+            float value = ldexpf(mantissa, exponent);
+            CHECK(IsWithinErrorBound(value));
+            CHECK(IsWithinErrorBound(-value));
+        }
+    }
+
+    // Exact values stay exact
+    const float exactValues[] = { 0.0f, 1.0f, -1.0f, 0.5f, 2048.0f, 0.099975586f, 65504.0f, -65504.0f };
+    for (float value : exactValues)
+        CHECK(RoundTrip(value) == value);
+
+    // Round to nearest even: 2049 is halfway between 2048 and 2050
+    CHECK(RoundTrip(2049.0f) == 2048.0f);
+    CHECK(RoundTrip(2051.0f) == 2052.0f);
+    return true;
+}
+
+static bool TestClamping()
+{
+    CHECK(FloatToHalf(65504.0f) == 0x7BFF);
+    CHECK(RoundTrip(65519.0f) == 65504.0f); // below the rounding midpoint
+    CHECK(RoundTrip(65520.0f) == 65504.0f); // would round to infinity
+    CHECK(RoundTrip(1e10f) == 65504.0f);
+    CHECK(RoundTrip(-1e10f) == -65504.0f);
+    CHECK(RoundTrip(INFINITY) == 65504.0f);
+    CHECK(RoundTrip(-INFINITY) == -65504.0f);
+    CHECK(fabsf(RoundTrip(NAN)) == 65504.0f);
+
+    CHECK(GetHalfErrorBound(1e6f) == 1e6f - 65504.0f);
+    CHECK(IsWithinErrorBound(1e6f));
+    CHECK(IsWithinErrorBound(-70000.0f));
+    return true;
+}
+
+static bool TestDenormals()
+{
+    const float denormalStep = ldexpf(1.0f, -24);
+    CHECK(FloatToHalf(denormalStep) == 0x0001);
+    CHECK(FloatToHalf(-denormalStep) == 0x8001);
+    CHECK(FloatToHalf(1023.0f * denormalStep) == 0x03FF); // largest denormal
+    CHECK(FloatToHalf(FP16_MIN_NORMAL) == 0x0400);
+    CHECK(HalfToFloat(0x03FF) == 1023.0f * denormalStep);
+    CHECK(HalfToFloat(0x0400) == FP16_MIN_NORMAL);
+
+    // Halfway cases round to even, anything below half a step flushes to zero
+    CHECK(FloatToHalf(0.5f * denormalStep) == 0x0000);
+    CHECK(FloatToHalf(1.5f * denormalStep) == 0x0002);
+    CHECK(FloatToHalf(0.25f * denormalStep) == 0x0000);
+    CHECK(RoundTrip(-0.25f * denormalStep) == 0.0f);
+
+    for (uint32_t i = 0; i < 4096; ++i)
+    {
+        float value = float(i) * 0.37f * denormalStep;
+        CHECK(IsWithinErrorBound(value));
+    }
+    return true;
+}
+
+static bool TestInstanceRecords()
+{
+    InstanceDataDesc desc = {};
+    const float rotation[3][3] = { { 0.36f, 0.48f, -0.8f }, { -0.8f, 0.6f, 0.0f }, { 0.48f, 0.64f, 0.6f } };
+    memcpy(desc.rotation, rotation, sizeof(rotation));
+    const float baseColorAndMetalnessScale[4] = { 0.9f, 0.1f, 0.333f, 1.0f };
+    const float emissionAndRoughnessScale[4] = { 100.0f, 0.0f, 70000.0f, 0.5f };
+    memcpy(desc.baseColorAndMetalnessScale, baseColorAndMetalnessScale, sizeof(baseColorAndMetalnessScale));
+    memcpy(desc.emissionAndRoughnessScale, emissionAndRoughnessScale, sizeof(emissionAndRoughnessScale));
+    desc.invScale = 0.25f;
+    desc.textureOffsetAndFlags = 0xABCDEF12;
+    desc.primitiveOffset = 123456;
+    desc.morphedPrimitiveOffset = 7;
+    desc.isStatic = true;
+
+    InstanceData instanceData = {};
+    InstanceDataDesc decoded = {};
+    EncodeInstanceData(desc, instanceData);
+    DecodeInstanceData(instanceData, true, decoded);
+    for (uint32_t i = 0; i < 9; ++i)
+        CHECK(fabsf(decoded.rotation[i / 3][i % 3] - rotation[i / 3][i % 3]) <= GetHalfErrorBound(rotation[i / 3][i % 3]));
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        CHECK(fabsf(decoded.baseColorAndMetalnessScale[i] - baseColorAndMetalnessScale[i]) <= GetHalfErrorBound(baseColorAndMetalnessScale[i]));
+        CHECK(fabsf(decoded.emissionAndRoughnessScale[i] - emissionAndRoughnessScale[i]) <= GetHalfErrorBound(emissionAndRoughnessScale[i]));
+    }
+    CHECK(decoded.emissionAndRoughnessScale[2] == 65504.0f);
+    CHECK(decoded.invScale == 0.25f);
+    CHECK(decoded.textureOffsetAndFlags == desc.textureOffsetAndFlags);
+    CHECK(decoded.primitiveOffset == desc.primitiveOffset);
+    CHECK(decoded.morphedPrimitiveOffset == desc.morphedPrimitiveOffset);
+    CHECK(decoded.isStatic);
+
+    // Same packing as the shaders: "lo | hi << 16"
+    CHECK((instanceData.materialScales.x & 0xFFFF) == FloatToHalf(0.9f));
+    CHECK((instanceData.materialScales.x >> 16) == FloatToHalf(0.1f));
+    CHECK((instanceData.rotation22AndInvScale & 0xFFFF) == FloatToHalf(0.6f));
+
+    // Dynamic: the transform record index replaces the rotation
+    desc.isStatic = false;
+    desc.transformIndex = 4242;
+    EncodeInstanceData(desc, instanceData);
+    DecodeInstanceData(instanceData, false, decoded);
+    CHECK(decoded.transformIndex == 4242);
+    CHECK(instanceData.rotation.y == 0 && instanceData.rotation.z == 0 && instanceData.rotation.w == 0);
+    CHECK(decoded.rotation[0][0] == 0.0f && decoded.rotation[2][2] == 0.0f);
+    CHECK(!decoded.isStatic);
+
+    // Transform records: rows are bit cast, no precision loss
+    const float rows[3][4] = { { 1.0f, 2.0f, 3.0f, 4.0f }, { -5.5f, 1e-30f, 1e30f, 65505.0f }, { 0.1f, 0.2f, 0.3f, -0.0f } };
+    float4 row[3];
+    for (uint32_t i = 0; i < 3; ++i)
+        memcpy(&row[i], rows[i], sizeof(rows[i]));
+
+    InstanceData transform = {};
+    EncodeInstanceTransform(row[0], row[1], row[2], transform);
+    CHECK(memcmp(&transform, rows, sizeof(rows)) == 0);
+    return true;
+}
+
+int main()
+{
+    bool result = TestRoundTrip();
+    result = result && TestClamping();
+    result = result && TestDenormals();
+    result = result && TestInstanceRecords();
+
+    if (!result)
+        printf("[FAIL]: instance data encoding test failed\n");
+    return result ? 0 : 1;
+}
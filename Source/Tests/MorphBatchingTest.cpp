@@ -0,0 +1,135 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+// MorphBatching.hpp as used by "RecordAccelerationStructureUpdates": batches cover every mesh once, are full up to
+// "MORPH_BATCH_MAX_MESHES_NUM" meshes except the last one, and every thread group of a batch maps back to its mesh
+// with exactly the groups the mesh needs, meshes without vertices included
+
+#include "MathLib/MathLib.h"
+#include "../Shaders/Include/Shared.hlsli"
+#include "MorphBatching.hpp"
+#include "TestCommon.h"
+#include <vector>
+
+static std::vector<uint32_t> CreateItemNums(uint32_t meshNum, uint32_t seed)
+{ // group size boundaries first, then pseudo random sizes
+    static const uint32_t boundaries[] = { 0, 1, MORPH_GROUP_SIZE - 1, MORPH_GROUP_SIZE, MORPH_GROUP_SIZE + 1, 0, 5 * MORPH_GROUP_SIZE };
+    const uint32_t boundaryNum = sizeof(boundaries) / sizeof(boundaries[0]);
+    std::vector<uint32_t> itemNums(meshNum);
+    for (uint32_t i = 0; i < meshNum; ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        itemNums[i] = i < boundaryNum ? boundaries[(i + seed) % boundaryNum] : (seed >> 16) % (4 * MORPH_GROUP_SIZE);
+    }
+    return itemNums;
+}
+
+static bool CheckBatch(const std::vector<uint32_t>& itemNums, uint32_t batchBegin, uint32_t batchEnd)
+{
+    MorphMeshUpdateVerticesConstants constants = {};
+    constants.gVerticesMeshNum = batchEnd - batchBegin;
+
+    uint32_t groupNum = 0;
+    for (uint32_t j = batchBegin; j < batchEnd; j++)
+    {
+        constants.gVerticesWork[j - batchBegin].vertexNum = itemNums[j];
+        AddMorphBatchMesh(constants.gVerticesFirstGroup, j - batchBegin, itemNums[j], groupNum);
+    }
+
+    // Every group belongs to one mesh, its threads cover the vertices of that mesh once
+    std::vector<uint32_t> groupNums(constants.gVerticesMeshNum, 0);
+    std::vector<uint32_t> vertexNums(constants.gVerticesMeshNum, 0);
+    for (uint32_t groupIndex = 0; groupIndex < groupNum; groupIndex++)
+    {
+        const uint32_t meshIndex = FindMorphBatchMesh(constants.gVerticesFirstGroup, constants.gVerticesMeshNum, groupIndex);
+        CHECK(meshIndex < constants.gVerticesMeshNum);
+
+        const uint32_t firstGroup = constants.gVerticesFirstGroup[meshIndex / 4].pv[meshIndex % 4];
+        CHECK(firstGroup <= groupIndex);
+        CHECK(groupIndex - firstGroup == groupNums[meshIndex]); // groups of a mesh are consecutive
+        groupNums[meshIndex]++;
+
+        for (uint32_t threadIndex = 0; threadIndex < MORPH_GROUP_SIZE; threadIndex++)
+        {
+            const uint32_t vertexIndex = (groupIndex - firstGroup) * MORPH_GROUP_SIZE + threadIndex;
+            if (vertexIndex < constants.gVerticesWork[meshIndex].vertexNum)
+                vertexNums[meshIndex]++;
+        }
+    }
+
+    for (uint32_t i = 0; i < constants.gVerticesMeshNum; i++)
+    {
+        CHECK(groupNums[i] == GetMorphGroupNum(itemNums[batchBegin + i]));
+        CHECK(vertexNums[i] == itemNums[batchBegin + i]);
+    }
+
+    return true;
+}
+
+static bool TestBatches(uint32_t batchMeshNum)
+{
+    const uint32_t meshNums[] = { 1, 2, MORPH_BATCH_MAX_MESHES_NUM - 1, MORPH_BATCH_MAX_MESHES_NUM, MORPH_BATCH_MAX_MESHES_NUM + 1,
+        2 * MORPH_BATCH_MAX_MESHES_NUM, 2 * MORPH_BATCH_MAX_MESHES_NUM + 7, 5 * MORPH_BATCH_MAX_MESHES_NUM - 3 };
+
+    for (uint32_t meshNum : meshNums)
+    {
+        const std::vector<uint32_t> itemNums = CreateItemNums(meshNum, meshNum);
+
+        // The loop of "RecordAccelerationStructureUpdates"
+        uint32_t batchNum = 0;
+        uint32_t coveredNum = 0;
+        for (uint32_t batchBegin = 0; batchBegin < meshNum; batchBegin += batchMeshNum)
+        {
+            const uint32_t batchEnd = GetMorphBatchEnd(batchBegin, batchMeshNum, meshNum);
+            CHECK(batchBegin == coveredNum);
+            CHECK(batchEnd > batchBegin && batchEnd - batchBegin <= MORPH_BATCH_MAX_MESHES_NUM);
+
+            // Only the last batch is partial
+            const bool isLast = batchBegin + batchMeshNum >= meshNum;
+            CHECK(batchEnd - batchBegin == (isLast ? meshNum - batchBegin : batchMeshNum));
+
+            CHECK(CheckBatch(itemNums, batchBegin, batchEnd));
+            coveredNum = batchEnd;
+            batchNum++;
+        }
+
+        CHECK(coveredNum == meshNum);
+        CHECK(batchNum == (meshNum + batchMeshNum - 1) / batchMeshNum);
+    }
+
+    return true;
+}
+
+static bool TestEmptyMeshes()
+{ // meshes without groups start where the next mesh starts, groups must skip them
+    const std::vector<uint32_t> itemNums = { 0, 0, MORPH_GROUP_SIZE, 0, 1, 0 };
+    CHECK(CheckBatch(itemNums, 0, (uint32_t)itemNums.size()));
+
+    uint4 firstGroups[MORPH_BATCH_ROWS_NUM] = {};
+    uint32_t groupNum = 0;
+    for (uint32_t i = 0; i < (uint32_t)itemNums.size(); i++)
+        AddMorphBatchMesh(firstGroups, i, itemNums[i], groupNum);
+    CHECK(groupNum == 2);
+    CHECK(FindMorphBatchMesh(firstGroups, (uint32_t)itemNums.size(), 0) == 2);
+    CHECK(FindMorphBatchMesh(firstGroups, (uint32_t)itemNums.size(), 1) == 4);
+
+    return true;
+}
+
+int main()
+{
+    bool result = TestBatches(MORPH_BATCH_MAX_MESHES_NUM);
+    result = result && TestBatches(1); // per mesh update
+    result = result && TestEmptyMeshes();
+
+    if (!result)
+        printf("[FAIL]: morph batching test failed\n");
+    return result ? 0 : 1;
+}
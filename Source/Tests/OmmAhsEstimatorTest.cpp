@@ -0,0 +1,147 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+// OmmAhsEstimator on a single triangle with hand written OMM data: rays aimed at each micro-triangle of a level 1 OMM must be classified
+// by the state stored at its bird curve index (0: next to v0, 1: center, 2: next to v1, 3: next to v2)
+
+#include "VisibilityMasks/OmmAhsEstimator.h"
+#include "VisibilityMasks/OmmMicroTriangle.h"
+#include "omm.h"
+#include "TestCommon.h"
+
+using namespace ommhelper;
+
+static const float g_SunDirection[3] = { 0.0f, 0.0f, 1.0f }; // nothing above the triangle, shadow rays never hit
+
+static std::vector<OmmAhsRay> CreateRays()
+{ // straight down at [v0 corner, center, v1 corner, v2 corner] of the triangle (0,0) (1,0) (0,1)
+    static const float targets[][2] = { { 0.1f, 0.1f }, { 0.3f, 0.3f }, { 0.8f, 0.1f }, { 0.1f, 0.8f } };
+    std::vector<OmmAhsRay> rays;
+    for (const auto& target : targets)
+    {
+        OmmAhsRay ray = { { target[0], target[1], 5.0f }, { 0.0f, 0.0f, -1.0f } };
+        rays.push_back(ray);
+    }
+    return rays;
+}
+
+static void SetOmmData(OmmAhsEstimator& estimator, const std::vector<uint8_t>& arrayData, const std::vector<ommCpuOpacityMicromapDesc>& descs, int32_t index)
+{
+    OmmAhsOmmData data = {};
+    data.arrayData = arrayData.data();
+    data.arrayDataSize = arrayData.size();
+    data.descArray = (const uint8_t*)descs.data();
+    data.descArraySize = descs.size() * sizeof(ommCpuOpacityMicromapDesc);
+    data.indices = (const uint8_t*)&index;
+    data.indexDataSize = sizeof(index);
+    data.indexStride = sizeof(int32_t);
+    estimator.ClearOmmData();
+    estimator.SetOmmData(0, data);
+}
+
+static bool CheckStats(const OmmAhsRayStats& stats, uint64_t opaqueNum, uint64_t transparentNum, uint64_t anyHitNum)
+{
+    CHECK(stats.rayNum == 4);
+    CHECK(stats.candidateNum == 4);
+    CHECK(stats.resolvedOpaqueNum == opaqueNum);
+    CHECK(stats.resolvedTransparentNum == transparentNum);
+    CHECK(stats.anyHitNum == anyHitNum);
+    return true;
+}
+
+static bool TestBirdCurve()
+{ // level 1 micro-triangles by discrete barycentrics (u, v, w)
+    CHECK(DBary2Index(0, 0, 1, 1) == 0);
+    CHECK(DBary2Index(0, 0, 0, 1) == 1);
+    CHECK(DBary2Index(1, 0, 0, 1) == 2);
+    CHECK(DBary2Index(0, 1, 0, 1) == 3);
+
+    // Every micro-triangle of a level gets its own index
+    for (uint32_t level = 1; level <= 6; ++level)
+    {
+        const uint32_t stepNum = 1u << level;
+        std::vector<uint32_t> counts(stepNum * stepNum, 0);
+        for (uint32_t u = 0; u < stepNum; ++u)
+        {
+            for (uint32_t v = 0; u + v < stepNum; ++v)
+            {
+                counts[DBary2Index(u, v, stepNum - 1 - u - v, level)]++;
+                if (u + v + 1 < stepNum)
+                    counts[DBary2Index(u, v, stepNum - 2 - u - v, level)]++;
+            }
+        }
+        for (uint32_t count : counts)
+            CHECK(count == 1);
+    }
+
+    const uint8_t indices8[] = { 5, 0xFC, 0xFF };
+    CHECK(ReadOmmIndex(indices8, 1, 0) == 5 && ReadOmmIndex(indices8, 1, 1) == -4 && ReadOmmIndex(indices8, 1, 2) == -1);
+    const uint16_t indices16[] = { 0xFFFB, 0xFFFE };
+    CHECK(ReadOmmIndex((const uint8_t*)indices16, 2, 0) == 0xFFFB && ReadOmmIndex((const uint8_t*)indices16, 2, 1) == -2);
+
+    return true;
+}
+
+static bool TestEstimator()
+{
+    const float positions[] = { 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f };
+    const uint32_t indices[] = { 0, 1, 2 };
+    OmmAhsEstimator estimator;
+    estimator.AddTriangles(positions, indices, 1, 0);
+    estimator.Build();
+    CHECK(estimator.IsBuilt());
+
+    const std::vector<OmmAhsRay> rays = CreateRays();
+    for (uint32_t threadNum = 1; threadNum <= 4; threadNum += 3)
+    {
+        // No OMM data: every hit goes to any-hit and is committed
+        estimator.ClearOmmData();
+        OmmAhsStats stats = estimator.Trace(rays.data(), rays.size(), g_SunDirection, threadNum);
+        CHECK(CheckStats(stats.primary, 0, 0, 4));
+        CHECK(stats.shadow.candidateNum == 0);
+
+        // Special indices
+        SetOmmData(estimator, {}, {}, ommSpecialIndex_FullyOpaque);
+        stats = estimator.Trace(rays.data(), rays.size(), g_SunDirection, threadNum);
+        CHECK(CheckStats(stats.primary, 4, 0, 0));
+
+        SetOmmData(estimator, {}, {}, ommSpecialIndex_FullyTransparent);
+        stats = estimator.Trace(rays.data(), rays.size(), g_SunDirection, threadNum);
+        CHECK(CheckStats(stats.primary, 0, 4, 0));
+
+        // OC1_2: [opaque, transparent, opaque, transparent]
+        ommCpuOpacityMicromapDesc desc = {};
+        desc.offset = 0;
+        desc.subdivisionLevel = 1;
+        desc.format = ommFormat_OC1_2_State;
+        SetOmmData(estimator, { 0x05 }, { desc }, 0);
+        stats = estimator.Trace(rays.data(), rays.size(), g_SunDirection, threadNum);
+        CHECK(CheckStats(stats.primary, 2, 2, 0));
+
+        // OC1_4 after a 1 byte OMM: [opaque, unknown opaque, transparent, unknown transparent]
+        desc.offset = 1;
+        desc.format = ommFormat_OC1_4_State;
+        SetOmmData(estimator, { 0x00, uint8_t(ommOpacityState_Opaque | (ommOpacityState_UnknownOpaque << 2) | (ommOpacityState_Transparent << 4) | (ommOpacityState_UnknownTransparent << 6)) }, { desc }, 0);
+        stats = estimator.Trace(rays.data(), rays.size(), g_SunDirection, threadNum);
+        CHECK(CheckStats(stats.primary, 1, 1, 2));
+    }
+
+    return true;
+}
+
+int main()
+{
+    bool result = TestBirdCurve();
+    result = result && TestEstimator();
+
+    if (!result)
+        printf("[FAIL]: OMM AHS estimator test failed\n");
+    return result ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+// Cutoffs thresholded from OmmAlphaBounds must agree with the CPU baker run directly at the same cutoff. Bounds footprints are conservative,
+// so every micro-triangle the bounds classify as opaque or transparent must be baked to the same state; unknown ones may be anything.
+// The CPU baker needs an initialized context, so the test is skipped when no device can be created
+
+#include "OmmTestCommon.h"
+#include "VisibilityMasks/OmmAlphaBounds.h"
+
+using namespace ommhelper;
+
+#define TEST_SUBDIVISION_LEVEL 4
+
+static uint8_t GetState(const TriangleStates& triangle, uint32_t microTriangle)
+{ // special indices -1..-4 map to states 0..3
+    return triangle.specialIndex < 0 ? uint8_t(-triangle.specialIndex - 1) : triangle.states[microTriangle];
+}
+
+static bool TestAlphaBounds(nri::Device* device)
+{
+    std::vector<TestGeometry> geometries;
+    geometries.reserve(4); // descs point into the geometry's own vectors
+    for (uint32_t i = 0; i < 4; ++i)
+        geometries.emplace_back(3 + i, 23 + 11 * i, 0.5f, true);
+
+    OmmBakeDesc bakeDesc;
+    bakeDesc.type = OmmBakerType::CPU;
+    bakeDesc.subdivisionLevel = TEST_SUBDIVISION_LEVEL;
+    bakeDesc.dynamicSubdivisionScale = 0.0f; // same level everywhere, micro-triangles line up one to one
+    bakeDesc.format = OmmFormats::OC1_4_STATE;
+
+    OpacityMicroMapsHelper context;
+    context.Initialize(device, true);
+
+    const float alphaCutoffs[] = { 0.0f, 0.2f, 0.5f, 0.73f, 1.0f };
+    for (uint32_t filter = 0; filter < (uint32_t)OmmBakeFilter::Count; ++filter)
+    {
+        bakeDesc.filter = OmmBakeFilter(filter);
+
+        std::vector<OmmAlphaBounds> bounds(geometries.size());
+        for (size_t i = 0; i < geometries.size(); ++i)
+            AlphaBoundsBaker::Bake(geometries[i].desc, bakeDesc, bounds[i], 0);
+
+        for (float alphaCutoff : alphaCutoffs)
+        {
+            bakeDesc.alphaCutoff = alphaCutoff;
+            uint64_t knownNum = 0;
+            for (size_t i = 0; i < geometries.size(); ++i)
+            {
+                TestGeometry& geometry = geometries[i];
+                const size_t triangleNum = geometry.indices.size() / 3;
+                CHECK(bounds[i].levels.size() == triangleNum);
+
+                geometry.desc.alphaCutoff = alphaCutoff;
+                for (std::vector<uint8_t>& output : geometry.desc.outData)
+                    output.clear();
+                OmmBakeGeometryDesc* queue = &geometry.desc;
+                context.BakeOpacityMicroMapsCpu(&queue, 1, bakeDesc);
+                CHECK(!geometry.desc.outData[(uint32_t)OmmDataLayout::Indices].empty());
+                std::vector<TriangleStates> reference = DecodeTriangleStates(geometry.desc, triangleNum);
+
+                AlphaBoundsBaker::Threshold(bounds[i], alphaCutoff, bakeDesc, geometry.desc, 0);
+                CHECK(!geometry.desc.outData[(uint32_t)OmmDataLayout::Indices].empty());
+                std::vector<TriangleStates> thresholded = DecodeTriangleStates(geometry.desc, triangleNum);
+
+                for (size_t j = 0; j < triangleNum; ++j)
+                {
+                    CHECK(bounds[i].levels[j] == TEST_SUBDIVISION_LEVEL);
+                    for (uint32_t k = 0; k < (1u << (2 * TEST_SUBDIVISION_LEVEL)); ++k)
+                    {
+                        const uint8_t state = GetState(thresholded[j], k);
+                        if (state != ommOpacityState_Opaque && state != ommOpacityState_Transparent)
+                            continue;
+                        CHECK(GetState(reference[j], k) == state);
+                        ++knownNum;
+                    }
+                }
+            }
+            CHECK(knownNum != 0); // not a vacuous pass: the discs leave most of each fan known
+        }
+    }
+
+    context.Destroy();
+    return true;
+}
+
+int main()
+{
+    nri::Device* device = CreateTestDevice();
+    if (!device)
+        return TEST_SKIPPED;
+
+    bool result = TestAlphaBounds(device);
+    nri::nriDestroyDevice(*device);
+
+    if (!result)
+        printf("[FAIL]: OMM alpha bounds test failed\n");
+    return result ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+// OmmArrayCache bookkeeping against a stub serialization backend, no device needed: entries are found only under the state and
+// identity they were written with, the driver check is applied before use, identity 0 or a disabled cache neither read nor write
+
+#include "OmmTestCommon.h"
+
+using namespace ommhelper;
+
+#define TEST_CACHE_FILENAME "OmmArrayCacheTest.ommarrays"
+
+struct StubBackend : public OmmArrayCache::Backend
+{ // blobs start with the identity they were serialized with, like driver headers do
+    uint64_t identity = 0;
+    uint32_t checkNum = 0;
+
+    uint64_t GetOmmArraySerializationIdentity() override { return identity; };
+    bool IsSerializedOmmArrayCompatible(const void* data, size_t size) override
+    {
+        checkNum++;
+        return size >= sizeof(uint64_t) && *(const uint64_t*)data == identity;
+    };
+
+    std::vector<uint8_t> Serialize(uint32_t seed) const
+    {
+        std::vector<uint8_t> blob(sizeof(uint64_t) + 64 + seed);
+        *(uint64_t*)blob.data() = identity;
+        for (size_t i = sizeof(uint64_t); i < blob.size(); ++i)
+            blob[i] = uint8_t(i * 31 + seed);
+        return blob;
+    }
+};
+
+static long GetFileSize(const char* filename)
+{
+    FILE* file = fopen(filename, "rb");
+    if (!file)
+        return -1;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+static bool TestDisabled()
+{
+    StubBackend backend;
+    OmmArrayCache cache;
+    std::vector<uint8_t> blob;
+
+    // No serialization support
+    backend.identity = 0;
+    cache.Begin(TEST_CACHE_FILENAME, 1, &backend, true);
+    CHECK(!cache.IsEnabled());
+    cache.Save(1, backend.Serialize(1));
+    CHECK(GetFileSize(TEST_CACHE_FILENAME) == -1);
+
+    // Caching turned off, or no backend at all
+    backend.identity = 0xA;
+    cache.Begin(TEST_CACHE_FILENAME, 1, &backend, false);
+    CHECK(!cache.IsEnabled());
+    cache.Begin(TEST_CACHE_FILENAME, 1, nullptr, true);
+    CHECK(!cache.IsEnabled());
+    cache.Save(1, backend.Serialize(1));
+    CHECK(GetFileSize(TEST_CACHE_FILENAME) == -1);
+    CHECK(!cache.Read(1, blob));
+    CHECK(blob.empty());
+    CHECK(cache.GetReadNum() == 0 && cache.GetMissNum() == 1);
+    CHECK(backend.checkNum == 0);
+
+    return true;
+}
+
+static bool TestReadWrite()
+{
+    StubBackend backend;
+    backend.identity = 0xA;
+    OmmArrayCache cache;
+    std::vector<uint8_t> blob;
+
+    cache.Begin(TEST_CACHE_FILENAME, 1, &backend, true);
+    CHECK(cache.IsEnabled());
+    CHECK(!cache.Read(10, blob));
+    CHECK(!cache.Read(11, blob));
+    cache.Save(10, backend.Serialize(10));
+    cache.Save(11, backend.Serialize(11));
+    cache.Save(12, {}); // nothing serialized
+    CHECK(cache.GetReadNum() == 0 && cache.GetMissNum() == 2);
+
+    // Warm start
+    cache.Begin(TEST_CACHE_FILENAME, 1, &backend, true);
+    CHECK(cache.GetReadNum() == 0 && cache.GetMissNum() == 0);
+    CHECK(cache.Read(10, blob));
+    CHECK(blob == backend.Serialize(10));
+    CHECK(cache.Read(11, blob));
+    CHECK(blob == backend.Serialize(11));
+    CHECK(!cache.Read(12, blob));
+    CHECK(cache.GetReadNum() == 2 && cache.GetMissNum() == 1);
+
+    // Entries are written once
+    const long fileSize = GetFileSize(TEST_CACHE_FILENAME);
+    cache.Save(10, backend.Serialize(10));
+    CHECK(GetFileSize(TEST_CACHE_FILENAME) == fileSize);
+
+    // Another bake state
+    cache.Begin(TEST_CACHE_FILENAME, 2, &backend, true);
+    CHECK(!cache.Read(10, blob));
+    CHECK(blob.empty());
+
+    return true;
+}
+
+static bool TestIdentity()
+{
+    StubBackend backend;
+    OmmArrayCache cache;
+    std::vector<uint8_t> blob;
+
+    // Another device or driver: different key, its own entries live next to the old ones
+    backend.identity = 0xB;
+    cache.Begin(TEST_CACHE_FILENAME, 1, &backend, true);
+    const uint32_t checkNum = backend.checkNum;
+    CHECK(!cache.Read(10, blob));
+    CHECK(backend.checkNum == checkNum); // not even looked at
+    cache.Save(10, backend.Serialize(10));
+    CHECK(cache.Read(10, blob));
+    CHECK(blob == backend.Serialize(10));
+
+    backend.identity = 0xA;
+    cache.Begin(TEST_CACHE_FILENAME, 1, &backend, true);
+    CHECK(cache.Read(10, blob));
+    CHECK(blob == backend.Serialize(10));
+
+    // Same identity, but the driver refuses the blob: it is built, and the stale entry is not duplicated
+    cache.Begin(TEST_CACHE_FILENAME, 3, &backend, true);
+    std::vector<uint8_t> staleBlob = backend.Serialize(20);
+    staleBlob[0] ^= 0xFF;
+    cache.Save(20, staleBlob);
+    CHECK(!cache.Read(20, blob));
+    CHECK(blob.empty());
+    CHECK(cache.GetReadNum() == 0 && cache.GetMissNum() == 1);
+
+    const long fileSize = GetFileSize(TEST_CACHE_FILENAME);
+    cache.Save(20, backend.Serialize(20));
+    CHECK(GetFileSize(TEST_CACHE_FILENAME) == fileSize);
+
+    return true;
+}
+
+int main()
+{
+    remove(TEST_CACHE_FILENAME);
+
+    bool result = TestDisabled();
+    result = result && TestReadWrite();
+    result = result && TestIdentity();
+
+    remove(TEST_CACHE_FILENAME);
+
+    if (!result)
+        printf("[FAIL]: OMM array cache test failed\n");
+    return result ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+// Bake server round trip and shutdown. Runs against the real CPU baker, no GPU needed
+
+#include "BakeServer/OmmBakeServer.h"
+#include "TestCommon.h"
+#include <string.h>
+#include <future>
+#include <chrono>
+#include <filesystem>
+
+using namespace ommhelper;
+
+#define TEST_SOCKET "omm_bake_server_test.sock"
+#define TEST_CACHE "_OmmCache/ServerTest"
+#define TEST_TIMEOUT_S 30
+
+struct TestGeometry
+{ // a quad over a texture with an opaque left half
+    uint32_t indices[6] = { 0, 1, 2, 0, 2, 3 };
+    float texCoords[8] = { 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f };
+    float texels[8 * 8] = {};
+    OmmBakeRequestHeader header = {};
+
+    TestGeometry(float alphaCutoff)
+    {
+        for (uint32_t i = 0; i < 8 * 8; ++i)
+            texels[i] = (i % 8) < 4 ? 1.0f : 0.0f;
+
+        header.magic = OMM_BAKE_PROTOCOL_MAGIC;
+        header.version = OMM_BAKE_PROTOCOL_VERSION;
+        header.alphaMode = ommAlphaMode_Test;
+        header.format = ommFormat_OC1_4_State;
+        header.filter = ommTextureFilterMode_Linear;
+        header.addressingMode = ommTextureAddressMode_Clamp;
+        header.maxSubdivisionLevel = 4;
+        header.alphaCutoff = alphaCutoff;
+        header.dynamicSubdivisionScale = 0.0f;
+        header.indexFormat = ommIndexFormat_I32_UINT;
+        header.indexCount = 6;
+        header.texCoordFormat = ommTexCoordFormat_UV32_FLOAT;
+        header.textureFormat = ommCpuTextureFormat_FP32;
+        header.mipNum = 1;
+        header.mipWidth[0] = 8;
+        header.mipHeight[0] = 8;
+        header.indexDataSize = sizeof(indices);
+        header.texCoordDataSize = sizeof(texCoords);
+        header.mipDataSize[0] = sizeof(texels);
+    }
+
+    uint64_t GetHash() const
+    {
+        const void* mips[OMM_BAKE_PROTOCOL_MAX_MIP_NUM] = { texels };
+        return CalculateBakeRequestHash(header, indices, texCoords, mips);
+    }
+
+    bool Send(OmmBakeSocket socket) const
+    {
+        const void* mips[OMM_BAKE_PROTOCOL_MAX_MIP_NUM] = { texels };
+        return SendBakeRequest(socket, header, indices, texCoords, mips);
+    }
+};
+
+static bool WaitForRun(std::future<void>& run)
+{
+    return run.wait_for(std::chrono::seconds(TEST_TIMEOUT_S)) == std::future_status::ready;
+}
+
+static bool TestRoundTrip()
+{
+    OmmBakeServer server;
+    CHECK(server.Start(TEST_SOCKET, TEST_CACHE, 2));
+    std::future<void> run = std::async(std::launch::async, [&]() { server.Run(); });
+
+    OmmBakeSocket socket = OmmBakeSocketApi::Connect(TEST_SOCKET);
+    CHECK(socket != OMM_BAKE_INVALID_SOCKET);
+
+    // the second request is deduplicated or read from the cache, the third one is different
+    TestGeometry geometries[] = { TestGeometry(0.5f), TestGeometry(0.5f), TestGeometry(0.25f) };
+    for (const TestGeometry& geometry : geometries)
+        CHECK(geometry.Send(socket));
+
+    std::vector<uint8_t> outputs[3][OMM_BAKE_PROTOCOL_OUTPUT_NUM];
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+        OmmBakeResponseHeader response = {};
+        CHECK(RecvBakeResponse(socket, response, outputs[i]));
+        CHECK(response.magic == OMM_BAKE_PROTOCOL_MAGIC);
+        CHECK(response.requestHash == geometries[i].GetHash());
+        CHECK(response.result == ommResult_SUCCESS);
+        CHECK(!outputs[i][0].empty());
+    }
+    for (uint32_t i = 0; i < OMM_BAKE_PROTOCOL_OUTPUT_NUM; ++i)
+        CHECK(outputs[0][i] == outputs[1][i]);
+    OmmBakeSocketApi::Close(socket);
+
+    server.RequestStop();
+    CHECK(WaitForRun(run));
+    server.Stop();
+
+    CHECK(OmmBakeSocketApi::Connect(TEST_SOCKET) == OMM_BAKE_INVALID_SOCKET);
+    return true;
+}
+
+static bool TestMalformedRequests()
+{ // sizes that don't cover the data drop the connection, a broken cache record is baked again
+    OmmBakeServer server;
+    CHECK(server.Start(TEST_SOCKET, TEST_CACHE, 1));
+    std::future<void> run = std::async(std::launch::async, [&]() { server.Run(); });
+
+    TestGeometry malformedGeometries[] = { TestGeometry(0.5f), TestGeometry(0.5f), TestGeometry(0.5f) };
+    malformedGeometries[0].header.indexCount = 600;
+    malformedGeometries[1].header.mipWidth[0] = 1024;
+    malformedGeometries[2].indices[5] = 1000;
+    for (const TestGeometry& geometry : malformedGeometries)
+    {
+        OmmBakeSocket socket = OmmBakeSocketApi::Connect(TEST_SOCKET);
+        CHECK(socket != OMM_BAKE_INVALID_SOCKET);
+        CHECK(geometry.Send(socket));
+
+        OmmBakeResponseHeader response = {};
+        std::vector<uint8_t> outputs[OMM_BAKE_PROTOCOL_OUTPUT_NUM];
+        CHECK(!RecvBakeResponse(socket, response, outputs));
+        OmmBakeSocketApi::Close(socket);
+    }
+
+    TestGeometry geometry(0.75f);
+    {
+        char filename[64];
+        snprintf(filename, sizeof(filename), TEST_CACHE "/%016llx.ommbake", (unsigned long long)geometry.GetHash());
+        FILE* file = fopen(filename, "wb");
+        CHECK(file);
+
+        OmmBakeResponseHeader record = {};
+        record.magic = OMM_BAKE_PROTOCOL_MAGIC;
+        record.requestHash = geometry.GetHash();
+        record.sizes[0] = 1ull << 40;
+        fwrite(&record, sizeof(record), 1, file);
+        fclose(file);
+    }
+
+    OmmBakeSocket socket = OmmBakeSocketApi::Connect(TEST_SOCKET);
+    CHECK(socket != OMM_BAKE_INVALID_SOCKET);
+    CHECK(geometry.Send(socket));
+
+    OmmBakeResponseHeader response = {};
+    std::vector<uint8_t> outputs[OMM_BAKE_PROTOCOL_OUTPUT_NUM];
+    CHECK(RecvBakeResponse(socket, response, outputs));
+    CHECK(response.result == ommResult_SUCCESS);
+    CHECK(!response.isFromCache);
+    CHECK(!outputs[0].empty());
+    OmmBakeSocketApi::Close(socket);
+
+    server.RequestStop();
+    CHECK(WaitForRun(run));
+    server.Stop();
+    return true;
+}
+
+static bool TestStopWithQueuedJobs()
+{ // one worker and a long queue: stopping must not wait for the queue or leave the client hanging
+    OmmBakeServer server;
+    CHECK(server.Start(TEST_SOCKET, TEST_CACHE, 1));
+    std::future<void> run = std::async(std::launch::async, [&]() { server.Run(); });
+
+    OmmBakeSocket socket = OmmBakeSocketApi::Connect(TEST_SOCKET);
+    CHECK(socket != OMM_BAKE_INVALID_SOCKET);
+
+    const uint32_t requestNum = 64;
+    std::vector<TestGeometry> geometries;
+    for (uint32_t i = 0; i < requestNum; ++i)
+        geometries.emplace_back(0.1f + 0.8f * float(i) / requestNum);
+    for (const TestGeometry& geometry : geometries)
+        CHECK(geometry.Send(socket));
+
+    server.RequestStop();
+    CHECK(WaitForRun(run));
+    std::future<void> stop = std::async(std::launch::async, [&]() { server.Stop(); });
+    CHECK(WaitForRun(stop));
+
+    // Every request read by the server is answered in order, the connection is closed after that
+    uint32_t responseNum = 0;
+    uint32_t failedNum = 0;
+    while (true)
+    {
+        OmmBakeResponseHeader response = {};
+        std::vector<uint8_t> outputs[OMM_BAKE_PROTOCOL_OUTPUT_NUM];
+        if (!RecvBakeResponse(socket, response, outputs))
+            break;
+
+        CHECK(responseNum < requestNum);
+        CHECK(response.requestHash == geometries[responseNum].GetHash());
+        failedNum += response.result != ommResult_SUCCESS ? 1 : 0;
+        ++responseNum;
+    }
+    OmmBakeSocketApi::Close(socket);
+
+    printf("Stopped with %u responses, %u failed\n", responseNum, failedNum);
+    return true;
+}
+
+int main()
+{
+    std::error_code errorCode;
+    std::filesystem::remove_all(TEST_CACHE, errorCode);
+
+    uint32_t failedNum = 0;
+    failedNum += TestRoundTrip() ? 0 : 1;
+    failedNum += TestMalformedRequests() ? 0 : 1;
+    failedNum += TestStopWithQueuedJobs() ? 0 : 1;
+
+    std::filesystem::remove_all(TEST_CACHE, errorCode);
+
+    if (failedNum)
+        printf("[FAIL]: %u bake server tests failed\n", failedNum);
+    return failedNum ? 1 : 0;
+}
@@ -0,0 +1,107 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+// Two bake contexts used from two threads at once, one created with "shareFrom", must bake exactly what a context used alone bakes.
+// The shared GPU baker resources must outlive the context they were created by. Skipped when no device can be created
+
+#include "OmmTestCommon.h"
+
+using namespace ommhelper;
+
+#define TEST_ITERATION_NUM 4
+
+typedef std::vector<std::vector<uint8_t>> BakeResult;
+
+static std::vector<TestGeometry> CreateGeometries(uint32_t seed)
+{
+    std::vector<TestGeometry> geometries;
+    geometries.reserve(8); // descs point into the geometry's own vectors
+    for (uint32_t i = 0; i < 8; ++i)
+        geometries.emplace_back(seed + i, 16 + 8 * i, 0.25f + 0.05f * float(i));
+    return geometries;
+}
+
+static BakeResult Bake(OpacityMicroMapsHelper& context, std::vector<TestGeometry>& geometries, const OmmBakeDesc& bakeDesc)
+{
+    std::vector<OmmBakeGeometryDesc*> queue;
+    for (TestGeometry& geometry : geometries)
+    {
+        for (std::vector<uint8_t>& output : geometry.desc.outData)
+            output.clear();
+        queue.push_back(&geometry.desc);
+    }
+    context.BakeOpacityMicroMapsCpu(queue.data(), queue.size(), bakeDesc);
+
+    BakeResult result;
+    for (const TestGeometry& geometry : geometries)
+        for (uint32_t i = 0; i < (uint32_t)OmmDataLayout::CpuMaxNum; ++i)
+            result.push_back(geometry.desc.outData[i]);
+    return result;
+}
+
+static bool TestIsolation(nri::Device* device)
+{
+    OmmBakeDesc bakeDescs[2];
+    bakeDescs[0].type = OmmBakerType::CPU;
+    bakeDescs[0].subdivisionLevel = 6;
+    bakeDescs[1].type = OmmBakerType::CPU;
+    bakeDescs[1].subdivisionLevel = 4;
+    bakeDescs[1].format = OmmFormats::OC1_2_STATE;
+    bakeDescs[1].filter = OmmBakeFilter::Nearest;
+    bakeDescs[1].cpuFlags.enableSpecialIndices = false;
+
+    std::vector<TestGeometry> geometries[2] = { CreateGeometries(1), CreateGeometries(100) };
+
+    BakeResult references[2];
+    {
+        OpacityMicroMapsHelper context;
+        context.Initialize(device, true);
+        for (uint32_t i = 0; i < 2; ++i)
+            references[i] = Bake(context, geometries[i], bakeDescs[i]);
+        context.Destroy();
+    }
+    CHECK(!references[0].empty() && !references[0][0].empty());
+
+    OpacityMicroMapsHelper contexts[2];
+    contexts[0].Initialize(device, true);
+    contexts[1].Initialize(device, true, &contexts[0]);
+
+    for (uint32_t iteration = 0; iteration < TEST_ITERATION_NUM; ++iteration)
+    {
+        BakeResult results[2];
+        std::thread worker([&]() { results[1] = Bake(contexts[1], geometries[1], bakeDescs[1]); });
+        results[0] = Bake(contexts[0], geometries[0], bakeDescs[0]);
+        worker.join();
+
+        CHECK(results[0] == references[0]);
+        CHECK(results[1] == references[1]);
+    }
+
+    // The context sharing its resources goes first, the other one must keep working
+    contexts[0].Destroy();
+    CHECK(Bake(contexts[1], geometries[1], bakeDescs[1]) == references[1]);
+    contexts[1].Destroy();
+
+    return true;
+}
+
+int main()
+{
+    nri::Device* device = CreateTestDevice();
+    if (!device)
+        return TEST_SKIPPED;
+
+    bool result = TestIsolation(device);
+    nri::nriDestroyDevice(*device);
+
+    if (!result)
+        printf("[FAIL]: OMM context isolation test failed\n");
+    return result ? 0 : 1;
+}
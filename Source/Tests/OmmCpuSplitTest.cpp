@@ -0,0 +1,88 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+// Geometries baked as triangle-range chunks (CpuBakerFlags::splitWorkLog2) must decode to the same per-triangle states as
+// geometries baked whole. Chunks may deduplicate differently, so decoded states are compared, not raw outputs. Skipped when no device can be created
+
+#include "OmmTestCommon.h"
+
+using namespace ommhelper;
+
+#define TEST_SPLIT_WORK_LOG2 10 // 4 triangles per chunk at subdivision level 4
+
+static bool Bake(OpacityMicroMapsHelper& context, std::vector<TestGeometry>& geometries, const OmmBakeDesc& bakeDesc, std::vector<std::vector<TriangleStates>>& result)
+{
+    std::vector<OmmBakeGeometryDesc*> queue;
+    for (TestGeometry& geometry : geometries)
+    {
+        for (std::vector<uint8_t>& output : geometry.desc.outData)
+            output.clear();
+        queue.push_back(&geometry.desc);
+    }
+    context.BakeOpacityMicroMapsCpu(queue.data(), queue.size(), bakeDesc);
+
+    result.clear();
+    for (const TestGeometry& geometry : geometries)
+    {
+        CHECK(!geometry.desc.outData[(uint32_t)OmmDataLayout::Indices].empty());
+        result.push_back(DecodeTriangleStates(geometry.desc, geometry.indices.size() / 3));
+    }
+    return true;
+}
+
+static bool TestSplit(nri::Device* device)
+{
+    std::vector<TestGeometry> geometries;
+    geometries.reserve(6); // descs point into the geometry's own vectors
+    for (uint32_t i = 0; i < 6; ++i)
+        geometries.emplace_back(7 + i, 37 + 19 * i, 0.3f + 0.07f * float(i));
+
+    OmmBakeDesc bakeDesc;
+    bakeDesc.type = OmmBakerType::CPU;
+    bakeDesc.subdivisionLevel = 4;
+
+    OpacityMicroMapsHelper context;
+    context.Initialize(device, true);
+
+    for (uint32_t i = 0; i < 4; ++i)
+    { // OC1_4 and OC1_2 states, pinned and unpinned workers
+        bakeDesc.format = (i & 1) ? OmmFormats::OC1_2_STATE : OmmFormats::OC1_4_STATE;
+        bakeDesc.cpuFlags.enableNumaPlacement = (i & 2) != 0;
+
+        std::vector<std::vector<TriangleStates>> reference;
+        bakeDesc.cpuFlags.splitWorkLog2 = 0;
+        CHECK(Bake(context, geometries, bakeDesc, reference));
+
+        for (uint32_t repeat = 0; repeat < 2; ++repeat)
+        { // the second pass reuses the workers and their bakers
+            std::vector<std::vector<TriangleStates>> split;
+            bakeDesc.cpuFlags.splitWorkLog2 = TEST_SPLIT_WORK_LOG2;
+            CHECK(Bake(context, geometries, bakeDesc, split));
+            CHECK(split == reference);
+        }
+    }
+
+    context.Destroy();
+    return true;
+}
+
+int main()
+{
+    nri::Device* device = CreateTestDevice();
+    if (!device)
+        return TEST_SKIPPED;
+
+    bool result = TestSplit(device);
+    nri::nriDestroyDevice(*device);
+
+    if (!result)
+        printf("[FAIL]: OMM cpu split test failed\n");
+    return result ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+// Shared by the tests built with "add_omm_test": the device they run on, the test geometry and decoding of baked OMM states
+
+#pragma once
+#include "TestCommon.h"
+#include "VisibilityMasks/OmmHelper.h"
+#include "VisibilityMasks/OmmMicroTriangle.h"
+#include <math.h>
+#include <algorithm>
+
+namespace ommhelper
+{
+    inline nri::Device* CreateTestDevice()
+    { // nullptr if there is no adapter or no device can be created: the test is skipped then
+        nri::AdapterDesc adapterDesc = {};
+        uint32_t adapterDescsNum = 1;
+        if (nri::nriEnumerateAdapters(&adapterDesc, adapterDescsNum) != nri::Result::SUCCESS || !adapterDescsNum)
+        {
+            printf("No adapters, skipped\n");
+            return nullptr;
+        }
+
+        nri::DeviceCreationDesc deviceCreationDesc = {};
+#ifdef _WIN32
+        deviceCreationDesc.graphicsAPI = nri::GraphicsAPI::D3D12;
+#else
+        deviceCreationDesc.graphicsAPI = nri::GraphicsAPI::VULKAN;
+#endif
+        deviceCreationDesc.adapterDesc = &adapterDesc;
+
+        nri::Device* device = nullptr;
+        if (nri::nriCreateDevice(deviceCreationDesc, device) != nri::Result::SUCCESS)
+        {
+            printf("Can't create a device, skipped\n");
+            return nullptr;
+        }
+        return device;
+    }
+
+    struct TestGeometry
+    { // a triangle fan over a texture with a few alpha tested discs. Soft edged discs: the cutoff moves the edge, quantized bounds see fractional alpha
+        std::vector<uint32_t> indices;
+        std::vector<float> texCoords;
+        std::vector<float> texels;
+        OmmBakeGeometryDesc desc = {};
+
+        TestGeometry(uint32_t seed, uint32_t triangleNum, float alphaCutoff, bool isSoftEdged = false)
+        {
+            const uint32_t size = 64;
+            texels.resize(size * size);
+            for (uint32_t y = 0; y < size; ++y)
+            {
+                for (uint32_t x = 0; x < size; ++x)
+                {
+                    float dx = float(x % 16) - 8.0f + float(seed % 5);
+                    float dy = float(y % 16) - 8.0f - float(seed % 3);
+                    float distance = sqrtf(dx * dx + dy * dy);
+                    if (isSoftEdged)
+                        texels[y * size + x] = std::min(std::max(6.0f + float(seed % 4) - distance, 0.0f), 3.0f) / 3.0f;
+                    else
+                        texels[y * size + x] = distance < 5.0f + float(seed % 4) ? 1.0f : 0.0f;
+                }
+            }
+
+            texCoords.push_back(0.5f);
+            texCoords.push_back(0.5f);
+            for (uint32_t i = 0; i <= triangleNum; ++i)
+            {
+                float angle = 6.2831853f * float(i) / float(triangleNum);
+                texCoords.push_back(0.5f + 0.5f * cosf(angle));
+                texCoords.push_back(0.5f + 0.5f * sinf(angle));
+            }
+            for (uint32_t i = 0; i < triangleNum; ++i)
+            {
+                indices.push_back(0);
+                indices.push_back(i + 1);
+                indices.push_back(i + 2);
+            }
+
+            desc.indices.nriBufferOrPtr.ptr = indices.data();
+            desc.indices.numElements = indices.size();
+            desc.indices.stride = sizeof(uint32_t);
+            desc.indices.bufferSize = indices.size() * sizeof(uint32_t);
+            desc.indices.format = nri::Format::R32_UINT;
+
+            desc.uvs.nriBufferOrPtr.ptr = texCoords.data();
+            desc.uvs.numElements = texCoords.size() / 2;
+            desc.uvs.stride = sizeof(float) * 2;
+            desc.uvs.bufferSize = texCoords.size() * sizeof(float);
+            desc.uvs.format = nri::Format::RG32_SFLOAT;
+
+            desc.texture.mips[0].nriTextureOrPtr.ptr = texels.data();
+            desc.texture.mips[0].width = size;
+            desc.texture.mips[0].height = size;
+            desc.texture.mips[0].rowPitch = size * sizeof(float);
+            desc.texture.mipNum = 1;
+            desc.texture.format = nri::Format::R32_SFLOAT;
+            desc.texture.addressingMode = nri::AddressMode::REPEAT;
+
+            desc.alphaCutoff = alphaCutoff;
+            desc.alphaMode = OmmAlphaMode::Test;
+        }
+    };
+
+    struct TriangleStates
+    { // special index, or the states of every micro-triangle
+        int32_t specialIndex;
+        uint32_t subdivisionLevel;
+        uint32_t format;
+        std::vector<uint8_t> states;
+
+        bool operator==(const TriangleStates& other) const
+        {
+            return specialIndex == other.specialIndex && subdivisionLevel == other.subdivisionLevel && format == other.format && states == other.states;
+        }
+    };
+
+    inline std::vector<TriangleStates> DecodeTriangleStates(const OmmBakeGeometryDesc& desc, size_t triangleNum)
+    {
+        const std::vector<uint8_t>& arrayData = desc.outData[(uint32_t)OmmDataLayout::ArrayData];
+        const ommCpuOpacityMicromapDesc* descArray = (const ommCpuOpacityMicromapDesc*)desc.outData[(uint32_t)OmmDataLayout::DescArray].data();
+        const std::vector<uint8_t>& indices = desc.outData[(uint32_t)OmmDataLayout::Indices];
+
+        std::vector<TriangleStates> result(triangleNum);
+        for (size_t i = 0; i < triangleNum; ++i)
+        {
+            TriangleStates& triangle = result[i];
+            triangle.specialIndex = ReadOmmIndex(indices.data(), desc.outOmmIndexStride, i);
+            triangle.subdivisionLevel = 0;
+            triangle.format = 0;
+            if (triangle.specialIndex < 0)
+                continue;
+
+            const ommCpuOpacityMicromapDesc& micromap = descArray[triangle.specialIndex];
+            triangle.subdivisionLevel = micromap.subdivisionLevel;
+            triangle.format = micromap.format;
+            triangle.specialIndex = 0;
+
+            const uint32_t bitsPerState = micromap.format == ommFormat_OC1_2_State ? 1 : 2;
+            const uint32_t stateNum = 1u << (2 * micromap.subdivisionLevel);
+            for (uint32_t j = 0; j < stateNum; ++j)
+            {
+                const uint32_t bit = j * bitsPerState;
+                triangle.states.push_back((arrayData[micromap.offset + bit / 8] >> (bit % 8)) & ((1u << bitsPerState) - 1));
+            }
+        }
+        return result;
+    }
+}
@@ -0,0 +1,24 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+// Shared by every test: failed checks print the condition and return false from the test function, main returns 0 on success,
+// 1 on failure and TEST_SKIPPED when the test can't run (ctest SKIP_RETURN_CODE)
+
+#pragma once
+#include <stdio.h>
+
+#define TEST_SKIPPED 77
+
+#define CHECK(condition) \
+    if (!(condition)) \
+    { \
+        printf("[FAIL]: %s (%s:%d)\n", #condition, __FILE__, __LINE__); \
+        return false; \
+    }
@@ -0,0 +1,135 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+// TracePermutations.hpp keys and cache: flags a pass doesn't use are masked out of its keys, only keys inside the pass mask are valid,
+// shader names follow "<pass>_P<key>.cs" and the cache falls back to the generic shader for missing permutations
+
+#include "TracePermutations.hpp"
+#include "TestCommon.h"
+#include <string.h>
+
+static bool TestKeys()
+{
+    for (uint32_t pass = 0; pass < (uint32_t)TracePass::MAX_NUM; ++pass)
+    {
+        for (uint32_t flags = 0; flags < TRACE_PERMUTATION_MAX_NUM; ++flags)
+        {
+            const bool ahsDynamicMip = (flags & TracePermutationBit(TracePermutationFlag::AhsDynamicMip)) != 0;
+            const bool highlightAhs = (flags & TracePermutationBit(TracePermutationFlag::HighlightAhs)) != 0;
+            const TracePermutationKey key = TracePermutationKey::Make((TracePass)pass, ahsDynamicMip, highlightAhs);
+
+            CHECK(key.bits == (flags & TRACE_PASS_FLAG_MASKS[pass]));
+            CHECK(TracePermutationKey::IsValid((TracePass)pass, key.bits));
+            CHECK(key.Has(TracePermutationFlag::AhsDynamicMip) == ahsDynamicMip);
+        }
+    }
+
+    // Only "Opaque" highlights any-hit shaders
+    CHECK(TracePermutationKey::Make(TracePass::Opaque, false, true).Has(TracePermutationFlag::HighlightAhs));
+    CHECK(!TracePermutationKey::Make(TracePass::Ambient, false, true).Has(TracePermutationFlag::HighlightAhs));
+    CHECK(!TracePermutationKey::Make(TracePass::Transparent, true, true).Has(TracePermutationFlag::HighlightAhs));
+    CHECK(TracePermutationKey::Make(TracePass::Transparent, false, true).bits == 0);
+
+    return true;
+}
+
+static bool TestIsValid()
+{
+    const uint32_t highlightAhs = TracePermutationBit(TracePermutationFlag::HighlightAhs);
+    CHECK(TracePermutationKey::IsValid(TracePass::Opaque, highlightAhs));
+    CHECK(!TracePermutationKey::IsValid(TracePass::Ambient, highlightAhs));
+    CHECK(!TracePermutationKey::IsValid(TracePass::Transparent, highlightAhs));
+
+    // Out of range keys, even with the pass bits only
+    for (uint32_t pass = 0; pass < (uint32_t)TracePass::MAX_NUM; ++pass)
+    {
+        CHECK(TracePermutationKey::IsValid((TracePass)pass, 0));
+        CHECK(!TracePermutationKey::IsValid((TracePass)pass, TRACE_PERMUTATION_MAX_NUM));
+        CHECK(!TracePermutationKey::IsValid((TracePass)pass, TRACE_PERMUTATION_MAX_NUM | TRACE_PASS_FLAG_MASKS[pass]));
+        CHECK(!TracePermutationKey::IsValid((TracePass)pass, uint32_t(-1)));
+    }
+
+    return true;
+}
+
+static bool TestShaderNames()
+{
+    char name[64];
+    TracePermutationKey key = { 0 };
+    key.GetShaderName(TracePass::Ambient, name, sizeof(name));
+    CHECK(strcmp(name, "TraceAmbient_P0.cs") == 0);
+
+    key = TracePermutationKey::Make(TracePass::Opaque, true, true);
+    key.GetShaderName(TracePass::Opaque, name, sizeof(name));
+    CHECK(strcmp(name, "TraceOpaque_P3.cs") == 0);
+
+    key = TracePermutationKey::Make(TracePass::Transparent, true, true);
+    key.GetShaderName(TracePass::Transparent, name, sizeof(name));
+    CHECK(strcmp(name, "TraceTransparent_P1.cs") == 0);
+
+    // Truncated, but still terminated
+    char shortName[8];
+    key.GetShaderName(TracePass::Transparent, shortName, sizeof(shortName));
+    CHECK(strcmp(shortName, "TraceTr") == 0);
+
+    return true;
+}
+
+static bool TestCache()
+{
+    static int values[(uint32_t)TracePass::MAX_NUM][TRACE_PERMUTATION_MAX_NUM];
+    int fallback = 0;
+
+    TracePermutationCache<const int*> cache;
+    const TracePermutationKey opaqueKey = TracePermutationKey::Make(TracePass::Opaque, true, false);
+    CHECK(cache.Find(TracePass::Opaque, opaqueKey, &fallback) == &fallback);
+
+    for (uint32_t pass = 0; pass < (uint32_t)TracePass::MAX_NUM; ++pass)
+    {
+        for (uint32_t bits = 0; bits < TRACE_PERMUTATION_MAX_NUM; ++bits)
+        {
+            if (TracePermutationKey::IsValid((TracePass)pass, bits))
+                cache.Set((TracePass)pass, { bits }, &values[pass][bits]);
+        }
+    }
+
+    // Every valid key finds its own entry, keys of the same value don't alias across passes
+    for (uint32_t pass = 0; pass < (uint32_t)TracePass::MAX_NUM; ++pass)
+    {
+        for (uint32_t bits = 0; bits < TRACE_PERMUTATION_MAX_NUM; ++bits)
+        {
+            const int* expected = TracePermutationKey::IsValid((TracePass)pass, bits) ? &values[pass][bits] : &fallback;
+            CHECK(cache.Find((TracePass)pass, { bits }, &fallback) == expected);
+        }
+    }
+
+    // Overwritten, then missing again
+    cache.Set(TracePass::Opaque, opaqueKey, nullptr);
+    CHECK(cache.Find(TracePass::Opaque, opaqueKey, &fallback) == &fallback);
+    CHECK(cache.Find(TracePass::Ambient, opaqueKey, &fallback) == &values[(uint32_t)TracePass::Ambient][opaqueKey.bits]);
+
+    cache.Clear();
+    for (uint32_t pass = 0; pass < (uint32_t)TracePass::MAX_NUM; ++pass)
+        CHECK(cache.Find((TracePass)pass, { 0 }, &fallback) == &fallback);
+
+    return true;
+}
+
+int main()
+{
+    bool result = TestKeys();
+    result = result && TestIsValid();
+    result = result && TestShaderNames();
+    result = result && TestCache();
+
+    if (!result)
+        printf("[FAIL]: trace permutations test failed\n");
+    return result ? 0 : 1;
+}
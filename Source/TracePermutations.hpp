@@ -0,0 +1,103 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <array>
+
+// Frame uniform flags of the trace passes, compiled as permutations instead of branching in the ray query loops.
+// Permutation "N" of a pass is "Shaders/<pass>_P<N>.cs.hlsl", where N is the key: a bit mask of the flags the pass uses.
+// Without a permutation the generic shader reads the flags from the global constants.
+// NOTE: no NRI / scene dependencies, the key and cache logic runs on the CPU alone.
+
+enum class TracePermutationFlag : uint32_t
+{
+    AhsDynamicMip,          // PERMUTATION_AHS_DYNAMIC_MIP
+    HighlightAhs,           // PERMUTATION_HIGHLIGHT_AHS
+
+    MAX_NUM,
+};
+
+enum class TracePass : uint32_t
+{
+    Ambient,
+    Opaque,
+    Transparent,
+
+    MAX_NUM,
+};
+
+constexpr uint32_t TRACE_PERMUTATION_MAX_NUM = 1 << (uint32_t)TracePermutationFlag::MAX_NUM;
+
+constexpr uint32_t TracePermutationBit(TracePermutationFlag flag)
+{ return 1 << (uint32_t)flag; }
+
+// Flags each pass depends on: the other flags are masked out of its key, which keeps the permutation count down
+constexpr uint32_t TRACE_PASS_FLAG_MASKS[(uint32_t)TracePass::MAX_NUM] =
+{
+    TracePermutationBit(TracePermutationFlag::AhsDynamicMip),
+    TracePermutationBit(TracePermutationFlag::AhsDynamicMip) | TracePermutationBit(TracePermutationFlag::HighlightAhs),
+    TracePermutationBit(TracePermutationFlag::AhsDynamicMip),
+};
+
+constexpr const char* TRACE_PASS_SHADER_NAMES[(uint32_t)TracePass::MAX_NUM] =
+{
+    "TraceAmbient",
+    "TraceOpaque",
+    "TraceTransparent",
+};
+
+struct TracePermutationKey
+{
+    uint32_t bits;
+
+    static TracePermutationKey Make(TracePass pass, bool ahsDynamicMip, bool highlightAhs)
+    {
+        uint32_t bits = 0;
+        bits |= ahsDynamicMip ? TracePermutationBit(TracePermutationFlag::AhsDynamicMip) : 0;
+        bits |= highlightAhs ? TracePermutationBit(TracePermutationFlag::HighlightAhs) : 0;
+
+        return { bits & TRACE_PASS_FLAG_MASKS[(uint32_t)pass] };
+    }
+
+    bool Has(TracePermutationFlag flag) const
+    { return (bits & TracePermutationBit(flag)) != 0; }
+
+    // Keys with flags outside of the pass mask have no permutation
+    static bool IsValid(TracePass pass, uint32_t bits)
+    { return bits < TRACE_PERMUTATION_MAX_NUM && (bits & ~TRACE_PASS_FLAG_MASKS[(uint32_t)pass]) == 0; }
+
+    // "TraceOpaque_P3.cs", as expected by "utils::LoadShader"
+    void GetShaderName(TracePass pass, char* name, size_t nameSize) const
+    { snprintf(name, nameSize, "%s_P%u.cs", TRACE_PASS_SHADER_NAMES[(uint32_t)pass], bits); }
+};
+
+template<typename T>
+class TracePermutationCache
+{
+public:
+    void Set(TracePass pass, TracePermutationKey key, T value)
+    { m_Entries[(uint32_t)pass][key.bits] = value; }
+
+    // Returns "fallback" (the generic shader) if the permutation is missing
+    T Find(TracePass pass, TracePermutationKey key, T fallback) const
+    {
+        T value = m_Entries[(uint32_t)pass][key.bits];
+
+        return value ? value : fallback;
+    }
+
+    void Clear()
+    { m_Entries = {}; }
+
+private:
+    std::array<std::array<T, TRACE_PERMUTATION_MAX_NUM>, (uint32_t)TracePass::MAX_NUM> m_Entries = {};
+};
@@ -0,0 +1,357 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#include "OmmAhsEstimator.h"
+#include "OmmMicroTriangle.h"
+#include "omm.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace ommhelper
+{
+    constexpr uint32_t BVH_LEAF_SIZE = 4;
+    constexpr uint32_t BVH_STACK_SIZE = 64;
+    constexpr size_t RAYS_PER_JOB = 1024;
+
+    inline void AddToBounds(float* boundsMin, float* boundsMax, const float* p)
+    {
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            boundsMin[i] = std::min(boundsMin[i], p[i]);
+            boundsMax[i] = std::max(boundsMax[i], p[i]);
+        }
+    }
+
+    inline bool IntersectBounds(const float* boundsMin, const float* boundsMax, const float* origin, const float* invDirection, float tMax)
+    {
+        float tNear = 0.0f;
+        float tFar = tMax;
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            float t0 = (boundsMin[i] - origin[i]) * invDirection[i];
+            float t1 = (boundsMax[i] - origin[i]) * invDirection[i];
+            tNear = std::max(tNear, std::min(t0, t1));
+            tFar = std::min(tFar, std::max(t0, t1));
+        }
+        return tNear <= tFar;
+    }
+
+    inline bool IntersectTriangle(const float* v0, const float* v1, const float* v2, const OmmAhsRay& ray, float tMax, float& t, float& u, float& v)
+    { // Moller-Trumbore, both faces: instances are TRIANGLE_CULL_DISABLE
+        float e1[3] = { v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2] };
+        float e2[3] = { v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2] };
+        const float* d = ray.direction;
+        float p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+        float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+        if (fabsf(det) < 1e-12f)
+            return false;
+
+        float invDet = 1.0f / det;
+        float s[3] = { ray.origin[0] - v0[0], ray.origin[1] - v0[1], ray.origin[2] - v0[2] };
+        u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+
+        float q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+        v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * invDet;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+
+        t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * invDet;
+        return t > 0.0f && t < tMax;
+    }
+
+    void OmmAhsEstimator::AddTriangles(const float* positions, const uint32_t* indices, uint32_t triangleNum, uint32_t geometryId)
+    {
+        m_Nodes.clear();
+        m_Triangles.reserve(m_Triangles.size() + triangleNum);
+        for (uint32_t i = 0; i < triangleNum; ++i)
+        {
+            Triangle triangle = {};
+            memcpy(triangle.v0, positions + indices[i * 3 + 0] * 3, sizeof(triangle.v0));
+            memcpy(triangle.v1, positions + indices[i * 3 + 1] * 3, sizeof(triangle.v1));
+            memcpy(triangle.v2, positions + indices[i * 3 + 2] * 3, sizeof(triangle.v2));
+            triangle.geometryId = geometryId;
+            triangle.primitiveId = i;
+            m_Triangles.push_back(triangle);
+        }
+    }
+
+    uint32_t OmmAhsEstimator::BuildNode(uint32_t first, uint32_t count)
+    { // Median split along the widest centroid axis. Not SAH quality, but traversal order is what matters for the counts
+        uint32_t nodeId = (uint32_t)m_Nodes.size();
+        m_Nodes.emplace_back();
+
+        Node node = {};
+        float centroidMin[3];
+        float centroidMax[3];
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            node.boundsMin[i] = centroidMin[i] = INFINITY;
+            node.boundsMax[i] = centroidMax[i] = -INFINITY;
+        }
+
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            const Triangle& triangle = m_Triangles[i];
+            AddToBounds(node.boundsMin, node.boundsMax, triangle.v0);
+            AddToBounds(node.boundsMin, node.boundsMax, triangle.v1);
+            AddToBounds(node.boundsMin, node.boundsMax, triangle.v2);
+
+            float centroid[3];
+            for (uint32_t j = 0; j < 3; ++j)
+                centroid[j] = triangle.v0[j] + triangle.v1[j] + triangle.v2[j];
+            AddToBounds(centroidMin, centroidMax, centroid);
+        }
+
+        uint32_t axis = 0;
+        for (uint32_t i = 1; i < 3; ++i)
+        {
+            if (centroidMax[i] - centroidMin[i] > centroidMax[axis] - centroidMin[axis])
+                axis = i;
+        }
+
+        if (count <= BVH_LEAF_SIZE || centroidMax[axis] <= centroidMin[axis])
+        {
+            node.first = first;
+            node.count = count;
+            m_Nodes[nodeId] = node;
+            return nodeId;
+        }
+
+        uint32_t middle = first + count / 2;
+        std::nth_element(m_Triangles.begin() + first, m_Triangles.begin() + middle, m_Triangles.begin() + first + count, [axis](const Triangle& a, const Triangle& b)
+        {
+            return a.v0[axis] + a.v1[axis] + a.v2[axis] < b.v0[axis] + b.v1[axis] + b.v2[axis];
+        });
+
+        BuildNode(first, middle - first);
+        node.first = BuildNode(middle, first + count - middle);
+        node.count = 0;
+        m_Nodes[nodeId] = node;
+        return nodeId;
+    }
+
+    void OmmAhsEstimator::Build()
+    {
+        m_Nodes.clear();
+        if (m_Triangles.empty())
+            return;
+
+        m_Nodes.reserve(2 * m_Triangles.size() / BVH_LEAF_SIZE + 1);
+        BuildNode(0, (uint32_t)m_Triangles.size());
+        printf("[OMM] AHS estimator BVH: %zu triangles, %zu nodes\n", m_Triangles.size(), m_Nodes.size());
+    }
+
+    void OmmAhsEstimator::SetOmmData(uint32_t geometryId, const OmmAhsOmmData& data)
+    {
+        if (geometryId >= m_OmmData.size())
+            m_OmmData.resize(geometryId + 1);
+
+        OmmData& ommData = m_OmmData[geometryId];
+        ommData.arrayData.assign(data.arrayData, data.arrayData + data.arrayDataSize);
+        ommData.descArray.assign(data.descArray, data.descArray + data.descArraySize);
+        ommData.indices.assign(data.indices, data.indices + data.indexDataSize);
+        ommData.indexStride = data.indexStride;
+    }
+
+    void OmmAhsEstimator::ClearOmmData()
+    {
+        m_OmmData.clear();
+    }
+
+    void OmmAhsEstimator::Clear()
+    {
+        m_Triangles.clear();
+        m_Triangles.shrink_to_fit();
+        m_Nodes.clear();
+        m_Nodes.shrink_to_fit();
+        m_OmmData.clear();
+    }
+
+    OmmAhsEstimator::HitState OmmAhsEstimator::GetHitState(const Triangle& triangle, float u, float v) const
+    {
+        if (triangle.geometryId >= m_OmmData.size() || m_OmmData[triangle.geometryId].indices.empty())
+            return HitState::AnyHitOpaque;
+
+        const OmmData& data = m_OmmData[triangle.geometryId];
+        if (size_t(triangle.primitiveId + 1) * data.indexStride > data.indices.size())
+            return HitState::AnyHitOpaque;
+
+        int32_t index = ReadOmmIndex(data.indices.data(), data.indexStride, triangle.primitiveId);
+        switch (index)
+        {
+        case (int32_t)ommSpecialIndex_FullyTransparent: return HitState::Transparent;
+        case (int32_t)ommSpecialIndex_FullyOpaque: return HitState::Opaque;
+        case (int32_t)ommSpecialIndex_FullyUnknownTransparent: return HitState::AnyHitTransparent;
+        case (int32_t)ommSpecialIndex_FullyUnknownOpaque: return HitState::AnyHitOpaque;
+        default: break;
+        }
+
+        if (index < 0 || size_t(index + 1) * sizeof(ommCpuOpacityMicromapDesc) > data.descArray.size())
+            return HitState::AnyHitOpaque;
+
+        const ommCpuOpacityMicromapDesc& desc = ((const ommCpuOpacityMicromapDesc*)data.descArray.data())[index];
+        const uint32_t bitsPerState = desc.format == ommFormat_OC1_4_State ? 2 : 1;
+        const uint32_t bit = Bary2Index(u, v, desc.subdivisionLevel) * bitsPerState;
+        const size_t byteOffset = desc.offset + bit / 8;
+        if (byteOffset >= data.arrayData.size())
+            return HitState::AnyHitOpaque;
+
+        const uint32_t state = (data.arrayData[byteOffset] >> (bit % 8)) & ((1u << bitsPerState) - 1);
+        switch ((ommOpacityState)state)
+        {
+        case ommOpacityState_Transparent: return HitState::Transparent;
+        case ommOpacityState_Opaque: return HitState::Opaque;
+        case ommOpacityState_UnknownTransparent: return HitState::AnyHitTransparent;
+        default: return HitState::AnyHitOpaque;
+        }
+    }
+
+    bool OmmAhsEstimator::TraceRay(const OmmAhsRay& ray, bool acceptFirstHit, OmmAhsRayStats& stats, float& hitT) const
+    {
+        stats.rayNum++;
+
+        float invDirection[3];
+        for (uint32_t i = 0; i < 3; ++i)
+            invDirection[i] = 1.0f / (ray.direction[i] != 0.0f ? ray.direction[i] : 1e-20f);
+
+        bool isHit = false;
+        float tMax = INFINITY;
+
+        uint32_t stack[BVH_STACK_SIZE];
+        uint32_t stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize)
+        {
+            const Node& node = m_Nodes[stack[--stackSize]];
+            if (!IntersectBounds(node.boundsMin, node.boundsMax, ray.origin, invDirection, tMax))
+                continue;
+
+            if (node.count == 0)
+            { // near child on top
+                uint32_t left = uint32_t(&node - m_Nodes.data()) + 1;
+                uint32_t right = node.first;
+                uint32_t axis = 0;
+                float extent = 0.0f;
+                for (uint32_t i = 0; i < 3; ++i)
+                {
+                    if (node.boundsMax[i] - node.boundsMin[i] > extent)
+                    {
+                        extent = node.boundsMax[i] - node.boundsMin[i];
+                        axis = i;
+                    }
+                }
+                bool isLeftNear = (m_Nodes[left].boundsMin[axis] + m_Nodes[left].boundsMax[axis]) <= (m_Nodes[right].boundsMin[axis] + m_Nodes[right].boundsMax[axis]);
+                isLeftNear = ray.direction[axis] >= 0.0f ? isLeftNear : !isLeftNear;
+
+                if (stackSize + 2 > BVH_STACK_SIZE)
+                    continue;
+                stack[stackSize++] = isLeftNear ? right : left;
+                stack[stackSize++] = isLeftNear ? left : right;
+                continue;
+            }
+
+            for (uint32_t i = node.first; i < node.first + node.count; ++i)
+            {
+                const Triangle& triangle = m_Triangles[i];
+                float t, u, v;
+                if (!IntersectTriangle(triangle.v0, triangle.v1, triangle.v2, ray, tMax, t, u, v))
+                    continue;
+
+                stats.candidateNum++;
+                bool isCommitted = false;
+                switch (GetHitState(triangle, u, v))
+                {
+                case HitState::Opaque: stats.resolvedOpaqueNum++; isCommitted = true; break;
+                case HitState::Transparent: stats.resolvedTransparentNum++; break;
+                case HitState::AnyHitOpaque: stats.anyHitNum++; isCommitted = true; break;
+                case HitState::AnyHitTransparent: stats.anyHitNum++; break;
+                }
+
+                if (!isCommitted)
+                    continue;
+
+                isHit = true;
+                tMax = t;
+                if (acceptFirstHit)
+                {
+                    hitT = t;
+                    return true;
+                }
+            }
+        }
+
+        hitT = tMax;
+        return isHit;
+    }
+
+    inline void AddRayStats(OmmAhsRayStats& dst, const OmmAhsRayStats& src)
+    {
+        dst.rayNum += src.rayNum;
+        dst.candidateNum += src.candidateNum;
+        dst.resolvedOpaqueNum += src.resolvedOpaqueNum;
+        dst.resolvedTransparentNum += src.resolvedTransparentNum;
+        dst.anyHitNum += src.anyHitNum;
+    }
+
+    OmmAhsStats OmmAhsEstimator::Trace(const OmmAhsRay* rays, size_t rayNum, const float sunDirection[3], uint32_t threadNum) const
+    {
+        OmmAhsStats result = {};
+        if (m_Nodes.empty() || rayNum == 0)
+            return result;
+
+        std::mutex resultMutex;
+        std::atomic<size_t> nextRay = 0;
+        auto worker = [&]()
+        {
+            OmmAhsStats stats = {};
+            for (size_t begin = nextRay.fetch_add(RAYS_PER_JOB); begin < rayNum; begin = nextRay.fetch_add(RAYS_PER_JOB))
+            {
+                size_t end = std::min(begin + RAYS_PER_JOB, rayNum);
+                for (size_t i = begin; i < end; ++i)
+                {
+                    const OmmAhsRay& ray = rays[i];
+                    float hitT = 0.0f;
+                    if (!TraceRay(ray, false, stats.primary, hitT))
+                        continue;
+
+                    OmmAhsRay shadowRay = {};
+                    const float offset = 1e-4f * (1.0f + hitT);
+                    for (uint32_t j = 0; j < 3; ++j)
+                    {
+                        shadowRay.origin[j] = ray.origin[j] + ray.direction[j] * hitT + sunDirection[j] * offset;
+                        shadowRay.direction[j] = sunDirection[j];
+                    }
+                    TraceRay(shadowRay, true, stats.shadow, hitT);
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(resultMutex);
+            AddRayStats(result.primary, stats.primary);
+            AddRayStats(result.shadow, stats.shadow);
+        };
+
+        threadNum = threadNum ? threadNum : std::max(std::thread::hardware_concurrency(), 1u);
+        std::vector<std::thread> threads;
+        for (uint32_t i = 1; i < threadNum; ++i)
+            threads.emplace_back(worker);
+        worker();
+        for (std::thread& thread : threads)
+            thread.join();
+
+        return result;
+    }
+}
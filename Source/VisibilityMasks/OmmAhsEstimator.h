@@ -0,0 +1,114 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace ommhelper
+{
+    // CPU reference traversal: estimates how many any-hit invocations OMMs remove, without ray tracing hardware.
+    // Traversal is front to back with closest hit pruning. Every alpha tested triangle the ray reaches is a candidate:
+    // it's resolved by the OMM as opaque / transparent, or it still goes to any-hit. Unknown states follow their
+    // opaque / transparent hint to decide whether the hit is committed. Triangles without OMM data always go to any-hit.
+    struct OmmAhsRayStats
+    {
+        uint64_t rayNum;
+        uint64_t candidateNum; // any-hit invocations without OMMs
+        uint64_t resolvedOpaqueNum;
+        uint64_t resolvedTransparentNum;
+        uint64_t anyHitNum; // any-hit invocations left
+
+        double GetReduction() const { return candidateNum ? 1.0 - double(anyHitNum) / double(candidateNum) : 0.0; };
+    };
+
+    struct OmmAhsStats
+    {
+        OmmAhsRayStats primary;
+        OmmAhsRayStats shadow; // toward the sun from committed primary hits
+    };
+
+    struct OmmAhsRay
+    {
+        float origin[3];
+        float direction[3]; // normalized
+    };
+
+    struct OmmAhsOmmData
+    { // bake output in OmmDataLayout order, desc array as ommCpuOpacityMicromapDesc
+        const uint8_t* arrayData;
+        size_t arrayDataSize;
+        const uint8_t* descArray;
+        size_t descArraySize;
+        const uint8_t* indices;
+        size_t indexDataSize;
+        uint32_t indexStride;
+    };
+
+    class OmmAhsEstimator
+    {
+    public:
+        // World space triangles. OMM data is bound per geometry, so instances of a geometry share it
+        void AddTriangles(const float* positions, const uint32_t* indices, uint32_t triangleNum, uint32_t geometryId);
+        void Build();
+        bool IsBuilt() const { return !m_Nodes.empty(); };
+        size_t GetTriangleNum() const { return m_Triangles.size(); };
+
+        // OMM data is copied. Switching bake configurations only needs new OMM data, the BVH is kept
+        void SetOmmData(uint32_t geometryId, const OmmAhsOmmData& data);
+        void ClearOmmData();
+
+        OmmAhsStats Trace(const OmmAhsRay* rays, size_t rayNum, const float sunDirection[3], uint32_t threadNum) const;
+        void Clear();
+
+    private:
+        struct Triangle
+        {
+            float v0[3];
+            float v1[3];
+            float v2[3];
+            uint32_t geometryId;
+            uint32_t primitiveId;
+        };
+
+        struct Node
+        {
+            float boundsMin[3];
+            float boundsMax[3];
+            uint32_t first; // first triangle for leaves, right child for inner nodes (left child follows the node)
+            uint32_t count; // 0 for inner nodes
+        };
+
+        struct OmmData
+        {
+            std::vector<uint8_t> arrayData;
+            std::vector<uint8_t> descArray;
+            std::vector<uint8_t> indices;
+            uint32_t indexStride;
+        };
+
+        enum class HitState
+        {
+            Opaque,
+            Transparent,
+            AnyHitOpaque,
+            AnyHitTransparent,
+        };
+
+        HitState GetHitState(const Triangle& triangle, float u, float v) const;
+        bool TraceRay(const OmmAhsRay& ray, bool acceptFirstHit, OmmAhsRayStats& stats, float& hitT) const;
+        uint32_t BuildNode(uint32_t first, uint32_t count);
+
+        std::vector<Triangle> m_Triangles;
+        std::vector<Node> m_Nodes;
+        std::vector<OmmData> m_OmmData; // by geometry id
+    };
+}
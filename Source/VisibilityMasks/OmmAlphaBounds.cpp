@@ -0,0 +1,415 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#include "OmmAlphaBounds.h"
+#include "OmmMicroTriangle.h"
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+
+namespace ommhelper
+{
+    constexpr size_t TRIANGLES_PER_JOB = 64;
+    constexpr uint32_t QUANTIZED_ALPHA_MAX = 15;
+    constexpr int32_t MAX_TEXEL_COORD = 1 << 30;
+
+    // 8 bit alpha is exact: 255 = 15 * 17
+    inline uint32_t QuantizeMin(uint8_t alpha) { return alpha / 17; }
+    inline uint32_t QuantizeMax(uint8_t alpha) { return (alpha + 16) / 17; }
+    inline uint32_t QuantizeMin(float alpha) { return (uint32_t)std::min(std::max(floorf(alpha * QUANTIZED_ALPHA_MAX), 0.0f), float(QUANTIZED_ALPHA_MAX)); }
+    inline uint32_t QuantizeMax(float alpha) { return (uint32_t)std::min(std::max(ceilf(alpha * QUANTIZED_ALPHA_MAX), 0.0f), float(QUANTIZED_ALPHA_MAX)); }
+
+    inline int32_t ToTexelCoord(float x)
+    {
+        return (int32_t)std::min(std::max(floorf(x), -float(MAX_TEXEL_COORD)), float(MAX_TEXEL_COORD));
+    }
+
+    inline int32_t GetTexelAddress(int32_t x, int32_t size, nri::AddressMode mode)
+    { // -1: border
+        if (x >= 0 && x < size)
+            return x;
+
+        switch (mode)
+        {
+        case nri::AddressMode::REPEAT:
+            x %= size;
+            return x < 0 ? x + size : x;
+        case nri::AddressMode::MIRRORED_REPEAT:
+            x %= 2 * size;
+            x = x < 0 ? x + 2 * size : x;
+            return x < size ? x : 2 * size - 1 - x;
+        case nri::AddressMode::CLAMP_TO_BORDER:
+            return -1;
+        default:
+            return x < 0 ? 0 : size - 1;
+        }
+    }
+
+    template<typename Texel>
+    struct AlphaPlane
+    {
+        const Texel* texels;
+        int32_t width;
+        int32_t height;
+        nri::AddressMode addressingMode;
+        float borderAlpha;
+
+        uint8_t GetBounds(int32_t xMin, int32_t xMax, int32_t yMin, int32_t yMax) const
+        { // Texel range is inclusive. Wrapping modes cover the whole axis once the range spans it
+            const bool isWrapped = addressingMode == nri::AddressMode::REPEAT || addressingMode == nri::AddressMode::MIRRORED_REPEAT;
+            if (isWrapped && xMax - xMin + 1 >= width)
+            {
+                xMin = 0;
+                xMax = width - 1;
+            }
+            if (isWrapped && yMax - yMin + 1 >= height)
+            {
+                yMin = 0;
+                yMax = height - 1;
+            }
+
+            bool isBorderSampled = false;
+            Texel minAlpha = texels[0];
+            Texel maxAlpha = texels[0];
+            bool isFirst = true;
+            for (int32_t y = yMin; y <= yMax; ++y)
+            {
+                int32_t row = GetTexelAddress(y, height, addressingMode);
+                if (row < 0)
+                {
+                    isBorderSampled = true;
+                    continue;
+                }
+
+                const Texel* rowTexels = texels + size_t(row) * width;
+                if (xMin >= 0 && xMax < width)
+                { // contiguous, vectorizable
+                    Texel rowMin = rowTexels[xMin];
+                    Texel rowMax = rowTexels[xMin];
+                    for (int32_t x = xMin + 1; x <= xMax; ++x)
+                    {
+                        rowMin = std::min(rowMin, rowTexels[x]);
+                        rowMax = std::max(rowMax, rowTexels[x]);
+                    }
+                    minAlpha = isFirst ? rowMin : std::min(minAlpha, rowMin);
+                    maxAlpha = isFirst ? rowMax : std::max(maxAlpha, rowMax);
+                    isFirst = false;
+                    continue;
+                }
+
+                for (int32_t x = xMin; x <= xMax; ++x)
+                {
+                    int32_t column = GetTexelAddress(x, width, addressingMode);
+                    if (column < 0)
+                    {
+                        isBorderSampled = true;
+                        continue;
+                    }
+                    minAlpha = isFirst ? rowTexels[column] : std::min(minAlpha, rowTexels[column]);
+                    maxAlpha = isFirst ? rowTexels[column] : std::max(maxAlpha, rowTexels[column]);
+                    isFirst = false;
+                }
+            }
+
+            uint32_t minQuantized = isFirst ? QUANTIZED_ALPHA_MAX : QuantizeMin(minAlpha);
+            uint32_t maxQuantized = isFirst ? 0 : QuantizeMax(maxAlpha);
+            if (isBorderSampled)
+            {
+                minQuantized = std::min(minQuantized, QuantizeMin(borderAlpha));
+                maxQuantized = std::max(maxQuantized, QuantizeMax(borderAlpha));
+            }
+            return uint8_t(minQuantized | (maxQuantized << 4));
+        }
+    };
+
+    struct TexelTriangle
+    {
+        float p0[2];
+        float e1[2];
+        float e2[2];
+    };
+
+    inline bool ReadTexelTriangle(const OmmBakeGeometryDesc& instance, size_t triangle, float width, float height, TexelTriangle& outTriangle)
+    {
+        const InputBuffer& indices = instance.indices;
+        const InputBuffer& uvs = instance.uvs;
+        const uint8_t* indexData = (const uint8_t*)indices.nriBufferOrPtr.ptr;
+        const uint8_t* uvData = (const uint8_t*)uvs.nriBufferOrPtr.ptr;
+
+        float texel[3][2];
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            const uint8_t* index = indexData + (triangle * 3 + i) * indices.stride + indices.offsetInStruct;
+            uint32_t vertex = indices.format == nri::Format::R16_UINT ? *(const uint16_t*)index : *(const uint32_t*)index;
+            const float* uv = (const float*)(uvData + vertex * uvs.stride + uvs.offsetInStruct);
+            texel[i][0] = uv[0] * width;
+            texel[i][1] = uv[1] * height;
+        }
+
+        for (uint32_t i = 0; i < 2; ++i)
+        {
+            outTriangle.p0[i] = texel[0][i];
+            outTriangle.e1[i] = texel[1][i] - texel[0][i];
+            outTriangle.e2[i] = texel[2][i] - texel[0][i];
+        }
+        return std::isfinite(outTriangle.p0[0] + outTriangle.p0[1] + outTriangle.e1[0] + outTriangle.e1[1] + outTriangle.e2[0] + outTriangle.e2[1]);
+    }
+
+    inline uint32_t GetSubdivisionLevel(const TexelTriangle& triangle, const OmmBakeDesc& desc)
+    { // Dynamic subdivision targets micro-triangles covering scale^2 texels
+        if (desc.dynamicSubdivisionScale <= 0.0f)
+            return desc.subdivisionLevel;
+
+        const float texelArea = 0.5f * fabsf(triangle.e1[0] * triangle.e2[1] - triangle.e1[1] * triangle.e2[0]);
+        const float microTriangleNum = texelArea / (desc.dynamicSubdivisionScale * desc.dynamicSubdivisionScale);
+        if (!(microTriangleNum > 1.0f))
+            return 0;
+        return std::min((uint32_t)ceilf(0.5f * log2f(microTriangleNum)), desc.subdivisionLevel);
+    }
+
+    template<typename Texel>
+    static void BakeTriangle(const AlphaPlane<Texel>& plane, const TexelTriangle& triangle, uint32_t level, bool isLinear, uint8_t* outBounds)
+    { // Upright micro-triangle (u, v) spans lattice points (u, v), (u + 1, v), (u, v + 1). Inverted spans (u + 1, v), (u, v + 1), (u + 1, v + 1)
+        const uint32_t stepNum = 1u << level;
+        const float step = 1.0f / float(stepNum);
+        const float filterOffset = isLinear ? 0.5f : 0.0f;
+        const int32_t filterExtent = isLinear ? 1 : 0;
+
+        auto GetLatticePoint = [&](uint32_t u, uint32_t v, uint32_t axis) -> float
+        {
+            return triangle.p0[axis] + triangle.e1[axis] * (float(u) * step) + triangle.e2[axis] * (float(v) * step);
+        };
+
+        auto BakeMicroTriangle = [&](uint32_t u0, uint32_t v0, uint32_t u1, uint32_t v1, uint32_t u2, uint32_t v2) -> uint8_t
+        {
+            int32_t texelMin[2];
+            int32_t texelMax[2];
+            for (uint32_t axis = 0; axis < 2; ++axis)
+            {
+                float a = GetLatticePoint(u0, v0, axis);
+                float b = GetLatticePoint(u1, v1, axis);
+                float c = GetLatticePoint(u2, v2, axis);
+                texelMin[axis] = ToTexelCoord(std::min(a, std::min(b, c)) - filterOffset);
+                texelMax[axis] = ToTexelCoord(std::max(a, std::max(b, c)) - filterOffset) + filterExtent;
+            }
+            return plane.GetBounds(texelMin[0], texelMax[0], texelMin[1], texelMax[1]);
+        };
+
+        for (uint32_t v = 0; v < stepNum; ++v)
+        {
+            for (uint32_t u = 0; u + v < stepNum; ++u)
+            {
+                outBounds[DBary2Index(u, v, stepNum - 1 - u - v, level)] = BakeMicroTriangle(u, v, u + 1, v, u, v + 1);
+                if (u + v + 2 <= stepNum)
+                    outBounds[DBary2Index(u, v, stepNum - 2 - u - v, level)] = BakeMicroTriangle(u + 1, v, u, v + 1, u + 1, v + 1);
+            }
+        }
+    }
+
+    template<typename Texel>
+    static void BakeBounds(const OmmBakeGeometryDesc& instance, const OmmBakeDesc& desc, OmmAlphaBounds& outBounds, uint32_t threadNum)
+    {
+        const MipDesc& mip = instance.texture.mips[0];
+        AlphaPlane<Texel> plane = {};
+        plane.texels = (const Texel*)mip.nriTextureOrPtr.ptr;
+        plane.width = (int32_t)mip.width;
+        plane.height = (int32_t)mip.height;
+        plane.addressingMode = instance.texture.addressingMode;
+        plane.borderAlpha = instance.borderAlpha;
+
+        const size_t triangleNum = instance.indices.numElements / 3;
+        outBounds.levels.resize(triangleNum);
+        std::vector<uint64_t> boundsOffsets(triangleNum + 1, 0);
+        for (size_t i = 0; i < triangleNum; ++i)
+        {
+            TexelTriangle triangle = {};
+            outBounds.levels[i] = ReadTexelTriangle(instance, i, float(plane.width), float(plane.height), triangle) ? (uint8_t)GetSubdivisionLevel(triangle, desc) : 0;
+            boundsOffsets[i + 1] = boundsOffsets[i] + (1ull << (2 * outBounds.levels[i]));
+        }
+        outBounds.bounds.resize(boundsOffsets[triangleNum]);
+
+        const bool isLinear = desc.filter == OmmBakeFilter::Linear;
+        ParallelFor((triangleNum + TRIANGLES_PER_JOB - 1) / TRIANGLES_PER_JOB, threadNum, [&](size_t job)
+        {
+            for (size_t i = job * TRIANGLES_PER_JOB; i < std::min(triangleNum, (job + 1) * TRIANGLES_PER_JOB); ++i)
+            {
+                uint8_t* triangleBounds = outBounds.bounds.data() + boundsOffsets[i];
+                TexelTriangle triangle = {};
+                if (ReadTexelTriangle(instance, i, float(plane.width), float(plane.height), triangle))
+                    BakeTriangle(plane, triangle, outBounds.levels[i], isLinear, triangleBounds);
+                else
+                    *triangleBounds = uint8_t(QUANTIZED_ALPHA_MAX << 4); // invalid uvs: any alpha
+            }
+        });
+    }
+
+    void AlphaBoundsBaker::Bake(const OmmBakeGeometryDesc& instance, const OmmBakeDesc& desc, OmmAlphaBounds& outBounds, uint32_t threadNum)
+    {
+        outBounds.levels.clear();
+        outBounds.bounds.clear();
+
+        const MipDesc& mip = instance.texture.mips[0];
+        if (!mip.nriTextureOrPtr.ptr || !mip.width || !mip.height || instance.uvs.format != nri::Format::RG32_SFLOAT)
+        {
+            printf("[FAIL]: AlphaBoundsBaker needs an R8_UNORM / R32_SFLOAT alpha plane and RG32_SFLOAT uvs\n");
+            std::abort();
+        }
+
+        if (instance.texture.format == nri::Format::R32_SFLOAT)
+            BakeBounds<float>(instance, desc, outBounds, threadNum);
+        else
+            BakeBounds<uint8_t>(instance, desc, outBounds, threadNum);
+    }
+
+    template<uint32_t BitsPerState>
+    inline void PackStates(const uint8_t* bounds, size_t microTriangleNum, const uint8_t* stateLut, uint8_t* outData)
+    {
+        constexpr uint32_t statesPerByte = 8 / BitsPerState;
+        size_t i = 0;
+        for (; i + statesPerByte <= microTriangleNum; i += statesPerByte)
+        {
+            uint32_t packed = 0;
+            for (uint32_t j = 0; j < statesPerByte; ++j)
+                packed |= uint32_t(stateLut[bounds[i + j]]) << (j * BitsPerState);
+            *outData++ = uint8_t(packed);
+        }
+
+        uint32_t packed = 0;
+        for (uint32_t j = 0; i < microTriangleNum; ++i, ++j)
+            packed |= uint32_t(stateLut[bounds[i]]) << (j * BitsPerState);
+        if (microTriangleNum % statesPerByte)
+            *outData = uint8_t(packed);
+    }
+
+    static uint32_t WriteUsageCounts(std::vector<uint8_t>& outData, const std::map<uint32_t, uint32_t>& histogram)
+    {
+        outData.resize(histogram.size() * sizeof(ommCpuOpacityMicromapUsageCount));
+        ommCpuOpacityMicromapUsageCount* usageCounts = (ommCpuOpacityMicromapUsageCount*)outData.data();
+        for (const auto& it : histogram)
+            *usageCounts++ = { it.second, uint16_t(it.first >> 16), uint16_t(it.first & 0xFFFF) };
+        return (uint32_t)histogram.size();
+    }
+
+    void AlphaBoundsBaker::Threshold(const OmmAlphaBounds& bounds, float alphaCutoff, const OmmBakeDesc& desc, OmmBakeGeometryDesc& outInstance, uint32_t threadNum)
+    {
+        const bool is4State = desc.format == OmmFormats::OC1_4_STATE;
+        const uint32_t bitsPerState = is4State ? 2 : 1;
+        const ommFormat format = is4State ? ommFormat_OC1_4_State : ommFormat_OC1_2_State;
+
+        // Opaque when the whole range is above the cutoff, transparent when it's at or below it. Cutoffs between two quantized values
+        // round down, which keeps both tests conservative
+        const int32_t threshold = std::min(std::max((int32_t)floorf(alphaCutoff * QUANTIZED_ALPHA_MAX), -1), (int32_t)QUANTIZED_ALPHA_MAX);
+        uint8_t stateLut[256];
+        for (int32_t i = 0; i < 256; ++i)
+        {
+            const int32_t minAlpha = i & 0xF;
+            const int32_t maxAlpha = i >> 4;
+            ommOpacityState state = minAlpha + maxAlpha > 2 * threshold + 1 ? ommOpacityState_UnknownOpaque : ommOpacityState_UnknownTransparent;
+            if (minAlpha > threshold)
+                state = ommOpacityState_Opaque;
+            else if (maxAlpha <= threshold)
+                state = ommOpacityState_Transparent;
+            stateLut[i] = is4State ? uint8_t(state) : uint8_t(state & 1); // 2 state: unknown opaque -> opaque, unknown transparent -> transparent
+        }
+
+        const size_t triangleNum = bounds.levels.size();
+        std::vector<uint64_t> boundsOffsets(triangleNum + 1, 0);
+        for (size_t i = 0; i < triangleNum; ++i)
+            boundsOffsets[i + 1] = boundsOffsets[i] + (1ull << (2 * bounds.levels[i]));
+
+        // Uniform triangles take special indices, the rest gets a micromap each
+        std::vector<int32_t> indices(triangleNum, 0);
+        if (desc.cpuFlags.enableSpecialIndices)
+        {
+            ParallelFor((triangleNum + TRIANGLES_PER_JOB - 1) / TRIANGLES_PER_JOB, threadNum, [&](size_t job)
+            {
+                for (size_t i = job * TRIANGLES_PER_JOB; i < std::min(triangleNum, (job + 1) * TRIANGLES_PER_JOB); ++i)
+                {
+                    const uint8_t* triangleBounds = bounds.bounds.data() + boundsOffsets[i];
+                    const size_t microTriangleNum = size_t(boundsOffsets[i + 1] - boundsOffsets[i]);
+                    const uint8_t state = stateLut[triangleBounds[0]];
+                    bool isUniform = true;
+                    for (size_t j = 1; j < microTriangleNum; ++j)
+                        isUniform &= stateLut[triangleBounds[j]] == state;
+                    indices[i] = isUniform ? -int32_t(state) - 1 : 0; // ommSpecialIndex_FullyTransparent = -1 ... FullyUnknownOpaque = -4
+                }
+            });
+        }
+
+        std::vector<ommCpuOpacityMicromapDesc> descArray;
+        std::map<uint32_t, uint32_t> histogram; // (subdivisionLevel << 16 | format) -> count, every micromap is referenced once
+        uint32_t arrayDataSize = 0;
+        for (size_t i = 0; i < triangleNum; ++i)
+        {
+            if (indices[i] < 0)
+                continue;
+
+            const uint32_t level = bounds.levels[i];
+            indices[i] = (int32_t)descArray.size();
+            descArray.push_back({ arrayDataSize, uint16_t(level), uint16_t(format) });
+            ++histogram[level << 16 | uint32_t(format)];
+            arrayDataSize += uint32_t(((1ull << (2 * level)) * bitsPerState + 7) / 8);
+        }
+
+        std::vector<uint8_t>* outData = outInstance.outData;
+        for (uint32_t i = 0; i < (uint32_t)OmmDataLayout::CpuMaxNum; ++i)
+            outData[i].clear();
+
+        std::vector<uint8_t>& arrayData = outData[(uint32_t)OmmDataLayout::ArrayData];
+        arrayData.resize(arrayDataSize);
+        ParallelFor((triangleNum + TRIANGLES_PER_JOB - 1) / TRIANGLES_PER_JOB, threadNum, [&](size_t job)
+        {
+            for (size_t i = job * TRIANGLES_PER_JOB; i < std::min(triangleNum, (job + 1) * TRIANGLES_PER_JOB); ++i)
+            {
+                if (indices[i] < 0)
+                    continue;
+
+                const uint8_t* triangleBounds = bounds.bounds.data() + boundsOffsets[i];
+                const size_t microTriangleNum = size_t(boundsOffsets[i + 1] - boundsOffsets[i]);
+                uint8_t* triangleData = arrayData.data() + descArray[indices[i]].offset;
+                if (is4State)
+                    PackStates<2>(triangleBounds, microTriangleNum, stateLut, triangleData);
+                else
+                    PackStates<1>(triangleBounds, microTriangleNum, stateLut, triangleData);
+            }
+        });
+
+        outData[(uint32_t)OmmDataLayout::DescArray].resize(descArray.size() * sizeof(ommCpuOpacityMicromapDesc));
+        memcpy(outData[(uint32_t)OmmDataLayout::DescArray].data(), descArray.data(), outData[(uint32_t)OmmDataLayout::DescArray].size());
+        outInstance.outDescArrayHistogramCount = WriteUsageCounts(outData[(uint32_t)OmmDataLayout::DescArrayHistogram], histogram);
+        outInstance.outIndexHistogramCount = WriteUsageCounts(outData[(uint32_t)OmmDataLayout::IndexHistogram], histogram);
+
+        // Same width rules as the baker: 16 bit unless regular indices reach the special values
+        const bool is16bit = !desc.cpuFlags.force32bitIndices && descArray.size() <= 0x10000 - 4;
+        outInstance.outOmmIndexFormat = is16bit ? nri::Format::R16_UINT : nri::Format::R32_UINT;
+        outInstance.outOmmIndexStride = is16bit ? sizeof(uint16_t) : sizeof(uint32_t);
+        std::vector<uint8_t>& outIndices = outData[(uint32_t)OmmDataLayout::Indices];
+        outIndices.resize(indices.size() * outInstance.outOmmIndexStride);
+        for (size_t i = 0; i < indices.size(); ++i)
+        { // truncation keeps special indices special: -1 -> 0xFFFF
+            if (is16bit)
+                ((uint16_t*)outIndices.data())[i] = uint16_t(indices[i]);
+            else
+                ((int32_t*)outIndices.data())[i] = indices[i];
+        }
+    }
+
+    uint64_t AlphaBoundsBaker::CalculateStateHash(const OmmBakeDesc& desc)
+    {
+        OmmBakeDesc boundsDesc = desc;
+        boundsDesc.alphaCutoff = 0.0f;
+        boundsDesc.format = OmmFormats::OC1_4_STATE;
+        boundsDesc.mipCount = 1; // only the first mip is read
+        boundsDesc.cpuFlags = CpuBakerFlags();
+        boundsDesc.cpuFlags.enableAlphaBounds = true;
+        return OmmCaching::CalculateSateHash(boundsDesc);
+    }
+}
@@ -0,0 +1,40 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#pragma once
+#include "OmmHelper.h"
+
+namespace ommhelper
+{
+    // Cutoff agnostic intermediate bake product. Sampling the alpha texture over every micro-triangle doesn't depend on the alpha cutoff,
+    // so it's done once: each micro-triangle keeps the alpha range of its texel footprint, quantized to 4 bits per bound.
+    // Any cutoff is then classified with a table lookup per micro-triangle, without touching the texture.
+    struct OmmAlphaBounds
+    {
+        std::vector<uint8_t> levels; // subdivision level by triangle
+        std::vector<uint8_t> bounds; // by micro-triangle, bird curve order inside a triangle. Low nibble: min alpha rounded down, high nibble: max alpha rounded up
+
+        size_t GetSize() const { return levels.size() + bounds.size(); };
+    };
+
+    struct AlphaBoundsBaker
+    {
+        // Reads mip 0 of OmmBakeGeometryDesc::texture (R8_UNORM or R32_SFLOAT alpha plane). Footprints are conservative: the texel bounding box
+        // of the micro-triangle, grown by the bilinear footprint for OmmBakeFilter::Linear. Triangle ranges are split over "threadNum" threads, 0: all cores
+        static void Bake(const OmmBakeGeometryDesc& instance, const OmmBakeDesc& desc, OmmAlphaBounds& outBounds, uint32_t threadNum);
+
+        // Fills OmmBakeGeometryDesc outputs the way the CPU baker does (alpha test: opaque above the cutoff), duplicate detection excluded.
+        // Unknown micro-triangles lean towards the side of the cutoff holding the middle of their alpha range
+        static void Threshold(const OmmAlphaBounds& bounds, float alphaCutoff, const OmmBakeDesc& desc, OmmBakeGeometryDesc& outInstance, uint32_t threadNum);
+
+        // Bake state without the parameters only the threshold pass depends on (alpha cutoff, format, index and special index flags)
+        static uint64_t CalculateStateHash(const OmmBakeDesc& desc);
+    };
+}
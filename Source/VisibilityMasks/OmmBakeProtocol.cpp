@@ -0,0 +1,306 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#include "OmmBakeProtocol.h"
+#include <stdio.h>
+#include <string.h>
+
+#define OMM_SUPPORTS_CPP17 (1)
+#include "omm.h"
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <afunix.h>
+    #define CLOSE_SOCKET closesocket
+    #define SHUT_RD SD_RECEIVE
+#else
+    #include <sys/socket.h>
+    #include <sys/select.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+    typedef int SOCKET;
+    #define INVALID_SOCKET (-1)
+    #define CLOSE_SOCKET close
+#endif
+
+namespace ommhelper
+{
+    static_assert(sizeof(OmmBakeRequestHeader) % sizeof(uint64_t) == 0, "OmmBakeRequestHeader must not contain padding");
+
+    bool OmmBakeSocketApi::Initialize()
+    {
+#ifdef _WIN32
+        static bool isInitialized = false;
+        if (!isInitialized)
+        {
+            WSADATA wsaData = {};
+            isInitialized = WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+        }
+        return isInitialized;
+#else
+        return true;
+#endif
+    }
+
+    static bool FillAddress(const char* path, sockaddr_un& address)
+    {
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(address.sun_path))
+        {
+            printf("[FAIL]: Bake server socket path is too long: %s\n", path);
+            return false;
+        }
+        strcpy(address.sun_path, path);
+        return true;
+    }
+
+    OmmBakeSocket OmmBakeSocketApi::Connect(const char* path)
+    {
+        sockaddr_un address;
+        if (!Initialize() || !FillAddress(path, address))
+            return OMM_BAKE_INVALID_SOCKET;
+
+        SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s == INVALID_SOCKET)
+            return OMM_BAKE_INVALID_SOCKET;
+
+        if (connect(s, (sockaddr*)&address, sizeof(address)) != 0)
+        {
+            CLOSE_SOCKET(s);
+            return OMM_BAKE_INVALID_SOCKET;
+        }
+        return (OmmBakeSocket)s;
+    }
+
+    OmmBakeSocket OmmBakeSocketApi::Listen(const char* path)
+    {
+        sockaddr_un address;
+        if (!Initialize() || !FillAddress(path, address))
+            return OMM_BAKE_INVALID_SOCKET;
+
+        SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s == INVALID_SOCKET)
+            return OMM_BAKE_INVALID_SOCKET;
+
+        remove(path); // stale socket from a previous run
+        if (bind(s, (sockaddr*)&address, sizeof(address)) != 0 || listen(s, SOMAXCONN) != 0)
+        {
+            CLOSE_SOCKET(s);
+            return OMM_BAKE_INVALID_SOCKET;
+        }
+        return (OmmBakeSocket)s;
+    }
+
+    OmmBakeSocket OmmBakeSocketApi::Accept(OmmBakeSocket listenSocket, uint32_t timeoutMs)
+    { // a bounded wait keeps the accept loop responsive to stop requests
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET((SOCKET)listenSocket, &readSet);
+        timeval timeout = { long(timeoutMs / 1000), long(timeoutMs % 1000) * 1000 };
+        if (select(int((SOCKET)listenSocket + 1), &readSet, nullptr, nullptr, &timeout) <= 0)
+            return OMM_BAKE_INVALID_SOCKET;
+
+        SOCKET s = accept((SOCKET)listenSocket, nullptr, nullptr);
+        return s == INVALID_SOCKET ? OMM_BAKE_INVALID_SOCKET : (OmmBakeSocket)s;
+    }
+
+    bool OmmBakeSocketApi::Send(OmmBakeSocket socket, const void* data, size_t size)
+    {
+        const char* ptr = (const char*)data;
+        while (size)
+        {
+            int chunk = size > (1u << 30) ? (1 << 30) : (int)size;
+#ifdef _WIN32
+            int sent = send((SOCKET)socket, ptr, chunk, 0);
+#else
+            int sent = (int)send((SOCKET)socket, ptr, chunk, MSG_NOSIGNAL);
+#endif
+            if (sent <= 0)
+                return false;
+            ptr += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    bool OmmBakeSocketApi::Recv(OmmBakeSocket socket, void* data, size_t size)
+    {
+        char* ptr = (char*)data;
+        while (size)
+        {
+            int chunk = size > (1u << 30) ? (1 << 30) : (int)size;
+            int received = (int)recv((SOCKET)socket, ptr, chunk, 0);
+            if (received <= 0)
+                return false;
+            ptr += received;
+            size -= received;
+        }
+        return true;
+    }
+
+    void OmmBakeSocketApi::Shutdown(OmmBakeSocket socket)
+    {
+        if (socket != OMM_BAKE_INVALID_SOCKET)
+            shutdown((SOCKET)socket, SHUT_RD);
+    }
+
+    void OmmBakeSocketApi::Close(OmmBakeSocket socket)
+    {
+        if (socket != OMM_BAKE_INVALID_SOCKET)
+            CLOSE_SOCKET((SOCKET)socket);
+    }
+
+    static uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+    {
+        const uint8_t* p = (const uint8_t*)data;
+        while (size--)
+            hash = (hash ^ (*p++)) * 1099511628211ull;
+        return hash;
+    }
+
+    uint64_t CalculateBakeRequestHash(const OmmBakeRequestHeader& header, const void* indices, const void* texCoords, const void* const* mips)
+    {
+        uint64_t result = 14695981039346656037ull;
+        result = HashBytes(result, &header, sizeof(header));
+        result = HashBytes(result, indices, header.indexDataSize);
+        result = HashBytes(result, texCoords, header.texCoordDataSize);
+        for (uint32_t mip = 0; mip < header.mipNum; ++mip)
+            result = HashBytes(result, mips[mip], header.mipDataSize[mip]);
+        return result;
+    }
+
+    bool SendBakeRequest(OmmBakeSocket socket, const OmmBakeRequestHeader& header, const void* indices, const void* texCoords, const void* const* mips)
+    {
+        bool result = OmmBakeSocketApi::Send(socket, &header, sizeof(header));
+        result = result && OmmBakeSocketApi::Send(socket, indices, header.indexDataSize);
+        result = result && OmmBakeSocketApi::Send(socket, texCoords, header.texCoordDataSize);
+        for (uint32_t mip = 0; mip < header.mipNum && result; ++mip)
+            result = OmmBakeSocketApi::Send(socket, mips[mip], header.mipDataSize[mip]);
+        return result;
+    }
+
+    static bool RecvChunk(OmmBakeSocket socket, std::vector<uint8_t>& outData, uint64_t size)
+    {
+        if (size > OMM_BAKE_PROTOCOL_MAX_CHUNK_SIZE)
+            return false;
+        outData.resize(size);
+        return OmmBakeSocketApi::Recv(socket, outData.data(), size);
+    }
+
+    static uint32_t GetIndexSize(uint32_t indexFormat)
+    {
+        switch (indexFormat)
+        {
+        case ommIndexFormat_I16_UINT: return sizeof(uint16_t);
+        case ommIndexFormat_I32_UINT: return sizeof(uint32_t);
+        default: return 0;
+        }
+    }
+
+    static uint32_t GetTexCoordSize(uint32_t texCoordFormat)
+    {
+        switch (texCoordFormat)
+        {
+        case ommTexCoordFormat_UV16_UNORM: return 2 * sizeof(uint16_t);
+        case ommTexCoordFormat_UV16_FLOAT: return 2 * sizeof(uint16_t);
+        case ommTexCoordFormat_UV32_FLOAT: return 2 * sizeof(float);
+        default: return 0;
+        }
+    }
+
+    static uint32_t GetTexelSize(uint32_t textureFormat)
+    {
+        switch (textureFormat)
+        {
+        case ommCpuTextureFormat_UNORM8: return sizeof(uint8_t);
+        case ommCpuTextureFormat_FP32: return sizeof(float);
+        default: return 0;
+        }
+    }
+
+    static bool IsBakeRequestValid(const OmmBakeRequest& request)
+    { // the baker trusts the header, so everything it reads must be covered by the received data
+        const OmmBakeRequestHeader& header = request.header;
+
+        uint32_t indexSize = GetIndexSize(header.indexFormat);
+        uint32_t texCoordSize = GetTexCoordSize(header.texCoordFormat);
+        uint32_t texelSize = GetTexelSize(header.textureFormat);
+        if (!indexSize || !texCoordSize || !texelSize)
+            return false;
+
+        if (uint64_t(header.indexCount) * indexSize > header.indexDataSize)
+            return false;
+
+        for (uint32_t mip = 0; mip < header.mipNum; ++mip)
+        {
+            uint64_t texelNum = uint64_t(header.mipWidth[mip]) * header.mipHeight[mip];
+            if (texelNum > header.mipDataSize[mip] / texelSize)
+                return false;
+        }
+
+        uint64_t maxIndex = 0;
+        for (uint32_t i = 0; i < header.indexCount; ++i)
+        {
+            uint32_t index = 0;
+            if (indexSize == sizeof(uint16_t))
+                index = ((const uint16_t*)request.indices.data())[i];
+            else
+                index = ((const uint32_t*)request.indices.data())[i];
+            maxIndex = index > maxIndex ? index : maxIndex;
+        }
+
+        return header.indexCount == 0 || (maxIndex + 1) * texCoordSize <= header.texCoordDataSize;
+    }
+
+    bool RecvBakeRequest(OmmBakeSocket socket, OmmBakeRequest& outRequest)
+    {
+        OmmBakeRequestHeader& header = outRequest.header;
+        if (!OmmBakeSocketApi::Recv(socket, &header, sizeof(header)))
+            return false;
+
+        if (header.magic != OMM_BAKE_PROTOCOL_MAGIC || header.version != OMM_BAKE_PROTOCOL_VERSION || header.mipNum > OMM_BAKE_PROTOCOL_MAX_MIP_NUM)
+        {
+            printf("[FAIL]: Invalid bake request header\n");
+            return false;
+        }
+
+        bool result = RecvChunk(socket, outRequest.indices, header.indexDataSize);
+        result = result && RecvChunk(socket, outRequest.texCoords, header.texCoordDataSize);
+        for (uint32_t mip = 0; mip < header.mipNum && result; ++mip)
+            result = RecvChunk(socket, outRequest.mips[mip], header.mipDataSize[mip]);
+
+        if (result && !IsBakeRequestValid(outRequest))
+        {
+            printf("[FAIL]: Bake request sizes don't match its data\n");
+            return false;
+        }
+        return result;
+    }
+
+    bool SendBakeResponse(OmmBakeSocket socket, const OmmBakeResponseHeader& header, const std::vector<uint8_t>* outputs)
+    {
+        bool result = OmmBakeSocketApi::Send(socket, &header, sizeof(header));
+        for (uint32_t i = 0; i < OMM_BAKE_PROTOCOL_OUTPUT_NUM && result; ++i)
+            result = OmmBakeSocketApi::Send(socket, outputs[i].data(), header.sizes[i]);
+        return result;
+    }
+
+    bool RecvBakeResponse(OmmBakeSocket socket, OmmBakeResponseHeader& outHeader, std::vector<uint8_t>* outOutputs)
+    {
+        if (!OmmBakeSocketApi::Recv(socket, &outHeader, sizeof(outHeader)) || outHeader.magic != OMM_BAKE_PROTOCOL_MAGIC)
+            return false;
+
+        bool result = true;
+        for (uint32_t i = 0; i < OMM_BAKE_PROTOCOL_OUTPUT_NUM && result; ++i)
+            result = RecvChunk(socket, outOutputs[i], outHeader.sizes[i]);
+        return result;
+    }
+}
@@ -0,0 +1,102 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+// Wire format shared by the local bake server (Source/BakeServer) and OpacityMicroMapsHelper client mode.
+// Only OMM SDK level data is transferred, so the server doesn't depend on NRI.
+// Request:  OmmBakeRequestHeader, indices, texCoords, mips[0..mipNum)
+// Response: OmmBakeResponseHeader, outputs[0..OMM_BAKE_PROTOCOL_OUTPUT_NUM) in OmmDataLayout order
+
+#define OMM_BAKE_PROTOCOL_MAGIC 0x4B424D4F // "OMBK"
+#define OMM_BAKE_PROTOCOL_VERSION 1
+#define OMM_BAKE_PROTOCOL_MAX_MIP_NUM 16
+#define OMM_BAKE_PROTOCOL_OUTPUT_NUM 5 // OmmDataLayout::CpuMaxNum
+#define OMM_BAKE_PROTOCOL_MAX_CHUNK_SIZE (4ull * 1024 * 1024 * 1024) // sanity limit for sizes coming from the wire or the cache
+#define OMM_BAKE_SERVER_DEFAULT_SOCKET "omm_bake_server.sock"
+#define OMM_BAKE_SERVER_CONNECT_ATTEMPT_NUM 4
+#define OMM_BAKE_SERVER_CONNECT_DELAY_MS 50 // doubled after every failed attempt
+
+namespace ommhelper
+{
+    struct OmmBakeRequestHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+
+        // ommCpuBakeInputDesc
+        uint32_t bakeFlags;
+        uint32_t alphaMode;
+        uint32_t format;
+        uint32_t filter;
+        uint32_t addressingMode;
+        uint32_t maxSubdivisionLevel;
+        float alphaCutoff;
+        float dynamicSubdivisionScale;
+
+        uint32_t indexFormat;
+        uint32_t indexCount;
+        uint32_t texCoordFormat;
+        uint32_t textureFormat;
+        uint32_t mipNum;
+        uint32_t reserved; // keeps the header free of padding, hashed as is
+        uint32_t mipWidth[OMM_BAKE_PROTOCOL_MAX_MIP_NUM];
+        uint32_t mipHeight[OMM_BAKE_PROTOCOL_MAX_MIP_NUM];
+
+        uint64_t indexDataSize;
+        uint64_t texCoordDataSize;
+        uint64_t mipDataSize[OMM_BAKE_PROTOCOL_MAX_MIP_NUM];
+    };
+
+    struct OmmBakeResponseHeader
+    {
+        uint32_t magic;
+        int32_t result; // ommResult
+        uint64_t requestHash;
+        uint64_t sizes[OMM_BAKE_PROTOCOL_OUTPUT_NUM];
+        uint32_t indexFormat; // ommIndexFormat
+        uint32_t descArrayHistogramCount;
+        uint32_t indexHistogramCount;
+        uint32_t isFromCache;
+    };
+
+    struct OmmBakeRequest
+    {
+        OmmBakeRequestHeader header;
+        std::vector<uint8_t> indices;
+        std::vector<uint8_t> texCoords;
+        std::vector<uint8_t> mips[OMM_BAKE_PROTOCOL_MAX_MIP_NUM];
+    };
+
+    typedef uintptr_t OmmBakeSocket;
+    constexpr OmmBakeSocket OMM_BAKE_INVALID_SOCKET = OmmBakeSocket(~0ull);
+
+    struct OmmBakeSocketApi
+    { // Unix domain sockets. On Windows AF_UNIX is available since 10 1803
+        static bool Initialize();
+        static OmmBakeSocket Connect(const char* path);
+        static OmmBakeSocket Listen(const char* path);
+        static OmmBakeSocket Accept(OmmBakeSocket listenSocket, uint32_t timeoutMs); // invalid socket on timeout
+        static bool Send(OmmBakeSocket socket, const void* data, size_t size);
+        static bool Recv(OmmBakeSocket socket, void* data, size_t size);
+        static void Shutdown(OmmBakeSocket socket); // blocked and following Recv calls fail, Send keeps working
+        static void Close(OmmBakeSocket socket);
+    };
+
+    uint64_t CalculateBakeRequestHash(const OmmBakeRequestHeader& header, const void* indices, const void* texCoords, const void* const* mips);
+
+    bool SendBakeRequest(OmmBakeSocket socket, const OmmBakeRequestHeader& header, const void* indices, const void* texCoords, const void* const* mips);
+    bool RecvBakeRequest(OmmBakeSocket socket, OmmBakeRequest& outRequest);
+    bool SendBakeResponse(OmmBakeSocket socket, const OmmBakeResponseHeader& header, const std::vector<uint8_t>* outputs);
+    bool RecvBakeResponse(OmmBakeSocket socket, OmmBakeResponseHeader& outHeader, std::vector<uint8_t>* outOutputs);
+}
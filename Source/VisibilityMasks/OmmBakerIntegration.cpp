@@ -14,7 +14,7 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
     if ((result) != nri::Result::SUCCESS) \
         exit(1);
 
-void OmmBakerGpuIntegration::Initialize(nri::Device& device)
+void OmmBakerGpuIntegration::Initialize(nri::Device& device, const OmmBakerGpuIntegration* shareFrom)
 {
     m_Device = &device;
 
@@ -53,14 +53,33 @@ void OmmBakerGpuIntegration::Initialize(nri::Device& device)
         std::abort();
     }
 
-    nri::CommandQueue* commandQueue = nullptr;
-    NRI_ABORT_ON_FAILURE(NRI.GetCommandQueue(*m_Device, nri::CommandQueueType::GRAPHICS, commandQueue));
+    if (shareFrom)
     {
-        CreateStaticResources(commandQueue);
-        CreateSamplers(m_PipelineInfo);
-        CreateFrameBuffers(m_PipelineInfo->pipelineNum);
-        CreatePipelines(m_PipelineInfo);
+        if (shareFrom->m_Device != m_Device || shareFrom->m_PipelineInfo->pipelineNum != m_PipelineInfo->pipelineNum)
+        {
+            printf("[FAIL]: OmmBakerGpuIntegration can only share resources of the same device and pipeline set\n");
+            std::abort();
+        }
+        m_Shared = shareFrom->m_Shared;
     }
+    else
+    {
+        m_Shared = std::shared_ptr<SharedResources>(new SharedResources(), [](SharedResources* shared) { shared->Destroy(); delete shared; });
+        m_Shared->NRI = NRI;
+
+        nri::CommandQueue* commandQueue = nullptr;
+        NRI_ABORT_ON_FAILURE(NRI.GetCommandQueue(*m_Device, nri::CommandQueueType::GRAPHICS, commandQueue));
+        {
+            CreateStaticResources(commandQueue);
+            CreateSamplers(m_PipelineInfo);
+            CreatePipelines(m_PipelineInfo);
+        }
+    }
+
+    for (uint32_t i = 0; i < (uint32_t)GpuStaticResources::Count; ++i)
+        m_StaticBuffers[i] = m_Shared->staticBuffers[i];
+
+    CreateFrameBuffers();
 }
 
 ommTexCoordFormat GetOmmTexcoordFormat(nri::Format format)
@@ -242,7 +261,7 @@ void OmmBakerGpuIntegration::CreateGraphicsPipeline(uint32_t pipelineId, const o
 
     nri::DescriptorRangeDesc& staticSamplersRange = descriptorRangeDescs.back();
     staticSamplersRange.baseRegisterIndex = 0;
-    staticSamplersRange.descriptorNum = (uint32_t)m_Samplers.size();
+    staticSamplersRange.descriptorNum = (uint32_t)m_Shared->samplers.size();
     staticSamplersRange.descriptorType = nri::DescriptorType::SAMPLER;
     staticSamplersRange.visibility = nri::ShaderStage::ALL;
 
@@ -271,10 +290,10 @@ void OmmBakerGpuIntegration::CreateGraphicsPipeline(uint32_t pipelineId, const o
         layoutDesc.pushConstants = &pushConstantDesc;
         layoutDesc.pushConstantNum = 1;
     }
-    NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, layoutDesc, m_NriPipelineLayouts.emplace_back()));
+    NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, layoutDesc, m_Shared->pipelineLayouts.emplace_back()));
 
     nri::GraphicsPipelineDesc nriPipelineDesc = {};
-    nriPipelineDesc.pipelineLayout = m_NriPipelineLayouts.back();
+    nriPipelineDesc.pipelineLayout = m_Shared->pipelineLayouts.back();
 
     ommGpuGraphicsPipelineInputElementDesc inputElementDesc = ommGpuGraphicsPipelineInputElementDescDefault();
     nri::VertexAttributeDesc vertextAttributes = {};
@@ -320,7 +339,7 @@ void OmmBakerGpuIntegration::CreateGraphicsPipeline(uint32_t pipelineId, const o
     outputMergerDesc.color = colorAttachments.data();
     outputMergerDesc.depth.write = false;
 
-    m_FrameBufferPerPipeline[pipelineId] = outputMergerDesc.colorNum ? &m_FrameBuffers[m_DebugFrameBufferId] : &m_FrameBuffers[m_EmptyFrameBufferId];
+    m_Shared->frameBufferIdPerPipeline[pipelineId] = outputMergerDesc.colorNum ? m_DebugFrameBufferId : m_EmptyFrameBufferId;
 
     std::vector<nri::ShaderDesc> shaderStages;
     if (pipelineDesc.vertexShader.data)
@@ -350,7 +369,7 @@ void OmmBakerGpuIntegration::CreateGraphicsPipeline(uint32_t pipelineId, const o
 
     nriPipelineDesc.shaderStages = shaderStages.data();
     nriPipelineDesc.shaderStageNum = (uint32_t)shaderStages.size();
-    NRI_ABORT_ON_FAILURE(NRI.CreateGraphicsPipeline(*m_Device, nriPipelineDesc, m_NriPipelines.emplace_back()));
+    NRI_ABORT_ON_FAILURE(NRI.CreateGraphicsPipeline(*m_Device, nriPipelineDesc, m_Shared->pipelines.emplace_back()));
 }
 
 void OmmBakerGpuIntegration::CreateComputePipeline(uint32_t id, const ommGpuPipelineInfoDesc* pipelineInfo)
@@ -362,7 +381,7 @@ void OmmBakerGpuIntegration::CreateComputePipeline(uint32_t id, const ommGpuPipe
 
     nri::DescriptorRangeDesc& staticSamplersRange = descriptorRangeDescs.back();
     staticSamplersRange.baseRegisterIndex = 0;
-    staticSamplersRange.descriptorNum = (uint32_t)m_Samplers.size();
+    staticSamplersRange.descriptorNum = (uint32_t)m_Shared->samplers.size();
     staticSamplersRange.descriptorType = nri::DescriptorType::SAMPLER;
     staticSamplersRange.visibility = nri::ShaderStage::ALL;
 
@@ -390,15 +409,15 @@ void OmmBakerGpuIntegration::CreateComputePipeline(uint32_t id, const ommGpuPipe
         layoutDesc.pushConstants = &pushConstantDesc;
         layoutDesc.pushConstantNum = 1;
     }
-    NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, layoutDesc, m_NriPipelineLayouts.emplace_back()));
+    NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, layoutDesc, m_Shared->pipelineLayouts.emplace_back()));
 
     nri::ComputePipelineDesc nriPipelineDesc = {};
-    nriPipelineDesc.pipelineLayout = m_NriPipelineLayouts.back();
+    nriPipelineDesc.pipelineLayout = m_Shared->pipelineLayouts.back();
     nriPipelineDesc.computeShader.bytecode = pipelineDesc.computeShader.data;
     nriPipelineDesc.computeShader.size = pipelineDesc.computeShader.size;
     nriPipelineDesc.computeShader.entryPointName = pipelineDesc.shaderEntryPointName;
     nriPipelineDesc.computeShader.stage = nri::ShaderStage::COMPUTE;
-    NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, nriPipelineDesc, m_NriPipelines.emplace_back()));
+    NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, nriPipelineDesc, m_Shared->pipelines.emplace_back()));
 }
 
 inline void FillSamplerDesc(nri::SamplerDesc& nriDesc, const ommGpuStaticSamplerDesc& ommDesc)
@@ -420,14 +439,12 @@ void OmmBakerGpuIntegration::CreateSamplers(const ommGpuPipelineInfoDesc* pipeli
         FillSamplerDesc(samplerDesc, ommDesc);
         nri::Descriptor* descriptor = nullptr;
         NRI_ABORT_ON_FAILURE(NRI.CreateSampler(*m_Device, samplerDesc, descriptor));
-        m_Samplers.push_back(descriptor);
+        m_Shared->samplers.push_back(descriptor);
     }
 }
 
-void OmmBakerGpuIntegration::CreateFrameBuffers(uint32_t pipelineNum)
+void OmmBakerGpuIntegration::CreateFrameBuffers()
 {
-    m_FrameBufferPerPipeline.resize(pipelineNum, nullptr);
-
     {//create empty framebuffer
         nri::FrameBufferDesc frameBufferDesc = {};
         frameBufferDesc.colorAttachmentNum = 0;
@@ -437,7 +454,10 @@ void OmmBakerGpuIntegration::CreateFrameBuffers(uint32_t pipelineNum)
         frameBufferDesc.layerNum = 1;
         NRI.CreateFrameBuffer(*m_Device, frameBufferDesc, m_FrameBuffers[m_EmptyFrameBufferId].frameBuffer);
     }
+}
 
+void OmmBakerGpuIntegration::CreateDebugFrameBuffer()
+{
     {//create debug frame buffer
         nri::TextureDesc textureDesc = {};
         textureDesc.arraySize = 1;
@@ -475,6 +495,7 @@ void OmmBakerGpuIntegration::CreateFrameBuffers(uint32_t pipelineNum)
 
 void OmmBakerGpuIntegration::CreatePipelines(const ommGpuPipelineInfoDesc* pipelinesInfo)
 {
+    m_Shared->frameBufferIdPerPipeline.resize(pipelinesInfo->pipelineNum, m_EmptyFrameBufferId);
     for (uint32_t i = 0; i < pipelinesInfo->pipelineNum; ++i)
     {
         const ommGpuPipelineDesc& ommPipelineDesc = pipelinesInfo->pipelines[i];
@@ -505,10 +526,10 @@ void OmmBakerGpuIntegration::CreateStaticResources(nri::CommandQueue* commandQue
         nri::BufferDesc bufferDesc = {};
         bufferDesc.size = outSize;
         bufferDesc.usageMask = usageBits[i];
-        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_StaticBuffers[i].buffer));
+        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_Shared->staticBuffers[i].buffer));
 
         nri::BufferUploadDesc& uploadDesc = bufferUploadDescs[i];
-        uploadDesc.buffer = m_StaticBuffers[i].buffer;
+        uploadDesc.buffer = m_Shared->staticBuffers[i].buffer;
         uploadDesc.bufferOffset = 0;
         uploadDesc.data = &uploadData[i][0];
         uploadDesc.dataSize = outSize;
@@ -516,16 +537,16 @@ void OmmBakerGpuIntegration::CreateStaticResources(nri::CommandQueue* commandQue
         uploadDesc.nextAccess = nexAccessBits[i];
     }
 
-    nri::Buffer* buffers[] = { m_StaticBuffers[0].buffer, m_StaticBuffers[1].buffer };
+    nri::Buffer* buffers[] = { m_Shared->staticBuffers[0].buffer, m_Shared->staticBuffers[1].buffer };
     nri::ResourceGroupDesc resourceGrpoupDesc = {};
     resourceGrpoupDesc.bufferNum = (uint32_t)GpuStaticResources::Count;
     resourceGrpoupDesc.buffers = buffers;
     resourceGrpoupDesc.memoryLocation = nri::MemoryLocation::DEVICE;
 
-    size_t currentMemoryAllocSize = m_NriStaticMemories.size();
+    size_t currentMemoryAllocSize = m_Shared->staticMemories.size();
     uint32_t allocRequestNum = NRI.CalculateAllocationNumber(*m_Device, resourceGrpoupDesc);
-    m_NriStaticMemories.resize(currentMemoryAllocSize + allocRequestNum, nullptr);
-    NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGrpoupDesc, m_NriStaticMemories.data() + currentMemoryAllocSize));
+    m_Shared->staticMemories.resize(currentMemoryAllocSize + allocRequestNum, nullptr);
+    NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGrpoupDesc, m_Shared->staticMemories.data() + currentMemoryAllocSize));
     NRI_ABORT_ON_FAILURE(NRI.UploadData(*commandQueue, nullptr, 0, bufferUploadDescs, (uint32_t)GpuStaticResources::Count));
 }
 
@@ -715,7 +736,7 @@ void OmmBakerGpuIntegration::UpdateDescriptorPool(uint32_t geometryId, const omm
 
     desc.descriptorSetMaxNum = uniqueDescriptorSetNum;
     desc.dynamicConstantBufferMaxNum = dispatchNum;
-    desc.samplerMaxNum = uniqueDescriptorSetNum * (uint32_t)m_Samplers.size();
+    desc.samplerMaxNum = uniqueDescriptorSetNum * (uint32_t)m_Shared->samplers.size();
     NRI_ABORT_ON_FAILURE(NRI.CreateDescriptorPool(*m_Device, desc, desctriptorPool));
 }
 
@@ -816,8 +837,8 @@ nri::DescriptorSet* OmmBakerGpuIntegration::PrepareDispatch(nri::CommandBuffer&
     }
 
     nri::DescriptorRangeUpdateDesc& staticSamlersRange = rangeUpdateDescs.emplace_back();
-    staticSamlersRange.descriptors = m_Samplers.data();
-    staticSamlersRange.descriptorNum = (uint32_t)m_Samplers.size();
+    staticSamlersRange.descriptors = m_Shared->samplers.data();
+    staticSamlersRange.descriptorNum = (uint32_t)m_Shared->samplers.size();
     staticSamlersRange.offsetInRange = 0;
 
     nri::TransitionBarrierDesc transitionBarriers = {};
@@ -826,7 +847,7 @@ nri::DescriptorSet* OmmBakerGpuIntegration::PrepareDispatch(nri::CommandBuffer&
     if (transitionBarriers.bufferNum)
         NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
 
-    nri::PipelineLayout*& pipelineLayout = m_NriPipelineLayouts[pipelineIndex];
+    nri::PipelineLayout*& pipelineLayout = m_Shared->pipelineLayouts[pipelineIndex];
     NRI.CmdSetPipelineLayout(commandBuffer, *pipelineLayout);
 
     // Descriptor set
@@ -843,7 +864,7 @@ nri::DescriptorSet* OmmBakerGpuIntegration::PrepareDispatch(nri::CommandBuffer&
     else
         descriptorSet = it->second;
 
-    NRI.CmdSetPipeline(commandBuffer, *m_NriPipelines[pipelineIndex]);
+    NRI.CmdSetPipeline(commandBuffer, *m_Shared->pipelines[pipelineIndex]);
 
     return descriptorSet;
 }
@@ -925,7 +946,11 @@ void OmmBakerGpuIntegration::DispatchDrawIndexedIndirect(nri::CommandBuffer& com
         argBuffer.state = nri::AccessBits::ARGUMENT_BUFFER;
     }
 
-    FrameBuffer* frameBuffer = m_FrameBufferPerPipeline[desc.pipelineIndex];
+    uint32_t frameBufferId = m_Shared->frameBufferIdPerPipeline[desc.pipelineIndex];
+    if (frameBufferId == m_DebugFrameBufferId && !m_FrameBuffers[frameBufferId].frameBuffer)
+        CreateDebugFrameBuffer(); // large, so created on first use
+
+    FrameBuffer* frameBuffer = &m_FrameBuffers[frameBufferId];
     if (frameBuffer->texture && frameBuffer->state != nri::AccessBits::COLOR_ATTACHMENT)
     { // perform debug frame buffer transition
         nri::TextureTransitionBarrierDesc textureBarrierDesc = {};
@@ -1112,27 +1137,34 @@ void OmmBakerGpuIntegration::Destroy()
             frameBuffer.memory = nullptr;
         }
     }
-    m_FrameBufferPerPipeline.resize(0);
-    m_FrameBufferPerPipeline.shrink_to_fit();
 
-    for (auto& sampler : m_Samplers)
+    for (uint32_t i = 0; i < (uint32_t)GpuStaticResources::Count; ++i)
+        m_StaticBuffers[i] = {};
+    m_Shared.reset();
+
+    ommGpuDestroyPipeline(m_GpuBaker, m_Pipeline);
+    ommDestroyBaker(m_GpuBaker);
+    m_Pipeline = 0;
+    m_GpuBaker = 0;
+}
+
+void OmmBakerGpuIntegration::SharedResources::Destroy()
+{
+    for (auto& sampler : samplers)
         if (sampler) NRI.DestroyDescriptor(*sampler);
 
-    for (auto& pipeline : m_NriPipelines)
+    for (auto& pipeline : pipelines)
         if (pipeline) NRI.DestroyPipeline(*pipeline);
 
-    for (auto& layout : m_NriPipelineLayouts)
+    for (auto& layout : pipelineLayouts)
         if (layout) NRI.DestroyPipelineLayout(*layout);
 
     for (uint32_t i = 0; i < (uint32_t)GpuStaticResources::Count; ++i)
     {
-        if (m_StaticBuffers[i].buffer)
-            NRI.DestroyBuffer(*m_StaticBuffers[i].buffer);
+        if (staticBuffers[i].buffer)
+            NRI.DestroyBuffer(*staticBuffers[i].buffer);
     }
 
-    for (auto& memory : m_NriStaticMemories)
+    for (auto& memory : staticMemories)
         if (memory) NRI.FreeMemory(*memory);
-
-    ommGpuDestroyPipeline(m_GpuBaker, m_Pipeline);
-    ommDestroyBaker(m_GpuBaker);
 }
\ No newline at end of file
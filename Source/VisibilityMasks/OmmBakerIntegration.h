@@ -11,6 +11,7 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
 #pragma once
 #include <vector>
 #include <map>
+#include <memory>
 
 #include "../../External/NRIFramework/External/NRI/Include/NRI.h"
 #include "../../External/NRIFramework/External/NRI/Include/Extensions/NRIHelper.h"
@@ -143,10 +144,13 @@ struct InputGeometryDesc
     BakerSettings settings;
 };
 
+// All per-bake state (geometry queue, descriptors, constant buffer, frame buffers, omm pipeline) is owned by the instance.
+// Instances initialized with "shareFrom" reuse its NRI pipelines, samplers and static buffers, which are immutable after creation,
+// so several instances can record bakes concurrently on separate threads and command buffers.
 class OmmBakerGpuIntegration
 {
 public:
-    void Initialize(nri::Device& device);                                                               //0.
+    void Initialize(nri::Device& device, const OmmBakerGpuIntegration* shareFrom = nullptr);            //0.
     void GetPrebuildInfo(InputGeometryDesc* geometryDesc, uint32_t geometryNum);                        //1. Get info on output resources sizes
     void Bake(nri::CommandBuffer& commandBuffer, InputGeometryDesc* geometryDesc, uint32_t geometryNum);//2. After the queue is ready kick off the baker
     void ReleaseTemporalResources();                                                                    //3. Clean up internal data after work is finished
@@ -180,9 +184,23 @@ private:
         ommGpuDispatchConfigDesc dispatchConfigDesc;
     };
 
+    struct SharedResources
+    { // immutable after creation, released with the last instance referencing it
+        NRIInterface NRI = {};
+        BufferResource staticBuffers[(uint32_t)GpuStaticResources::Count] = {};
+        std::vector<nri::Memory*> staticMemories;
+        std::vector<nri::Descriptor*> samplers;
+        std::vector<nri::Pipeline*> pipelines;
+        std::vector<nri::PipelineLayout*> pipelineLayouts;
+        std::vector<uint32_t> frameBufferIdPerPipeline;
+
+        void Destroy();
+    };
+
 private:
     //On Init
-    void CreateFrameBuffers(uint32_t pipelineNum);
+    void CreateFrameBuffers();
+    void CreateDebugFrameBuffer();
     void CreateSamplers(const ommGpuPipelineInfoDesc* pipelinesInfo);
     void CreatePipelines(const ommGpuPipelineInfoDesc* pipelinesInfo);
     void CreateComputePipeline(uint32_t id, const ommGpuPipelineInfoDesc* pipelineInfo);
@@ -211,42 +229,36 @@ private:
 private:
     std::vector<GeometryQueueInstance> m_GeometryQueue;
 
+    //shared: pipelines, samplers, static buffers
+    std::shared_ptr<SharedResources> m_Shared;
+
     //resources
-    BufferResource m_StaticBuffers[(uint32_t)GpuStaticResources::Count];
+    BufferResource m_StaticBuffers[(uint32_t)GpuStaticResources::Count] = {}; // shared buffers, per instance state
     std::map<uint64_t, nri::Descriptor*> m_NriDescriptors;
     std::map<uint64_t, nri::DescriptorSet*> m_NriDescriptorSets;
-    std::vector<nri::Memory*> m_NriStaticMemories;
     std::vector<nri::DescriptorPool*> m_NriDescriptorPools;
 
-    //samplers
-    std::vector<nri::Descriptor*> m_Samplers;
-
-    //pipelines
-    std::vector<nri::Pipeline*> m_NriPipelines;
-    std::vector<nri::PipelineLayout*> m_NriPipelineLayouts;
-
     //vars
     NRIInterface NRI = {};
-    nri::Device* m_Device;
+    nri::Device* m_Device = nullptr;
 
     //CB
-    nri::Descriptor* m_ConstantBufferView;
-    nri::Buffer* m_ConstantBuffer;
-    nri::Memory* m_ConstantBufferHeap;
-    uint32_t m_ConstantBufferViewSize;
-    uint32_t m_ConstantBufferSize;
-    uint32_t m_ConstantBufferOffset;
+    nri::Descriptor* m_ConstantBufferView = nullptr;
+    nri::Buffer* m_ConstantBuffer = nullptr;
+    nri::Memory* m_ConstantBufferHeap = nullptr;
+    uint32_t m_ConstantBufferViewSize = 0;
+    uint32_t m_ConstantBufferSize = 0;
+    uint32_t m_ConstantBufferOffset = 0;
 
     //framebuffers
-    FrameBuffer m_FrameBuffers[2];
-    std::vector<FrameBuffer*> m_FrameBufferPerPipeline;
+    FrameBuffer m_FrameBuffers[2] = {};
     const uint32_t m_EmptyFrameBufferId = 0;
     const uint32_t m_DebugFrameBufferId = 1;
     const nri::Format m_DebugTexFormat = nri::Format::RGBA8_SNORM;
 
-    //ommbaker
-    const ommGpuPipelineInfoDesc* m_PipelineInfo;
-    ommBaker m_GpuBaker;
-    ommGpuPipeline m_Pipeline;
+    //ommbaker: per instance, the dispatch chain returned by ommGpuDispatch is owned by the pipeline
+    const ommGpuPipelineInfoDesc* m_PipelineInfo = nullptr;
+    ommBaker m_GpuBaker = 0;
+    ommGpuPipeline m_Pipeline = 0;
 };
 
@@ -0,0 +1,285 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#include "OmmCpuTopology.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+    #undef APIENTRY
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <sched.h>
+    #include <dirent.h>
+#endif
+
+namespace ommhelper
+{
+#ifndef _WIN32
+    static std::vector<uint32_t> ParseCpuList(const char* cpuList)
+    { // "0-15,32-47\n"
+        std::vector<uint32_t> result;
+        const char* it = cpuList;
+        while (*it)
+        {
+            char* end = nullptr;
+            uint32_t first = (uint32_t)strtoul(it, &end, 10);
+            if (end == it)
+                break;
+            uint32_t last = first;
+            it = end;
+            if (*it == '-')
+            {
+                ++it;
+                last = (uint32_t)strtoul(it, &end, 10);
+                it = end;
+            }
+            for (uint32_t cpu = first; cpu <= last; ++cpu)
+                result.push_back(cpu);
+            if (*it != ',')
+                break;
+            ++it;
+        }
+        return result;
+    }
+#endif
+
+    std::vector<CpuNode> CpuTopology::DiscoverNodes()
+    {
+        std::vector<CpuNode> nodes;
+#ifdef _WIN32
+        ULONG highestNode = 0;
+        if (GetNumaHighestNodeNumber(&highestNode))
+        {
+            DWORD_PTR processMask = 0;
+            DWORD_PTR systemMask = 0;
+            GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask);
+            for (USHORT node = 0; node <= (USHORT)highestNode; ++node)
+            {
+                GROUP_AFFINITY affinity = {};
+                if (!GetNumaNodeProcessorMaskEx(node, &affinity) || !affinity.Mask)
+                    continue;
+
+                CpuNode cpuNode = { node, {} };
+                for (uint32_t bit = 0; bit < sizeof(KAFFINITY) * 8; ++bit)
+                {
+                    KAFFINITY cpuBit = KAFFINITY(1) << bit;
+                    bool isAllowed = affinity.Group != 0 || (processMask & cpuBit);
+                    if ((affinity.Mask & cpuBit) && isAllowed)
+                        cpuNode.logicalCpus.push_back(uint32_t(affinity.Group) * 64 + bit);
+                }
+                if (!cpuNode.logicalCpus.empty())
+                    nodes.push_back(cpuNode);
+            }
+        }
+#else
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        bool hasAffinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+        std::map<uint32_t, CpuNode> sortedNodes;
+        if (DIR* dir = opendir("/sys/devices/system/node"))
+        {
+            while (dirent* entry = readdir(dir))
+            {
+                uint32_t nodeId = 0;
+                char tail = 0;
+                if (sscanf(entry->d_name, "node%u%c", &nodeId, &tail) != 1)
+                    continue;
+
+                std::string path = std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist";
+                FILE* file = fopen(path.c_str(), "r");
+                if (!file)
+                    continue;
+
+                char cpuList[4096] = {};
+                size_t readSize = fread(cpuList, 1, sizeof(cpuList) - 1, file);
+                fclose(file);
+                cpuList[readSize] = 0;
+
+                CpuNode cpuNode = { nodeId, {} };
+                for (uint32_t cpu : ParseCpuList(cpuList))
+                {
+                    if (!hasAffinity || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)))
+                        cpuNode.logicalCpus.push_back(cpu);
+                }
+                if (!cpuNode.logicalCpus.empty())
+                    sortedNodes[nodeId] = cpuNode;
+            }
+            closedir(dir);
+        }
+        for (auto& it : sortedNodes)
+            nodes.push_back(it.second);
+#endif
+
+        if (nodes.empty())
+        { // no NUMA info: treat the machine as a single node
+            CpuNode cpuNode = { 0, {} };
+            uint32_t cpuNum = std::max(std::thread::hardware_concurrency(), 1u);
+            for (uint32_t cpu = 0; cpu < cpuNum; ++cpu)
+                cpuNode.logicalCpus.push_back(cpu);
+            nodes.push_back(cpuNode);
+        }
+
+        printf("[OMM] CPU topology: %u node(s):", (uint32_t)nodes.size());
+        for (const CpuNode& node : nodes)
+            printf(" node%u[%u cpus]", node.id, (uint32_t)node.logicalCpus.size());
+        printf("\n");
+
+        return nodes;
+    }
+
+    const std::vector<CpuNode>& CpuTopology::GetNodes()
+    {
+        static const std::vector<CpuNode> nodes = DiscoverNodes();
+        return nodes;
+    }
+
+    bool CpuTopology::PinCurrentThread(uint32_t nodeIndex)
+    {
+        const std::vector<CpuNode>& nodes = GetNodes();
+        if (nodeIndex >= nodes.size())
+            return false;
+
+        const CpuNode& node = nodes[nodeIndex];
+#ifdef _WIN32
+        GROUP_AFFINITY affinity = {};
+        affinity.Group = WORD(node.logicalCpus[0] / 64);
+        for (uint32_t cpu : node.logicalCpus)
+        {
+            if (cpu / 64 == affinity.Group)
+                affinity.Mask |= KAFFINITY(1) << (cpu % 64);
+        }
+        return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#else
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        for (uint32_t cpu : node.logicalCpus)
+        {
+            if (cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &cpuSet);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#endif
+    }
+
+    std::vector<uint32_t> CpuTopology::PartitionByTexture(const uint64_t* textureKeys, const uint64_t* workloads, size_t count, uint32_t nodeNum)
+    {
+        std::vector<uint32_t> result(count, 0);
+        if (nodeNum <= 1)
+            return result;
+
+        std::map<uint64_t, uint64_t> textureToWorkload;
+        for (size_t i = 0; i < count; ++i)
+            textureToWorkload[textureKeys[i]] += workloads[i];
+
+        std::vector<std::pair<uint64_t, uint64_t>> sortedTextures(textureToWorkload.begin(), textureToWorkload.end());
+        std::stable_sort(sortedTextures.begin(), sortedTextures.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+        // Heaviest texture first to the least loaded node. Cpu count per node is not equal on every machine.
+        const std::vector<CpuNode>& nodes = GetNodes();
+        std::vector<double> nodeLoad(nodeNum, 0.0);
+        std::map<uint64_t, uint32_t> textureToNode;
+        for (const auto& texture : sortedTextures)
+        {
+            uint32_t bestNode = 0;
+            double bestLoad = 0.0;
+            for (uint32_t node = 0; node < nodeNum; ++node)
+            {
+                double cpuNum = node < nodes.size() ? (double)nodes[node].logicalCpus.size() : 1.0;
+                double load = (nodeLoad[node] + (double)texture.second) / cpuNum;
+                if (node == 0 || load < bestLoad)
+                {
+                    bestLoad = load;
+                    bestNode = node;
+                }
+            }
+            nodeLoad[bestNode] += (double)texture.second;
+            textureToNode[texture.first] = bestNode;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+            result[i] = textureToNode[textureKeys[i]];
+
+        return result;
+    }
+
+    void CpuWorkerPool::Start(uint32_t workerNum, uint32_t nodeIndex)
+    {
+        Stop();
+        m_IsStopped = false;
+        m_Workers.reserve(workerNum);
+        for (uint32_t worker = 0; worker < workerNum; ++worker)
+            m_Workers.emplace_back(&CpuWorkerPool::WorkerLoop, this, worker, nodeIndex);
+    }
+
+    void CpuWorkerPool::Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_IsStopped = true;
+        }
+        m_JobCondition.notify_all();
+        for (std::thread& worker : m_Workers)
+            worker.join();
+        m_Workers.clear();
+    }
+
+    void CpuWorkerPool::Submit(Job job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Job = std::move(job);
+            m_BusyNum = (uint32_t)m_Workers.size();
+            ++m_JobId;
+        }
+        m_JobCondition.notify_all();
+    }
+
+    void CpuWorkerPool::Wait()
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_DoneCondition.wait(lock, [this]() { return m_BusyNum == 0; });
+        m_Job = nullptr;
+    }
+
+    void CpuWorkerPool::WorkerLoop(uint32_t workerIndex, uint32_t nodeIndex)
+    { // pinned before anything is allocated, so per worker state stays node-local
+        if (nodeIndex != OMM_CPU_NODE_ANY)
+            CpuTopology::PinCurrentThread(nodeIndex);
+
+        uint64_t jobId = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_JobCondition.wait(lock, [&]() { return m_IsStopped || m_JobId != jobId; });
+                if (m_IsStopped)
+                    return;
+                jobId = m_JobId;
+            }
+
+            m_Job(workerIndex); // not reassigned until every worker is done with it
+
+            bool isLast = false;
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                isLast = --m_BusyNum == 0;
+            }
+            if (isLast)
+                m_DoneCondition.notify_all();
+        }
+    }
+}
@@ -0,0 +1,75 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <stdint.h>
+#include <stddef.h>
+
+#define OMM_CPU_NODE_ANY uint32_t(-1)
+
+namespace ommhelper
+{
+    struct CpuNode
+    {
+        uint32_t id;
+        std::vector<uint32_t> logicalCpus; // only cpus the process is allowed to run on
+    };
+
+    struct CpuTopology
+    {
+        // Discovered once. Linux: /sys/devices/system/node, Windows: NUMA api. Falls back to a single node.
+        static const std::vector<CpuNode>& GetNodes();
+        static uint32_t GetNodeNum() { return (uint32_t)GetNodes().size(); };
+
+        // Restricts the calling thread to the cpus of the node. Threads spawned afterwards inherit the mask on Linux.
+        static bool PinCurrentThread(uint32_t nodeIndex);
+
+        // Greedy partitioning: all geometries sharing a texture go to the same node, nodes are balanced by workload.
+        // Returns node index per element.
+        static std::vector<uint32_t> PartitionByTexture(const uint64_t* textureKeys, const uint64_t* workloads, size_t count, uint32_t nodeNum);
+
+    private:
+        static std::vector<CpuNode> DiscoverNodes();
+    };
+
+    // Persistent workers, pinned to a node unless OMM_CPU_NODE_ANY is given. Threads are created once, not per bake.
+    // Submit() hands the same job to every worker, Wait() returns when all of them are done. One job at a time.
+    class CpuWorkerPool
+    {
+    public:
+        typedef std::function<void(uint32_t workerIndex)> Job;
+
+        ~CpuWorkerPool() { Stop(); };
+
+        void Start(uint32_t workerNum, uint32_t nodeIndex);
+        void Stop();
+        void Submit(Job job);
+        void Wait();
+        void Run(Job job) { Submit(std::move(job)); Wait(); };
+        uint32_t GetWorkerNum() const { return (uint32_t)m_Workers.size(); };
+
+    private:
+        void WorkerLoop(uint32_t workerIndex, uint32_t nodeIndex);
+
+        std::vector<std::thread> m_Workers;
+        std::mutex m_Mutex;
+        std::condition_variable m_JobCondition;
+        std::condition_variable m_DoneCondition;
+        Job m_Job;
+        uint64_t m_JobId = 0;
+        uint32_t m_BusyNum = 0;
+        bool m_IsStopped = false;
+    };
+}
@@ -9,12 +9,16 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
 */
 
 #include "OmmHelper.h"
+#include "OmmMicroTriangle.h"
 #include <filesystem>
+#include <thread>
+#include <chrono>
+#include <atomic>
 #include "ImGui/imgui.h"
 
 namespace ommhelper
 {
-    void OpacityMicroMapsHelper::Initialize(nri::Device* device, bool disableMaskedGeometryBuild)
+    void OpacityMicroMapsHelper::Initialize(nri::Device* device, bool disableMaskedGeometryBuild, const OpacityMicroMapsHelper* shareFrom, bool isIndexTypeUint8Enabled)
     {
         m_Device = device;
         if (m_Device)
@@ -39,7 +43,7 @@ namespace ommhelper
                 std::abort();
             }
 
-            m_GpuBakerIntegration.Initialize(*m_Device);
+            m_GpuBakerIntegration.Initialize(*m_Device, shareFrom ? &shareFrom->m_GpuBakerIntegration : nullptr);
 
             m_DisableGeometryBuild = disableMaskedGeometryBuild;
             if (m_DisableGeometryBuild)
@@ -54,13 +58,17 @@ namespace ommhelper
             {
                 nriResult |= (uint32_t)nri::nriGetInterface(*m_Device, NRI_INTERFACE(nri::WrapperVKInterface), (nri::WrapperVKInterface*)&NRI);
                 InitializeVK();
+                m_IsIndexTypeUint8Enabled = isIndexTypeUint8Enabled;
             }
         }
     }
 
     void OpacityMicroMapsHelper::Destroy()
     {
+        DisconnectFromBakeServer();
+        m_BakeServerPath.clear();
         m_GpuBakerIntegration.Destroy();
+        DestroyCpuWorkers();
         ommDestroyBaker(m_OmmCpuBaker);
         ReleaseGeometryMemory();
         if (NRI.GetDeviceDesc(*m_Device).graphicsAPI == nri::GraphicsAPI::D3D12)
@@ -195,6 +203,83 @@ namespace ommhelper
             ReleaseMemoryD3D12();
         else
             ReleaseMemoryVK();
+        m_GeometryHeaps.clear();
+    }
+
+    uint32_t OpacityMicroMapsHelper::BeginGeometryGeneration()
+    {
+        m_CurrentHeapOffset = m_DefaultHeapSize; // the next allocation opens a heap of the new generation
+        return ++m_GeometryGeneration;
+    }
+
+    uint64_t OpacityMicroMapsHelper::GetGeometryMemorySize(uint32_t generation)
+    {
+        uint64_t size = 0;
+        for (const GeometryHeap& heap : m_GeometryHeaps)
+            size += heap.generation == generation ? heap.size : 0;
+        return size;
+    }
+
+    void OpacityMicroMapsHelper::ReleaseGeometryMemory(uint32_t generation)
+    {
+        if (NRI.GetDeviceDesc(*m_Device).graphicsAPI == nri::GraphicsAPI::D3D12)
+            ReleaseMemoryD3D12(generation);
+        else
+            ReleaseMemoryVK(generation);
+
+        if (m_GeometryHeaps.empty() || m_GeometryHeaps.back().generation != m_GeometryGeneration)
+            m_CurrentHeapOffset = m_DefaultHeapSize;
+    }
+
+    bool OpacityMicroMapsHelper::IsOmmIndexFormatSupported(nri::Format format)
+    {
+        switch (format)
+        {
+        case nri::Format::R16_UINT:
+        case nri::Format::R32_UINT: return true;
+        case nri::Format::R8_UINT: return m_IsIndexTypeUint8Enabled; // Vulkan with indexTypeUint8 enabled on the device only, NVAPI accepts R16/R32 only
+        default: return false;
+        }
+    }
+
+    uint64_t OpacityMicroMapsHelper::CompactOmmIndices(OmmBakeGeometryDesc& instance)
+    {
+        std::vector<uint8_t>& indices = instance.outData[(uint32_t)OmmDataLayout::Indices];
+        const uint32_t stride = instance.outOmmIndexStride;
+        if (indices.empty() || stride <= sizeof(uint8_t))
+            return 0;
+
+        const size_t indexNum = indices.size() / stride;
+        int32_t maxIndex = -1;
+        for (size_t i = 0; i < indexNum; ++i)
+            maxIndex = std::max(maxIndex, ReadOmmIndex(indices.data(), stride, i));
+
+        // Regular indices must stay below the 4 special values occupying the top of the range
+        nri::Format format = instance.outOmmIndexFormat;
+        if (maxIndex < 0x100 - 4 && IsOmmIndexFormatSupported(nri::Format::R8_UINT))
+            format = nri::Format::R8_UINT;
+        else if (maxIndex < 0x10000 - 4)
+            format = nri::Format::R16_UINT;
+
+        const uint32_t newStride = GetOmmIndexStride(format);
+        if (newStride >= stride)
+            return 0;
+
+        std::vector<uint8_t> compacted(indexNum * newStride);
+        for (size_t i = 0; i < indexNum; ++i)
+        { // truncation keeps special indices special: -1 -> 0xFF / 0xFFFF
+            int32_t index = ReadOmmIndex(indices.data(), stride, i);
+            if (newStride == sizeof(uint8_t))
+                compacted[i] = uint8_t(index);
+            else
+                ((uint16_t*)compacted.data())[i] = uint16_t(index);
+        }
+
+        uint64_t savedSize = indices.size() - compacted.size();
+        indices.swap(compacted);
+        instance.outOmmIndexFormat = format;
+        instance.outOmmIndexStride = newStride;
+        return savedSize;
     }
 
 #pragma endregion
@@ -207,115 +292,537 @@ namespace ommhelper
         result |= !cpuBakerFlags.enableSpecialIndices ? uint32_t(ommCpuBakeFlags_DisableSpecialIndices) : 0;
         result |= !cpuBakerFlags.enableDuplicateDetection ? uint32_t(ommCpuBakeFlags_DisableDuplicateDetection) : 0;
         result |= cpuBakerFlags.enableNearDuplicateDetection ? uint32_t(ommCpuBakeFlags_EnableNearDuplicateDetection) : 0;
-        result |= !cpuBakerFlags.force32bitIndices ? uint32_t(ommCpuBakeFlags_Force32BitIndices) : 0;
+        result |= cpuBakerFlags.force32bitIndices ? uint32_t(ommCpuBakeFlags_Force32BitIndices) : 0;
         return  ommCpuBakeFlags(result);
     }
 
-    void OpacityMicroMapsHelper::BakeOpacityMicroMapsCpu(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc)
+    static ommBaker CreateCpuBaker()
     {
-        for (size_t i = 0; i < count; ++i)
+        ommBaker baker = 0;
+        ommBakerCreationDesc bakerDesc = ommBakerCreationDescDefault();
+        bakerDesc.enableValidation = false;
+        bakerDesc.type = ommBakerType_CPU;
+        if (ommCreateBaker(&bakerDesc, &baker) != ommResult_SUCCESS)
         {
-            OmmBakeGeometryDesc& instance = *queue[i];
+            printf("[FAIL]: ommCreateOpacityMicromapBaker\n");
+            std::abort();
+        }
+        return baker;
+    }
 
-            InputTexture& inTexture = instance.texture;
-            ommCpuTextureMipDesc texuteMipDescs[OMM_MAX_MIP_NUM] = {};
-            for (uint32_t mip = 0; mip < inTexture.mipNum; ++mip)
+    static ommCpuTexture CreateCpuTexture(ommBaker baker, const OmmBakeGeometryDesc& instance)
+    {
+        const InputTexture& inTexture = instance.texture;
+        ommCpuTextureMipDesc texuteMipDescs[OMM_MAX_MIP_NUM] = {};
+        for (uint32_t mip = 0; mip < inTexture.mipNum; ++mip)
+        {
+            ommCpuTextureMipDesc& texuteMipDesc = texuteMipDescs[mip];
+            texuteMipDesc = ommCpuTextureMipDescDefault();
+            const MipDesc& inMipDesc = inTexture.mips[mip];
+            texuteMipDesc.width = inMipDesc.width;
+            texuteMipDesc.height = inMipDesc.height;
+            texuteMipDesc.textureData = inMipDesc.nriTextureOrPtr.ptr;
+        }
+
+        ommCpuTextureDesc textureDesc = ommCpuTextureDescDefault();
+        textureDesc.mipCount = inTexture.mipNum;
+        textureDesc.mips = texuteMipDescs;
+        textureDesc.format = GetOmmBakerTextureFormat(inTexture.format);
+        textureDesc.alphaCutoff = instance.alphaCutoff;
+
+        ommCpuTexture vmTex = 0;
+        if (ommCpuCreateTexture(baker, &textureDesc, &vmTex) != ommResult_SUCCESS)
+        {
+            printf("[FAIL]: ommCpuCreateTexture\n");
+            std::abort();
+        }
+        return vmTex;
+    }
+
+    ommResult OpacityMicroMapsHelper::BakeGeometryCpu(ommBaker baker, OmmBakeGeometryDesc& instance, const OmmBakeDesc& desc, bool enableInternalThreads, ommCpuTexture texture)
+    { // "texture" is owned by the caller when provided
+        InputTexture& inTexture = instance.texture;
+        ommCpuTexture vmTex = texture ? texture : CreateCpuTexture(baker, instance);
+
+        ommCpuBakeInputDesc bakeDesc = ommCpuBakeInputDescDefault();
+        bakeDesc.texture = vmTex;
+        bakeDesc.alphaMode = ommAlphaMode(instance.alphaMode);
+        bakeDesc.runtimeSamplerDesc.addressingMode = GetOmmAddressingMode(inTexture.addressingMode);
+        bakeDesc.runtimeSamplerDesc.filter = ommTextureFilterMode(desc.filter);
+        bakeDesc.maxSubdivisionLevel = (uint8_t)desc.subdivisionLevel;
+        bakeDesc.alphaCutoff = instance.alphaCutoff;
+        bakeDesc.dynamicSubdivisionScale = desc.dynamicSubdivisionScale;
+
+        InputBuffer& inIndices = instance.indices;
+        bakeDesc.indexFormat = GetOmmBakerIndexFormat(inIndices.format);
+        bakeDesc.indexBuffer = (uint8_t*)inIndices.nriBufferOrPtr.ptr;
+        bakeDesc.indexCount = (uint32_t)inIndices.numElements;
+
+        InputBuffer& inUvs = instance.uvs;
+        bakeDesc.texCoords = (uint8_t*)inUvs.nriBufferOrPtr.ptr;
+        bakeDesc.texCoordFormat = GetOmmBakerUvFormat(inUvs.format);
+
+        bakeDesc.bakeFlags = GetCpuBakeFlags(desc.cpuFlags);
+        if (!enableInternalThreads)
+            bakeDesc.bakeFlags = ommCpuBakeFlags(uint32_t(bakeDesc.bakeFlags) & ~uint32_t(ommCpuBakeFlags_EnableInternalThreads));
+        bakeDesc.format = GetOmmFormat(desc.format);
+
+        ommCpuBakeResult bakeResult;
+        ommResult res = ommCpuBake(baker, &bakeDesc, &bakeResult);
+
+        if (res == ommResult_WORKLOAD_TOO_BIG)
+        {
+            if (!texture)
+                ommCpuDestroyTexture(baker, vmTex);
+            return res;
+        }
+
+        if (res != ommResult_SUCCESS)
+        {
+            printf("[FAIL]: ommCpuBakeVisibilityMap\n");
+            std::abort();
+        }
+
+        const ommCpuBakeResultDesc* resDesc = nullptr;
+        res = ommCpuGetBakeResultDesc(bakeResult, &resDesc);
+
+        if (res != ommResult_SUCCESS)
+        {
+            printf("[FAIL]: ommCpuGetBakeResultDesc\n");
+            std::abort();
+        }
+
+        if (resDesc->arrayData)
+        {
+            instance.outData[(uint32_t)OmmDataLayout::ArrayData].resize(resDesc->arrayDataSize);
+            memcpy(instance.outData[(uint32_t)OmmDataLayout::ArrayData].data(), resDesc->arrayData, resDesc->arrayDataSize);
+
+            size_t ommDescArraySize = resDesc->descArrayCount * sizeof(ommCpuOpacityMicromapDesc);
+            instance.outData[(uint32_t)OmmDataLayout::DescArray].resize(ommDescArraySize);
+            memcpy(instance.outData[(uint32_t)OmmDataLayout::DescArray].data(), resDesc->descArray, ommDescArraySize);
+
+            size_t ommDescArrayHistogramSize = resDesc->descArrayHistogramCount * sizeof(ommCpuOpacityMicromapDesc);
+            instance.outData[(uint32_t)OmmDataLayout::DescArrayHistogram].resize(ommDescArrayHistogramSize);
+            memcpy(instance.outData[(uint32_t)OmmDataLayout::DescArrayHistogram].data(), resDesc->descArrayHistogram, ommDescArrayHistogramSize);
+            instance.outDescArrayHistogramCount = resDesc->descArrayHistogramCount;
+
+            size_t ommIndexHistogramSize = resDesc->indexHistogramCount * sizeof(ommCpuOpacityMicromapDesc);
+            instance.outData[(uint32_t)OmmDataLayout::IndexHistogram].resize(ommIndexHistogramSize);
+            memcpy(instance.outData[(uint32_t)OmmDataLayout::IndexHistogram].data(), resDesc->indexHistogram, ommIndexHistogramSize);
+            instance.outIndexHistogramCount = resDesc->indexHistogramCount;
+        }
+
+        if (resDesc->indexBuffer)
+        { // kept even without micromaps: special indices of a chunk are still needed when merging
+            size_t stride = resDesc->indexFormat == ommIndexFormat_I16_UINT ? sizeof(uint16_t) : sizeof(uint32_t);
+            size_t indexDataSize = resDesc->indexCount * stride;
+            instance.outOmmIndexFormat = GetNriIndexFormat(resDesc->indexFormat);
+            instance.outOmmIndexStride = (uint32_t)stride;
+            instance.outData[(uint32_t)OmmDataLayout::Indices].resize(indexDataSize);
+            memcpy(instance.outData[(uint32_t)OmmDataLayout::Indices].data(), resDesc->indexBuffer, indexDataSize);
+        }
+
+        if (!texture)
+            ommCpuDestroyTexture(baker, vmTex);
+        ommCpuDestroyBakeResult(bakeResult);
+        return ommResult_SUCCESS;
+    }
+
+    inline uint64_t GetCpuBakeWork(const OmmBakeGeometryDesc& instance, const OmmBakeDesc& desc)
+    { // micro-triangles at max subdivision, dynamic subdivision can only lower it
+        return (instance.indices.numElements / 3) << (2 * desc.subdivisionLevel);
+    }
+
+    OpacityMicroMapsHelper::CpuWorkers& OpacityMicroMapsHelper::GetCpuWorkers(uint32_t nodeIndex)
+    { // nodeIndex out of range selects the unpinned pool over all cores
+        const std::vector<CpuNode>& nodes = CpuTopology::GetNodes();
+        const uint32_t nodeNum = (uint32_t)nodes.size();
+        if (m_CpuWorkers.empty())
+            m_CpuWorkers.resize(nodeNum + 1);
+
+        const bool isPinned = nodeIndex < nodeNum;
+        std::unique_ptr<CpuWorkers>& workers = m_CpuWorkers[isPinned ? nodeIndex : nodeNum];
+        if (!workers)
+        {
+            const uint32_t workerNum = isPinned ? (uint32_t)nodes[nodeIndex].logicalCpus.size() : std::max(std::thread::hardware_concurrency(), 1u);
+            workers = std::make_unique<CpuWorkers>();
+            workers->bakers.resize(workerNum, 0);
+            workers->pool.Start(workerNum, isPinned ? nodeIndex : OMM_CPU_NODE_ANY);
+        }
+        return *workers;
+    }
+
+    void OpacityMicroMapsHelper::DestroyCpuWorkers()
+    {
+        for (std::unique_ptr<CpuWorkers>& workers : m_CpuWorkers)
+        {
+            if (!workers)
+                continue;
+            workers->pool.Stop();
+            for (ommBaker baker : workers->bakers)
+                ommDestroyBaker(baker);
+        }
+        m_CpuWorkers.clear();
+    }
+
+    inline ommBaker GetWorkerCpuBaker(std::vector<ommBaker>& bakers, uint32_t worker)
+    {
+        if (!bakers[worker])
+            bakers[worker] = CreateCpuBaker();
+        return bakers[worker];
+    }
+
+    static void MergeCpuBakeChunks(OmmBakeGeometryDesc& instance, OmmBakeGeometryDesc* chunks, size_t chunkNum, bool force32bitIndices)
+    { // Chunks are in triangle order. Micromaps are appended, chunk local indices are rebased and histograms are rebuilt from the merged arrays
+        std::vector<uint8_t> arrayData;
+        std::vector<ommCpuOpacityMicromapDesc> descArray;
+        std::vector<int32_t> indices;
+        for (size_t i = 0; i < chunkNum; ++i)
+        {
+            const std::vector<uint8_t>* chunkData = chunks[i].outData;
+            const std::vector<uint8_t>& chunkArrayData = chunkData[(uint32_t)OmmDataLayout::ArrayData];
+            const uint32_t arrayDataOffset = uint32_t((arrayData.size() + 15) & ~size_t(15)); // keeps any alignment the baker used inside a chunk
+            const int32_t descOffset = (int32_t)descArray.size();
+            if (!chunkArrayData.empty())
             {
-                ommCpuTextureMipDesc& texuteMipDesc = texuteMipDescs[mip];
-                texuteMipDesc = ommCpuTextureMipDescDefault();
-                MipDesc& inMipDesc = inTexture.mips[mip];
-                texuteMipDesc.width = inMipDesc.width;
-                texuteMipDesc.height = inMipDesc.height;
-                texuteMipDesc.textureData = inMipDesc.nriTextureOrPtr.ptr;
+                arrayData.resize(arrayDataOffset);
+                arrayData.insert(arrayData.end(), chunkArrayData.begin(), chunkArrayData.end());
             }
 
-            ommCpuTextureDesc textureDesc = ommCpuTextureDescDefault();
-            textureDesc.mipCount = inTexture.mipNum;
-            textureDesc.mips = texuteMipDescs;
-            textureDesc.format = GetOmmBakerTextureFormat(inTexture.format);
-            textureDesc.alphaCutoff = instance.alphaCutoff;
+            const std::vector<uint8_t>& chunkDescArray = chunkData[(uint32_t)OmmDataLayout::DescArray];
+            const ommCpuOpacityMicromapDesc* chunkDescs = (const ommCpuOpacityMicromapDesc*)chunkDescArray.data();
+            for (size_t j = 0; j < chunkDescArray.size() / sizeof(ommCpuOpacityMicromapDesc); ++j)
+            {
+                ommCpuOpacityMicromapDesc ommDesc = chunkDescs[j];
+                ommDesc.offset += arrayDataOffset;
+                descArray.push_back(ommDesc);
+            }
 
-            ommCpuTexture vmTex = 0;
-            if (ommCpuCreateTexture(m_OmmCpuBaker, &textureDesc, &vmTex) != ommResult_SUCCESS)
+            const std::vector<uint8_t>& chunkIndices = chunkData[(uint32_t)OmmDataLayout::Indices];
+            const uint32_t stride = chunks[i].outOmmIndexStride;
+            for (size_t j = 0; stride && j < chunkIndices.size() / stride; ++j)
             {
-                printf("[FAIL]: ommCpuCreateTexture\n");
-                std::abort();
+                int32_t index = ReadOmmIndex(chunkIndices.data(), stride, j);
+                indices.push_back(index < 0 ? index : index + descOffset);
             }
+        }
 
-            ommCpuBakeInputDesc bakeDesc = ommCpuBakeInputDescDefault();
-            bakeDesc.texture = vmTex;
-            bakeDesc.alphaMode = ommAlphaMode(instance.alphaMode);
-            bakeDesc.runtimeSamplerDesc.addressingMode = GetOmmAddressingMode(inTexture.addressingMode);
-            bakeDesc.runtimeSamplerDesc.filter = ommTextureFilterMode(desc.filter);
-            bakeDesc.maxSubdivisionLevel = (uint8_t)desc.subdivisionLevel;
-            bakeDesc.alphaCutoff = instance.alphaCutoff;
-            bakeDesc.dynamicSubdivisionScale = desc.dynamicSubdivisionScale;
+        std::map<uint32_t, uint32_t> descArrayHistogram; // (subdivisionLevel << 16 | format) -> count
+        std::map<uint32_t, uint32_t> indexHistogram;
+        for (const ommCpuOpacityMicromapDesc& ommDesc : descArray)
+            ++descArrayHistogram[uint32_t(ommDesc.subdivisionLevel) << 16 | ommDesc.format];
 
-            InputBuffer& inIndices = instance.indices;
-            bakeDesc.indexFormat = GetOmmBakerIndexFormat(inIndices.format);
-            bakeDesc.indexBuffer = (uint8_t*)inIndices.nriBufferOrPtr.ptr;
-            bakeDesc.indexCount = (uint32_t)inIndices.numElements;
+        int32_t maxIndex = -1;
+        for (int32_t index : indices)
+        {
+            if (index < 0)
+                continue;
+            const ommCpuOpacityMicromapDesc& ommDesc = descArray[index];
+            ++indexHistogram[uint32_t(ommDesc.subdivisionLevel) << 16 | ommDesc.format];
+            maxIndex = std::max(maxIndex, index);
+        }
+
+        auto writeUsageCounts = [](std::vector<uint8_t>& outData, const std::map<uint32_t, uint32_t>& histogram) -> uint32_t
+        {
+            outData.resize(histogram.size() * sizeof(ommCpuOpacityMicromapUsageCount));
+            ommCpuOpacityMicromapUsageCount* usageCounts = (ommCpuOpacityMicromapUsageCount*)outData.data();
+            for (const auto& it : histogram)
+                *usageCounts++ = { it.second, uint16_t(it.first >> 16), uint16_t(it.first & 0xFFFF) };
+            return (uint32_t)histogram.size();
+        };
+
+        std::vector<uint8_t>* outData = instance.outData;
+        outData[(uint32_t)OmmDataLayout::ArrayData].swap(arrayData);
+        outData[(uint32_t)OmmDataLayout::DescArray].resize(descArray.size() * sizeof(ommCpuOpacityMicromapDesc));
+        memcpy(outData[(uint32_t)OmmDataLayout::DescArray].data(), descArray.data(), outData[(uint32_t)OmmDataLayout::DescArray].size());
+        instance.outDescArrayHistogramCount = writeUsageCounts(outData[(uint32_t)OmmDataLayout::DescArrayHistogram], descArrayHistogram);
+        instance.outIndexHistogramCount = writeUsageCounts(outData[(uint32_t)OmmDataLayout::IndexHistogram], indexHistogram);
+
+        // Same width rules as the baker: 16 bit unless regular indices reach the special values
+        const bool is16bit = !force32bitIndices && maxIndex < 0x10000 - 4;
+        instance.outOmmIndexFormat = is16bit ? nri::Format::R16_UINT : nri::Format::R32_UINT;
+        instance.outOmmIndexStride = is16bit ? sizeof(uint16_t) : sizeof(uint32_t);
+        std::vector<uint8_t>& outIndices = outData[(uint32_t)OmmDataLayout::Indices];
+        outIndices.resize(indices.size() * instance.outOmmIndexStride);
+        for (size_t i = 0; i < indices.size(); ++i)
+        { // truncation keeps special indices special: -1 -> 0xFFFF
+            if (is16bit)
+                ((uint16_t*)outIndices.data())[i] = uint16_t(indices[i]);
+            else
+                ((int32_t*)outIndices.data())[i] = indices[i];
+        }
+    }
+
+    bool OpacityMicroMapsHelper::BakeTriangleRangeCpu(ommBaker baker, ommCpuTexture texture, const OmmBakeGeometryDesc& instance, const OmmBakeDesc& desc, uint64_t firstTriangle, uint64_t triangleNum, OmmBakeGeometryDesc& outChunk)
+    { // Uvs are shared, only the index range moves. Halves the range until the baker accepts it
+        outChunk.indices = instance.indices;
+        outChunk.indices.nriBufferOrPtr.ptr = (uint8_t*)instance.indices.nriBufferOrPtr.ptr + firstTriangle * 3 * instance.indices.stride;
+        outChunk.indices.numElements = triangleNum * 3;
+        outChunk.uvs = instance.uvs;
+        outChunk.texture = instance.texture;
+        outChunk.alphaCutoff = instance.alphaCutoff;
+        outChunk.borderAlpha = instance.borderAlpha;
+        outChunk.alphaMode = instance.alphaMode;
+
+        if (BakeGeometryCpu(baker, outChunk, desc, false, texture) == ommResult_SUCCESS)
+            return true;
+
+        if (triangleNum == 1)
+            return false;
+
+        std::vector<OmmBakeGeometryDesc> halves(2);
+        const uint64_t halfTriangleNum = triangleNum / 2;
+        bool isBaked = BakeTriangleRangeCpu(baker, texture, instance, desc, firstTriangle, halfTriangleNum, halves[0]);
+        isBaked = isBaked && BakeTriangleRangeCpu(baker, texture, instance, desc, firstTriangle + halfTriangleNum, triangleNum - halfTriangleNum, halves[1]);
+        if (isBaked)
+            MergeCpuBakeChunks(outChunk, halves.data(), halves.size(), desc.cpuFlags.force32bitIndices);
+        return isBaked;
+    }
 
-            InputBuffer& inUvs = instance.uvs;
-            bakeDesc.texCoords = (uint8_t*)inUvs.nriBufferOrPtr.ptr;
-            bakeDesc.texCoordFormat = GetOmmBakerUvFormat(inUvs.format);
+    void OpacityMicroMapsHelper::BakeGeometryCpuSplit(OmmBakeGeometryDesc& instance, const OmmBakeDesc& desc)
+    { // Workers own a baker and a texture copy each. Chunks are small enough to give every worker a few of them
+        const uint64_t triangleNum = instance.indices.numElements / 3;
+        if (!triangleNum)
+            return;
+
+        CpuWorkers& workers = GetCpuWorkers(desc.cpuFlags.enableNumaPlacement ? instance.cpuNodeId : OMM_CPU_NODE_ANY);
+        const uint32_t workerNum = workers.pool.GetWorkerNum();
+        uint64_t chunkTriangleNum = (triangleNum + workerNum * 4 - 1) / (workerNum * 4);
+        if (desc.cpuFlags.splitWorkLog2)
+            chunkTriangleNum = std::min<uint64_t>(chunkTriangleNum, (1ull << desc.cpuFlags.splitWorkLog2) >> (2 * desc.subdivisionLevel));
+        chunkTriangleNum = std::max<uint64_t>(chunkTriangleNum, 1);
 
-            bakeDesc.bakeFlags = GetCpuBakeFlags(desc.cpuFlags);
-            bakeDesc.format = GetOmmFormat(desc.format);
+        const size_t chunkNum = size_t((triangleNum + chunkTriangleNum - 1) / chunkTriangleNum);
+        std::vector<OmmBakeGeometryDesc> chunks(chunkNum);
 
-            ommCpuBakeResult bakeResult;
-            ommResult res = ommCpuBake(m_OmmCpuBaker, &bakeDesc, &bakeResult);
+        std::atomic<size_t> cursor = 0;
+        std::atomic<uint32_t> failedNum = 0;
+        workers.pool.Run([&](uint32_t worker)
+        {
+            size_t i = cursor++;
+            if (i >= chunkNum)
+                return; // no texture copy for workers without a chunk
 
-            if (res == ommResult_WORKLOAD_TOO_BIG)
+            ommBaker baker = GetWorkerCpuBaker(workers.bakers, worker);
+            ommCpuTexture texture = CreateCpuTexture(baker, instance);
+            for (; i < chunkNum; i = cursor++)
             {
-                printf("[WARNING]: ommCpuBakeOpacityMicromap - Workload size is too big.\n");
-                return;
+                const uint64_t firstTriangle = i * chunkTriangleNum;
+                if (!BakeTriangleRangeCpu(baker, texture, instance, desc, firstTriangle, std::min(chunkTriangleNum, triangleNum - firstTriangle), chunks[i]))
+                    ++failedNum;
             }
+            ommCpuDestroyTexture(baker, texture);
+        });
+
+        if (failedNum)
+        {
+            printf("[WARNING]: ommCpuBakeOpacityMicromap - Workload size is too big even for a single triangle. Geometry skipped.\n");
+            return;
+        }
+
+        MergeCpuBakeChunks(instance, chunks.data(), chunks.size(), desc.cpuFlags.force32bitIndices);
+    }
+
+    void OpacityMicroMapsHelper::BakeOpacityMicroMapsCpuPinned(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc)
+    { // One pool per node, all nodes run at once. Workers are pinned, so ommCpuTexture copies and outputs stay node-local
+        const uint32_t nodeNum = CpuTopology::GetNodeNum();
+        std::vector<std::vector<OmmBakeGeometryDesc*>> nodeQueues(nodeNum);
+        for (size_t i = 0; i < count; ++i)
+            nodeQueues[queue[i]->cpuNodeId < nodeNum ? queue[i]->cpuNodeId : 0].push_back(queue[i]);
 
-            if (res != ommResult_SUCCESS)
+        std::mutex tooBigMutex;
+        std::vector<OmmBakeGeometryDesc*> tooBigQueue;
+        std::vector<std::atomic<size_t>> nodeCursors(nodeNum);
+        for (uint32_t node = 0; node < nodeNum; ++node)
+        {
+            nodeCursors[node] = 0;
+            if (nodeQueues[node].empty())
+                continue;
+
+            CpuWorkers& workers = GetCpuWorkers(node);
+            workers.pool.Submit([&, node](uint32_t worker)
             {
-                printf("[FAIL]: ommCpuBakeVisibilityMap\n");
-                std::abort();
+                const std::vector<OmmBakeGeometryDesc*>& nodeQueue = nodeQueues[node];
+                for (size_t i = nodeCursors[node]++; i < nodeQueue.size(); i = nodeCursors[node]++)
+                { // geometry level parallelism replaces baker internal threads here
+                    if (BakeGeometryCpu(GetWorkerCpuBaker(workers.bakers, worker), *nodeQueue[i], desc, false) == ommResult_WORKLOAD_TOO_BIG)
+                    {
+                        std::lock_guard<std::mutex> lock(tooBigMutex);
+                        tooBigQueue.push_back(nodeQueue[i]);
+                    }
+                }
+            });
+        }
+
+        for (uint32_t node = 0; node < nodeNum; ++node)
+        {
+            if (!nodeQueues[node].empty())
+                GetCpuWorkers(node).pool.Wait();
+        }
+
+        // Rejected geometries get all cores of their node one by one
+        for (OmmBakeGeometryDesc* instance : tooBigQueue)
+            BakeGeometryCpuSplit(*instance, desc);
+    }
+
+    bool OpacityMicroMapsHelper::ConnectToBakeServer(const char* socketPath)
+    { // the server may be starting together with the sample, give it a moment
+        DisconnectFromBakeServer();
+        m_BakeServerPath = socketPath;
+        if (!ReconnectToBakeServer(OMM_BAKE_SERVER_CONNECT_ATTEMPT_NUM))
+        {
+            printf("[OMM] Bake server is not available at [%s]. Baking in-process.\n", socketPath);
+            return false;
+        }
+        printf("[OMM] Connected to bake server at [%s].\n", socketPath);
+        return true;
+    }
+
+    bool OpacityMicroMapsHelper::ReconnectToBakeServer(uint32_t attemptNum)
+    {
+        uint32_t delayMs = OMM_BAKE_SERVER_CONNECT_DELAY_MS;
+        for (uint32_t attempt = 0; attempt < attemptNum && m_BakeServerSocket == OMM_BAKE_INVALID_SOCKET; ++attempt)
+        {
+            if (attempt)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+                delayMs *= 2;
             }
+            m_BakeServerSocket = OmmBakeSocketApi::Connect(m_BakeServerPath.c_str());
+        }
+        return m_BakeServerSocket != OMM_BAKE_INVALID_SOCKET;
+    }
 
-            const ommCpuBakeResultDesc* resDesc = nullptr;
-            res = ommCpuGetBakeResultDesc(bakeResult, &resDesc);
+    void OpacityMicroMapsHelper::DisconnectFromBakeServer()
+    {
+        OmmBakeSocketApi::Close(m_BakeServerSocket);
+        m_BakeServerSocket = OMM_BAKE_INVALID_SOCKET;
+    }
 
-            if (res != ommResult_SUCCESS)
+    static_assert(OMM_BAKE_PROTOCOL_OUTPUT_NUM == (uint32_t)OmmDataLayout::CpuMaxNum, "Bake protocol outputs must match OmmDataLayout");
+    static_assert(OMM_BAKE_PROTOCOL_MAX_MIP_NUM == OMM_MAX_MIP_NUM, "Bake protocol mips must match InputTexture");
+
+    inline uint32_t GetTexelSize(nri::Format format)
+    {
+        return format == nri::Format::R32_SFLOAT ? sizeof(float) : sizeof(uint8_t);
+    }
+
+    size_t OpacityMicroMapsHelper::BakeOpacityMicroMapsCpuRemote(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc)
+    { // Send the whole queue first so the server can bake it in parallel, then collect responses in order
+        std::vector<uint64_t> requestHashes;
+        requestHashes.reserve(count);
+        bool isConnected = true;
+        for (size_t i = 0; i < count && isConnected; ++i)
+        {
+            const OmmBakeGeometryDesc& instance = *queue[i];
+            const InputTexture& inTexture = instance.texture;
+
+            OmmBakeRequestHeader header = {};
+            header.magic = OMM_BAKE_PROTOCOL_MAGIC;
+            header.version = OMM_BAKE_PROTOCOL_VERSION;
+            header.bakeFlags = GetCpuBakeFlags(desc.cpuFlags) & ~uint32_t(ommCpuBakeFlags_EnableInternalThreads); // threading is up to the server, keep it out of the request hash
+            header.alphaMode = (uint32_t)instance.alphaMode;
+            header.format = GetOmmFormat(desc.format);
+            header.filter = (uint32_t)desc.filter;
+            header.addressingMode = GetOmmAddressingMode(inTexture.addressingMode);
+            header.maxSubdivisionLevel = desc.subdivisionLevel;
+            header.alphaCutoff = instance.alphaCutoff;
+            header.dynamicSubdivisionScale = desc.dynamicSubdivisionScale;
+            header.indexFormat = GetOmmBakerIndexFormat(instance.indices.format);
+            header.indexCount = (uint32_t)instance.indices.numElements;
+            header.texCoordFormat = GetOmmBakerUvFormat(instance.uvs.format);
+            header.textureFormat = GetOmmBakerTextureFormat(inTexture.format);
+            header.mipNum = inTexture.mipNum;
+            header.indexDataSize = instance.indices.numElements * instance.indices.stride;
+            header.texCoordDataSize = instance.uvs.numElements * instance.uvs.stride;
+
+            const void* mips[OMM_MAX_MIP_NUM] = {};
+            for (uint32_t mip = 0; mip < inTexture.mipNum; ++mip)
             {
-                printf("[FAIL]: ommCpuGetBakeResultDesc\n");
-                std::abort();
+                const MipDesc& mipDesc = inTexture.mips[mip];
+                header.mipWidth[mip] = mipDesc.width;
+                header.mipHeight[mip] = mipDesc.height;
+                header.mipDataSize[mip] = uint64_t(mipDesc.width) * mipDesc.height * GetTexelSize(inTexture.format);
+                mips[mip] = mipDesc.nriTextureOrPtr.ptr;
             }
 
-            if (resDesc->arrayData)
+            requestHashes.push_back(CalculateBakeRequestHash(header, instance.indices.nriBufferOrPtr.ptr, instance.uvs.nriBufferOrPtr.ptr, mips));
+            isConnected = SendBakeRequest(m_BakeServerSocket, header, instance.indices.nriBufferOrPtr.ptr, instance.uvs.nriBufferOrPtr.ptr, mips);
+        }
+
+        size_t completedNum = 0;
+        for (; completedNum < count && isConnected; ++completedNum)
+        {
+            OmmBakeGeometryDesc& instance = *queue[completedNum];
+            OmmBakeResponseHeader response = {};
+            isConnected = RecvBakeResponse(m_BakeServerSocket, response, instance.outData);
+            if (!isConnected)
+                break;
+
+            if (completedNum >= requestHashes.size() || response.requestHash != requestHashes[completedNum])
+            { // out of sync, nothing after this point can be trusted
+                printf("[FAIL]: Bake server response doesn't match the request\n");
+                for (std::vector<uint8_t>& output : instance.outData)
+                    output.clear();
+                isConnected = false;
+                break;
+            }
+
+            if (response.result != ommResult_SUCCESS)
+            { // WORKLOAD_TOO_BIG, or the server is shutting down
+                if (BakeGeometryCpu(m_OmmCpuBaker, instance, desc, desc.cpuFlags.enableInternalThreads) == ommResult_WORKLOAD_TOO_BIG)
+                    BakeGeometryCpuSplit(instance, desc);
+                continue;
+            }
+
+            if (response.sizes[(uint32_t)OmmDataLayout::ArrayData])
             {
-                instance.outData[(uint32_t)OmmDataLayout::ArrayData].resize(resDesc->arrayDataSize);
-                memcpy(instance.outData[(uint32_t)OmmDataLayout::ArrayData].data(), resDesc->arrayData, resDesc->arrayDataSize);
-
-                size_t ommDescArraySize = resDesc->descArrayCount * sizeof(ommCpuOpacityMicromapDesc);
-                instance.outData[(uint32_t)OmmDataLayout::DescArray].resize(ommDescArraySize);
-                memcpy(instance.outData[(uint32_t)OmmDataLayout::DescArray].data(), resDesc->descArray, ommDescArraySize);
-
-                size_t ommDescArrayHistogramSize = resDesc->descArrayHistogramCount * sizeof(ommCpuOpacityMicromapDesc);
-                instance.outData[(uint32_t)OmmDataLayout::DescArrayHistogram].resize(ommDescArrayHistogramSize);
-                memcpy(instance.outData[(uint32_t)OmmDataLayout::DescArrayHistogram].data(), resDesc->descArrayHistogram, ommDescArrayHistogramSize);
-                instance.outDescArrayHistogramCount = resDesc->descArrayHistogramCount;
-
-                size_t ommIndexHistogramSize = resDesc->indexHistogramCount * sizeof(ommCpuOpacityMicromapDesc);
-                instance.outData[(uint32_t)OmmDataLayout::IndexHistogram].resize(ommIndexHistogramSize);
-                memcpy(instance.outData[(uint32_t)OmmDataLayout::IndexHistogram].data(), resDesc->indexHistogram, ommIndexHistogramSize);
-                instance.outIndexHistogramCount = resDesc->indexHistogramCount;
-
-                size_t stride = resDesc->indexFormat == ommIndexFormat_I16_UINT ? sizeof(uint16_t) : sizeof(uint32_t);
-                size_t indexDataSize = resDesc->indexCount * stride;
-                instance.outOmmIndexFormat = GetNriIndexFormat(resDesc->indexFormat);
+                size_t stride = response.indexFormat == ommIndexFormat_I16_UINT ? sizeof(uint16_t) : sizeof(uint32_t);
+                instance.outOmmIndexFormat = GetNriIndexFormat(ommIndexFormat(response.indexFormat));
                 instance.outOmmIndexStride = (uint32_t)stride;
-                instance.outData[(uint32_t)OmmDataLayout::Indices].resize(indexDataSize);
-                memcpy(instance.outData[(uint32_t)OmmDataLayout::Indices].data(), resDesc->indexBuffer, indexDataSize);
-
+                instance.outDescArrayHistogramCount = response.descArrayHistogramCount;
+                instance.outIndexHistogramCount = response.indexHistogramCount;
             }
-            ommCpuDestroyTexture(m_OmmCpuBaker, vmTex);
-            ommCpuDestroyBakeResult(bakeResult);
+        }
+
+        if (!isConnected)
+        {
+            printf("[OMM] Lost connection to bake server. Baking remaining %llu geometries in-process.\n", (unsigned long long)(count - completedNum));
+            DisconnectFromBakeServer();
+        }
+        return completedNum;
+    }
+
+    void OpacityMicroMapsHelper::BakeOpacityMicroMapsCpu(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc)
+    { // Geometries above the work threshold are baked one by one over all cores, the rest keeps geometry level parallelism
+        std::vector<OmmBakeGeometryDesc*> regularQueue;
+        regularQueue.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (desc.cpuFlags.splitWorkLog2 && GetCpuBakeWork(*queue[i], desc) > (1ull << desc.cpuFlags.splitWorkLog2))
+                BakeGeometryCpuSplit(*queue[i], desc);
+            else
+                regularQueue.push_back(queue[i]);
+        }
+        queue = regularQueue.data();
+
+        if (m_BakeServerSocket == OMM_BAKE_INVALID_SOCKET && !m_BakeServerPath.empty())
+            ReconnectToBakeServer(1); // the server may be back after a restart
+
+        size_t remoteNum = m_BakeServerSocket != OMM_BAKE_INVALID_SOCKET ? BakeOpacityMicroMapsCpuRemote(queue, regularQueue.size(), desc) : 0;
+        queue += remoteNum;
+        const size_t localNum = regularQueue.size() - remoteNum;
+
+        if (desc.cpuFlags.enableNumaPlacement)
+        {
+            BakeOpacityMicroMapsCpuPinned(queue, localNum, desc);
+            return;
+        }
+
+        for (size_t i = 0; i < localNum; ++i)
+        {
+            if (BakeGeometryCpu(m_OmmCpuBaker, *queue[i], desc, desc.cpuFlags.enableInternalThreads) == ommResult_WORKLOAD_TOO_BIG)
+                BakeGeometryCpuSplit(*queue[i], desc);
         }
     }
 #pragma endregion
@@ -392,7 +899,7 @@ namespace ommhelper
 
         settings.samplerAddressingMode = desc.texture.addressingMode;
         settings.samplerFilterMode = bakeDesc.filter == OmmBakeFilter::Linear ? nri::Filter::LINEAR : nri::Filter::NEAREST;
-        settings.maxScratchMemorySize = BakerScratchMemoryBudget::MB_512;
+        settings.maxScratchMemorySize = bakeDesc.gpuFlags.scratchMemoryBudget;
 
         settings.dynamicSubdivisionScale = bakeDesc.dynamicSubdivisionScale;
         settings.bakeFlags = GetGpuBakeFlags(bakeDesc, pass);
@@ -441,6 +948,11 @@ namespace ommhelper
 #pragma endregion
 
 #pragma region [ Geometry Builder ]
+    uint32_t OpacityMicroMapsHelper::GetPrepareThreadNum() const
+    {
+        return m_PrepareThreadNum ? m_PrepareThreadNum : std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
     void OpacityMicroMapsHelper::GetBlasPrebuildInfo(MaskedGeometryBuildDesc** queue, const size_t count)
     {
         if (m_DisableGeometryBuild)
@@ -462,11 +974,43 @@ namespace ommhelper
         else
             BuildMaskedGeometryVK(queue, count, commandBuffer);
     }
+
+    uint64_t OpacityMicroMapsHelper::GetOmmArraySerializationIdentity()
+    {
+        if (m_DisableGeometryBuild || NRI.GetDeviceDesc(*m_Device).graphicsAPI != nri::GraphicsAPI::VULKAN)
+            return 0;
+        return GetOmmArraySerializationIdentityVK();
+    }
+
+    bool OpacityMicroMapsHelper::IsSerializedOmmArrayCompatible(const void* data, size_t size)
+    {
+        if (!GetOmmArraySerializationIdentity())
+            return false;
+        return IsSerializedOmmArrayCompatibleVK(data, size);
+    }
+
+    void OpacityMicroMapsHelper::SerializeOmmArrays(MaskedGeometryBuildDesc** queue, const size_t count, nri::CommandBuffer* commandBuffer)
+    {
+        if (GetOmmArraySerializationIdentity())
+            SerializeOmmArraysVK(queue, count, commandBuffer);
+    }
+
+    void OpacityMicroMapsHelper::ReadSerializedOmmArrays(MaskedGeometryBuildDesc** queue, const size_t count)
+    {
+        if (GetOmmArraySerializationIdentity())
+            ReadSerializedOmmArraysVK(queue, count);
+    }
 #pragma endregion
 
 #pragma region [ OMM Caching ]
 
-    std::map<uint64_t, uint64_t> OmmCaching::m_IdentifierToDataOffset;
+    std::map<std::string, std::map<uint64_t, uint64_t>> OmmCaching::m_FileToIdentifierToDataOffset;
+    std::recursive_mutex OmmCaching::m_Mutex;
+
+    std::map<uint64_t, uint64_t>& OmmCaching::GetFileOffsets(const char* filename)
+    {
+        return m_FileToIdentifierToDataOffset[filename];
+    }
 
     uint64_t OmmCaching::CalculateSateHash(const OmmBakeDesc& bakeDesc)
     {
@@ -478,11 +1022,13 @@ namespace ommhelper
             uint32_t format;
             uint32_t type;
             float dynamicSubdivisionScale;
+            float alphaCutoff;
             void InitCommon(const OmmBakeDesc& bakeDesc)
             {
                 subdivisionLevel = bakeDesc.subdivisionLevel;
                 mipBias = bakeDesc.mipBias;
                 dynamicSubdivisionScale = bakeDesc.dynamicSubdivisionScale;
+                alphaCutoff = bakeDesc.alphaCutoff;
                 filter = (uint32_t)bakeDesc.filter;
                 format = (uint32_t)bakeDesc.format;
                 type = (uint32_t)bakeDesc.type;
@@ -496,6 +1042,7 @@ namespace ommhelper
             {
                 InitCommon(bakeDesc);
                 gpuFlags = bakeDesc.gpuFlags;
+                gpuFlags.scratchMemoryBudget = BakerScratchMemoryBudget::Undefined; // doesn't affect bake results
             }
         };
 
@@ -507,6 +1054,8 @@ namespace ommhelper
             {
                 InitCommon(bakeDesc);
                 cpuFlags = bakeDesc.cpuFlags;
+                cpuFlags.enableNumaPlacement = false; // doesn't affect bake results
+                cpuFlags.splitWorkLog2 = 0;
                 mipCount = bakeDesc.mipCount;
             }
         };
@@ -527,6 +1076,46 @@ namespace ommhelper
         return result;
     }
 
+    void OmmArrayCache::Begin(const std::string& filename, uint64_t stateHash, Backend* backend, bool isEnabled)
+    {
+        const uint64_t identity = (backend && isEnabled) ? backend->GetOmmArraySerializationIdentity() : 0;
+        m_Filename = filename;
+        m_Key = stateHash ^ (identity * 1099511628211ull);
+        m_Backend = identity ? backend : nullptr;
+        m_Counts[0] = m_Counts[1] = 0;
+    }
+
+    bool OmmArrayCache::Read(uint64_t instanceHash, std::vector<uint8_t>& outBlob)
+    { // the blob goes to the ArrayData slot
+        outBlob.clear();
+        bool isRead = false;
+        OmmCaching::OmmData data = {};
+        if (m_Backend && OmmCaching::ReadMaskFromCache(m_Filename.c_str(), data, m_Key, instanceHash, nullptr))
+        {
+            outBlob.resize(data.sizes[(uint32_t)OmmDataLayout::ArrayData]);
+            data.data[(uint32_t)OmmDataLayout::ArrayData] = outBlob.data();
+            isRead = OmmCaching::ReadMaskFromCache(m_Filename.c_str(), data, m_Key, instanceHash, nullptr) && !outBlob.empty();
+
+            isRead = isRead && m_Backend->IsSerializedOmmArrayCompatible(outBlob.data(), outBlob.size());
+            if (!isRead)
+                outBlob.clear();
+        }
+
+        m_Counts[isRead ? 0 : 1]++;
+        return isRead;
+    }
+
+    void OmmArrayCache::Save(uint64_t instanceHash, const std::vector<uint8_t>& blob)
+    {
+        if (!m_Backend || blob.empty())
+            return;
+
+        OmmCaching::OmmData data = {};
+        data.data[(uint32_t)OmmDataLayout::ArrayData] = (void*)blob.data();
+        data.sizes[(uint32_t)OmmDataLayout::ArrayData] = blob.size();
+        OmmCaching::SaveMasksToDisc(m_Filename.c_str(), data, m_Key, instanceHash, 0);
+    }
+
     inline uint64_t CalculateIdentifier(uint64_t a, uint64_t b)
     {
         uint64_t identifier = ((a + b) * (a + b + 1)) / 2 + b;
@@ -544,13 +1133,13 @@ namespace ommhelper
                 return;
 
             uint64_t identifier = CalculateIdentifier(currentHeader.stateHash, currentHeader.instanceHash);
-            m_IdentifierToDataOffset.insert(std::make_pair(identifier, uint64_t(currentPos)));
+            GetFileOffsets(filename).insert(std::make_pair(identifier, uint64_t(currentPos)));
 
             size_t blobSize = currentHeader.blobSize;
             currentPos = ftell(file);
             if (ValidateChunkRead(filename, file, fileSize, currentPos, blobSize) == false)
             {
-                m_IdentifierToDataOffset.clear();
+                GetFileOffsets(filename).clear();
                 return;
             }
 
@@ -562,7 +1151,8 @@ namespace ommhelper
 
     bool OmmCaching::LookForCache(const char* filename, uint64_t stateMask, uint64_t hash, size_t* dataOffset)
     {
-        if (m_IdentifierToDataOffset.empty())
+        std::lock_guard<std::recursive_mutex> lock(m_Mutex);
+        if (GetFileOffsets(filename).empty())
         {
             FILE* file = fopen(filename, "rb");
             if (file == nullptr)
@@ -577,8 +1167,9 @@ namespace ommhelper
         }
 
         uint64_t identifier = CalculateIdentifier(stateMask, hash);
-        const auto& it = m_IdentifierToDataOffset.find(identifier);
-        if (it == m_IdentifierToDataOffset.end())
+        const std::map<uint64_t, uint64_t>& offsets = GetFileOffsets(filename);
+        const auto& it = offsets.find(identifier);
+        if (it == offsets.end())
             return false;
         else
         {
@@ -590,6 +1181,7 @@ namespace ommhelper
 
     bool OmmCaching::ReadMaskFromCache(const char* filename, OmmData& data, uint64_t stateMask, uint64_t hash, uint16_t* ommIndexFormat)
     {
+        std::lock_guard<std::recursive_mutex> lock(m_Mutex);
         size_t dataOffset = 0;
         if (LookForCache(filename, stateMask, hash, &dataOffset) == false)
             return false;
@@ -598,7 +1190,7 @@ namespace ommhelper
         if (file == nullptr)
         {
             printf("[FAIL] Unable to open file for reading: {%s}\n", filename);
-            m_IdentifierToDataOffset.clear();
+            GetFileOffsets(filename).clear();
             return false;
         }
 
@@ -610,20 +1202,19 @@ namespace ommhelper
         if (ReadChunkFromFile(filename, file, fileSize, &header, sizeof(header)) == false)
             return false;
 
-        std::vector<uint8_t> blob(header.blobSize);
-        if (ReadChunkFromFile(filename, file, fileSize, blob.data(), header.blobSize) == false)
-            return false;
-
         for (uint32_t i = 0; i < (uint32_t)OmmDataLayout::CpuMaxNum; ++i)
-        {
+        { // Chunks are read straight to their destinations, missing ones are skipped
             void* out = data.data[i];
             data.sizes[i] = header.sizes[i];
 
             if (!out)
+            {
+                fseek(file, long(header.sizes[i]), SEEK_CUR);
                 continue;
+            }
 
-            memcpy(out, blob.data(), header.sizes[i]);
-            blob.erase(blob.begin(), blob.begin() + header.sizes[i]);
+            if (ReadChunkFromFile(filename, file, fileSize, out, header.sizes[i]) == false)
+                return false;
         }
 
         if(ommIndexFormat)
@@ -635,6 +1226,7 @@ namespace ommhelper
 
     void OmmCaching::SaveMasksToDisc(const char* filename, const OmmData& data, uint64_t stateMask, uint64_t hash, uint32_t ommIndexFormat)
     {
+        std::lock_guard<std::recursive_mutex> lock(m_Mutex);
         if (LookForCache(filename, stateMask, hash, nullptr))
             return;//mask for this state is already cached
 
@@ -642,7 +1234,7 @@ namespace ommhelper
         if (outputFile == nullptr)
         {
             printf("[FAIL] Unable to open file for writing: {%s}\n", filename);
-            m_IdentifierToDataOffset.clear();
+            GetFileOffsets(filename).clear();
             return;
         }
 
@@ -666,7 +1258,8 @@ namespace ommhelper
                 header.sizes[i] = size;
                 size_t blobOffset = dataBlob.size();
                 dataBlob.resize(dataBlob.size() + size);
-                memcpy(dataBlob.data() + blobOffset, data.data[i], size);
+                if (size)
+                    memcpy(dataBlob.data() + blobOffset, data.data[i], size);
             }
 
             header.instanceHash = hash;
@@ -680,7 +1273,7 @@ namespace ommhelper
                 return;
 
             uint64_t identifier = CalculateIdentifier(stateMask, hash);
-            m_IdentifierToDataOffset.insert(std::make_pair(identifier, fileSize));
+            GetFileOffsets(filename).insert(std::make_pair(identifier, fileSize));
         }
 
         fclose(outputFile);
@@ -702,7 +1295,7 @@ namespace ommhelper
             printf("[FAIL] Unable to write to file: {%s}\n", fileName);
             fclose(file);
             std::filesystem::remove(fileName);
-            m_IdentifierToDataOffset.clear();
+            GetFileOffsets(fileName).clear();
             return false;
         }
         return true;
@@ -715,7 +1308,7 @@ namespace ommhelper
             printf("[FAIL] File end unexpected. Invalidating: {%s}\n", fileName);
             fclose(file);
             std::filesystem::remove(fileName);
-            m_IdentifierToDataOffset.clear();
+            GetFileOffsets(fileName).clear();
             return false;
         }
         return true;
@@ -731,7 +1324,7 @@ namespace ommhelper
         {
             printf("[FAIL] Unable to read file: {%s}\n", fileName);
             fclose(file);
-            m_IdentifierToDataOffset.clear();
+            GetFileOffsets(fileName).clear();
             return false;
         }
         return true;
@@ -15,6 +15,14 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
 #include <vector>
 #include <array>
 #include <map>
+#include <memory>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 
 #include "NRI.h"
 #include "Extensions/NRIDeviceCreation.h"
@@ -28,6 +36,8 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
 
 #include "nvapi.h"
 #include "OmmBakerIntegration.h"
+#include "OmmCpuTopology.h"
+#include "OmmBakeProtocol.h"
 
 namespace ommhelper
 {
@@ -59,6 +69,9 @@ namespace ommhelper
         bool enableDuplicateDetection = true;
         bool enableNearDuplicateDetection = false;
         bool force32bitIndices = false;
+        bool enableNumaPlacement = false; // bake each geometry on threads pinned to OmmBakeGeometryDesc::cpuNodeId
+        uint32_t splitWorkLog2 = 0; // geometries above 2^N micro-triangles are baked as parallel triangle-range chunks. 0: split only when the baker rejects the workload
+        bool enableAlphaBounds = false; // cutoff agnostic bake through AlphaBoundsBaker (OmmAlphaBounds.h), run by the caller instead of BakeOpacityMicroMapsCpu
     };
 
     struct GpuBakerFlags
@@ -68,6 +81,7 @@ namespace ommhelper
         bool enableTexCoordDeduplication = true;
         bool force32bitIndices = false;
         bool computeOnlyWorkload = true;
+        BakerScratchMemoryBudget scratchMemoryBudget = BakerScratchMemoryBudget::MB_512; // doesn't affect bake results, only the baker's transient pool and dispatch granularity
     };
 
     struct OmmBakeDesc
@@ -77,6 +91,7 @@ namespace ommhelper
         uint32_t mipCount = 1;
         uint32_t buildFrameId = 0;
         float dynamicSubdivisionScale = 1.0f;
+        float alphaCutoff = 0.5f; // alpha test: opaque above
         OmmBakeFilter filter = OmmBakeFilter::Linear;
         OmmFormats format = OmmFormats::OC1_4_STATE;
         OmmBakerType type = OmmBakerType::GPU;
@@ -186,6 +201,8 @@ namespace ommhelper
         float alphaCutoff;
         float borderAlpha;
 
+        uint32_t cpuNodeId; // CpuTopology node owning the alpha data, used with CpuBakerFlags::enableNumaPlacement
+
         uint32_t outIndexHistogramCount;
         uint32_t outDescArrayHistogramCount;
         uint32_t outOmmIndexStride;
@@ -204,10 +221,14 @@ namespace ommhelper
 
             GpuBakerBuffer buffers[uint32_t(OmmDataLayout::BlasBuildGpuBuffersNum)];
 
+            const void* serializedOmmArray; // deserialized instead of built when set. ArrayData and DescArray buffers aren't needed then
+            uint64_t serializedOmmArraySize;
+
             uint64_t ommIndexStride;
             uint32_t descArrayHistogramNum;
             uint32_t indexHistogramNum;
             nri::Format ommIndexFormat;
+            bool serializeOmmArray; // see SerializeOmmArrays
         } inputs;
 
         struct PrebuildInfo
@@ -221,6 +242,7 @@ namespace ommhelper
         {
             nri::AccelerationStructure* blas;
             nri::Buffer* ommArray;
+            std::vector<uint8_t> serializedOmmArray; // filled by ReadSerializedOmmArrays
         } outputs;
     };
 
@@ -249,35 +271,146 @@ namespace ommhelper
         static bool WriteChunkToFile(const char* fileName, FILE* file, void* data, size_t size);
         static bool ValidateChunkRead(const char* fileName, FILE* file, size_t fileSize, size_t currentPos, size_t dataSize);
         static bool ReadChunkFromFile(const char* fileName, FILE* file, size_t fileSize, void* data, size_t dataSize);
-        static std::map<uint64_t, uint64_t> m_IdentifierToDataOffset;
+        static std::map<uint64_t, uint64_t>& GetFileOffsets(const char* filename);
+        // Offsets are kept per cache file, so bake contexts working on different scenes don't invalidate each other
+        static std::map<std::string, std::map<uint64_t, uint64_t>> m_FileToIdentifierToDataOffset;
+        static std::recursive_mutex m_Mutex;
     };
 
-    class OpacityMicroMapsHelper
+    // Serialized OMM arrays in the mask cache format, one file per scene. Entries are keyed by the bake state hash combined with the
+    // serialization identity of the device and driver, and are checked by the backend before use. Identity 0 disables the cache.
+    // Masked BLASes are not cached: they keep the device address of the OMM array they were built against, which differs per run
+    class OmmArrayCache
     {
     public:
-        void Initialize(nri::Device* device, bool disableMaskedGeometryBuild);
+        struct Backend
+        {
+            virtual uint64_t GetOmmArraySerializationIdentity() = 0; // driver and device identity, 0 if serialization is not supported
+            virtual bool IsSerializedOmmArrayCompatible(const void* data, size_t size) = 0;
+        protected:
+            ~Backend() = default;
+        };
+
+        void Begin(const std::string& filename, uint64_t stateHash, Backend* backend, bool isEnabled); // per update, resets the counts
+        bool IsEnabled() const { return m_Backend != nullptr; };
+        bool Read(uint64_t instanceHash, std::vector<uint8_t>& outBlob); // false: build it, and serialize it if the cache is enabled
+        void Save(uint64_t instanceHash, const std::vector<uint8_t>& blob); // existing entries are kept, the file is append-only
+        uint32_t GetReadNum() const { return m_Counts[0]; };
+        uint32_t GetMissNum() const { return m_Counts[1]; };
+
+    private:
+        std::string m_Filename;
+        uint64_t m_Key = 0;
+        Backend* m_Backend = nullptr;
+        uint32_t m_Counts[2] = {}; // [deserialized, built]
+    };
+
+    // Runs func(i) for every i in [0, count) on up to threadNum threads (0: all cores), the calling thread included. Items are claimed one at a time
+    // in no particular order: func writes to its own item only, anything order dependent is left to a serial pass afterwards
+    template<typename Func>
+    inline void ParallelFor(size_t count, uint32_t threadNum, Func func)
+    {
+        if (threadNum == 0)
+            threadNum = std::max(std::thread::hardware_concurrency(), 1u);
+        const size_t workerNum = std::min<size_t>(threadNum, count);
+        if (workerNum <= 1)
+        {
+            for (size_t i = 0; i < count; ++i)
+                func(i);
+            return;
+        }
+
+        std::atomic<size_t> cursor = 0;
+        auto work = [&]()
+        {
+            for (size_t i = cursor++; i < count; i = cursor++)
+                func(i);
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t worker = 1; worker < workerNum; ++worker)
+            workers.emplace_back(work);
+        work();
+
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    inline uint32_t GetOmmIndexStride(nri::Format format)
+    {
+        switch (format)
+        {
+        case nri::Format::R8_UINT: return sizeof(uint8_t);
+        case nri::Format::R16_UINT: return sizeof(uint16_t);
+        case nri::Format::R32_UINT: return sizeof(uint32_t);
+        default: printf("[FAIL] Unknown OMM index format!\n"); std::abort();
+        }
+    }
+
+    // One instance is one bake context: baker queues, descriptors and geometry heaps are never shared.
+    // Contexts initialized with "shareFrom" reuse its GPU baker pipelines and samplers and may bake concurrently on separate threads and command buffers.
+    class OpacityMicroMapsHelper : public OmmArrayCache::Backend
+    {
+    public:
+        // "isIndexTypeUint8Enabled": the VkDevice was created with VK_EXT_index_type_uint8 and indexTypeUint8 enabled.
+        // Device support alone isn't enough, R8 OMM indices stay off otherwise
+        void Initialize(nri::Device* device, bool disableMaskedGeometryBuild, const OpacityMicroMapsHelper* shareFrom = nullptr, bool isIndexTypeUint8Enabled = false);
 
         void GetGpuBakerPrebuildInfo(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc);
         void BakeOpacityMicroMapsGpu(nri::CommandBuffer* commandBuffer, OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& bakeDesc, OmmGpuBakerPass pass);
         void GpuPostBakeCleanUp();
 
         void BakeOpacityMicroMapsCpu(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc);
+        bool ConnectToBakeServer(const char* socketPath); // CPU bakes go to the server while connected, in-process otherwise
+        void DisconnectFromBakeServer();
         void ConvertUsageCountsToApiFormat(uint8_t* outFormattedBuffer, size_t& outSize, const uint8_t* bakerOutputBuffer, size_t bakerOutputBufferSize);
+        // Rewrites cpu side OMM indices (OmmDataLayout::Indices) with the narrowest format the API accepts. Returns saved bytes
+        uint64_t CompactOmmIndices(OmmBakeGeometryDesc& instance);
+        bool IsOmmIndexFormatSupported(nri::Format format);
+
+        // Per geometry preparation (prebuild info queries) is spread across this many threads. 0: all logical cpus
+        void SetPrepareThreadNum(uint32_t threadNum) { m_PrepareThreadNum = threadNum; };
+        uint32_t GetPrepareThreadNum() const;
 
         void GetBlasPrebuildInfo(MaskedGeometryBuildDesc** queue, const size_t count);
-        void BuildMaskedGeometry(MaskedGeometryBuildDesc** queue, const size_t count, nri::CommandBuffer* commandBuffer);
+        void BuildMaskedGeometry(MaskedGeometryBuildDesc** queue, const size_t count, nri::CommandBuffer* commandBuffer); // after GetBlasPrebuildInfo on the same queue
         void DestroyMaskedGeometry(nri::AccelerationStructure* blas, nri::Buffer* ommArray);
         void ReleaseGeometryMemory();
 
+        // Masked geometry memory is allocated per generation. A rebuild starts a new one, so the previous masked geometry
+        // can stay bound until it's released separately. Memory of a generation is released after its objects are destroyed
+        uint32_t BeginGeometryGeneration();
+        uint64_t GetGeometryMemorySize(uint32_t generation);
+        void ReleaseGeometryMemory(uint32_t generation);
+
+        // Built OMM arrays can be serialized and deserialized later instead of being rebuilt, see OmmArrayCache.
+        // Vulkan only: NVAPI doesn't serialize OMM arrays.
+        uint64_t GetOmmArraySerializationIdentity() override;
+        bool IsSerializedOmmArrayCompatible(const void* data, size_t size) override;
+        void SerializeOmmArrays(MaskedGeometryBuildDesc** queue, const size_t count, nri::CommandBuffer* commandBuffer); // after BuildMaskedGeometry is complete on the GPU
+        void ReadSerializedOmmArrays(MaskedGeometryBuildDesc** queue, const size_t count); // after SerializeOmmArrays is complete on the GPU
+
         void Destroy();
 
     private:
+        //CPU:
+        ommResult BakeGeometryCpu(ommBaker baker, OmmBakeGeometryDesc& instance, const OmmBakeDesc& desc, bool enableInternalThreads, ommCpuTexture texture = 0);
+        bool BakeTriangleRangeCpu(ommBaker baker, ommCpuTexture texture, const OmmBakeGeometryDesc& instance, const OmmBakeDesc& desc, uint64_t firstTriangle, uint64_t triangleNum, OmmBakeGeometryDesc& outChunk);
+        void BakeGeometryCpuSplit(OmmBakeGeometryDesc& instance, const OmmBakeDesc& desc);
+        void BakeOpacityMicroMapsCpuPinned(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc);
+        struct CpuWorkers;
+        CpuWorkers& GetCpuWorkers(uint32_t nodeIndex);
+        void DestroyCpuWorkers();
+        size_t BakeOpacityMicroMapsCpuRemote(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc);
+        bool ReconnectToBakeServer(uint32_t attemptNum);
+
         //D3D12:
         void InitializeD3D12();
         void GetPreBuildInfoD3D12(MaskedGeometryBuildDesc** queue, const size_t count);
         void BindResourceToMemoryD3D12(ID3D12Resource*& resource, size_t size);
         void AllocateMemoryD3D12(uint64_t size);
         void ReleaseMemoryD3D12();
+        void ReleaseMemoryD3D12(uint32_t generation);
         void BuildMaskedGeometryD3D12(MaskedGeometryBuildDesc** queue, const size_t count, nri::CommandBuffer* commandBuffer);
         void BuildOmmArrayD3D12(MaskedGeometryBuildDesc& desc, nri::CommandBuffer* commandBuffer);
         void BuildBlasD3D12(MaskedGeometryBuildDesc& desc, nri::CommandBuffer* commandBuffer);
@@ -288,6 +421,7 @@ namespace ommhelper
         void InitializeVK();
         void AllocateMemoryVK(uint64_t size);
         void ReleaseMemoryVK();
+        void ReleaseMemoryVK(uint32_t generation);
         void GetPreBuildInfoVK(MaskedGeometryBuildDesc** queue, const size_t count);
         void BindOmmToMemoryVK(VkMicromapEXT& ommArray, size_t size);
         void BindBlasToMemoryVK(VkAccelerationStructureKHR& blas, size_t size);
@@ -295,6 +429,12 @@ namespace ommhelper
         void BuildOmmArrayVK(MaskedGeometryBuildDesc& desc, nri::CommandBuffer* commandBuffer);
         void BuildBlasVK(MaskedGeometryBuildDesc& desc, nri::CommandBuffer* commandBuffer);
         void DestroyOmmArrayVK(nri::Buffer* ommArray);
+        void DeserializeOmmArrayVK(MaskedGeometryBuildDesc& desc, nri::CommandBuffer* commandBuffer);
+        void WriteOmmArraySerializationSizesVK(MaskedGeometryBuildDesc** queue, const size_t count, nri::CommandBuffer* commandBuffer);
+        void SerializeOmmArraysVK(MaskedGeometryBuildDesc** queue, const size_t count, nri::CommandBuffer* commandBuffer);
+        void ReadSerializedOmmArraysVK(MaskedGeometryBuildDesc** queue, const size_t count);
+        uint64_t GetOmmArraySerializationIdentityVK();
+        bool IsSerializedOmmArrayCompatibleVK(const void* data, size_t size);
         VkDevice GetVkDevice();
 
     private:
@@ -302,18 +442,43 @@ namespace ommhelper
         //TODO: when micromaps are supported in NRI, move memory managment to the sample main part
         const uint64_t m_DefaultHeapSize = 100 * 1024 * 1024;
         const uint64_t m_SctrachSize = 10 * 1024 * 1024;
-        uint64_t m_CurrentHeapOffset;
+        uint64_t m_CurrentHeapOffset = 0;
+
+        struct GeometryHeap
+        {
+            uint64_t size;
+            uint32_t generation;
+        };
+        std::vector<GeometryHeap> m_GeometryHeaps; // parallel to m_D3D12GeometryHeaps or m_VkMemories
+        uint32_t m_GeometryGeneration = 0;
 
         //D3D12:
         std::vector<ID3D12Heap*> m_D3D12GeometryHeaps;
+        ID3D12Heap* m_D3D12ScratchHeap = nullptr; // scratch lives outside of the generations
         ID3D12Resource* m_D3D12ScratchBuffer = nullptr;
 
         //VK:
         std::vector<VkDeviceMemory> m_VkMemories;
         std::vector<VkBuffer> m_VkBuffers;
         uint32_t m_VkMemoryTypeId = uint32_t(~0);
+        VkDeviceMemory m_VkScratchMemory = NULL;
         VkBuffer m_VkScrathBuffer;
 
+        struct VkHostBuffer
+        {
+            VkBuffer buffer;
+            VkDeviceMemory memory;
+            uint8_t* data;
+        };
+        void CreateHostBufferVK(VkHostBuffer& hostBuffer, uint64_t size);
+        void DestroyHostBufferVK(VkHostBuffer& hostBuffer);
+        std::vector<VkHostBuffer> m_VkDeserializationBuffers; // released with the next build
+        VkHostBuffer m_VkSerializationBuffer = {};
+        VkQueryPool m_VkSerializationQueryPool = NULL;
+        uint32_t m_VkSerializationQueryNum = 0;
+        uint32_t m_VkHostMemoryTypeId = uint32_t(~0);
+        bool m_IsIndexTypeUint8Enabled = false; // see Initialize
+
         //common
         struct NriInterface
             : public nri::CoreInterface
@@ -326,7 +491,16 @@ namespace ommhelper
 
         OmmBakerGpuIntegration m_GpuBakerIntegration;
         ommBaker m_OmmCpuBaker = 0;
+        struct CpuWorkers
+        {
+            CpuWorkerPool pool;
+            std::vector<ommBaker> bakers; // per worker, created by the worker itself on first use
+        };
+        std::vector<std::unique_ptr<CpuWorkers>> m_CpuWorkers; // per node, the last one is not pinned. Created on first use
+        OmmBakeSocket m_BakeServerSocket = OMM_BAKE_INVALID_SOCKET;
+        std::string m_BakeServerPath; // kept after a lost connection to reconnect on the next bake
         nri::Device* m_Device;
+        uint32_t m_PrepareThreadNum = 0;
         bool m_DisableGeometryBuild = false;
     };
 }
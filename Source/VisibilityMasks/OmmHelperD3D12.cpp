@@ -162,6 +162,10 @@ namespace ommhelper
             m_D3D12ScratchBuffer->Release();
         m_D3D12ScratchBuffer = nullptr;
 
+        if (m_D3D12ScratchHeap)
+            m_D3D12ScratchHeap->Release();
+        m_D3D12ScratchHeap = nullptr;
+
         for (auto& heap : m_D3D12GeometryHeaps)
             heap->Release();
         m_D3D12GeometryHeaps.clear();
@@ -169,25 +173,41 @@ namespace ommhelper
         m_CurrentHeapOffset = 0;
     }
 
+    void OpacityMicroMapsHelper::ReleaseMemoryD3D12(uint32_t generation)
+    {
+        for (size_t i = m_D3D12GeometryHeaps.size(); i-- > 0;)
+        {
+            if (m_GeometryHeaps[i].generation != generation)
+                continue;
+
+            m_D3D12GeometryHeaps[i]->Release();
+            m_D3D12GeometryHeaps.erase(m_D3D12GeometryHeaps.begin() + i);
+            m_GeometryHeaps.erase(m_GeometryHeaps.begin() + i);
+        }
+    }
+
     void OpacityMicroMapsHelper::AllocateMemoryD3D12(uint64_t size)
     {
         m_D3D12GeometryHeaps.reserve(16);
         ID3D12Device5* device = GetD3D12Device5();
-        ID3D12Heap*& newHeap = m_D3D12GeometryHeaps.emplace_back();
         D3D12_HEAP_DESC desc = {};
         desc.Properties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
         desc.Properties.Type = D3D12_HEAP_TYPE_DEFAULT;
-        desc.SizeInBytes = size > m_DefaultHeapSize ? size : m_DefaultHeapSize;
-        desc.SizeInBytes = m_D3D12ScratchBuffer ? desc.SizeInBytes : desc.SizeInBytes + m_SctrachSize;
-        device->CreateHeap(&desc, IID_PPV_ARGS(&newHeap));
-        m_CurrentHeapOffset = 0;
 
         if (!m_D3D12ScratchBuffer)
-        {
+        { // own heap, geometry heaps are released per generation
+            desc.SizeInBytes = m_SctrachSize;
+            device->CreateHeap(&desc, IID_PPV_ARGS(&m_D3D12ScratchHeap));
+
             D3D12_RESOURCE_DESC resourceDesc = InitBufferResourceDesc(m_SctrachSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
-            GetD3D12Device5()->CreatePlacedResource(m_D3D12GeometryHeaps.back(), 0, &resourceDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(&m_D3D12ScratchBuffer));
-            m_CurrentHeapOffset += Align(m_SctrachSize);
+            device->CreatePlacedResource(m_D3D12ScratchHeap, 0, &resourceDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(&m_D3D12ScratchBuffer));
         }
+
+        ID3D12Heap*& newHeap = m_D3D12GeometryHeaps.emplace_back();
+        desc.SizeInBytes = size > m_DefaultHeapSize ? size : m_DefaultHeapSize;
+        device->CreateHeap(&desc, IID_PPV_ARGS(&newHeap));
+        m_GeometryHeaps.push_back({ desc.SizeInBytes, m_GeometryGeneration });
+        m_CurrentHeapOffset = 0;
     }
 
     void OpacityMicroMapsHelper::BindResourceToMemoryD3D12(ID3D12Resource*& resource, size_t size)
@@ -202,8 +222,8 @@ namespace ommhelper
     }
 
     void OpacityMicroMapsHelper::GetPreBuildInfoD3D12(MaskedGeometryBuildDesc** queue, const size_t count)
-    {
-        for (size_t i = 0; i < count; ++i)
+    { // Queries are independent, each writes the prebuild info of its own geometry
+        ParallelFor(count, GetPrepareThreadNum(), [&](size_t i)
         {
             MaskedGeometryBuildDesc& desc = *queue[i];
             {// get omm prebuild info
@@ -249,7 +269,7 @@ namespace ommhelper
                 desc.prebuildInfo.blasSize = blasPrebuildInfo.ResultDataMaxSizeInBytes;
                 desc.prebuildInfo.maxScratchDataSize = std::max(blasPrebuildInfo.ScratchDataSizeInBytes, desc.prebuildInfo.maxScratchDataSize);
             }
-        }
+        });
     }
 
     void OpacityMicroMapsHelper::BuildOmmArrayD3D12(MaskedGeometryBuildDesc& desc, nri::CommandBuffer* commandBuffer)
@@ -339,8 +359,6 @@ namespace ommhelper
 
     void OpacityMicroMapsHelper::BuildMaskedGeometryD3D12(MaskedGeometryBuildDesc** queue, const size_t count, nri::CommandBuffer* commandBuffer)
     {
-        GetPreBuildInfoD3D12(queue, count);
-
         for (size_t i = 0; i < count; ++i)
         {//build omm then blas to increase memory locality
             BuildOmmArrayD3D12(*queue[i], commandBuffer);
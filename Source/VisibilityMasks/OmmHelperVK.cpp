@@ -47,6 +47,17 @@ namespace ommhelper
         DECLARE_VK_FUNC(GetAccelerationStructureDeviceAddressKHR);
         DECLARE_VK_FUNC(CmdPipelineBarrier);
         DECLARE_VK_FUNC(DestroyMicromapEXT);
+        DECLARE_VK_FUNC(GetPhysicalDeviceProperties2);
+        DECLARE_VK_FUNC(GetDeviceMicromapCompatibilityEXT);
+        DECLARE_VK_FUNC(CmdWriteMicromapsPropertiesEXT);
+        DECLARE_VK_FUNC(CmdCopyMicromapToMemoryEXT);
+        DECLARE_VK_FUNC(CmdCopyMemoryToMicromapEXT);
+        DECLARE_VK_FUNC(CreateQueryPool);
+        DECLARE_VK_FUNC(DestroyQueryPool);
+        DECLARE_VK_FUNC(CmdResetQueryPool);
+        DECLARE_VK_FUNC(GetQueryPoolResults);
+        DECLARE_VK_FUNC(MapMemory);
+        DECLARE_VK_FUNC(UnmapMemory);
     } VK = {};
 
     inline VkDevice OpacityMicroMapsHelper::GetVkDevice()
@@ -60,6 +71,7 @@ namespace ommhelper
         {
         case nri::Format::R32_UINT: return VkIndexType::VK_INDEX_TYPE_UINT32;
         case nri::Format::R16_UINT: return VkIndexType::VK_INDEX_TYPE_UINT16;
+        case nri::Format::R8_UINT: return VkIndexType::VK_INDEX_TYPE_UINT8_EXT;
         default: return VkIndexType::VK_INDEX_TYPE_NONE_KHR;
         }
     }
@@ -82,11 +94,16 @@ namespace ommhelper
             PFN_vkGetInstanceProcAddr getInstanceProcAddr = (PFN_vkGetInstanceProcAddr)NRI.GetVkGetInstanceProcAddr(*m_Device);
 
             INIT_VK_FUNC(getInstanceProcAddr, vkInstance, GetPhysicalDeviceMemoryProperties);
+            INIT_VK_FUNC(getInstanceProcAddr, vkInstance, GetPhysicalDeviceProperties2);
 
             INIT_VK_FUNC(getDeviceProcAddr, vkDevice, GetMicromapBuildSizesEXT);
             INIT_VK_FUNC(getDeviceProcAddr, vkDevice, CreateMicromapEXT);
             INIT_VK_FUNC(getDeviceProcAddr, vkDevice, CmdBuildMicromapsEXT);
             INIT_VK_FUNC(getDeviceProcAddr, vkDevice, DestroyMicromapEXT);
+            INIT_VK_FUNC(getDeviceProcAddr, vkDevice, GetDeviceMicromapCompatibilityEXT);
+            INIT_VK_FUNC(getDeviceProcAddr, vkDevice, CmdWriteMicromapsPropertiesEXT);
+            INIT_VK_FUNC(getDeviceProcAddr, vkDevice, CmdCopyMicromapToMemoryEXT);
+            INIT_VK_FUNC(getDeviceProcAddr, vkDevice, CmdCopyMemoryToMicromapEXT);
 
             INIT_VK_FUNC(getDeviceProcAddr, vkDevice, GetAccelerationStructureBuildSizesKHR);
             INIT_VK_FUNC(getDeviceProcAddr, vkDevice, CreateAccelerationStructureKHR);
@@ -103,6 +120,13 @@ namespace ommhelper
             INIT_VK_FUNC(getDeviceProcAddr, vkDevice, DestroyBuffer);
 
             INIT_VK_FUNC(getDeviceProcAddr, vkDevice, CmdPipelineBarrier);
+
+            INIT_VK_FUNC(getDeviceProcAddr, vkDevice, CreateQueryPool);
+            INIT_VK_FUNC(getDeviceProcAddr, vkDevice, DestroyQueryPool);
+            INIT_VK_FUNC(getDeviceProcAddr, vkDevice, CmdResetQueryPool);
+            INIT_VK_FUNC(getDeviceProcAddr, vkDevice, GetQueryPoolResults);
+            INIT_VK_FUNC(getDeviceProcAddr, vkDevice, MapMemory);
+            INIT_VK_FUNC(getDeviceProcAddr, vkDevice, UnmapMemory);
         }
 
         {//create a buffer with properties required to store ommArrays, blases and scratch buffer to query memory type for future allocations
@@ -130,6 +154,17 @@ namespace ommhelper
                     break;
                 }
             }
+
+            // OMM array (de)serialization goes through mapped memory. Without it OMM arrays are always rebuilt
+            const uint32_t hostMemProperty = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+            {
+                if ((memoryRequirments.memoryTypeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & hostMemProperty) == hostMemProperty)
+                {
+                    m_VkHostMemoryTypeId = i;
+                    break;
+                }
+            }
             VK.DestroyBuffer(GetVkDevice(), buffer, nullptr);
 
             if (m_VkMemoryTypeId == uint32_t(-1))
@@ -152,6 +187,10 @@ namespace ommhelper
             VK.DestroyBuffer(GetVkDevice(), m_VkScrathBuffer, nullptr);
         m_VkScrathBuffer = NULL;
 
+        if (m_VkScratchMemory)
+            VK.FreeMemory(GetVkDevice(), m_VkScratchMemory, nullptr);
+        m_VkScratchMemory = NULL;
+
         for (auto& buffer : m_VkBuffers)
             VK.DestroyBuffer(GetVkDevice(), buffer, nullptr);
         m_VkBuffers.clear();
@@ -161,41 +200,107 @@ namespace ommhelper
 
         m_VkMemories.clear();
         m_CurrentHeapOffset = 0;
+
+        for (VkHostBuffer& hostBuffer : m_VkDeserializationBuffers)
+            DestroyHostBufferVK(hostBuffer);
+        m_VkDeserializationBuffers.clear();
+        DestroyHostBufferVK(m_VkSerializationBuffer);
+
+        if (m_VkSerializationQueryPool)
+            VK.DestroyQueryPool(GetVkDevice(), m_VkSerializationQueryPool, nullptr);
+        m_VkSerializationQueryPool = NULL;
+        m_VkSerializationQueryNum = 0;
     }
 
-    void OpacityMicroMapsHelper::AllocateMemoryVK(uint64_t size)
+    void OpacityMicroMapsHelper::ReleaseMemoryVK(uint32_t generation)
     {
-        m_CurrentHeapOffset = 0;
-        VkDeviceMemory& newMemory = m_VkMemories.emplace_back();
+        for (size_t i = m_VkMemories.size(); i-- > 0;)
+        {
+            if (m_GeometryHeaps[i].generation != generation)
+                continue;
+
+            VK.DestroyBuffer(GetVkDevice(), m_VkBuffers[i], nullptr);
+            VK.FreeMemory(GetVkDevice(), m_VkMemories[i], nullptr);
+            m_VkBuffers.erase(m_VkBuffers.begin() + i);
+            m_VkMemories.erase(m_VkMemories.begin() + i);
+            m_GeometryHeaps.erase(m_GeometryHeaps.begin() + i);
+        }
+    }
 
-        uint64_t allocationSize = (size > m_DefaultHeapSize) ? size : m_DefaultHeapSize; //make the initial heap bigger to store the scratch resource
-        allocationSize = (m_VkScrathBuffer == NULL) ? allocationSize + m_SctrachSize : allocationSize; //make the initial heap bigger to store the scratch resource
+    void OpacityMicroMapsHelper::CreateHostBufferVK(VkHostBuffer& hostBuffer, uint64_t size)
+    {
+        VkBufferCreateInfo bufferDesc = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+        bufferDesc.pNext = NULL;
+        bufferDesc.size = size;
+        bufferDesc.flags = 0;
+        bufferDesc.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+        VK_CALL(VK.CreateBuffer(GetVkDevice(), &bufferDesc, nullptr, &hostBuffer.buffer));
+
+        VkMemoryRequirements memoryRequirments = {};
+        VK.GetBufferMemoryRequirements(GetVkDevice(), hostBuffer.buffer, &memoryRequirments);
 
         VkMemoryAllocateFlagsInfo flagsInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO };
-        flagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_MASK_BIT | VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+        flagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
 
         VkMemoryAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-        allocInfo.allocationSize = allocationSize;
-        allocInfo.memoryTypeIndex = m_VkMemoryTypeId;
+        allocInfo.allocationSize = memoryRequirments.size;
+        allocInfo.memoryTypeIndex = m_VkHostMemoryTypeId;
         allocInfo.pNext = &flagsInfo;
+        VK_CALL(VK.AllocateMemory(GetVkDevice(), &allocInfo, nullptr, &hostBuffer.memory));
+        VK_CALL(VK.BindBufferMemory(GetVkDevice(), hostBuffer.buffer, hostBuffer.memory, 0));
+        VK_CALL(VK.MapMemory(GetVkDevice(), hostBuffer.memory, 0, VK_WHOLE_SIZE, 0, (void**)&hostBuffer.data));
+    }
 
-        for (uint32_t i = 0; i < NRI.GetDeviceDesc(*m_Device).physicalDeviceNum; ++i)
+    void OpacityMicroMapsHelper::DestroyHostBufferVK(VkHostBuffer& hostBuffer)
+    {
+        if (hostBuffer.memory)
         {
-            flagsInfo.deviceMask = 1 << i;
-            VK_CALL(VK.AllocateMemory(GetVkDevice(), &allocInfo, nullptr, &newMemory));
+            VK.UnmapMemory(GetVkDevice(), hostBuffer.memory);
+            VK.FreeMemory(GetVkDevice(), hostBuffer.memory, nullptr);
         }
+        if (hostBuffer.buffer)
+            VK.DestroyBuffer(GetVkDevice(), hostBuffer.buffer, nullptr);
+        hostBuffer = {};
+    }
+
+    void OpacityMicroMapsHelper::AllocateMemoryVK(uint64_t size)
+    {
+        m_CurrentHeapOffset = 0;
+
+        VkMemoryAllocateFlagsInfo flagsInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO };
+        flagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_MASK_BIT | VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+
+        VkMemoryAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+        allocInfo.memoryTypeIndex = m_VkMemoryTypeId;
+        allocInfo.pNext = &flagsInfo;
 
         if (m_VkScrathBuffer == NULL)
-        {//create scratch buffer and put it in the end of the heap
+        {//create scratch buffer in its own memory, geometry memories are released per generation
+            allocInfo.allocationSize = m_SctrachSize;
+            for (uint32_t i = 0; i < NRI.GetDeviceDesc(*m_Device).physicalDeviceNum; ++i)
+            {
+                flagsInfo.deviceMask = 1 << i;
+                VK_CALL(VK.AllocateMemory(GetVkDevice(), &allocInfo, nullptr, &m_VkScratchMemory));
+            }
+
             VkBufferCreateInfo scratchDesc = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
             scratchDesc.pNext = NULL;
             scratchDesc.size = m_SctrachSize;
             scratchDesc.flags = 0;
             scratchDesc.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
             VK_CALL(VK.CreateBuffer(GetVkDevice(), &scratchDesc, nullptr, &m_VkScrathBuffer));
-            VK_CALL(VK.BindBufferMemory(GetVkDevice(), m_VkScrathBuffer, newMemory, m_DefaultHeapSize));
+            VK_CALL(VK.BindBufferMemory(GetVkDevice(), m_VkScrathBuffer, m_VkScratchMemory, 0));
         }
 
+        VkDeviceMemory& newMemory = m_VkMemories.emplace_back();
+        allocInfo.allocationSize = (size > m_DefaultHeapSize) ? size : m_DefaultHeapSize;
+        for (uint32_t i = 0; i < NRI.GetDeviceDesc(*m_Device).physicalDeviceNum; ++i)
+        {
+            flagsInfo.deviceMask = 1 << i;
+            VK_CALL(VK.AllocateMemory(GetVkDevice(), &allocInfo, nullptr, &newMemory));
+        }
+        m_GeometryHeaps.push_back({ allocInfo.allocationSize, m_GeometryGeneration });
+
         VkBufferCreateInfo bufferDesc = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
         bufferDesc.pNext = NULL;
         bufferDesc.size = m_DefaultHeapSize;
@@ -282,9 +387,9 @@ namespace ommhelper
         if (count == 0)
             return;
 
-        uint64_t maxMicromapSize = 0;
-        uint64_t maxScratchSize = 0;
-        for (size_t i = 0; i < count; ++i)
+        // Queries are independent, each writes the prebuild info of its own geometry. The temporal allocation is sized afterwards
+        const uint32_t threadNum = GetPrepareThreadNum();
+        ParallelFor(count, threadNum, [&](size_t i)
         {
             MaskedGeometryBuildDesc& desc = *queue[i];
             const MaskedGeometryBuildDesc::Inputs& inputs = desc.inputs;
@@ -295,9 +400,15 @@ namespace ommhelper
 
                 desc.prebuildInfo.ommArraySize = preBuildInfo.micromapSize;
                 desc.prebuildInfo.maxScratchDataSize = preBuildInfo.buildScratchSize;
-                maxMicromapSize = std::max(preBuildInfo.micromapSize, maxMicromapSize);
-                maxScratchSize = std::max(preBuildInfo.buildScratchSize, maxScratchSize);
             }
+        });
+
+        uint64_t maxMicromapSize = 0;
+        uint64_t maxScratchSize = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            maxMicromapSize = std::max(queue[i]->prebuildInfo.ommArraySize, maxMicromapSize);
+            maxScratchSize = std::max(queue[i]->prebuildInfo.maxScratchDataSize, maxScratchSize);
         }
 
         VkDeviceMemory tmpMemory = {};
@@ -329,8 +440,8 @@ namespace ommhelper
             VK_CALL(VK.BindBufferMemory(GetVkDevice(), scratch, tmpMemory, Align(maxMicromapSize, VK_PLACEMENT_ALIGNMENT)));
         }
 
-        for (size_t i = 0; i < count; ++i)
-        { // Get BLAS prebuild info
+        ParallelFor(count, threadNum, [&](size_t i)
+        { // Get BLAS prebuild info. Temporal micromaps of all threads alias the same buffer, they are never built
             MaskedGeometryBuildDesc& desc = *queue[i];
             const MaskedGeometryBuildDesc::Inputs& inputs = desc.inputs;
             const GpuBakerBuffer* buffers = inputs.buffers;
@@ -377,7 +488,7 @@ namespace ommhelper
                 desc.prebuildInfo.maxScratchDataSize = std::max(preBuildInfo.buildScratchSize, desc.prebuildInfo.maxScratchDataSize);
                 VK.DestroyMicromapEXT(GetVkDevice(), tmpMicromap, nullptr);
             }
-        }
+        });
         VK.DestroyBuffer(GetVkDevice(), scratch, nullptr);
         VK.DestroyBuffer(GetVkDevice(), tmpOmmBuffer, nullptr);
         VK.FreeMemory(GetVkDevice(), tmpMemory, nullptr);
@@ -421,6 +532,12 @@ namespace ommhelper
 
     void OpacityMicroMapsHelper::BuildOmmArrayVK(MaskedGeometryBuildDesc& desc, nri::CommandBuffer* commandBuffer)
     {
+        if (desc.inputs.serializedOmmArray)
+        {
+            DeserializeOmmArrayVK(desc, commandBuffer);
+            return;
+        }
+
         if (!desc.inputs.buffers[(uint32_t)OmmDataLayout::ArrayData].buffer)
             return;
 
@@ -521,13 +638,186 @@ namespace ommhelper
 
     void OpacityMicroMapsHelper::BuildMaskedGeometryVK(MaskedGeometryBuildDesc** queue, const size_t count, nri::CommandBuffer* commandBuffer)
     {
-        GetPreBuildInfoVK(queue, count);
+        // The previous build has been waited for by now
+        for (VkHostBuffer& hostBuffer : m_VkDeserializationBuffers)
+            DestroyHostBufferVK(hostBuffer);
+        m_VkDeserializationBuffers.clear();
 
         for (size_t i = 0; i < count; ++i)
         { // Build omm then blas to increase memory locality
             BuildOmmArrayVK(*queue[i], commandBuffer);
             BuildBlasVK(*queue[i], commandBuffer);
         }
+
+        WriteOmmArraySerializationSizesVK(queue, count, commandBuffer);
+    }
+
+    // Serialized micromap header: driverUUID, compatibilityUUID, serialized size, deserialized size
+    constexpr size_t VK_SERIALIZED_MICROMAP_HEADER_SIZE = 2 * VK_UUID_SIZE + 2 * sizeof(uint64_t);
+
+    inline bool IsSerializationRequested(const MaskedGeometryBuildDesc& desc)
+    {
+        return desc.inputs.serializeOmmArray && desc.outputs.ommArray && !desc.inputs.serializedOmmArray;
+    }
+
+    inline void InsertMemoryBarrier(VkCommandBuffer commandBuffer, VkAccessFlags dstAccessMask)
+    {
+        VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+        barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dstAccessMask = dstAccessMask;
+
+        uint32_t stageBit = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        uint32_t dstStageBit = dstAccessMask == VK_ACCESS_HOST_READ_BIT ? VK_PIPELINE_STAGE_HOST_BIT : stageBit;
+        VK.CmdPipelineBarrier(commandBuffer, stageBit, dstStageBit, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    uint64_t OpacityMicroMapsHelper::GetOmmArraySerializationIdentityVK()
+    { // Blobs carry their own driver UUIDs. The identity keeps blobs of other devices and drivers from being looked up at all
+        if (m_VkHostMemoryTypeId == uint32_t(~0))
+            return 0;
+
+        VkPhysicalDeviceIDProperties idProperties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES };
+        VkPhysicalDeviceProperties2 properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+        properties.pNext = &idProperties;
+        VK.GetPhysicalDeviceProperties2((VkPhysicalDevice)NRI.GetVkPhysicalDevice(*m_Device), &properties);
+
+        uint64_t result = 14695981039346656037ull;
+        auto hashBytes = [&result](const void* data, size_t size)
+        {
+            for (size_t i = 0; i < size; ++i)
+                result = (result ^ ((const uint8_t*)data)[i]) * 1099511628211ull;
+        };
+        hashBytes(idProperties.deviceUUID, VK_UUID_SIZE);
+        hashBytes(idProperties.driverUUID, VK_UUID_SIZE);
+        hashBytes(&properties.properties.driverVersion, sizeof(uint32_t));
+        return result ? result : 1;
+    }
+
+    bool OpacityMicroMapsHelper::IsSerializedOmmArrayCompatibleVK(const void* data, size_t size)
+    {
+        if (!data || size < VK_SERIALIZED_MICROMAP_HEADER_SIZE)
+            return false;
+
+        const uint64_t serializedSize = *(const uint64_t*)((const uint8_t*)data + 2 * VK_UUID_SIZE);
+        if (serializedSize != size)
+            return false;
+
+        VkMicromapVersionInfoEXT versionInfo = { VK_STRUCTURE_TYPE_MICROMAP_VERSION_INFO_EXT };
+        versionInfo.pVersionData = (const uint8_t*)data;
+
+        VkAccelerationStructureCompatibilityKHR compatibility = VK_ACCELERATION_STRUCTURE_COMPATIBILITY_INCOMPATIBLE_KHR;
+        VK.GetDeviceMicromapCompatibilityEXT(GetVkDevice(), &versionInfo, &compatibility);
+        return compatibility == VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR;
+    }
+
+    void OpacityMicroMapsHelper::DeserializeOmmArrayVK(MaskedGeometryBuildDesc& desc, nri::CommandBuffer* commandBuffer)
+    { // Straight into the geometry heap, the blob goes through a mapped buffer kept alive until the next build
+        const uint8_t* serializedData = (const uint8_t*)desc.inputs.serializedOmmArray;
+        const uint64_t deserializedSize = *(const uint64_t*)(serializedData + 2 * VK_UUID_SIZE + sizeof(uint64_t));
+
+        VkMicromapEXT ommArray = {};
+        BindOmmToMemoryVK(ommArray, deserializedSize);
+
+        VkHostBuffer& hostBuffer = m_VkDeserializationBuffers.emplace_back();
+        CreateHostBufferVK(hostBuffer, desc.inputs.serializedOmmArraySize);
+        memcpy(hostBuffer.data, serializedData, desc.inputs.serializedOmmArraySize);
+
+        VkBufferDeviceAddressInfo hostBufferAddressInfo = GetBufferAddressInfo(hostBuffer.buffer);
+
+        VkCopyMemoryToMicromapInfoEXT copyDesc = { VK_STRUCTURE_TYPE_COPY_MEMORY_TO_MICROMAP_INFO_EXT };
+        copyDesc.src.deviceAddress = VK.GetBufferDeviceAddress(GetVkDevice(), &hostBufferAddressInfo);
+        copyDesc.dst = ommArray;
+        copyDesc.mode = VK_COPY_MICROMAP_MODE_DESERIALIZE_EXT;
+
+        VkCommandBuffer vkCommandBuffer = (VkCommandBuffer)NRI.GetCommandBufferNativeObject(*commandBuffer);
+        VK.CmdCopyMemoryToMicromapEXT(vkCommandBuffer, &copyDesc);
+        InsertMemoryBarrier(vkCommandBuffer, VK_ACCESS_MICROMAP_READ_BIT_EXT);
+
+        desc.prebuildInfo.ommArraySize = deserializedSize;
+        desc.outputs.ommArray = reinterpret_cast<nri::Buffer*>(ommArray);
+    }
+
+    void OpacityMicroMapsHelper::WriteOmmArraySerializationSizesVK(MaskedGeometryBuildDesc** queue, const size_t count, nri::CommandBuffer* commandBuffer)
+    { // Serialized sizes are only known on the GPU, they are read back in SerializeOmmArraysVK
+        std::vector<VkMicromapEXT> micromaps;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (IsSerializationRequested(*queue[i]))
+                micromaps.push_back(reinterpret_cast<VkMicromapEXT>(queue[i]->outputs.ommArray));
+        }
+
+        if (m_VkSerializationQueryPool)
+            VK.DestroyQueryPool(GetVkDevice(), m_VkSerializationQueryPool, nullptr);
+        m_VkSerializationQueryPool = NULL;
+        m_VkSerializationQueryNum = (uint32_t)micromaps.size();
+        if (micromaps.empty())
+            return;
+
+        VkQueryPoolCreateInfo queryPoolDesc = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        queryPoolDesc.queryType = VK_QUERY_TYPE_MICROMAP_SERIALIZATION_SIZE_EXT;
+        queryPoolDesc.queryCount = m_VkSerializationQueryNum;
+        VK_CALL(VK.CreateQueryPool(GetVkDevice(), &queryPoolDesc, nullptr, &m_VkSerializationQueryPool));
+
+        VkCommandBuffer vkCommandBuffer = (VkCommandBuffer)NRI.GetCommandBufferNativeObject(*commandBuffer);
+        VK.CmdResetQueryPool(vkCommandBuffer, m_VkSerializationQueryPool, 0, m_VkSerializationQueryNum);
+        InsertMemoryBarrier(vkCommandBuffer, VK_ACCESS_MICROMAP_READ_BIT_EXT);
+        VK.CmdWriteMicromapsPropertiesEXT(vkCommandBuffer, m_VkSerializationQueryNum, micromaps.data(), VK_QUERY_TYPE_MICROMAP_SERIALIZATION_SIZE_EXT, m_VkSerializationQueryPool, 0);
+    }
+
+    void OpacityMicroMapsHelper::SerializeOmmArraysVK(MaskedGeometryBuildDesc** queue, const size_t count, nri::CommandBuffer* commandBuffer)
+    {
+        DestroyHostBufferVK(m_VkSerializationBuffer);
+        if (!m_VkSerializationQueryNum)
+            return;
+
+        std::vector<uint64_t> sizes(m_VkSerializationQueryNum);
+        VK_CALL(VK.GetQueryPoolResults(GetVkDevice(), m_VkSerializationQueryPool, 0, m_VkSerializationQueryNum, sizes.size() * sizeof(uint64_t), sizes.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+        uint64_t totalSize = 0;
+        for (uint64_t size : sizes)
+            totalSize += Align(size, VK_PLACEMENT_ALIGNMENT);
+        CreateHostBufferVK(m_VkSerializationBuffer, totalSize);
+
+        VkBufferDeviceAddressInfo hostBufferAddressInfo = GetBufferAddressInfo(m_VkSerializationBuffer.buffer);
+        VkDeviceAddress hostBufferAddress = VK.GetBufferDeviceAddress(GetVkDevice(), &hostBufferAddressInfo);
+        VkCommandBuffer vkCommandBuffer = (VkCommandBuffer)NRI.GetCommandBufferNativeObject(*commandBuffer);
+
+        uint64_t offset = 0;
+        uint32_t queryId = 0;
+        for (size_t i = 0; i < count && queryId < m_VkSerializationQueryNum; ++i)
+        { // same order as WriteOmmArraySerializationSizesVK
+            MaskedGeometryBuildDesc& desc = *queue[i];
+            if (!IsSerializationRequested(desc))
+                continue;
+
+            VkCopyMicromapToMemoryInfoEXT copyDesc = { VK_STRUCTURE_TYPE_COPY_MICROMAP_TO_MEMORY_INFO_EXT };
+            copyDesc.src = reinterpret_cast<VkMicromapEXT>(desc.outputs.ommArray);
+            copyDesc.dst.deviceAddress = hostBufferAddress + offset;
+            copyDesc.mode = VK_COPY_MICROMAP_MODE_SERIALIZE_EXT;
+            VK.CmdCopyMicromapToMemoryEXT(vkCommandBuffer, &copyDesc);
+
+            desc.outputs.serializedOmmArray.resize(sizes[queryId]);
+            offset += Align(sizes[queryId++], VK_PLACEMENT_ALIGNMENT);
+        }
+        InsertMemoryBarrier(vkCommandBuffer, VK_ACCESS_HOST_READ_BIT);
+    }
+
+    void OpacityMicroMapsHelper::ReadSerializedOmmArraysVK(MaskedGeometryBuildDesc** queue, const size_t count)
+    {
+        if (!m_VkSerializationBuffer.data)
+            return;
+
+        uint64_t offset = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            MaskedGeometryBuildDesc& desc = *queue[i];
+            if (!IsSerializationRequested(desc) || desc.outputs.serializedOmmArray.empty())
+                continue;
+
+            memcpy(desc.outputs.serializedOmmArray.data(), m_VkSerializationBuffer.data + offset, desc.outputs.serializedOmmArray.size());
+            offset += Align(desc.outputs.serializedOmmArray.size(), VK_PLACEMENT_ALIGNMENT);
+        }
+        DestroyHostBufferVK(m_VkSerializationBuffer);
     }
 }
 
@@ -0,0 +1,81 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+
+namespace ommhelper
+{
+    // Micro-triangle index in bird curve order. Reference implementation from the DXR / VK opacity micromap specs
+    inline uint32_t PrefixEor(uint32_t x)
+    {
+        x ^= (x >> 1) & 0x7fff7fff;
+        x ^= (x >> 2) & 0x3fff3fff;
+        x ^= (x >> 4) & 0x0fff0fff;
+        x ^= (x >> 8) & 0x00ff00ff;
+        return x;
+    }
+
+    inline uint32_t InterleaveBits(uint32_t x, uint32_t y)
+    {
+        x = (x | (x << 8)) & 0x00ff00ff;
+        x = (x | (x << 4)) & 0x0f0f0f0f;
+        x = (x | (x << 2)) & 0x33333333;
+        x = (x | (x << 1)) & 0x55555555;
+
+        y = (y | (y << 8)) & 0x00ff00ff;
+        y = (y | (y << 4)) & 0x0f0f0f0f;
+        y = (y | (y << 2)) & 0x33333333;
+        y = (y | (y << 1)) & 0x55555555;
+
+        return x | (y << 1);
+    }
+
+    // Discrete barycentrics of a micro-triangle: u + v + w == 2^level - 1 for upright ones, 2^level - 2 for upside down ones
+    inline uint32_t DBary2Index(uint32_t u, uint32_t v, uint32_t w, uint32_t level)
+    {
+        const uint32_t coordMask = (1u << level) - 1;
+
+        uint32_t b0 = ~(u ^ w) & coordMask;
+        uint32_t t = (u ^ v) & b0;
+        uint32_t c = (((u & v & w) | (~u & ~v & ~w)) & coordMask) << 16;
+        uint32_t f = PrefixEor(t | c) ^ u;
+        uint32_t b1 = ((f & ~b0) | t) & coordMask; // the upper half of f holds the prefix of c, keep it out of the index
+
+        return InterleaveBits(b0, b1);
+    }
+
+    inline uint32_t Bary2Index(float u, float v, uint32_t level)
+    {
+        const float stepNum = float(1u << level);
+        const uint32_t maxStep = (1u << level) - 1;
+        uint32_t iu = std::min(uint32_t(std::max(stepNum * u, 0.0f)), maxStep);
+        uint32_t iv = std::min(uint32_t(std::max(stepNum * v, 0.0f)), maxStep);
+        uint32_t iw = std::min(uint32_t(std::max(stepNum * (1.0f - u - v), 0.0f)), maxStep);
+        return DBary2Index(iu, iv, iw, level);
+    }
+
+    // OMM index of the i-th triangle. Special indices occupy the top 4 values of any width and are returned as -1..-4
+    inline int32_t ReadOmmIndex(const uint8_t* indices, uint32_t stride, size_t i)
+    {
+        uint32_t index = 0;
+        if (stride == sizeof(uint8_t))
+            index = indices[i];
+        else if (stride == sizeof(uint16_t))
+            index = ((const uint16_t*)indices)[i];
+        else
+            return ((const int32_t*)indices)[i];
+
+        const uint32_t specialIndexBase = (1u << (stride * 8)) - 4;
+        return index >= specialIndexBase ? int32_t(index) - int32_t(1u << (stride * 8)) : int32_t(index);
+    }
+}